@@ -0,0 +1,654 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "batch.h"
+#include "telemetry.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_X86
+#include <immintrin.h>
+#endif
+
+#define BATCH_FLOOR     4
+
+// a row with nothing in it but the walls
+#define BatchEmptyRow(batch)    (~(((1U << (batch)->Bx) - 1) << BATCH_WALL))
+
+#define BatchRows(batch, i)     ((batch)->rows + (size_t)(i) * (batch)->stride)
+#define BatchField(batch, i)    ((batch)->field + (size_t)(i) * (batch)->Bx * (batch)->By)
+#define BatchQueue(batch, i)    ((batch)->queue + (size_t)(i) * BATCH_QUEUE)
+#define BatchMask(batch, i, rot) ((const guint32*)(batch)->masks + ((batch)->shape[i] * 4 + (rot)) * 4)
+
+static guint32 BatchRandom(BATCH* batch, int i)
+{
+    // splitmix64, as Random() in engine.c
+    guint64 z;
+
+    z = (batch->rng[i] += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return (guint32)((z ^ (z >> 31)) >> 32);
+}
+
+static int BatchOverlap(const BATCH* batch, int i, int x, int y, int rot)
+{
+    const guint32* rows = BatchRows(batch, i) + y;
+    const guint32* mask = BatchMask(batch, i, rot);
+    int shift = x + BATCH_WALL;
+
+    return ((rows[0] & (mask[0] << shift)) |
+            (rows[1] & (mask[1] << shift)) |
+            (rows[2] & (mask[2] << shift)) |
+            (rows[3] & (mask[3] << shift))) != 0;
+}
+
+static int BatchFits(const BATCH* batch, int i, int x, int y, int rot)
+{
+    // a kick can take the tetrad further out than a move or a fall
+    // ever does; every box has a block in its first row and column,
+    // so a box starting off the field does not fit, and the rows and
+    // bits BatchOverlap() looks at stay inside the game's
+    if ((unsigned)x >= (unsigned)batch->Bx || (unsigned)y >= (unsigned)batch->By)
+        return 0;
+
+    return ! BatchOverlap(batch, i, x, y, rot);
+}
+
+static void BatchGravity(BATCH* batch, int lo, int hi)
+{
+    int i, live, fall, hit;
+
+    // no branches on the game, so that the compiler can vectorize
+    // this where there is no hand-written kernel
+    for (i = lo; i < hi; i++) {
+        live = ! (batch->over[i] | batch->pause[i]);
+        fall = live & (batch->t[i] >= batch->speed[i]);
+        hit = fall & BatchOverlap(batch, i, batch->x[i], batch->y[i] + 1, batch->rot[i]);
+
+        batch->y[i] += fall & ! hit;
+        batch->t[i] = hit ? batch->t[i] : fall ? 1 : batch->t[i] + live;
+        batch->lock[i] = hit;
+    }
+
+    return;
+}
+
+#ifdef BATCH_X86
+
+__attribute__((target("avx2")))
+static void BatchGravityAVX2(BATCH* batch, int lo, int hi)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i stride = _mm256_set1_epi32(batch->stride);
+    const __m256i wall = _mm256_set1_epi32(BATCH_WALL);
+    const int* rows = (const int*)batch->rows;
+    __m256i t, y, live, fall, hit, base, piece, shift, m, row;
+    int i, r;
+
+    // eight games per step: gather each game's four piece rows and the
+    // four field rows under them, and test them all at once
+    for (i = lo; i + 8 <= hi; i += 8) {
+        t = _mm256_loadu_si256((const __m256i*)(batch->t + i));
+        y = _mm256_loadu_si256((const __m256i*)(batch->y + i));
+
+        live = _mm256_cmpeq_epi32(zero, _mm256_or_si256(
+                    _mm256_loadu_si256((const __m256i*)(batch->over + i)),
+                    _mm256_loadu_si256((const __m256i*)(batch->pause + i))));
+        fall = _mm256_andnot_si256(_mm256_cmpgt_epi32(
+                    _mm256_loadu_si256((const __m256i*)(batch->speed + i)), t), live);
+
+        base = _mm256_add_epi32(_mm256_mullo_epi32(
+                    _mm256_add_epi32(_mm256_set1_epi32(i), lane), stride),
+                _mm256_add_epi32(y, one));
+        piece = _mm256_slli_epi32(_mm256_add_epi32(_mm256_slli_epi32(
+                    _mm256_loadu_si256((const __m256i*)(batch->shape + i)), 2),
+                _mm256_loadu_si256((const __m256i*)(batch->rot + i))), 2);
+        shift = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(batch->x + i)), wall);
+
+        hit = zero;
+        for (r = 0; r < 4; r++) {
+            m = _mm256_i32gather_epi32(batch->masks,
+                    _mm256_add_epi32(piece, _mm256_set1_epi32(r)), 4);
+            row = _mm256_i32gather_epi32(rows,
+                    _mm256_add_epi32(base, _mm256_set1_epi32(r)), 4);
+            hit = _mm256_or_si256(hit, _mm256_and_si256(row, _mm256_sllv_epi32(m, shift)));
+        }
+        hit = _mm256_andnot_si256(_mm256_cmpeq_epi32(hit, zero), fall);
+
+        // y += fall & ! hit
+        y = _mm256_add_epi32(y, _mm256_and_si256(_mm256_andnot_si256(hit, fall), one));
+        // t = hit ? t : fall ? 1 : t + live
+        t = _mm256_blendv_epi8(
+                _mm256_blendv_epi8(_mm256_sub_epi32(t, live), one, fall),
+                t, hit);
+
+        _mm256_storeu_si256((__m256i*)(batch->y + i), y);
+        _mm256_storeu_si256((__m256i*)(batch->t + i), t);
+        _mm256_storeu_si256((__m256i*)(batch->lock + i), _mm256_and_si256(hit, one));
+    }
+
+    BatchGravity(batch, i, hi);
+
+    return;
+}
+
+#endif
+
+static void BatchMasks(BATCH* batch)
+{
+    TETRAD tetrad;
+    int x[4], y[4];
+    int shape, rot, n, X;
+
+    memset(batch->masks, 0, sizeof(batch->masks));
+    memset(&tetrad, 0, sizeof(tetrad));
+
+    for (shape = 0; shape < 7; shape++) {
+        for (rot = 0; rot < 4; rot++) {
+            tetrad.shape = shape;
+            tetrad.rot = rot;
+            n = TetradCells(&tetrad, x, y);
+            for (X = 0; X < n; X++)
+                batch->masks[(shape * 4 + rot) * 4 + y[X]] |= 1 << x[X];
+        }
+    }
+
+    return;
+}
+
+BATCH* BatchAlloc(const STATE* settings)
+{
+    BATCH* batch;
+
+    if (settings->Bx < 1 || settings->Bx > BATCH_MAX_WIDTH || settings->By < 1 ||
+            settings->queue_size < 0 || settings->queue_size > BATCH_QUEUE)
+        return NULL;
+
+    batch = g_new0(BATCH, 1);
+    batch->Bx = settings->Bx;
+    batch->By = settings->By;
+    batch->stride = settings->By + BATCH_FLOOR;
+
+    batch->queue_size = settings->queue_size;
+    batch->init_level = settings->init_level;
+    batch->init_speed = settings->init_speed;
+    batch->delta = settings->delta;
+    batch->do_rotate_timeout_reset = settings->do_rotate_timeout_reset;
+
+    BatchMasks(batch);
+
+    batch->gravity = BatchGravity;
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        batch->gravity = BatchGravityAVX2;
+#endif
+
+    return batch;
+}
+
+void BatchFree(BATCH* batch)
+{
+    g_free(batch->rows);
+    g_free(batch->field);
+    g_free(batch->queue);
+    g_free(batch->seed);
+    g_free(batch->rng);
+    g_free(batch->ticks);
+    g_free(batch->x);
+    g_free(batch->y);
+    g_free(batch->rot);
+    g_free(batch->shape);
+    g_free(batch->t);
+    g_free(batch->next);
+    g_free(batch->speed);
+    g_free(batch->level);
+    g_free(batch->lines);
+    g_free(batch->score);
+    g_free(batch->pieces);
+    g_free(batch->over);
+    g_free(batch->pause);
+    g_free(batch->quit);
+    g_free(batch->lock);
+    g_free(batch->tag);
+    g_free(batch);
+
+    return;
+}
+
+const char* BatchKernel(const BATCH* batch)
+{
+    return batch->gravity == BatchGravity ? "scalar" : "avx2";
+}
+
+static void BatchGrow(BATCH* batch)
+{
+    int size = batch->size ? batch->size * 2 : 64;
+
+    batch->rows = g_renew(guint32, batch->rows, (size_t)size * batch->stride);
+    batch->field = g_renew(char, batch->field, (size_t)size * batch->Bx * batch->By);
+    batch->queue = g_renew(guint8, batch->queue, (size_t)size * BATCH_QUEUE);
+    batch->seed = g_renew(guint64, batch->seed, size);
+    batch->rng = g_renew(guint64, batch->rng, size);
+    batch->ticks = g_renew(guint64, batch->ticks, size);
+    batch->x = g_renew(gint32, batch->x, size);
+    batch->y = g_renew(gint32, batch->y, size);
+    batch->rot = g_renew(gint32, batch->rot, size);
+    batch->shape = g_renew(gint32, batch->shape, size);
+    batch->t = g_renew(gint32, batch->t, size);
+    batch->next = g_renew(gint32, batch->next, size);
+    batch->speed = g_renew(gint32, batch->speed, size);
+    batch->level = g_renew(gint32, batch->level, size);
+    batch->lines = g_renew(gint32, batch->lines, size);
+    batch->score = g_renew(gint32, batch->score, size);
+    batch->pieces = g_renew(gint32, batch->pieces, size);
+    batch->over = g_renew(gint32, batch->over, size);
+    batch->pause = g_renew(gint32, batch->pause, size);
+    batch->quit = g_renew(gint32, batch->quit, size);
+    batch->lock = g_renew(gint32, batch->lock, size);
+    batch->tag = g_renew(guint64, batch->tag, size);
+    batch->size = size;
+
+    return;
+}
+
+static void BatchCopy(BATCH* batch, int to, int from)
+{
+    memcpy(BatchRows(batch, to), BatchRows(batch, from),
+            batch->stride * sizeof(guint32));
+    memcpy(BatchField(batch, to), BatchField(batch, from),
+            (size_t)batch->Bx * batch->By);
+    memcpy(BatchQueue(batch, to), BatchQueue(batch, from), BATCH_QUEUE);
+
+    batch->seed[to] = batch->seed[from];
+    batch->rng[to] = batch->rng[from];
+    batch->ticks[to] = batch->ticks[from];
+    batch->x[to] = batch->x[from];
+    batch->y[to] = batch->y[from];
+    batch->rot[to] = batch->rot[from];
+    batch->shape[to] = batch->shape[from];
+    batch->t[to] = batch->t[from];
+    batch->next[to] = batch->next[from];
+    batch->speed[to] = batch->speed[from];
+    batch->level[to] = batch->level[from];
+    batch->lines[to] = batch->lines[from];
+    batch->score[to] = batch->score[from];
+    batch->pieces[to] = batch->pieces[from];
+    batch->over[to] = batch->over[from];
+    batch->pause[to] = batch->pause[from];
+    batch->quit[to] = batch->quit[from];
+    batch->lock[to] = batch->lock[from];
+    batch->tag[to] = batch->tag[from];
+
+    return;
+}
+
+int BatchAdd(BATCH* batch, guint64 seed)
+{
+    int i;
+
+    if (batch->n == batch->size)
+        BatchGrow(batch);
+
+    i = batch->n ++;
+    batch->tag[i] = i;
+    batch->seed[i] = seed;
+    batch->rng[i] = seed;
+    BatchReset(batch, i);
+
+    return i;
+}
+
+int BatchRemove(BATCH* batch, int game)
+{
+    int last = -- batch->n;
+
+    // the last game takes the place of the removed one
+    if (game == last)
+        return -1;
+
+    BatchCopy(batch, game, last);
+
+    return last;
+}
+
+static void BatchSpawn(BATCH* batch, int i, int shape)
+{
+    batch->shape[i] = shape;
+    batch->x[i] = batch->Bx / 2 - 2;
+    batch->y[i] = 0;
+    batch->rot[i] = 0;
+    batch->t[i] = 0;
+
+    return;
+}
+
+void BatchReset(BATCH* batch, int game)
+{
+    guint32* rows = BatchRows(batch, game);
+    guint8* queue = BatchQueue(batch, game);
+    int Y, X;
+
+    batch->ticks[game] = 0;
+    batch->speed[game] = batch->init_speed;
+    batch->level[game] = batch->init_level;
+    batch->lines[game] = 0;
+    batch->score[game] = 0;
+    batch->pieces[game] = 0;
+    batch->over[game] = 0;
+    batch->pause[game] = 0;
+    batch->quit[game] = 0;
+    batch->lock[game] = 0;
+
+    for (Y = 0; Y < batch->By; Y++)
+        rows[Y] = BatchEmptyRow(batch);
+    for (; Y < batch->stride; Y++)
+        rows[Y] = ~0U;
+    memset(BatchField(batch, game), 0, (size_t)batch->Bx * batch->By);
+
+    // the same draws, in the same order, as Reset() fills its queue
+    BatchSpawn(batch, game, BatchRandom(batch, game) % 7);
+    for (X = 0; X < batch->queue_size; X++)
+        queue[X] = BatchRandom(batch, game) % 7;
+    batch->next[game] = 0;
+
+    return;
+}
+
+static void BatchQuery(BATCH* batch, int i)
+{
+    guint8* queue = BatchQueue(batch, i);
+    int shape, drawn;
+
+    drawn = BatchRandom(batch, i) % 7;
+    if (batch->queue_size) {
+        shape = queue[batch->next[i]];
+        queue[batch->next[i]] = drawn;
+        batch->next[i] = (batch->next[i] + 1) % batch->queue_size;
+    } else {
+        shape = drawn;
+    }
+
+    BatchSpawn(batch, i, shape);
+    if (BatchOverlap(batch, i, batch->x[i], batch->y[i], batch->rot[i]))
+        batch->over[i] = 1;
+
+    return;
+}
+
+void BatchTelemetry(BATCH* batch, int game, int type, int a, int b, int c, int d)
+{
+    if (batch->telemetry)
+        TelemetryEvent(batch->telemetry, batch->tag[game], batch->ticks[game], type,
+                a, b, c, d, batch->score[game]);
+
+    return;
+}
+
+static void BatchLock(BATCH* batch, int i)
+{
+    guint32* rows = BatchRows(batch, i);
+    char* field = BatchField(batch, i);
+    const guint32* mask = BatchMask(batch, i, batch->rot[i]);
+    int x = batch->x[i], y = batch->y[i];
+    int full[4], nfull = 0;
+    int Y, X, h, n, score;
+
+    BatchTelemetry(batch, i, TELEMETRY_PLACE, batch->shape[i], x, y, batch->rot[i]);
+
+    // the tetrad becomes part of the field
+    for (Y = 0; Y < 4; Y++) {
+        if (! mask[Y] || y + Y >= batch->By)
+            continue;
+
+        rows[y + Y] |= mask[Y] << (x + BATCH_WALL);
+        for (X = 0; X < 4; X++) {
+            if (mask[Y] & (1U << X) && x + X >= 0 && x + X < batch->Bx)
+                field[(y + Y) * batch->Bx + x + X] = batch->shape[i] + 1;
+        }
+    }
+    batch->pieces[i] ++;
+
+    // the rows LineMark() would look at, a word compare each
+    h = batch->rot[i] % 2 ? 4 : 2;
+    for (Y = y; Y < y + h && Y < batch->By; Y++) {
+        if (rows[Y] == ~0U)
+            full[nfull++] = Y;
+    }
+
+    // scored as LineClear() does, by runs of consecutive rows
+    score = batch->score[i];
+    for (X = 0; X < nfull; X += n) {
+        for (n = 1; X + n < nfull && full[X + n] == full[X] + n; n++);
+        batch->lines[i] += n;
+        batch->score[i] += (1 << (n - 1)) * 1000;
+    }
+    if (nfull)
+        BatchTelemetry(batch, i, TELEMETRY_CLEAR, nfull, batch->score[i] - score,
+                batch->lines[i], 0);
+
+    // top to bottom, so that moving one row never moves another full one
+    for (X = 0; X < nfull; X++) {
+        Y = full[X];
+        memmove(rows + 1, rows, Y * sizeof(guint32));
+        rows[0] = BatchEmptyRow(batch);
+        memmove(field + batch->Bx, field, (size_t)Y * batch->Bx);
+        memset(field, 0, batch->Bx);
+    }
+
+    BatchQuery(batch, i);
+
+    return;
+}
+
+void BatchAction(BATCH* batch, int game, int action)
+{
+    const signed char (*kicks)[2];
+    int i = game, n, rot, x = 0, y = 0;
+
+    BatchTelemetry(batch, i, TELEMETRY_INPUT, action, 0, 0, 0);
+
+    switch (action) {
+        case TETRIS_KEY_QUIT:
+            batch->quit[i] = 1;
+            break;
+        case TETRIS_KEY_DROP:
+            if (batch->pause[i] || batch->over[i])
+                break;
+            // TetradDrop() counts the row it stopped on as well
+            for (n = 0; ! BatchOverlap(batch, i, batch->x[i], batch->y[i], batch->rot[i]); n++)
+                batch->y[i] ++;
+            batch->y[i] --;
+            batch->score[i] += n * 10;
+            BatchLock(batch, i);
+            break;
+        case TETRIS_KEY_LOWER:
+            if (batch->pause[i])
+                break;
+            if (! BatchOverlap(batch, i, batch->x[i], batch->y[i] + 1, batch->rot[i]))
+                batch->y[i] ++;
+            break;
+        case TETRIS_KEY_ROTATE_CW:
+        case TETRIS_KEY_ROTATE_CCW:
+            if (batch->pause[i])
+                break;
+            rot = (batch->rot[i] + (action == TETRIS_KEY_ROTATE_CW ? 1 : 3)) % 4;
+            kicks = tetrad_kicks[batch->shape[i]][batch->rot[i]][action == TETRIS_KEY_ROTATE_CCW];
+            for (n = 0; n < TETRIS_KICKS; n++) {
+                x = batch->x[i] + kicks[n][0];
+                y = batch->y[i] + kicks[n][1];
+                if (BatchFits(batch, i, x, y, rot))
+                    break;
+            }
+            if (n < TETRIS_KICKS) {
+                batch->x[i] = x;
+                batch->y[i] = y;
+                batch->rot[i] = rot;
+                if (batch->do_rotate_timeout_reset)
+                    batch->t[i] = 0;
+            }
+            break;
+        case TETRIS_KEY_MOVE_LEFT:
+        case TETRIS_KEY_MOVE_RIGHT:
+            if (batch->pause[i])
+                break;
+            n = action == TETRIS_KEY_MOVE_LEFT ? -1 : 1;
+            if (! BatchOverlap(batch, i, batch->x[i] + n, batch->y[i], batch->rot[i]))
+                batch->x[i] += n;
+            break;
+        case TETRIS_KEY_PAUSE:
+            if (! batch->over[i])
+                batch->pause[i] = ! batch->pause[i];
+            break;
+        case TETRIS_KEY_RESET:
+            BatchReset(batch, i);
+            break;
+        default:
+            break;
+    }
+
+    return;
+}
+
+void BatchTick(BATCH* batch, int lo, int hi)
+{
+    int i;
+
+    // Update() for every game in [lo, hi)
+    for (i = lo; i < hi; i++) {
+        batch->level[i] = batch->lines[i] / 10 + batch->init_level;
+        batch->speed[i] = batch->init_speed - batch->delta * batch->level[i];
+    }
+
+    batch->gravity(batch, lo, hi);
+
+    for (i = lo; i < hi; i++) {
+        if (batch->lock[i])
+            BatchLock(batch, i);
+    }
+
+    return;
+}
+
+int BatchLoad(BATCH* batch, int game, const STATE* state)
+{
+    guint32* rows = BatchRows(batch, game);
+    guint8* queue = BatchQueue(batch, game);
+    char* field = BatchField(batch, game);
+    const char* row;
+    TETRAD* tetrad;
+    int Y, X, n;
+
+    n = state->queue ? g_queue_get_length(state->queue) : 0;
+    if (state->Bx != batch->Bx || state->By != batch->By || ! state->tetrad ||
+            n != batch->queue_size || state->queue_size != batch->queue_size ||
+            state->init_level != batch->init_level ||
+            state->init_speed != batch->init_speed ||
+            state->delta != batch->delta ||
+            state->do_rotate_timeout_reset != batch->do_rotate_timeout_reset)
+        return 0;
+
+    for (Y = 0; Y < batch->By; Y++) {
+        row = FieldRow(state->field, Y);
+        memcpy(field + Y * batch->Bx, row, batch->Bx);
+        rows[Y] = BatchEmptyRow(batch);
+        for (X = 0; X < batch->Bx; X++) {
+            if (row[X])
+                rows[Y] |= 1U << (X + BATCH_WALL);
+        }
+    }
+    for (; Y < batch->stride; Y++)
+        rows[Y] = ~0U;
+
+    batch->seed[game] = state->seed;
+    batch->rng[game] = state->rng;
+    batch->ticks[game] = state->ticks;
+    batch->speed[game] = state->speed;
+    batch->level[game] = state->level;
+    batch->lines[game] = state->lines;
+    batch->score[game] = state->score;
+    batch->pieces[game] = state->pieces;
+    batch->over[game] = state->game_over_f;
+    batch->pause[game] = state->pause_f;
+    batch->quit[game] = state->status == STATUS_GAMEOVER;
+    batch->lock[game] = 0;
+
+    batch->shape[game] = state->tetrad->shape;
+    batch->x[game] = state->tetrad->x;
+    batch->y[game] = state->tetrad->y;
+    batch->rot[game] = state->tetrad->rot;
+    batch->t[game] = state->tetrad->t;
+
+    // the tail of state->queue is the oldest tetrad
+    for (X = 0; X < n; X++) {
+        tetrad = g_queue_peek_nth(state->queue, n - 1 - X);
+        queue[X] = tetrad->shape;
+    }
+    batch->next[game] = 0;
+
+    return 1;
+}
+
+void BatchStore(const BATCH* batch, int game, STATE* state)
+{
+    const guint8* queue = BatchQueue(batch, game);
+    const char* field = BatchField(batch, game);
+    TETRAD* tetrad;
+    int X, Y;
+
+    while ((tetrad = g_queue_pop_tail(state->queue)))
+        TetradFree(tetrad);
+    if (state->tetrad)
+        TetradFree(state->tetrad);
+
+    state->Bx = batch->Bx;
+    state->By = batch->By;
+    state->queue_size = batch->queue_size;
+    state->init_level = batch->init_level;
+    state->init_speed = batch->init_speed;
+    state->delta = batch->delta;
+    state->do_rotate_timeout_reset = batch->do_rotate_timeout_reset;
+
+    FieldClear(state->field);
+    for (Y = 0; Y < batch->By; Y++) {
+        if (BatchRows(batch, game)[Y] != BatchEmptyRow(batch))
+            memcpy(FieldWrite(state->field, Y), field + Y * batch->Bx, batch->Bx);
+    }
+
+    state->seed = batch->seed[game];
+    state->rng = batch->rng[game];
+    state->ticks = batch->ticks[game];
+    state->status = batch->quit[game] ? STATUS_GAMEOVER : STATUS_GAME;
+    state->speed = batch->speed[game];
+    state->level = batch->level[game];
+    state->lines = batch->lines[game];
+    state->score = batch->score[game];
+    state->pieces = batch->pieces[game];
+    state->game_over_f = batch->over[game];
+    state->pause_f = batch->pause[game];
+
+    state->tetrad = TetradAlloc(batch->shape[game], batch->Bx / 2 - 2, 0);
+    state->tetrad->x = batch->x[game];
+    state->tetrad->y = batch->y[game];
+    state->tetrad->rot = batch->rot[game];
+    state->tetrad->t = batch->t[game];
+
+    for (X = 0; X < batch->queue_size; X++) {
+        tetrad = TetradAlloc(queue[(batch->next[game] + X) % batch->queue_size],
+                batch->Bx / 2 - 2, 0);
+        g_queue_push_head(state->queue, tetrad);
+    }
+
+    return;
+}
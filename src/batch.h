@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glib.h>
+#include "tetris.h"
+
+/*
+ * The batch engine steps many games of the same board size at once.
+ * Instead of one STATE per game, every per-game value lives in its own
+ * array (x[], y[], t[], score[], ...), and the fields are bitboards:
+ * one 32 bit word per row, with BATCH_WALL bits of wall on the left,
+ * the Bx cells, wall up to bit 31, and four full rows of floor below
+ * the field.  A tetrad overlaps when any of its row masks, shifted to
+ * its column, meets a set bit; a row is full when its word is ~0.
+ *
+ * BatchTick() does gravity and collision for a whole range of games in
+ * one pass over those arrays, eight games at a time on AVX2, and only
+ * the games whose tetrad landed take the slower path through locking,
+ * line clears and the next tetrad.  Games play exactly as the STATE
+ * engine does: same seed and actions, same game.
+ */
+
+#define BATCH_WALL          4
+#define BATCH_MAX_WIDTH     (32 - 2 * BATCH_WALL)
+#define BATCH_QUEUE         8
+
+typedef struct _BATCH {
+    int n, size;            // games in use, games allocated
+    int Bx, By;
+    int stride;             // row words per game, By plus the floor
+
+    // settings shared by every game
+    int queue_size;
+    int init_level;
+    int init_speed;
+    int delta;
+    int do_rotate_timeout_reset;
+
+    gint32 masks[7 * 4 * 4];    // [shape][rot][row], cells as bits from 0
+    void (*gravity)(struct _BATCH*, int, int);
+
+    guint32* rows;          // stride words per game
+    char* field;            // Bx * By colors per game, for snapshots
+    guint8* queue;          // BATCH_QUEUE shapes per game, a ring
+
+    guint64* seed;
+    guint64* rng;
+    guint64* ticks;
+
+    gint32* x;
+    gint32* y;
+    gint32* rot;
+    gint32* shape;
+    gint32* t;
+    gint32* next;           // oldest entry of the queue ring
+
+    gint32* speed;
+    gint32* level;
+    gint32* lines;
+    gint32* score;
+    gint32* pieces;
+
+    gint32* over;           // game_over_f
+    gint32* pause;          // pause_f
+    gint32* quit;           // status == STATUS_GAMEOVER
+    gint32* lock;           // scratch: the tetrad landed this tick
+
+    struct _TELEMETRY* telemetry;   // NULL unless it is being written
+    guint64* tag;           // the game's id in the telemetry
+} BATCH;
+
+#define BatchDone(batch, i)     ((batch)->over[i] || (batch)->quit[i])
+
+BATCH* BatchAlloc(const STATE* settings);
+void BatchFree(BATCH*);
+const char* BatchKernel(const BATCH*);
+
+int BatchAdd(BATCH*, guint64 seed);
+int BatchRemove(BATCH*, int game);
+void BatchReset(BATCH*, int game);
+
+void BatchAction(BATCH*, int game, int action);
+void BatchTick(BATCH*, int lo, int hi);
+void BatchTelemetry(BATCH*, int game, int type, int a, int b, int c, int d);
+
+int BatchLoad(BATCH*, int game, const STATE*);
+void BatchStore(const BATCH*, int game, STATE*);
@@ -0,0 +1,188 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <glib.h>
+#include "tetris.h"
+#include "bot.h"
+
+// placement weights, after Yiyuan Lee's near-perfect tetris bot
+#define BOT_W_HEIGHT    -0.510066
+#define BOT_W_LINES     0.760666
+#define BOT_W_HOLES     -0.35663
+#define BOT_W_BUMPS     -0.184483
+
+static int BotColumn(STATE* state, int x, int* holes)
+{
+    int Y, h = 0;
+
+    *holes = 0;
+    for (Y = state->field->top; Y < state->By; Y++) {
+        if (FieldCell(state->field, x, Y)) {
+            if (! h)
+                h = state->By - Y;
+        } else if (h) {
+            (*holes) ++;
+        }
+    }
+
+    return h;
+}
+
+static double BotScore(STATE* state, BOT* bot, TETRAD* tetrad, int holes)
+{
+    int cx[4], cy[4];
+    int A, B, X, n, h;
+    int lines = 0, height = 0, bumps = 0;
+
+    n = TetradCells(tetrad, cx, cy);
+
+    // stamp the tetrad into the field, it is lifted again below
+    for (A = 0; A < n; A++)
+        FieldWrite(state->field, cy[A])[cx[A]] = tetrad->shape + 1;
+
+    for (A = 0; A < n; A++) {
+        for (B = 0; B < A && cy[B] != cy[A]; B++);
+        if (B < A)
+            continue;
+
+        for (X = 0; X < state->Bx && FieldCell(state->field, X, cy[A]); X++);
+        if (X == state->Bx)
+            lines ++;
+    }
+
+    memcpy(bot->scratch, bot->heights, state->Bx * sizeof(int));
+    for (A = 0; A < n; A++) {
+        for (B = 0; B < A && cx[B] != cx[A]; B++);
+        if (B < A)
+            continue;
+
+        holes -= bot->holes[cx[A]];
+        bot->scratch[cx[A]] = BotColumn(state, cx[A], &h);
+        holes += h;
+    }
+
+    for (A = 0; A < n; A++)
+        FieldWrite(state->field, cy[A])[cx[A]] = 0;
+
+    for (X = 0; X < state->Bx; X++) {
+        height += bot->scratch[X];
+        if (X + 1 < state->Bx)
+            bumps += abs(bot->scratch[X] - bot->scratch[X + 1]);
+    }
+
+    return BOT_W_HEIGHT * height + BOT_W_LINES * lines +
+        BOT_W_HOLES * holes + BOT_W_BUMPS * bumps;
+}
+
+static void BotPlan(STATE* state, BOT* bot)
+{
+    TETRAD tetrad;
+    double score, best = -DBL_MAX;
+    int X, rot, holes = 0;
+
+    for (X = 0; X < state->Bx; X++) {
+        bot->heights[X] = BotColumn(state, X, &bot->holes[X]);
+        holes += bot->holes[X];
+    }
+
+    bot->rot = state->tetrad->rot;
+    bot->x = state->tetrad->x;
+
+    for (rot = 0; rot < 4; rot++) {
+        for (X = -3; X < state->Bx; X++) {
+            tetrad = *state->tetrad;
+            tetrad.rot = rot;
+            tetrad.x = X;
+
+            if (TetradOverlap(state, &tetrad))
+                continue;
+
+            while (! TetradOverlap(state, &tetrad))
+                tetrad.y ++;
+            tetrad.y --;
+
+            score = BotScore(state, bot, &tetrad, holes);
+            if (score > best) {
+                best = score;
+                bot->rot = rot;
+                bot->x = X;
+            }
+        }
+    }
+
+    bot->piece = state->pieces;
+    bot->planned = 1;
+    bot->last_action = -1;
+
+    return;
+}
+
+BOT* BotAlloc(STATE* state)
+{
+    BOT* bot;
+
+    bot = (BOT*)malloc(sizeof(BOT));
+    if (! bot)
+        return NULL;
+
+    memset(bot, 0, sizeof(BOT));
+    bot->heights = (int*)malloc(3 * state->Bx * sizeof(int));
+    if (! bot->heights) {
+        free(bot);
+        return NULL;
+    }
+
+    bot->holes = bot->heights + state->Bx;
+    bot->scratch = bot->holes + state->Bx;
+    bot->last_action = -1;
+
+    return bot;
+}
+
+void BotFree(BOT* bot)
+{
+    free(bot->heights);
+    free(bot);
+
+    return;
+}
+
+int BotInput(STATE* state, BOT* bot)
+{
+    TETRAD* tetrad = state->tetrad;
+    int action;
+
+    if (! tetrad || state->pause_f || state->game_over_f)
+        return -1;
+
+    if (! bot->planned || bot->piece != state->pieces) {
+        BotPlan(state, bot);
+    } else if (bot->last_action != -1 &&
+            tetrad->rot == bot->last_rot && tetrad->x == bot->last_x) {
+        // the last move was blocked, take what we can get
+        return TETRIS_KEY_DROP;
+    }
+
+    if (tetrad->rot != bot->rot) {
+        action = TETRIS_KEY_ROTATE_CW;
+    } else if (tetrad->x < bot->x) {
+        action = TETRIS_KEY_MOVE_RIGHT;
+    } else if (tetrad->x > bot->x) {
+        action = TETRIS_KEY_MOVE_LEFT;
+    } else {
+        action = TETRIS_KEY_DROP;
+    }
+
+    bot->last_action = action;
+    bot->last_rot = tetrad->rot;
+    bot->last_x = tetrad->x;
+
+    return action;
+}
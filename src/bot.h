@@ -0,0 +1,26 @@
+#pragma once
+
+#include "tetris.h"
+
+/*
+ * A simple placement bot.  For every new tetrad it scores each
+ * rotation and column with a weighted sum of aggregate height,
+ * completed lines, holes and bumpiness, then walks the tetrad there
+ * one action per tick, the same way a player at the keyboard would.
+ */
+
+typedef struct _BOT {
+    int piece;        // state->pieces the current plan belongs to
+    int planned;
+    int rot, x;       // target placement
+    int last_action;
+    int last_rot, last_x;
+
+    int* heights;     // per-column scratch space, Bx each
+    int* holes;
+    int* scratch;
+} BOT;
+
+BOT* BotAlloc(STATE*);
+void BotFree(BOT*);
+int BotInput(STATE*, BOT*);
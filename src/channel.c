@@ -0,0 +1,263 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "packet.h"
+#include "channel.h"
+
+// a is newer than b, with 16 bit sequence numbers that wrap
+#define SeqNewer(a, b)  ((gint16)((guint16)(a) - (guint16)(b)) > 0)
+
+void ChannelInit(CHANNEL* channel)
+{
+    memset(channel, 0, sizeof(CHANNEL));
+    channel->seq = 1;
+    channel->rto = CHANNEL_RTO_INIT;
+
+    return;
+}
+
+void ChannelReset(CHANNEL* channel)
+{
+    if (channel->unacked)
+        g_queue_free_full(channel->unacked, g_free);
+    ChannelInit(channel);
+
+    return;
+}
+
+void ChannelRestart(CHANNEL* channel)
+{
+    // the peer numbers its packets and messages from scratch again;
+    // what we still have to send it stays queued
+    channel->ack = 0;
+    channel->ack_bits = 0;
+    channel->received = 0;
+    channel->recv_id = 0;
+    channel->recv_bits = 0;
+    channel->accepted = 0;
+
+    return;
+}
+
+static int ChannelAcked(const CHANNEL* channel, guint16 ack, guint32 bits, guint16 seq)
+{
+    guint16 age = ack - seq;
+
+    return age == 0 || (age <= 32 && bits & (1U << (age - 1)));
+}
+
+static void ChannelSample(CHANNEL* channel, gint64 rtt)
+{
+    // RFC 6298
+    if (! channel->srtt) {
+        channel->srtt = rtt;
+        channel->rttvar = rtt / 2;
+    } else {
+        channel->rttvar = (3 * channel->rttvar + ABS(channel->srtt - rtt)) / 4;
+        channel->srtt = (7 * channel->srtt + rtt) / 8;
+    }
+
+    channel->rto = CLAMP(channel->srtt + 4 * channel->rttvar,
+            CHANNEL_RTO_MIN, CHANNEL_RTO_MAX);
+
+    return;
+}
+
+int ChannelReceive(CHANNEL* channel, const PACKET_HEADER* header, gint64 now)
+{
+    CHANNEL_MESSAGE* message;
+    GList* link, *next;
+    guint16 age;
+    int newest = 1;
+
+    // remember the packet, for our acks
+    if (! channel->received) {
+        channel->received = 1;
+        channel->ack = header->seq;
+        channel->ack_bits = 0;
+    } else if (SeqNewer(header->seq, channel->ack)) {
+        // the old newest is bit age - 1, which is still in the field at 32
+        age = header->seq - channel->ack;
+        channel->ack_bits = age <= 32 ?
+            (age < 32 ? channel->ack_bits << age : 0) | (1U << (age - 1)) : 0;
+        channel->ack = header->seq;
+    } else {
+        newest = 0;
+        age = channel->ack - header->seq;
+        if (age && age <= 32)
+            channel->ack_bits |= 1U << (age - 1);
+    }
+
+    // and let go of the messages the peer has got; no packet
+    // is ever numbered 0, that ack stands for none at all
+    if (channel->unacked && header->ack) {
+        for (link = channel->unacked->head; link; link = next) {
+            next = link->next;
+            message = (CHANNEL_MESSAGE*)link->data;
+            if (! message->sent ||
+                    ! ChannelAcked(channel, header->ack, header->ack_bits, message->seq))
+                continue;
+
+            // only a message sent once tells the round trip time
+            if (message->tries == 1)
+                ChannelSample(channel, MAX(now - message->sent, 1));
+
+            g_queue_delete_link(channel->unacked, link);
+            g_free(message);
+        }
+    }
+
+    return newest;
+}
+
+int ChannelAccept(CHANNEL* channel, guint16 id)
+{
+    guint16 age;
+
+    // whether or not it is new, the packet must be acked
+    channel->ack_pending = 1;
+
+    if (! channel->accepted) {
+        channel->accepted = 1;
+        channel->recv_id = id;
+        channel->recv_bits = 0;
+        return 1;
+    }
+
+    if (SeqNewer(id, channel->recv_id)) {
+        age = id - channel->recv_id;
+        channel->recv_bits = age <= 64 ?
+            (age < 64 ? channel->recv_bits << age : 0) | (1ULL << (age - 1)) : 0;
+        channel->recv_id = id;
+        return 1;
+    }
+
+    // anything further back than the window was long since seen:
+    // the sender never has more than CHANNEL_WINDOW messages out
+    age = channel->recv_id - id;
+    if (! age || age > 64 || channel->recv_bits & (1ULL << (age - 1)))
+        return 0;
+
+    channel->recv_bits |= 1ULL << (age - 1);
+
+    return 1;
+}
+
+void ChannelQueue(CHANNEL* channel, guint8 type, const void* value, guint16 length)
+{
+    CHANNEL_MESSAGE* message;
+    msg_reliable* reliable;
+
+    message = g_malloc0(sizeof(CHANNEL_MESSAGE) + sizeof(TLV) + sizeof(msg_reliable) +
+            sizeof(TLV) + length);
+    message->id = channel->next_id ++;
+    message->length = sizeof(TLV) + sizeof(msg_reliable) + sizeof(TLV) + length;
+
+    // kept as the whole RELIABLE TLV, ready to be copied out
+    TLV* tlv = (TLV*)message->data;
+    tlv->type = RELIABLE;
+    tlv->length = sizeof(msg_reliable) + sizeof(TLV) + length;
+
+    reliable = (msg_reliable*)tlv->value;
+    reliable->id = message->id;
+    reliable->message->type = type;
+    reliable->message->length = length;
+    memcpy(reliable->message->value, value, length);
+
+    if (! channel->unacked)
+        channel->unacked = g_queue_new();
+    g_queue_push_tail(channel->unacked, message);
+
+    return;
+}
+
+static gint64 ChannelDueAt(const CHANNEL* channel, const CHANNEL_MESSAGE* message)
+{
+    // backing off, twice as long for every try that went unacked
+    if (! message->sent)
+        return 0;
+
+    return message->sent + (channel->rto << MIN(message->tries - 1, 4));
+}
+
+int ChannelDue(const CHANNEL* channel, gint64 now)
+{
+    CHANNEL_MESSAGE* message, *oldest;
+    GList* link;
+
+    if (channel->ack_pending)
+        return 1;
+    if (! channel->unacked || g_queue_is_empty(channel->unacked))
+        return 0;
+
+    oldest = g_queue_peek_head(channel->unacked);
+    for (link = channel->unacked->head; link; link = link->next) {
+        message = (CHANNEL_MESSAGE*)link->data;
+        if ((guint16)(message->id - oldest->id) >= CHANNEL_WINDOW)
+            break;
+        if (now >= ChannelDueAt(channel, message))
+            return 1;
+    }
+
+    return 0;
+}
+
+size_t ChannelWrite(CHANNEL* channel, void* buffer, size_t size, guint64 token, gint64 now)
+{
+    PACKET_HEADER* header = (PACKET_HEADER*)buffer;
+    CHANNEL_MESSAGE* message, *oldest;
+    size_t offset = sizeof(PACKET_HEADER);
+    GList* link;
+
+    header->token = token;
+    header->seq = channel->seq ++;
+    if (! channel->seq)
+        channel->seq = 1;
+    header->ack = channel->ack;
+    header->ack_bits = channel->ack_bits;
+    channel->ack_pending = 0;
+
+    if (! channel->unacked)
+        return offset;
+
+    oldest = g_queue_peek_head(channel->unacked);
+    for (link = channel->unacked->head; link; link = link->next) {
+        message = (CHANNEL_MESSAGE*)link->data;
+        if ((guint16)(message->id - oldest->id) >= CHANNEL_WINDOW)
+            break;
+
+        if (now < ChannelDueAt(channel, message))
+            continue;
+        if (offset + message->length > size)
+            break;
+
+        memcpy((char*)buffer + offset, message->data, message->length);
+        offset += message->length;
+
+        message->seq = header->seq;
+        message->sent = now;
+        message->tries ++;
+    }
+
+    return offset;
+}
+
+int ChannelFailed(const CHANNEL* channel, gint64 now)
+{
+    CHANNEL_MESSAGE* message;
+
+    if (! channel->unacked || g_queue_is_empty(channel->unacked))
+        return 0;
+
+    // the last try went unacked for as long as it was given
+    message = g_queue_peek_head(channel->unacked);
+
+    return message->tries >= CHANNEL_TRIES && now >= ChannelDueAt(channel, message);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glib.h>
+#include "packet.h"
+
+/*
+ * A reliability layer over UDP, one CHANNEL per peer.  Every packet
+ * carries a sequence number and acknowledges the newest packet seen
+ * from the other side, plus the 32 before it as a bitfield, so one
+ * lost ack is covered by any later packet.
+ *
+ * Only control messages are reliable: ChannelQueue() keeps a copy of
+ * the message until a packet that carried it is acked, and
+ * ChannelWrite() puts it in the next packet again once its
+ * retransmission timeout, from the measured round trip time, runs out.
+ * Each reliable message has an id, so the receiver can drop copies it
+ * already has (ChannelAccept()).  Everything else goes out once, in
+ * whatever packet is sent next, and never waits for a lost message.
+ */
+
+#define CHANNEL_PACKET      1200        // bytes, below any sane MTU
+#define CHANNEL_WINDOW      32          // reliable messages in flight
+#define CHANNEL_TRIES       10          // sends before the peer is given up
+#define CHANNEL_RTO_INIT    250000      // microseconds, before any sample
+#define CHANNEL_RTO_MIN     100000      // two server ticks
+#define CHANNEL_RTO_MAX     2000000
+
+typedef struct _CHANNEL_MESSAGE {
+    guint16 id;
+    guint16 seq;        // of the last packet that carried it
+    gint64 sent;        // 0 until it is first sent
+    int tries;
+    guint16 length;     // of the TLV in data
+    guint8 data[];
+} CHANNEL_MESSAGE;
+
+typedef struct _CHANNEL {
+    guint16 seq;        // of the next packet sent
+    guint16 ack;        // newest packet received
+    guint32 ack_bits;   // bit n: packet ack - 1 - n was received
+    int received;       // any packet at all yet
+    int ack_pending;    // a reliable message no packet has acked yet
+
+    guint16 next_id;    // of the next reliable message queued
+    guint16 recv_id;    // newest reliable message received
+    guint64 recv_bits;  // bit n: message recv_id - 1 - n was received
+    int accepted;       // any reliable message at all yet
+
+    gint64 srtt, rttvar, rto;
+    GQueue* unacked;    // CHANNEL_MESSAGE*, oldest first
+    int queued;         // on the owner's list of channels to flush
+} CHANNEL;
+
+#define ChannelBusy(channel) \
+    ((channel)->ack_pending || ((channel)->unacked && ! g_queue_is_empty((channel)->unacked)))
+
+void ChannelInit(CHANNEL*);
+void ChannelReset(CHANNEL*);
+void ChannelRestart(CHANNEL*);
+
+int ChannelReceive(CHANNEL*, const PACKET_HEADER*, gint64 now);
+int ChannelAccept(CHANNEL*, guint16 id);
+
+void ChannelQueue(CHANNEL*, guint8 type, const void* value, guint16 length);
+int ChannelDue(const CHANNEL*, gint64 now);
+size_t ChannelWrite(CHANNEL*, void* buffer, size_t size, guint64 token, gint64 now);
+int ChannelFailed(const CHANNEL*, gint64 now);
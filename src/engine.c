@@ -0,0 +1,817 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The game engine.  Nothing in here may touch the terminal or any
+ * global state: all game data, including the random number generator,
+ * lives in the STATE, so that many games can be stepped at once from
+ * different threads (see sim.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "prof.h"
+#include "telemetry.h"
+
+/*
+ * The Tetrads
+ * ####  #       #   ##   ##   #   ##
+ *       ###   ###   ##  ##   ###   ##
+ * (I)   (J)   (L)   (O) (S)  (T)  (Z)
+ */
+
+const char* shapes[] = {
+    "####----#-#-#-#-####----#-#-#-#-", // I
+    "#---###-###-#---###---#--#-###--", // J
+    "--#-###-#-#-##--###-#---##-#-#--", // L
+    "##--##--####----##--##--####----", // O
+    "-##-##--#-##-#---##-##--#-##-#--", // S
+    "-#--###-#-###---###--#---###-#--", // T
+    "##---##--####---##---##--####---"  // Z
+};
+
+/*
+ * Rotation follows SRS.  The box of every rotation in shapes[] starts at
+ * its first row and column with a block; tetrad_origin[shape][rot] is
+ * where that box sits in the shape's SRS bounding box, which stays put
+ * as the tetrad turns.  So turning from rot to rot' moves the tetrad by
+ * tetrad_origin[shape][rot'] - tetrad_origin[shape][rot], and then by
+ * one of the SRS wall kicks if it has to.
+ *
+ * tetrad_kicks[shape][rot][ccw] is both added up, once, for turning from
+ * rot clockwise (ccw 0) or counterclockwise (ccw 1): the places to try,
+ * in order, with y growing downwards.  The first that fits is taken; a
+ * tetrad that fits in none does not turn.
+ */
+const signed char tetrad_origin[7][4][2] = {
+    { { 0, 1 }, { 2, 0 }, { 0, 2 }, { 1, 0 } }, // I
+    { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } }, // J
+    { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } }, // L
+    { { 1, 0 }, { 1, 0 }, { 1, 0 }, { 1, 0 } }, // O
+    { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } }, // S
+    { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } }, // T
+    { { 0, 0 }, { 1, 0 }, { 0, 1 }, { 0, 0 } }  // Z
+};
+
+const signed char tetrad_kicks[7][4][2][TETRIS_KICKS][2] = {
+    { // I
+        { { {  2, -1 }, {  0, -1 }, {  3, -1 }, {  0,  0 }, {  3, -3 } },
+          { {  1, -1 }, {  0, -1 }, {  3, -1 }, {  0, -3 }, {  3,  0 } } },
+        { { { -2,  2 }, { -3,  2 }, {  0,  2 }, { -3,  0 }, {  0,  3 } },
+          { { -2,  1 }, {  0,  1 }, { -3,  1 }, {  0,  0 }, { -3,  3 } } },
+        { { {  1, -2 }, {  3, -2 }, {  0, -2 }, {  3, -3 }, {  0,  0 } },
+          { {  2, -2 }, {  3, -2 }, {  0, -2 }, {  3,  0 }, {  0, -3 } } },
+        { { { -1,  1 }, {  0,  1 }, { -3,  1 }, {  0,  3 }, { -3,  0 } },
+          { { -1,  2 }, { -3,  2 }, {  0,  2 }, { -3,  3 }, {  0,  0 } } },
+    },
+    { // J
+        { { {  1,  0 }, {  0,  0 }, {  0, -1 }, {  1,  2 }, {  0,  2 } },
+          { {  0,  0 }, {  1,  0 }, {  1, -1 }, {  0,  2 }, {  1,  2 } } },
+        { { { -1,  1 }, {  0,  1 }, {  0,  2 }, { -1, -1 }, {  0, -1 } },
+          { { -1,  0 }, {  0,  0 }, {  0,  1 }, { -1, -2 }, {  0, -2 } } },
+        { { {  0, -1 }, {  1, -1 }, {  1, -2 }, {  0,  1 }, {  1,  1 } },
+          { {  1, -1 }, {  0, -1 }, {  0, -2 }, {  1,  1 }, {  0,  1 } } },
+        { { {  0,  0 }, { -1,  0 }, { -1,  1 }, {  0, -2 }, { -1, -2 } },
+          { {  0,  1 }, { -1,  1 }, { -1,  2 }, {  0, -1 }, { -1, -1 } } },
+    },
+    { // L
+        { { {  1,  0 }, {  0,  0 }, {  0, -1 }, {  1,  2 }, {  0,  2 } },
+          { {  0,  0 }, {  1,  0 }, {  1, -1 }, {  0,  2 }, {  1,  2 } } },
+        { { { -1,  1 }, {  0,  1 }, {  0,  2 }, { -1, -1 }, {  0, -1 } },
+          { { -1,  0 }, {  0,  0 }, {  0,  1 }, { -1, -2 }, {  0, -2 } } },
+        { { {  0, -1 }, {  1, -1 }, {  1, -2 }, {  0,  1 }, {  1,  1 } },
+          { {  1, -1 }, {  0, -1 }, {  0, -2 }, {  1,  1 }, {  0,  1 } } },
+        { { {  0,  0 }, { -1,  0 }, { -1,  1 }, {  0, -2 }, { -1, -2 } },
+          { {  0,  1 }, { -1,  1 }, { -1,  2 }, {  0, -1 }, { -1, -1 } } },
+    },
+    { // O
+        { { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } },
+          { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } } },
+        { { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } },
+          { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } } },
+        { { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } },
+          { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } } },
+        { { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } },
+          { {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 }, {  0,  0 } } },
+    },
+    { // S
+        { { {  1,  0 }, {  0,  0 }, {  0, -1 }, {  1,  2 }, {  0,  2 } },
+          { {  0,  0 }, {  1,  0 }, {  1, -1 }, {  0,  2 }, {  1,  2 } } },
+        { { { -1,  1 }, {  0,  1 }, {  0,  2 }, { -1, -1 }, {  0, -1 } },
+          { { -1,  0 }, {  0,  0 }, {  0,  1 }, { -1, -2 }, {  0, -2 } } },
+        { { {  0, -1 }, {  1, -1 }, {  1, -2 }, {  0,  1 }, {  1,  1 } },
+          { {  1, -1 }, {  0, -1 }, {  0, -2 }, {  1,  1 }, {  0,  1 } } },
+        { { {  0,  0 }, { -1,  0 }, { -1,  1 }, {  0, -2 }, { -1, -2 } },
+          { {  0,  1 }, { -1,  1 }, { -1,  2 }, {  0, -1 }, { -1, -1 } } },
+    },
+    { // T
+        { { {  1,  0 }, {  0,  0 }, {  0, -1 }, {  1,  2 }, {  0,  2 } },
+          { {  0,  0 }, {  1,  0 }, {  1, -1 }, {  0,  2 }, {  1,  2 } } },
+        { { { -1,  1 }, {  0,  1 }, {  0,  2 }, { -1, -1 }, {  0, -1 } },
+          { { -1,  0 }, {  0,  0 }, {  0,  1 }, { -1, -2 }, {  0, -2 } } },
+        { { {  0, -1 }, {  1, -1 }, {  1, -2 }, {  0,  1 }, {  1,  1 } },
+          { {  1, -1 }, {  0, -1 }, {  0, -2 }, {  1,  1 }, {  0,  1 } } },
+        { { {  0,  0 }, { -1,  0 }, { -1,  1 }, {  0, -2 }, { -1, -2 } },
+          { {  0,  1 }, { -1,  1 }, { -1,  2 }, {  0, -1 }, { -1, -1 } } },
+    },
+    { // Z
+        { { {  1,  0 }, {  0,  0 }, {  0, -1 }, {  1,  2 }, {  0,  2 } },
+          { {  0,  0 }, {  1,  0 }, {  1, -1 }, {  0,  2 }, {  1,  2 } } },
+        { { { -1,  1 }, {  0,  1 }, {  0,  2 }, { -1, -1 }, {  0, -1 } },
+          { { -1,  0 }, {  0,  0 }, {  0,  1 }, { -1, -2 }, {  0, -2 } } },
+        { { {  0, -1 }, {  1, -1 }, {  1, -2 }, {  0,  1 }, {  1,  1 } },
+          { {  1, -1 }, {  0, -1 }, {  0, -2 }, {  1,  1 }, {  0,  1 } } },
+        { { {  0,  0 }, { -1,  0 }, { -1,  1 }, {  0, -2 }, { -1, -2 } },
+          { {  0,  1 }, { -1,  1 }, { -1,  2 }, {  0, -1 }, { -1, -1 } } },
+    }
+};
+
+/*
+ * Almost every game is played on the default board, so the collision
+ * and line clear code below is written once, as always-inlined bodies
+ * that take the board size as arguments, and expanded twice: with the
+ * standard size as constants, and with the size read from the STATE.
+ * The constant copy has every row offset folded and every loop over a
+ * row or a tetrad unrolled.
+ */
+
+#ifdef __GNUC__
+#define ENGINE_INLINE   static inline __attribute__((always_inline))
+#else
+#define ENGINE_INLINE   static inline
+#endif
+
+#define EngineStandard(state) \
+    ((state)->Bx == TETRIS_STD_WIDTH && (state)->By == TETRIS_STD_HEIGHT)
+
+ENGINE_INLINE int EngineRowFull(const char* row, int Bx)
+{
+    int X;
+
+    if (Bx != TETRIS_STD_WIDTH)
+        return RowFull(row, Bx);
+
+    for (X = 0; X < TETRIS_STD_WIDTH; X++) {
+        if (! row[X])
+            return 0;
+    }
+
+    return 1;
+}
+
+ENGINE_INLINE int EngineRowMatch(const char* row, int Bx, char c)
+{
+    int X;
+
+    if (Bx != TETRIS_STD_WIDTH)
+        return RowMatch(row, Bx, c);
+
+    for (X = 0; X < TETRIS_STD_WIDTH; X++) {
+        if (row[X] != c)
+            return 0;
+    }
+
+    return 1;
+}
+
+STATE* GameAlloc(void)
+{
+    STATE* state;
+
+    state = (STATE*)calloc(1, sizeof(STATE));
+    if (! state)
+        return NULL;
+
+    // the default game, before any options
+    state->Bx = TETRIS_STD_WIDTH;
+    state->By = TETRIS_STD_HEIGHT;
+    state->queue_size = 5;
+    state->init_speed = INIT_SPEED;
+    state->delta = DELTA_SPEED;
+
+    state->init_level = 1;
+    state->line_clear_timeout = 0;
+
+    state->do_clear = CLEAR_FLASH;
+    state->do_rotate_timeout_reset = 0;
+    state->do_dissolve = 1;
+    state->do_pause_blocks = 0;
+
+    return state;
+}
+
+int GameStart(STATE* state, guint64 seed)
+{
+    if (! state->field)
+        state->field = FieldAlloc(state->Bx, state->By);
+
+    if (! state->queue)
+        state->queue = g_queue_new();
+
+    RandomSeed(state, seed);
+    Reset(state);
+
+    GameTelemetry(state, TELEMETRY_START, state->Bx, state->By,
+            (int)(seed & 0xFFFFFFFFU), (int)(seed >> 32));
+
+    return 1;
+}
+
+void GameFree(STATE* state)
+{
+    TETRAD* tetrad;
+
+    if (state->queue) {
+        while ((tetrad = g_queue_pop_tail(state->queue)))
+            TetradFree(tetrad);
+        g_queue_free(state->queue);
+    }
+
+    if (state->replays)
+        g_queue_free(state->replays);
+
+    if (state->tetrad)
+        TetradFree(state->tetrad);
+
+    if (state->field)
+        FieldFree(state->field);
+    free(state);
+
+    return;
+}
+
+void GameTelemetry(STATE* state, int type, int a, int b, int c, int d)
+{
+    if (state->telemetry)
+        TelemetryEvent(state->telemetry, state->game_id, state->ticks, type,
+                a, b, c, d, state->score);
+
+    return;
+}
+
+void RandomSeed(STATE* state, guint64 seed)
+{
+    state->seed = seed;
+    state->rng = seed;
+
+    return;
+}
+
+guint32 Random(STATE* state)
+{
+    // splitmix64
+    guint64 z;
+
+    z = (state->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return (guint32)((z ^ (z >> 31)) >> 32);
+}
+
+void Reset(STATE* state)
+{
+    TETRAD* tetrad;
+
+    state->status = STATUS_GAME;
+
+    state->ticks = 0;
+    state->speed = state->init_speed;
+    state->level = state->init_level;
+    state->lines = 0;
+    state->score = 0;
+    state->pieces = 0;
+    state->clears = 0;
+    state->ncleared = 0;
+    state->game_over_f = 0;
+    state->pause_f = 0;
+
+    FieldClear(state->field);
+
+    if (state->tetrad) {
+        TetradFree(state->tetrad);
+        state->tetrad = NULL;
+    }
+
+    while((tetrad = g_queue_pop_tail(state->queue)))
+        TetradFree(tetrad);
+
+    // push several new tetrads onto the stack
+    while (g_queue_get_length(state->queue) < state->queue_size + 1)
+        TetradQueue(state);
+
+    state->tetrad = g_queue_pop_tail(state->queue);
+
+    return;
+}
+
+void Update(STATE* state)
+{
+    state->level = state->lines / 10 + state->init_level;
+    state->speed = state->init_speed - (state->delta * state->level);
+
+    if (state->game_over_f || state->pause_f)
+        return;
+
+    if (state->tetrad && !TetradUpdate(state)) {
+        EventTetrad(state);
+    }
+
+    return;
+}
+
+TETRAD* TetradAlloc(int shape, int x, int y)
+{
+    TETRAD* tetrad = NULL;
+
+    tetrad = (TETRAD*)malloc(sizeof(TETRAD));
+    if (!tetrad)
+        return NULL;
+
+    tetrad->shape = shape;
+    tetrad->color = 0;
+    tetrad->x = x;
+    tetrad->y = y;
+    tetrad->x0 = x;
+    tetrad->y0 = y;
+    tetrad->t = 0;
+    tetrad->rot = 0;
+
+    return tetrad;
+}
+
+TETRAD* TetradRandomAlloc(STATE* state)
+{
+    TETRAD* tetrad;
+    int rot = 0;
+
+    rot = Random(state) % 4;
+    tetrad = TetradAlloc(Random(state) % 7, Random(state) % state->Bx, 0);
+
+    return tetrad;
+}
+
+void TetradFree(TETRAD* tetrad)
+{
+    free(tetrad);
+
+    return;
+}
+
+int TetradUpdate(STATE* state)
+{
+    if (! state->tetrad) {
+        // there is no tetrad
+        return 0;
+    }
+
+    if (state->tetrad->t >= state->speed) {
+        // lower the tetrad
+        state->tetrad->y ++;
+        if (TetradFieldOverlap(state)) {
+            // replace the tetrad
+            state->tetrad->y --;
+
+            return 0;
+        }
+
+        state->tetrad->t = 0;
+    }
+
+    state->tetrad->t ++;
+    return 1;
+}
+
+void TetradQueue(STATE* state)
+{
+    TETRAD* tetrad = NULL;
+
+    tetrad = TetradAlloc(Random(state) % 7,
+            state->Bx / 2 - 2,
+            0);
+    g_queue_push_head(state->queue, tetrad);
+
+    return;
+}
+
+/*
+ * The cells of a tetrad in rotation rot are shapes[shape][8 * rot ...],
+ * rows Z wide, so cell X sits at row X / Z and column X % Z of the
+ * tetrad.
+ */
+ENGINE_INLINE void TetradTranslateSized(FIELD* field, const TETRAD* tetrad, int Bx, int By)
+{
+    const char* cells = shapes[tetrad->shape] + 8 * tetrad->rot;
+    int shift = tetrad->rot % 2 ? 1 : 2;
+    int X, row, col;
+
+#ifdef __GNUC__
+#pragma GCC unroll 8
+#endif
+    for (X = 0; X < 8; X++) {
+        row = tetrad->y + (X >> shift);
+        col = tetrad->x + (X & ((1 << shift) - 1));
+
+        if (cells[X] == '#' && (unsigned)row < By && (unsigned)col < Bx)
+            FieldWrite(field, row)[col] = tetrad->shape + 1;
+    }
+
+    return;
+}
+
+ENGINE_INLINE int TetradOverlapSized(const FIELD* field, const TETRAD* tetrad, int Bx, int By)
+{
+    const char* cells = shapes[tetrad->shape] + 8 * tetrad->rot;
+    int shift = tetrad->rot % 2 ? 1 : 2;
+    int X, row, col;
+
+#ifdef __GNUC__
+#pragma GCC unroll 8
+#endif
+    for (X = 0; X < 8; X++) {
+        row = tetrad->y + (X >> shift);
+        col = tetrad->x + (X & ((1 << shift) - 1));
+
+        // off the board counts as a collision
+        if (cells[X] == '#' && ((unsigned)row >= By || (unsigned)col >= Bx ||
+                    FieldCell(field, col, row)))
+            return 1;
+    }
+
+    return 0;
+}
+
+void TetradTranslate(STATE* state, TETRAD* tetrad)
+{
+    if (EngineStandard(state))
+        TetradTranslateSized(state->field, tetrad, TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+    else
+        TetradTranslateSized(state->field, tetrad, state->Bx, state->By);
+
+    return;
+}
+
+int TetradFieldOverlap(STATE* state)
+{
+    return TetradOverlap(state, state->tetrad);
+}
+
+int TetradOverlap(STATE* state, TETRAD* tetrad)
+{
+    if (EngineStandard(state))
+        return TetradOverlapSized(state->field, tetrad, TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+
+    return TetradOverlapSized(state->field, tetrad, state->Bx, state->By);
+}
+
+int TetradCells(TETRAD* tetrad, int* x, int* y)
+{
+    const char* cells = shapes[tetrad->shape] + 8 * tetrad->rot;
+    int Z = tetrad->rot % 2 ? 2 : 4;
+    int X, n = 0;
+
+    for (X = 0; X < 8; X++) {
+        if (cells[X] == '#') {
+            x[n] = tetrad->x + X % Z;
+            y[n] = tetrad->y + X / Z;
+            n ++;
+        }
+    }
+
+    return n;
+}
+
+int TetradDrop(STATE* state)
+{
+    int n = 0;
+
+    if (! state->tetrad)
+        return 0;
+
+    for(n = 0; ! TetradFieldOverlap(state); n ++)
+        state->tetrad->y ++;
+
+    state->tetrad->y --;
+
+    return n;
+}
+
+ENGINE_INLINE int LineMarkSized(STATE* state, int y, int h, int Bx, int By)
+{
+    int Y, n = 0;
+
+    for (Y = y; Y < y + h && Y < By; Y ++) {
+        if (EngineRowFull(FieldRow(state->field, Y), Bx)) {
+            RowFill(FieldWrite(state->field, Y), Bx, CLEARED);
+            if (n < TETRIS_CLEAR_ROWS)
+                state->cleared[n] = Y;
+            n ++;
+        }
+    }
+
+    return n;
+}
+
+int LineMark(STATE* state, int y, int h)
+{
+    if (y < 0)
+        return 0;
+
+    if (EngineStandard(state))
+        return LineMarkSized(state, y, h, TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+
+    return LineMarkSized(state, y, h, state->Bx, state->By);
+}
+
+ENGINE_INLINE void LineClearSized(STATE* state, int Bx, int By)
+{
+    FIELD* field = state->field;
+    int Y = 0, top = 0;
+    int n = 0, X;
+
+    // rows above the topmost occupied row need not be moved,
+    // and the empty ones that were written can be handed back
+    for (top = field->top; top < By && EngineRowMatch(FieldRow(field, top), Bx, 0); top ++)
+        FieldRelease(field, top);
+
+    for (Y = top; Y < By; Y += n) {
+        n = 1;
+        if (EngineRowMatch(FieldRow(field, Y), Bx, CLEARED)) {
+            // how many consecutive lines are cleared?
+            for (n = 1; Y + n < By &&
+                    EngineRowMatch(FieldRow(field, Y + n), Bx, CLEARED); n ++);
+            // the cleared rows go back to the field as spares,
+            // and all above lines move down by n lines
+            for (X = 0; X < n; X++)
+                FieldRelease(field, Y + X);
+            memmove(field->rows + top + n, field->rows + top, (Y - top) * sizeof(char*));
+            for (X = 0; X < n; X++)
+                field->rows[top + X] = field->empty;
+            top += n;
+
+            state->lines += n;
+            state->score += Power(2, n - 1) * 1000;
+        }
+    }
+
+    field->top = top;
+
+    return;
+}
+
+void LineClear(STATE* state)
+{
+    int lines = state->lines, score = state->score;
+
+    PROF_BEGIN(state, PROF_LINE_CLEAR);
+
+    if (EngineStandard(state))
+        LineClearSized(state, TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+    else
+        LineClearSized(state, state->Bx, state->By);
+
+    GameTelemetry(state, TELEMETRY_CLEAR, state->lines - lines,
+            state->score - score, state->lines, 0);
+
+    PROF_END(state, PROF_LINE_CLEAR);
+
+    return;
+}
+
+// some useless function
+/*
+   int PrintTetrad(FILE* file, tetrad_t tetrad, int rot)
+   {
+   int n = 0;
+   size_t X = 0, Y = 0;
+
+   if (rot % 2) {
+   for(X = 8 * rot; X < 8 * rot + 8; X += 2) {
+   fprintf(file, "%.2s\n", shapes[tetrad] + X);
+   }
+   } else {
+   for(X = 8 * rot; X < 8 * rot + 8; X += 4) {
+   fprintf(file, "%.4s\n", shapes[tetrad] + X);
+   }
+   }
+
+   fputc('\n', file);
+   ++ n;
+
+   return n;
+   }
+   */
+
+void EventQuit(STATE* state)
+{
+    state->status = STATUS_GAMEOVER;
+    return;
+}
+
+void EventDrop(STATE* state)
+{
+    if (! state->tetrad || state->pause_f || state->game_over_f)
+        return;
+
+    state->score += TetradDrop(state) * 10;
+    EventTetrad(state);
+
+    return;
+}
+
+void EventLower(STATE* state)
+{
+    if (! state->tetrad || state->pause_f)
+        return;
+
+    state->tetrad->y ++;
+    if (TetradFieldOverlap(state)) {
+        state->tetrad->y --;
+    }
+
+    return;
+}
+
+void EventRotate(STATE* state, int rot)
+{
+    TETRAD* tetrad = state->tetrad;
+    const signed char (*kicks)[2];
+    int x, y, from, X;
+
+    if (! tetrad || state->pause_f)
+        return;
+
+    x = tetrad->x;
+    y = tetrad->y;
+    from = tetrad->rot;
+    kicks = tetrad_kicks[tetrad->shape][from][rot < 0];
+
+    tetrad->rot = (from + rot + 4) % 4;
+    for (X = 0; X < TETRIS_KICKS; X++) {
+        tetrad->x = x + kicks[X][0];
+        tetrad->y = y + kicks[X][1];
+        if (! TetradFieldOverlap(state))
+            break;
+    }
+
+    if (X == TETRIS_KICKS) {
+        // could not rotate
+        tetrad->x = x;
+        tetrad->y = y;
+        tetrad->rot = from;
+    } else if (state->do_rotate_timeout_reset) {
+        tetrad->t = 0;
+    }
+
+    return;
+}
+
+void EventMove(STATE* state, int x)
+{
+    if (! state->tetrad || state->pause_f)
+        return;
+
+    state->tetrad->x += x;
+    if (TetradFieldOverlap(state))
+        state->tetrad->x -= x;
+
+    return;
+}
+
+void EventTetrad(STATE* state)
+{
+    // NOTE: scoring for cleared lines occurs
+    //       in LineClear();
+
+    int y = 0, h = 0;
+
+    PROF_BEGIN(state, PROF_SPAWN);
+
+    GameTelemetry(state, TELEMETRY_PLACE, state->tetrad->shape,
+            state->tetrad->x, state->tetrad->y, state->tetrad->rot);
+
+    // translate the tetrad to the field as tiles
+    TetradTranslate(state, state->tetrad);
+    // gather information about tetrad dimensions
+    y = state->tetrad->y;
+    h = state->tetrad->rot % 2 ? 4 : 2;
+    // free the tetrad
+    TetradFree(state->tetrad);
+    state->tetrad = NULL;
+    state->pieces ++;
+
+    // the clear is committed at once, the renderer
+    // animates it on its own time
+    if ((state->ncleared = MIN(LineMark(state, y, h), TETRIS_CLEAR_ROWS))) {
+        LineClear(state);
+        state->clears ++;
+    }
+
+    EventQuery(state);
+
+    PROF_END(state, PROF_SPAWN);
+
+    /*
+       TetradQueue(state);
+       state->tetrad = ListDequeue(state->queue);
+       */
+    return;
+}
+
+void EventQuery(STATE* state)
+{
+    TetradQueue(state);
+    state->tetrad = g_queue_pop_tail(state->queue);
+    if (TetradFieldOverlap(state)) {
+        state->game_over_f = 1;
+    }
+
+    return;
+}
+
+void EventPause(STATE* state)
+{
+    state->pause_f = 1;
+
+    return;
+}
+
+void EventUnpause(STATE* state)
+{
+    state->pause_f = 0;
+
+    return;
+}
+
+void EventAction(STATE* state, int action)
+{
+    PROF_BEGIN(state, PROF_ACTION);
+
+    GameTelemetry(state, TELEMETRY_INPUT, action, 0, 0, 0);
+
+    switch (action) {
+        case TETRIS_KEY_QUIT:
+            EventQuit(state);
+            break;
+        case TETRIS_KEY_DROP:
+            EventDrop(state);
+            break;
+        case TETRIS_KEY_LOWER:
+            EventLower(state);
+            break;
+        case TETRIS_KEY_ROTATE_CW:
+            EventRotate(state, 1);
+            break;
+        case TETRIS_KEY_ROTATE_CCW:
+            EventRotate(state, -1);
+            break;
+        case TETRIS_KEY_MOVE_LEFT:
+            EventMove(state, -1);
+            break;
+        case TETRIS_KEY_MOVE_RIGHT:
+            EventMove(state, 1);
+            break;
+        case TETRIS_KEY_PAUSE:
+            if (! state->game_over_f) {
+                if (state->pause_f)
+                    EventUnpause(state);
+                else
+                    EventPause(state);
+            }
+            break;
+        case TETRIS_KEY_RESET:
+            Reset(state);
+            break;
+        default:
+            break;
+    }
+
+    PROF_END(state, PROF_ACTION);
+
+    return;
+}
+
+void DebugPrintTetrad(TETRAD* tetrad, FILE* file)
+{
+    if (! tetrad) {
+        fprintf(file, "tetrad (nil)\n");
+        return;
+    }
+
+    fprintf(file, "tetrad %p: %c rot %d at %d,%d (was %d,%d) t %d\n",
+            tetrad, "IJLOSTZ"[tetrad->shape % 7], tetrad->rot,
+            tetrad->x, tetrad->y, tetrad->x0, tetrad->y0, tetrad->t);
+    return;
+}
+
+int Power(int a, int x)
+{
+    return x ? a * Power(a, x - 1) : 1;
+}
@@ -0,0 +1,123 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "batch.h"
+#include "env.h"
+
+static guint64 EnvSeed(const ENV* env, int i)
+{
+    // splitmix64 finalizer, as SimSeed() in sim.c, over the
+    // game and its episode, so that no two episodes share a seed
+    guint64 z = env->seed + ((guint64)i << 32 | env->episode[i]) * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+static void EnvStart(ENV* env, int i)
+{
+    BATCH* batch = env->batch;
+
+    batch->seed[i] = batch->rng[i] = EnvSeed(env, i);
+    BatchReset(batch, i);
+    env->episode[i] ++;
+    env->last[i] = 0;
+
+    return;
+}
+
+ENV* EnvAlloc(const STATE* settings, int n, guint64 seed, unsigned long max_ticks)
+{
+    ENV* env;
+    int i;
+
+    if (n < 1)
+        return NULL;
+
+    env = g_new0(ENV, 1);
+    env->batch = BatchAlloc(settings);
+    if (! env->batch) {
+        g_free(env);
+        return NULL;
+    }
+
+    // every game is added now: the batch's arrays never move after this
+    for (i = 0; i < n; i++)
+        BatchAdd(env->batch, 0);
+
+    env->n = n;
+    env->seed = seed;
+    env->max_ticks = max_ticks;
+    env->episode = g_new0(guint32, n);
+    env->reward = g_new0(gint32, n);
+    env->done = g_new0(guint8, n);
+    env->last = g_new0(gint32, n);
+
+    EnvReset(env);
+
+    return env;
+}
+
+void EnvFree(ENV* env)
+{
+    BatchFree(env->batch);
+    g_free(env->episode);
+    g_free(env->reward);
+    g_free(env->done);
+    g_free(env->last);
+    g_free(env);
+
+    return;
+}
+
+void EnvReset(ENV* env)
+{
+    int i;
+
+    for (i = 0; i < env->n; i++) {
+        EnvStart(env, i);
+        env->reward[i] = 0;
+        env->done[i] = 0;
+    }
+
+    return;
+}
+
+void EnvStep(ENV* env, const guint8* actions, int lo, int hi)
+{
+    BATCH* batch = env->batch;
+    int i, action;
+
+    for (i = lo; i < hi; i++) {
+        batch->ticks[i] ++;
+
+        // pausing or resetting is not for the bot to decide
+        action = actions[i];
+        if (action < TETRIS_KEY_PAUSE)
+            BatchAction(batch, i, action);
+    }
+
+    BatchTick(batch, lo, hi);
+
+    for (i = lo; i < hi; i++) {
+        env->reward[i] = batch->score[i] - env->last[i];
+        env->last[i] = batch->score[i];
+        env->done[i] = BatchDone(batch, i) ||
+            (env->max_ticks && batch->ticks[i] >= env->max_ticks);
+
+        if (env->done[i])
+            EnvStart(env, i);
+    }
+
+    return;
+}
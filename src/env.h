@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glib.h>
+#include "tetris.h"
+#include "batch.h"
+
+/*
+ * A vectorized environment for training bots: n headless games on one
+ * BATCH, all stepped at once.  EnvStep() takes one action per game,
+ * plays a tick of every game, and leaves the score each game gained in
+ * reward[] and whether its episode ended in done[].  A game that ends
+ * starts over on its next seed right away, so the batch never has
+ * holes and every game can be stepped again.  Seeds only depend on the
+ * game and its episode count, and a step only touches the games in
+ * [lo, hi), so disjoint ranges may be stepped from different threads.
+ *
+ * Nothing is allocated after EnvAlloc(): the observations are the
+ * BATCH's own arrays (field, x, y, rot, shape, score, ...), which never
+ * move since the batch never grows, and can be handed out as they are
+ * (see env_python.c).
+ */
+
+#define ENV_NONE        0xFF    // an action that does nothing
+
+typedef struct _ENV {
+    BATCH* batch;
+    int n;
+    guint64 seed;
+    guint32* episode;       // episodes each game has started
+    unsigned long max_ticks; // an episode is cut off after, 0 for never
+
+    gint32* reward;         // score gained on the last step
+    guint8* done;           // the last step ended the game's episode
+    gint32* last;           // score before the last step
+} ENV;
+
+ENV* EnvAlloc(const STATE* settings, int n, guint64 seed, unsigned long max_ticks);
+void EnvFree(ENV*);
+
+void EnvReset(ENV*);
+void EnvStep(ENV*, const guint8* actions, int lo, int hi);
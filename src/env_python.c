@@ -0,0 +1,388 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The ntetris_env Python module: an ENV (see env.h) as ntetris_env.Env.
+ *
+ *     import numpy as np, ntetris_env
+ *     env = ntetris_env.Env(4096, seed=1)
+ *     field = np.asarray(env.field)       # (n, height, width) int8
+ *     actions = np.zeros(env.n, np.uint8)
+ *     while True:
+ *         actions[:] = policy(field, np.asarray(env.shape), ...)
+ *         env.step(actions)
+ *         learn(np.asarray(env.reward), np.asarray(env.done))
+ *
+ * Every array the Env hands out is a read-only view of the engine's own
+ * memory: take it once, and step() writes into it in place, so nothing
+ * is allocated, copied or converted from one step to the next.  NumPy is
+ * not needed to build this: the views are plain buffers, which
+ * np.asarray() wraps without a copy.
+ *
+ * step() lets go of the GIL, and step(actions, lo, hi) only plays the
+ * games in [lo, hi), so threads may step disjoint ranges of one Env.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "batch.h"
+#include "env.h"
+
+enum {
+    ENV_FIELD = 0,
+    ENV_X,
+    ENV_Y,
+    ENV_ROT,
+    ENV_SHAPE,
+    ENV_SCORE,
+    ENV_LINES,
+    ENV_LEVEL,
+    ENV_PIECES,
+    ENV_TICKS,
+    ENV_OVER,
+    ENV_REWARD,
+    ENV_DONE
+};
+
+typedef struct _ENV_OBJECT {
+    PyObject_HEAD
+    ENV* env;
+} ENV_OBJECT;
+
+// what a memoryview holds on to: a piece of the ENV, and the Env it is of
+typedef struct _ENV_ARRAY {
+    PyObject_HEAD
+    PyObject* owner;
+    void* data;
+    const char* format;
+    Py_ssize_t itemsize;
+    int ndim;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+} ENV_ARRAY;
+
+static PyTypeObject EnvArrayType;
+
+static int EnvArrayBuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    ENV_ARRAY* array = (ENV_ARRAY*)self;
+    int X;
+
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "the game's state is read-only");
+        return -1;
+    }
+
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = array->data;
+    view->readonly = 1;
+    view->itemsize = array->itemsize;
+    view->format = flags & PyBUF_FORMAT ? (char*)array->format : NULL;
+    view->ndim = array->ndim;
+    view->shape = flags & PyBUF_ND ? array->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? array->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    view->len = array->itemsize;
+    for (X = 0; X < array->ndim; X++)
+        view->len *= array->shape[X];
+
+    return 0;
+}
+
+static void EnvArrayDealloc(PyObject* self)
+{
+    Py_XDECREF(((ENV_ARRAY*)self)->owner);
+    Py_TYPE(self)->tp_free(self);
+
+    return;
+}
+
+static PyBufferProcs env_array_buffer = {
+    EnvArrayBuffer,
+    NULL
+};
+
+static PyTypeObject EnvArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ntetris_env.EnvArray",
+    .tp_basicsize = sizeof(ENV_ARRAY),
+    .tp_dealloc = EnvArrayDealloc,
+    .tp_as_buffer = &env_array_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A read-only view of one of an Env's arrays.",
+};
+
+static PyObject* EnvView(ENV_OBJECT* self, int which)
+{
+    BATCH* batch = self->env->batch;
+    ENV_ARRAY* array;
+    PyObject* view;
+    int X;
+
+    array = PyObject_New(ENV_ARRAY, &EnvArrayType);
+    if (! array)
+        return NULL;
+
+    array->owner = (PyObject*)self;
+    Py_INCREF(self);
+    array->ndim = 1;
+    array->shape[0] = self->env->n;
+    array->format = "i";
+    array->itemsize = sizeof(gint32);
+
+    switch (which) {
+        case ENV_FIELD:
+            array->data = batch->field;
+            array->format = "b";
+            array->itemsize = 1;
+            array->ndim = 3;
+            array->shape[1] = batch->By;
+            array->shape[2] = batch->Bx;
+            break;
+        case ENV_X:         array->data = batch->x; break;
+        case ENV_Y:         array->data = batch->y; break;
+        case ENV_ROT:       array->data = batch->rot; break;
+        case ENV_SHAPE:     array->data = batch->shape; break;
+        case ENV_SCORE:     array->data = batch->score; break;
+        case ENV_LINES:     array->data = batch->lines; break;
+        case ENV_LEVEL:     array->data = batch->level; break;
+        case ENV_PIECES:    array->data = batch->pieces; break;
+        case ENV_OVER:      array->data = batch->over; break;
+        case ENV_REWARD:    array->data = self->env->reward; break;
+        case ENV_TICKS:
+            array->data = batch->ticks;
+            array->format = "Q";
+            array->itemsize = sizeof(guint64);
+            break;
+        case ENV_DONE:
+            array->data = self->env->done;
+            array->format = "B";
+            array->itemsize = 1;
+            break;
+    }
+
+    // C order
+    array->strides[array->ndim - 1] = array->itemsize;
+    for (X = array->ndim - 2; X >= 0; X--)
+        array->strides[X] = array->strides[X + 1] * array->shape[X + 1];
+
+    // the view keeps the array alive, and the array the Env
+    view = PyMemoryView_FromObject((PyObject*)array);
+    Py_DECREF(array);
+
+    return view;
+}
+
+static int EnvInit(PyObject* object, PyObject* args, PyObject* kwargs)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+    STATE* settings;
+    int n, width = TETRIS_STD_WIDTH, height = TETRIS_STD_HEIGHT, level = 0;
+    unsigned long long seed = 0;
+    unsigned long max_ticks = 0;
+
+    static char* keywords[] = { "n", "seed", "width", "height", "level",
+        "max_ticks", NULL };
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwargs, "i|Kiiik", keywords,
+                &n, &seed, &width, &height, &level, &max_ticks))
+        return -1;
+
+    if (self->env) {
+        PyErr_SetString(PyExc_RuntimeError, "Env is already set up");
+        return -1;
+    }
+    if (n < 1) {
+        PyErr_SetString(PyExc_ValueError, "n must be at least 1");
+        return -1;
+    }
+
+    settings = GameAlloc();
+    if (! settings) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    settings->Bx = width;
+    settings->By = height;
+    settings->init_level = level;
+
+    self->env = EnvAlloc(settings, n, seed, max_ticks);
+    GameFree(settings);
+
+    if (! self->env) {
+        PyErr_Format(PyExc_ValueError, "no %dx%d game is possible", width, height);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void EnvDealloc(PyObject* object)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+
+    if (self->env)
+        EnvFree(self->env);
+    Py_TYPE(object)->tp_free(object);
+
+    return;
+}
+
+static int EnvReady(ENV_OBJECT* self)
+{
+    if (! self->env)
+        PyErr_SetString(PyExc_RuntimeError, "Env.__init__() was not called");
+
+    return self->env != NULL;
+}
+
+static PyObject* EnvPyReset(PyObject* object, PyObject* unused)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+
+    if (! EnvReady(self))
+        return NULL;
+
+    EnvReset(self->env);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* EnvPyStep(PyObject* object, PyObject* args)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+    Py_buffer actions;
+    int lo = 0, hi = -1;
+
+    if (! EnvReady(self) || ! PyArg_ParseTuple(args, "y*|ii", &actions, &lo, &hi))
+        return NULL;
+
+    if (hi < 0)
+        hi = self->env->n;
+    if (actions.len != self->env->n || lo < 0 || lo > hi || hi > self->env->n) {
+        PyBuffer_Release(&actions);
+        PyErr_Format(PyExc_ValueError, "need %d actions and 0 <= lo <= hi <= %d",
+                self->env->n, self->env->n);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    EnvStep(self->env, actions.buf, lo, hi);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&actions);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* EnvGet(PyObject* object, void* closure)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+
+    if (! EnvReady(self))
+        return NULL;
+
+    return EnvView(self, GPOINTER_TO_INT(closure));
+}
+
+static PyObject* EnvGetSize(PyObject* object, void* closure)
+{
+    ENV_OBJECT* self = (ENV_OBJECT*)object;
+    int which = GPOINTER_TO_INT(closure);
+
+    if (! EnvReady(self))
+        return NULL;
+
+    return PyLong_FromLong(which == 0 ? self->env->n :
+            which == 1 ? self->env->batch->Bx : self->env->batch->By);
+}
+
+#define ENV_GETTER(name, which, doc) \
+    { name, EnvGet, NULL, doc, GINT_TO_POINTER(which) }
+
+static PyGetSetDef env_getset[] = {
+    ENV_GETTER("field", ENV_FIELD, "(n, height, width) int8: 0 empty, else shape + 1"),
+    ENV_GETTER("x", ENV_X, "(n,) int32: column of the falling tetrad"),
+    ENV_GETTER("y", ENV_Y, "(n,) int32: row of the falling tetrad"),
+    ENV_GETTER("rot", ENV_ROT, "(n,) int32: rotation of the falling tetrad"),
+    ENV_GETTER("shape", ENV_SHAPE, "(n,) int32: shape of the falling tetrad"),
+    ENV_GETTER("score", ENV_SCORE, "(n,) int32"),
+    ENV_GETTER("lines", ENV_LINES, "(n,) int32"),
+    ENV_GETTER("level", ENV_LEVEL, "(n,) int32"),
+    ENV_GETTER("pieces", ENV_PIECES, "(n,) int32"),
+    ENV_GETTER("ticks", ENV_TICKS, "(n,) uint64: ticks into the episode"),
+    ENV_GETTER("over", ENV_OVER, "(n,) int32"),
+    ENV_GETTER("reward", ENV_REWARD, "(n,) int32: score gained on the last step"),
+    ENV_GETTER("done", ENV_DONE, "(n,) uint8: the last step ended the episode, "
+            "and the game has started over"),
+    { "n", EnvGetSize, NULL, "number of games", GINT_TO_POINTER(0) },
+    { "width", EnvGetSize, NULL, "field width", GINT_TO_POINTER(1) },
+    { "height", EnvGetSize, NULL, "field height", GINT_TO_POINTER(2) },
+    { NULL }
+};
+
+#undef ENV_GETTER
+
+static PyMethodDef env_methods[] = {
+    { "reset", EnvPyReset, METH_NOARGS,
+        "reset()\n\nStart a new episode in every game." },
+    { "step", EnvPyStep, METH_VARARGS,
+        "step(actions, lo=0, hi=n)\n\n"
+        "Play one tick of the games in [lo, hi).  actions is any buffer of n\n"
+        "bytes (a uint8 array, say): 0 quit, 1 drop, 2 lower, 3 rotate cw,\n"
+        "4 rotate ccw, 5 left, 6 right, anything else nothing." },
+    { NULL }
+};
+
+static PyTypeObject EnvType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "ntetris_env.Env",
+    .tp_basicsize = sizeof(ENV_OBJECT),
+    .tp_dealloc = EnvDealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Env(n, seed=0, width=10, height=20, level=0, max_ticks=0)\n\n"
+        "n headless games, stepped together.",
+    .tp_methods = env_methods,
+    .tp_getset = env_getset,
+    .tp_init = EnvInit,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef env_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "ntetris_env",
+    .m_doc = "Batched ntetris games for training bots.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_ntetris_env(void)
+{
+    PyObject* module;
+
+    if (PyType_Ready(&EnvArrayType) < 0 || PyType_Ready(&EnvType) < 0)
+        return NULL;
+
+    RowInit();
+
+    module = PyModule_Create(&env_module);
+    if (! module)
+        return NULL;
+
+    Py_INCREF(&EnvType);
+    if (PyModule_AddObject(module, "Env", (PyObject*)&EnvType) < 0) {
+        Py_DECREF(&EnvType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
@@ -0,0 +1,104 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "field.h"
+
+FIELD* FieldAlloc(int Bx, int By)
+{
+    FIELD* field;
+    int Y;
+
+    field = g_new0(FIELD, 1);
+    field->Bx = Bx;
+    field->By = By;
+    field->top = By;
+
+    field->rows = g_new(char*, By);
+    field->empty = g_malloc0(Bx);
+    field->spare = g_new(char*, By);
+    field->chunks = g_new0(char*, (By + FIELD_CHUNK_ROWS - 1) / FIELD_CHUNK_ROWS);
+
+    for (Y = 0; Y < By; Y++)
+        field->rows[Y] = field->empty;
+
+    return field;
+}
+
+void FieldFree(FIELD* field)
+{
+    int X;
+
+    for (X = 0; X < field->nchunks; X++)
+        g_free(field->chunks[X]);
+
+    g_free(field->chunks);
+    g_free(field->spare);
+    g_free(field->empty);
+    g_free(field->rows);
+    g_free(field);
+
+    return;
+}
+
+void FieldClear(FIELD* field)
+{
+    int Y;
+
+    for (Y = field->top; Y < field->By; Y++)
+        FieldRelease(field, Y);
+    field->top = field->By;
+
+    return;
+}
+
+static void FieldGrow(FIELD* field)
+{
+    char* chunk;
+    int X, n;
+
+    // there is never more than By rows in use, so
+    // the last chunk only holds the rows that are left
+    n = MIN(field->By - field->nchunks * FIELD_CHUNK_ROWS, FIELD_CHUNK_ROWS);
+
+    chunk = g_malloc((size_t)n * field->Bx);
+    field->chunks[field->nchunks++] = chunk;
+    for (X = 0; X < n; X++)
+        field->spare[field->nspare++] = chunk + (size_t)X * field->Bx;
+
+    return;
+}
+
+char* FieldWrite(FIELD* field, int y)
+{
+    char* row = field->rows[y];
+
+    if (row == field->empty) {
+        if (! field->nspare)
+            FieldGrow(field);
+
+        // rows are zeroed when they are taken, not when they are let go
+        row = field->spare[--field->nspare];
+        memset(row, 0, field->Bx);
+        field->rows[y] = row;
+    }
+
+    if (y < field->top)
+        field->top = y;
+
+    return row;
+}
+
+void FieldRelease(FIELD* field, int y)
+{
+    if (field->rows[y] != field->empty) {
+        field->spare[field->nspare++] = field->rows[y];
+        field->rows[y] = field->empty;
+    }
+
+    return;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Sparse playfield storage.  The field is a table of By row pointers;
+ * a row that has not been written since the last FieldClear() points
+ * at one shared row of zeroes, and a row buffer is only taken, from
+ * chunks of FIELD_CHUNK_ROWS rows allocated on demand, by the first
+ * FieldWrite() to that row.  A huge, mostly empty board costs memory
+ * for its occupied rows only.
+ *
+ * Rows are reached through field->rows, so moving rows (line clears)
+ * moves pointers, and clearing the field hands back the rows from
+ * field->top down, the only ones that can be occupied.
+ */
+
+#define FIELD_CHUNK_ROWS    16
+
+typedef struct _FIELD {
+    int Bx, By;
+    int top;            // no row above this one is occupied
+
+    char** rows;        // By rows, read only unless taken by FieldWrite()
+    char* empty;        // Bx zeroes, shared by every empty row
+
+    char** spare;       // row buffers not in use
+    int nspare;
+    char** chunks;      // where the row buffers came from
+    int nchunks;
+} FIELD;
+
+#define FieldRow(field, y)          ((const char*)(field)->rows[y])
+#define FieldCell(field, x, y)      ((field)->rows[y][x])
+
+FIELD* FieldAlloc(int Bx, int By);
+void FieldFree(FIELD*);
+void FieldClear(FIELD*);
+
+char* FieldWrite(FIELD*, int y);
+void FieldRelease(FIELD*, int y);
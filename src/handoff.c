@@ -0,0 +1,522 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "tetris.h"
+#include "room.h"
+#include "session.h"
+#include "journal.h"
+#include "lobby.h"
+#include "handoff.h"
+
+#define HANDOFF_LAYOUT  ((guint32)((((sizeof(SESSION) * 31 + sizeof(CHANNEL_MESSAGE)) * 31 + \
+                sizeof(ROOM_LOCKSTEP)) * 31 + sizeof(HANDOFF_ROOM)) * 31 + sizeof(HANDOFF_WAITING)))
+
+typedef struct _HANDOFF_READER {
+    const guint8* data;
+    gsize size;
+    gsize offset;
+} HANDOFF_READER;
+
+static const void* HandoffTake(HANDOFF_READER* reader, gsize size)
+{
+    const void* p = reader->data + reader->offset;
+
+    if (size > reader->size - reader->offset)
+        return NULL;
+    reader->offset += size;
+
+    return p;
+}
+
+static int HandoffGet(HANDOFF_READER* reader, void* out, gsize size)
+{
+    const void* p = HandoffTake(reader, size);
+
+    if (! p)
+        return 0;
+    memcpy(out, p, size);
+
+    return 1;
+}
+
+static int HandoffWrite(int fd, const void* data, size_t n)
+{
+    const char* p = (const char*)data;
+    ssize_t ret;
+
+    while (n) {
+        // a new server that went away is no reason for a SIGPIPE
+        ret = send(fd, p, n, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        p += ret;
+        n -= ret;
+    }
+
+    return 1;
+}
+
+static int HandoffRead(int fd, void* data, size_t n)
+{
+    char* p = (char*)data;
+    ssize_t ret;
+
+    while (n) {
+        ret = read(fd, p, n);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        p += ret;
+        n -= ret;
+    }
+
+    return 1;
+}
+
+static int HandoffAddress(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+
+    return g_strlcpy(addr->sun_path, path, sizeof(addr->sun_path)) < sizeof(addr->sun_path);
+}
+
+int HandoffListen(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (! HandoffAddress(&addr, path))
+        return -1;
+
+    // whoever had the path before is done with it by now
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int HandoffConnect(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (! HandoffAddress(&addr, path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    // nobody there, or a server that died and left the path behind
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static guint32 HandoffRooms(GByteArray* body, ROOMS* rooms)
+{
+    HANDOFF_ROOM entry;
+    GHashTableIter iter;
+    gpointer value;
+    ROOM* room;
+    guint offset;
+    guint32 X, n = 0;
+
+    g_hash_table_iter_init(&iter, rooms->table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        room = (ROOM*)value;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.id = room->id;
+        entry.players = room->players;
+        g_strlcpy(entry.name, room->name, sizeof(entry.name));
+        entry.seed = room->seed;
+        entry.tick = room->tick;
+        entry.mode = room->mode;
+        entry.lockstep = room->lockstep != NULL;
+        entry.nwatchers = room->nwatchers;
+        memcpy(entry.watchers, room->watchers, sizeof(entry.watchers));
+        entry.update = room->update;
+        entry.size = RoomSnapSize(room);
+
+        // between ticks, everything from tail on is for the next one
+        for (X = room->tail; X != room->head; X++)
+            entry.pending[entry.queued++] = room->pending[X % (2 * ROOM_PENDING)];
+
+        g_byte_array_append(body, (const guint8*)&entry, sizeof(entry));
+        if (room->lockstep)
+            g_byte_array_append(body, (const guint8*)room->lockstep, sizeof(ROOM_LOCKSTEP));
+
+        offset = body->len;
+        g_byte_array_set_size(body, offset + entry.size);
+        RoomSnapSave(room, body->data + offset, entry.size);
+        n ++;
+    }
+
+    return n;
+}
+
+static guint32 HandoffSessions(GByteArray* body, SESSIONS* sessions)
+{
+    const SESSION* session;
+    const CHANNEL_MESSAGE* message;
+    guint32 index, count, n = 0;
+    GList* link;
+
+    // oldest first, so that they come back in the same order
+    for (index = sessions->oldest; index != SESSION_NONE; index = session->next) {
+        session = &sessions->pool[index];
+        if (session->key.family == AF_UNIX)
+            continue;
+
+        count = session->channel.unacked ? g_queue_get_length(session->channel.unacked) : 0;
+        g_byte_array_append(body, (const guint8*)session, sizeof(SESSION));
+        g_byte_array_append(body, (const guint8*)&count, sizeof(count));
+
+        for (link = count ? session->channel.unacked->head : NULL; link; link = link->next) {
+            message = (const CHANNEL_MESSAGE*)link->data;
+
+            // the data starts inside the header's tail padding, so it
+            // goes after the whole header, where the new server reads it
+            g_byte_array_append(body, (const guint8*)message, sizeof(CHANNEL_MESSAGE));
+            g_byte_array_append(body, message->data, message->length);
+        }
+        n ++;
+    }
+
+    return n;
+}
+
+static guint32 HandoffQueue(GByteArray* body, LOBBY* lobby, const LOBBY_QUEUE* queue)
+{
+    HANDOFF_WAITING waiting;
+    const LOBBY_ENTRY* entry;
+    guint32 index, n = 0;
+
+    for (index = queue->head; index != LOBBY_NONE; index = entry->next) {
+        entry = &lobby->entries[index];
+
+        memset(&waiting, 0, sizeof(waiting));
+        waiting.token = entry->token;
+        waiting.since = entry->since;
+        waiting.players = queue->players;
+        waiting.mode = queue->mode;
+        waiting.band = queue->band;
+        g_strlcpy(waiting.name, queue->name ? queue->name : "", sizeof(waiting.name));
+        g_byte_array_append(body, (const guint8*)&waiting, sizeof(waiting));
+        n ++;
+    }
+
+    return n;
+}
+
+static guint32 HandoffLobby(GByteArray* body, LOBBY* lobby)
+{
+    GHashTableIter iter;
+    gpointer value;
+    int mode, players, band;
+    guint32 n = 0;
+
+    for (mode = 0; mode < 2; mode++)
+        for (players = 0; players <= LOBBY_PLAYERS; players++)
+            for (band = 0; band < LOBBY_BANDS; band++)
+                n += HandoffQueue(body, lobby, &lobby->bands[mode][players][band]);
+
+    g_hash_table_iter_init(&iter, lobby->names);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        n += HandoffQueue(body, lobby, (const LOBBY_QUEUE*)value);
+
+    return n;
+}
+
+int HandoffSend(int fd, const int* fds, int nfds, ROOMS* rooms, SESSIONS* sessions,
+        LOBBY* lobby, JOURNAL* journal)
+{
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct cmsghdr* cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    HANDOFF_HEADER header;
+    GByteArray* body;
+    guint32 length;
+    ssize_t ret;
+    char ack;
+    int X, ok;
+
+    if (nfds < 1 || nfds > HANDOFF_FDS)
+        return 0;
+
+    body = g_byte_array_new();
+
+    memset(&header, 0, sizeof(header));
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.nfds = nfds;
+    header.layout = HANDOFF_LAYOUT;
+    header.tick = rooms->tick;
+    header.next_id = rooms->next_id;
+    header.nrooms = HandoffRooms(body, rooms);
+    header.nsessions = HandoffSessions(body, sessions);
+    header.nwaiting = HandoffLobby(body, lobby);
+
+    // accepted since the last commit, and so for the next tick: the
+    // new server commits them along with whatever it accepts itself
+    if (journal) {
+        header.nshards = journal->nshards;
+        header.checkpoint = journal->checkpoint;
+        header.next_shard = journal->next;
+        for (X = 0; X < journal->nshards; X++) {
+            length = journal->shards[X].batch->len;
+            g_byte_array_append(body, (const guint8*)&length, sizeof(length));
+            g_byte_array_append(body, journal->shards[X].batch->data, length);
+        }
+    }
+    header.size = body->len;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    do {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+
+    // the sockets went with the first byte, the rest of the header may lag
+    ok = ret > 0 && HandoffWrite(fd, (char*)&header + ret, sizeof(header) - ret) &&
+        HandoffWrite(fd, body->data, body->len) &&
+        HandoffRead(fd, &ack, 1) && ack == 1;
+
+    g_byte_array_free(body, TRUE);
+
+    return ok;
+}
+
+static int HandoffRestoreRooms(HANDOFF_READER* reader, guint32 n, ROOMS* rooms)
+{
+    HANDOFF_ROOM entry;
+    const void* snap;
+    ROOM* room;
+    guint32 X, Y;
+
+    for (X = 0; X < n; X++) {
+        if (! HandoffGet(reader, &entry, sizeof(entry)) || entry.queued > ROOM_PENDING ||
+                entry.nwatchers > ROOM_WATCHERS)
+            return 0;
+        entry.name[ROOM_NAME_MAX] = '\0';
+
+        room = RoomCreate(rooms, entry.id, entry.seed, entry.players, entry.name);
+        if (! room)
+            return 0;
+
+        room->mode = entry.mode;
+        if (entry.lockstep) {
+            room->lockstep = g_new(ROOM_LOCKSTEP, 1);
+            if (! HandoffGet(reader, room->lockstep, sizeof(ROOM_LOCKSTEP)))
+                return 0;
+        }
+
+        snap = HandoffTake(reader, entry.size);
+        if (! snap || ! RoomSnapLoad(room, snap, entry.size))
+            return 0;
+
+        room->tick = entry.tick;
+        room->update = entry.update;
+        room->nwatchers = entry.nwatchers;
+        memcpy(room->watchers, entry.watchers, sizeof(room->watchers));
+        for (Y = 0; Y < entry.queued; Y++)
+            RoomAction(room, entry.pending[Y]);
+    }
+
+    return 1;
+}
+
+static int HandoffRestoreSessions(HANDOFF_READER* reader, guint32 n, SESSIONS* sessions)
+{
+    CHANNEL_MESSAGE header;
+    CHANNEL_MESSAGE* message;
+    SESSION saved;
+    SESSION* session;
+    guint32 X, Y, count;
+
+    for (X = 0; X < n; X++) {
+        if (! HandoffGet(reader, &saved, sizeof(saved)) ||
+                ! HandoffGet(reader, &count, sizeof(count)))
+            return 0;
+        saved.name[SESSION_NAME_MAX] = '\0';
+
+        // one that no longer fits has to register again
+        session = SessionRestore(sessions, &saved);
+
+        for (Y = 0; Y < count; Y++) {
+            if (! HandoffGet(reader, &header, sizeof(header)) ||
+                    header.length > reader->size - reader->offset)
+                return 0;
+
+            message = g_malloc(sizeof(CHANNEL_MESSAGE) + header.length);
+            *message = header;
+            HandoffGet(reader, message->data, header.length);
+
+            if (! session) {
+                g_free(message);
+                continue;
+            }
+            if (! session->channel.unacked)
+                session->channel.unacked = g_queue_new();
+            g_queue_push_tail(session->channel.unacked, message);
+        }
+    }
+
+    SessionsRelink(sessions);
+
+    return 1;
+}
+
+static int HandoffRestoreJournal(HANDOFF_READER* reader, guint32 nshards, JOURNAL* journal)
+{
+    const void* records;
+    guint32 X, length;
+
+    // the same shards or none at all, or rooms would end up in two
+    if (journal && nshards && nshards != (guint32)journal->nshards)
+        return 0;
+
+    for (X = 0; X < nshards; X++) {
+        if (! HandoffGet(reader, &length, sizeof(length)) ||
+                ! (records = HandoffTake(reader, length)))
+            return 0;
+        if (journal)
+            g_byte_array_append(journal->shards[X].batch, records, length);
+    }
+
+    return 1;
+}
+
+static int HandoffRestoreLobby(HANDOFF_READER* reader, guint32 n, LOBBY* lobby)
+{
+    HANDOFF_WAITING waiting;
+    guint32 X;
+
+    // whoever did not make it over is dropped at its turn, as ever
+    for (X = 0; X < n; X++) {
+        if (! HandoffGet(reader, &waiting, sizeof(waiting)))
+            return 0;
+        waiting.name[ROOM_NAME_MAX] = '\0';
+
+        LobbyJoin(lobby, waiting.token, waiting.players, waiting.mode, waiting.band,
+                waiting.name, waiting.since);
+    }
+
+    return 1;
+}
+
+int HandoffReceive(int fd, int* fds, int* nfds, ROOMS* rooms, SESSIONS* sessions,
+        LOBBY* lobby, JOURNAL* journal)
+{
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * HANDOFF_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct cmsghdr* cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    HANDOFF_HEADER header;
+    HANDOFF_READER reader;
+    guint8* body;
+    ssize_t ret;
+    char ack = 1;
+    int ok;
+
+    *nfds = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    do {
+        ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0)
+        return 0;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *nfds);
+        }
+    }
+
+    if (! HandoffRead(fd, (char*)&header + ret, sizeof(header) - ret) ||
+            header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION ||
+            header.layout != HANDOFF_LAYOUT || header.nfds != (guint32)*nfds ||
+            ! *nfds || (msg.msg_flags & MSG_CTRUNC))
+        return 0;
+
+    body = g_malloc(header.size ? header.size : 1);
+    if (! HandoffRead(fd, body, header.size)) {
+        g_free(body);
+        return 0;
+    }
+
+    reader.data = body;
+    reader.size = header.size;
+    reader.offset = 0;
+
+    rooms->tick = header.tick;
+    ok = HandoffRestoreRooms(&reader, header.nrooms, rooms) &&
+        HandoffRestoreSessions(&reader, header.nsessions, sessions) &&
+        HandoffRestoreLobby(&reader, header.nwaiting, lobby) &&
+        HandoffRestoreJournal(&reader, header.nshards, journal);
+    rooms->next_id = MAX(rooms->next_id, header.next_id);
+    if (journal) {
+        journal->checkpoint = header.nshards ? header.checkpoint : header.tick;
+        journal->next = header.next_shard < header.nshards ? header.next_shard : 0;
+    }
+
+    g_free(body);
+
+    // only now may the old server go
+    return ok && HandoffWrite(fd, &ack, 1);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glib.h>
+#include "room.h"
+#include "session.h"
+#include "journal.h"
+#include "lobby.h"
+
+/*
+ * Hot restart.  A server started with the --handoff path of a running
+ * one takes its place instead of starting afresh: it connects to the
+ * old server's handoff socket, and the old server, as soon as its
+ * current tick is done, sends it
+ *
+ *   the bound UDP socket itself, as SCM_RIGHTS
+ *   every room: its game, the actions queued for the next tick, the
+ *       lockstep history and the watchers
+ *   every UDP session with its token, channel and unacked messages
+ *   the sessions waiting in the lobby, in the order they came
+ *   the journal records not yet committed
+ *
+ * The new server acks once it has all of it, and the old one exits.
+ * The socket never closes, so the datagrams that come in meanwhile
+ * wait in it for the new server, which goes on from the next tick as
+ * if it had been there all along.  Should the new server go away
+ * without its ack, the old one carries on.
+ *
+ * Both ends must be the same build, which the header checks as best it
+ * can: sessions go over as they are in memory.  Shared memory clients
+ * are not handed over; they connect again.
+ */
+
+#define HANDOFF_MAGIC       0x4f48544eU     // "NTHO"
+#define HANDOFF_VERSION     2
+#define HANDOFF_FDS         4
+
+typedef struct _HANDOFF_HEADER {
+    guint32 magic;
+    guint32 version;
+    guint32 nfds;           // sockets that came with the header
+    guint32 layout;         // sizes of what goes over as it is in memory
+    guint32 nrooms, nsessions, nshards;
+    guint32 nwaiting;
+    guint32 next_id;
+    guint32 next_shard;     // of the journal's checkpoint round
+    guint64 tick;
+    guint64 checkpoint;     // of the journal, if any
+    guint64 size;           // of the body that follows
+} HANDOFF_HEADER;
+
+typedef struct _HANDOFF_ROOM {
+    guint32 id;
+    guint32 players;
+    char name[ROOM_NAME_MAX + 1];
+    guint64 seed;
+    guint64 tick;
+    guint32 mode;
+    guint32 lockstep;       // a ROOM_LOCKSTEP follows
+    guint32 queued;         // actions for the next tick, in pending
+    guint32 nwatchers;
+    guint32 size;           // of the game snapshot that follows
+    guint8 pending[ROOM_PENDING];
+    guint64 watchers[ROOM_WATCHERS];
+    msg_update_client_state update;
+} HANDOFF_ROOM;
+
+typedef struct _HANDOFF_WAITING {
+    guint64 token;
+    guint64 since;
+    guint32 players;
+    guint32 mode;
+    guint32 band;
+    char name[ROOM_NAME_MAX + 1];
+} HANDOFF_WAITING;
+
+int HandoffListen(const char* path);
+int HandoffConnect(const char* path);
+
+int HandoffSend(int fd, const int* fds, int nfds, ROOMS*, SESSIONS*, LOBBY*, JOURNAL*);
+int HandoffReceive(int fd, int* fds, int* nfds, ROOMS*, SESSIONS*, LOBBY*, JOURNAL*);
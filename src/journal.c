@@ -0,0 +1,567 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+#include "tetris.h"
+#include "room.h"
+#include "journal.h"
+
+#define JOURNAL_RECORD_MAX  4096    // longest payload a valid log can hold
+#define JOURNAL_ALIGN(n)    (((n) + 7) & ~(size_t)7)
+
+static guint32 JournalSum(const void* data, size_t n)
+{
+    // FNV-1a, enough to tell a torn write from a record
+    const unsigned char* p = (const unsigned char*)data;
+    guint32 sum = 2166136261U;
+    size_t X;
+
+    for (X = 0; X < n; X++) {
+        sum ^= p[X];
+        sum *= 16777619U;
+    }
+
+    return sum;
+}
+
+static int JournalWrite(int fd, const void* data, size_t n)
+{
+    const char* p = (const char*)data;
+    ssize_t ret;
+
+    while (n) {
+        ret = write(fd, p, n);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return 0;
+        p += ret;
+        n -= ret;
+    }
+
+    return 1;
+}
+
+static void JournalAppend(SHARD* shard, int type, guint32 room, guint64 tick,
+        const void* payload, guint32 length)
+{
+    JOURNAL_RECORD* record;
+    guint offset = shard->batch->len;
+
+    // padded out so that the next record's tick is aligned as well
+    g_byte_array_set_size(shard->batch, offset + sizeof(JOURNAL_RECORD) + JOURNAL_ALIGN(length));
+    record = (JOURNAL_RECORD*)(shard->batch->data + offset);
+    memset(record, 0, sizeof(JOURNAL_RECORD) + JOURNAL_ALIGN(length));
+
+    record->length = length;
+    record->type = type;
+    record->room = room;
+    record->tick = tick;
+    if (length)
+        memcpy(record + 1, payload, length);
+
+    // the sum covers everything after itself
+    record->sum = JournalSum(&record->type,
+            sizeof(JOURNAL_RECORD) - G_STRUCT_OFFSET(JOURNAL_RECORD, type) + length);
+
+    return;
+}
+
+static SHARD* JournalShard(JOURNAL* journal, guint32 room)
+{
+    return &journal->shards[room % journal->nshards];
+}
+
+JOURNAL* JournalOpen(const char* dir, int nshards, unsigned long interval)
+{
+    JOURNAL* journal;
+    SHARD* shard;
+    int X;
+
+    if (g_mkdir_with_parents(dir, 0755) < 0)
+        return NULL;
+
+    journal = g_new0(JOURNAL, 1);
+    journal->dir = g_strdup(dir);
+    journal->nshards = nshards;
+    journal->interval = interval;
+    journal->shards = g_new0(SHARD, nshards);
+
+    for (X = 0; X < nshards; X++) {
+        shard = &journal->shards[X];
+        shard->id = X;
+        shard->wal = g_strdup_printf("%s/shard-%d.wal", dir, X);
+        shard->snap = g_strdup_printf("%s/shard-%d.snap", dir, X);
+        shard->batch = g_byte_array_new();
+        shard->sealed = g_byte_array_new();
+
+        shard->fd = open(shard->wal, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (shard->fd < 0) {
+            journal->nshards = X + 1;
+            JournalClose(journal);
+            return NULL;
+        }
+    }
+
+    return journal;
+}
+
+void JournalClose(JOURNAL* journal)
+{
+    SHARD* shard;
+    int X;
+
+    for (X = 0; X < journal->nshards; X++) {
+        shard = &journal->shards[X];
+        if (shard->fd >= 0)
+            close(shard->fd);
+        g_free(shard->wal);
+        g_free(shard->snap);
+        g_byte_array_free(shard->batch, TRUE);
+        g_byte_array_free(shard->sealed, TRUE);
+        if (shard->snapshot)
+            g_byte_array_free(shard->snapshot, TRUE);
+    }
+
+    g_free(journal->shards);
+    g_free(journal->dir);
+    g_free(journal);
+
+    return;
+}
+
+void JournalCreate(JOURNAL* journal, ROOM* room, guint64 tick, guint64 seed)
+{
+    JOURNAL_CREATE_RECORD create;
+
+    memset(&create, 0, sizeof(create));
+    create.seed = seed;
+    create.players = room->players;
+    create.mode = room->mode;
+    create.nwatchers = room->nwatchers;
+    memcpy(create.watchers, room->watchers, sizeof(create.watchers));
+    g_strlcpy(create.name, room->name, sizeof(create.name));
+
+    JournalAppend(JournalShard(journal, room->id), JOURNAL_CREATE, room->id, tick,
+            &create, sizeof(create));
+
+    return;
+}
+
+void JournalAction(JOURNAL* journal, ROOM* room, guint64 tick, int action)
+{
+    JOURNAL_ACTION_RECORD record;
+
+    record.action = action;
+    JournalAppend(JournalShard(journal, room->id), JOURNAL_ACTION, room->id, tick,
+            &record, sizeof(record));
+
+    return;
+}
+
+void JournalRejoin(JOURNAL* journal, ROOM* room, guint64 tick, guint64 watcher, guint64 token)
+{
+    JOURNAL_REJOIN_RECORD record;
+
+    record.watcher = watcher;
+    record.token = token;
+    JournalAppend(JournalShard(journal, room->id), JOURNAL_REJOIN, room->id, tick,
+            &record, sizeof(record));
+
+    return;
+}
+
+void JournalSeal(JOURNAL* journal, guint64 tick)
+{
+    GByteArray* batch;
+    SHARD* shard;
+    int X;
+
+    for (X = 0; X < journal->nshards; X++) {
+        shard = &journal->shards[X];
+        if (! shard->batch->len)
+            continue;
+
+        // the TICK record is what makes the batch count on recovery
+        JournalAppend(shard, JOURNAL_TICK, 0, tick, NULL, 0);
+
+        // the next tick's records go on while this one is written
+        batch = shard->sealed;
+        shard->sealed = shard->batch;
+        shard->batch = batch;
+    }
+
+    return;
+}
+
+static int JournalSync(const char* path)
+{
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    ret = fsync(fd) == 0;
+    close(fd);
+
+    return ret;
+}
+
+static int JournalSnapWrite(JOURNAL* journal, SHARD* shard)
+{
+    GByteArray* buffer = shard->snapshot;
+    char* tmp;
+    int fd, ret;
+
+    // write the new checkpoint beside the old one,
+    // make it durable, then swap it in
+    tmp = g_strdup_printf("%s.tmp", shard->snap);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ret = fd >= 0;
+    if (fd >= 0) {
+        ret = JournalWrite(fd, buffer->data, buffer->len) && fsync(fd) == 0;
+        ret = close(fd) == 0 && ret;
+    }
+    ret = ret && rename(tmp, shard->snap) == 0 && JournalSync(journal->dir);
+    if (! ret)
+        unlink(tmp);
+
+    // only now can the log start over
+    if (ret)
+        ret = ftruncate(shard->fd, 0) == 0 && fdatasync(shard->fd) == 0;
+
+    g_free(tmp);
+    g_byte_array_free(buffer, TRUE);
+    shard->snapshot = NULL;
+
+    return ret;
+}
+
+int JournalFlush(JOURNAL* journal)
+{
+    SHARD* shard;
+    int X, ret = 1;
+
+    for (X = 0; X < journal->nshards; X++) {
+        shard = &journal->shards[X];
+
+        // the checkpoint holds everything the log had so far,
+        // so it goes first, and the new batch into a new log
+        if (shard->snapshot && ! JournalSnapWrite(journal, shard))
+            ret = 0;
+
+        if (! shard->sealed->len)
+            continue;
+
+        if (! JournalWrite(shard->fd, shard->sealed->data, shard->sealed->len) ||
+                fdatasync(shard->fd) < 0)
+            ret = 0;
+
+        g_byte_array_set_size(shard->sealed, 0);
+    }
+
+    return ret;
+}
+
+int JournalCommit(JOURNAL* journal, guint64 tick)
+{
+    JournalSeal(journal, tick);
+
+    return JournalFlush(journal);
+}
+
+static int JournalSnapShard(JOURNAL* journal, SHARD* shard, ROOMS* rooms)
+{
+    GByteArray* buffer;
+    GHashTableIter iter;
+    JOURNAL_SNAP* header;
+    JOURNAL_ROOM* entry;
+    gpointer value;
+    ROOM* room;
+    size_t size;
+    guint offset;
+    int ret = 1;
+
+    buffer = g_byte_array_sized_new(sizeof(JOURNAL_SNAP));
+    g_byte_array_set_size(buffer, sizeof(JOURNAL_SNAP));
+    header = (JOURNAL_SNAP*)buffer->data;
+    memset(header, 0, sizeof(JOURNAL_SNAP));
+    header->magic = JOURNAL_MAGIC;
+    header->version = JOURNAL_VERSION;
+    header->shard = shard->id;
+    header->nshards = journal->nshards;
+    header->tick = rooms->tick;
+    header->next_id = rooms->next_id;
+
+    g_hash_table_iter_init(&iter, rooms->table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        room = (ROOM*)value;
+        if (JournalShard(journal, room->id) != shard)
+            continue;
+
+        size = RoomSnapSize(room);
+        offset = buffer->len;
+        g_byte_array_set_size(buffer,
+                offset + sizeof(JOURNAL_ROOM) + JOURNAL_ALIGN(size));
+
+        entry = (JOURNAL_ROOM*)(buffer->data + offset);
+        memset(entry, 0, sizeof(JOURNAL_ROOM) + JOURNAL_ALIGN(size));
+        entry->id = room->id;
+        entry->players = room->players;
+        entry->tick = room->tick;
+        entry->size = size;
+        entry->mode = room->mode;
+        entry->nwatchers = room->nwatchers;
+        memcpy(entry->watchers, room->watchers, sizeof(entry->watchers));
+        g_strlcpy(entry->name, room->name, sizeof(entry->name));
+
+        // a room that cannot be saved must not leave the log
+        // as if it had been
+        if (RoomSnapSave(room, entry + 1, size) != size) {
+            ret = 0;
+            break;
+        }
+        ((JOURNAL_SNAP*)buffer->data)->nrooms ++;
+    }
+
+    if (! ret) {
+        g_byte_array_free(buffer, TRUE);
+        return 0;
+    }
+
+    // written by the next JournalFlush(), one not yet written
+    // is as good as the new one
+    if (shard->snapshot)
+        g_byte_array_free(shard->snapshot, TRUE);
+    shard->snapshot = buffer;
+
+    return 1;
+}
+
+int JournalCheckpoint(JOURNAL* journal, ROOMS* rooms)
+{
+    int ret;
+
+    // a round starts every interval, and takes a shard a tick
+    if (! journal->next) {
+        if (rooms->tick - journal->checkpoint < journal->interval)
+            return 1;
+        journal->checkpoint = rooms->tick;
+    }
+
+    ret = JournalSnapShard(journal, &journal->shards[journal->next], rooms);
+    journal->next = (journal->next + 1) % journal->nshards;
+
+    return ret;
+}
+
+typedef struct _JOURNAL_STEP {
+    JOURNAL* journal;
+    SHARD* shard;
+    guint64 tick;
+} JOURNAL_STEP;
+
+static gboolean JournalStepRoom(gpointer key, gpointer value, gpointer data)
+{
+    JOURNAL_STEP* step = (JOURNAL_STEP*)data;
+    ROOM* room = (ROOM*)value;
+
+    if (step->shard && JournalShard(step->journal, room->id) != step->shard)
+        return FALSE;
+
+    while (room->tick < step->tick) {
+        if (! RoomStep(room))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void JournalStep(JOURNAL* journal, SHARD* shard, ROOMS* rooms, guint64 tick)
+{
+    JOURNAL_STEP step = { journal, shard, tick };
+
+    g_hash_table_foreach_remove(rooms->table, JournalStepRoom, &step);
+
+    return;
+}
+
+static guint64 JournalLoad(JOURNAL* journal, SHARD* shard, ROOMS* rooms)
+{
+    const JOURNAL_SNAP* header;
+    const JOURNAL_ROOM* entry;
+    ROOM* room;
+    gchar* data;
+    gsize length, offset;
+    guint64 tick;
+    guint32 X;
+
+    if (! g_file_get_contents(shard->snap, &data, &length, NULL))
+        return 0;
+
+    header = (const JOURNAL_SNAP*)data;
+    if (length < sizeof(JOURNAL_SNAP) || header->magic != JOURNAL_MAGIC ||
+            header->version != JOURNAL_VERSION || header->shard != shard->id ||
+            header->nshards != journal->nshards) {
+        g_free(data);
+        return (guint64)-1;
+    }
+
+    offset = sizeof(JOURNAL_SNAP);
+    for (X = 0; X < header->nrooms; X++) {
+        entry = (const JOURNAL_ROOM*)(data + offset);
+        if (offset + sizeof(JOURNAL_ROOM) > length ||
+                offset + sizeof(JOURNAL_ROOM) + entry->size > length ||
+                entry->nwatchers > ROOM_WATCHERS) {
+            g_free(data);
+            return (guint64)-1;
+        }
+
+        room = RoomCreate(rooms, entry->id, 0, entry->players, entry->name);
+        if (! room || ! RoomSnapLoad(room, entry + 1, entry->size)) {
+            g_free(data);
+            return (guint64)-1;
+        }
+        room->tick = entry->tick;
+        if (entry->mode == ROOM_MODE_LOCKSTEP)
+            RoomLockstep(room);
+        room->nwatchers = entry->nwatchers;
+        memcpy(room->watchers, entry->watchers, sizeof(room->watchers));
+
+        offset += sizeof(JOURNAL_ROOM) + JOURNAL_ALIGN(entry->size);
+    }
+
+    rooms->next_id = MAX(rooms->next_id, header->next_id);
+    tick = header->tick;
+    g_free(data);
+
+    return tick;
+}
+
+static void JournalApply(ROOMS* rooms, const JOURNAL_RECORD* record)
+{
+    const JOURNAL_CREATE_RECORD* create;
+    const JOURNAL_ACTION_RECORD* action;
+    const JOURNAL_REJOIN_RECORD* rejoin;
+    ROOM* room;
+
+    switch (record->type) {
+        case JOURNAL_CREATE:
+            if (record->length < sizeof(JOURNAL_CREATE_RECORD))
+                break;
+            create = (const JOURNAL_CREATE_RECORD*)(record + 1);
+            rooms->tick = record->tick - 1;
+            room = RoomCreate(rooms, record->room, create->seed, create->players, create->name);
+            if (! room)
+                break;
+            if (create->mode == ROOM_MODE_LOCKSTEP)
+                RoomLockstep(room);
+            room->nwatchers = MIN(create->nwatchers, ROOM_WATCHERS);
+            memcpy(room->watchers, create->watchers, sizeof(room->watchers));
+            break;
+        case JOURNAL_ACTION:
+            if (record->length < sizeof(JOURNAL_ACTION_RECORD))
+                break;
+            action = (const JOURNAL_ACTION_RECORD*)(record + 1);
+            if ((room = RoomFind(rooms, record->room)))
+                RoomAction(room, action->action);
+            break;
+        case JOURNAL_REJOIN:
+            if (record->length < sizeof(JOURNAL_REJOIN_RECORD))
+                break;
+            rejoin = (const JOURNAL_REJOIN_RECORD*)(record + 1);
+            if ((room = RoomFind(rooms, record->room)))
+                RoomRejoin(room, rejoin->watcher, rejoin->token);
+            break;
+        default:
+            break;
+    }
+
+    return;
+}
+
+static guint64 JournalReplay(JOURNAL* journal, SHARD* shard, ROOMS* rooms, guint64 since)
+{
+    const JOURNAL_RECORD* record;
+    gchar* data;
+    gsize length, offset = 0, batch = 0, committed = 0, X;
+    guint64 tick = since;
+
+    if (! g_file_get_contents(shard->wal, &data, &length, NULL))
+        return since;
+
+    while (offset + sizeof(JOURNAL_RECORD) <= length) {
+        record = (const JOURNAL_RECORD*)(data + offset);
+        if (record->length > JOURNAL_RECORD_MAX ||
+                offset + sizeof(JOURNAL_RECORD) + JOURNAL_ALIGN(record->length) > length)
+            break;
+        if (record->sum != JournalSum(&record->type, sizeof(JOURNAL_RECORD) -
+                    G_STRUCT_OFFSET(JOURNAL_RECORD, type) + record->length))
+            break;
+
+        offset += sizeof(JOURNAL_RECORD) + JOURNAL_ALIGN(record->length);
+        if (record->type != JOURNAL_TICK)
+            continue;
+
+        // a complete batch: catch up to the tick before it, apply it
+        // and step the shard's rooms through its tick, just like
+        // the live server did
+        if (record->tick > since) {
+            JournalStep(journal, shard, rooms, record->tick - 1);
+            for (X = batch; X < offset - sizeof(JOURNAL_RECORD); ) {
+                const JOURNAL_RECORD* r = (const JOURNAL_RECORD*)(data + X);
+
+                JournalApply(rooms, r);
+                X += sizeof(JOURNAL_RECORD) + JOURNAL_ALIGN(r->length);
+            }
+            JournalStep(journal, shard, rooms, record->tick);
+            tick = record->tick;
+        }
+
+        batch = committed = offset;
+    }
+
+    g_free(data);
+
+    // whatever follows the last complete batch never happened
+    if (committed < length && ftruncate(shard->fd, committed) < 0)
+        return (guint64)-1;
+
+    return tick;
+}
+
+int JournalRecover(JOURNAL* journal, ROOMS* rooms)
+{
+    guint64 since, tick, last = 0;
+    int X;
+
+    for (X = 0; X < journal->nshards; X++) {
+        since = JournalLoad(journal, &journal->shards[X], rooms);
+        if (since == (guint64)-1)
+            return -1;
+
+        tick = JournalReplay(journal, &journal->shards[X], rooms, since);
+        if (tick == (guint64)-1)
+            return -1;
+
+        last = MAX(last, tick);
+        journal->checkpoint = MAX(journal->checkpoint, since);
+    }
+
+    // every room was stepped up to the same tick
+    // before the server went down
+    JournalStep(journal, NULL, rooms, last);
+    rooms->tick = last;
+
+    return g_hash_table_size(rooms->table);
+}
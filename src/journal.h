@@ -0,0 +1,125 @@
+#pragma once
+
+#include <glib.h>
+#include "room.h"
+
+/*
+ * Crash-safe room journal.  Rooms are split over shards by id, and
+ * each shard has a write-ahead log and a checkpoint in the journal
+ * directory:
+ *
+ *   shard-N.wal    room creations, accepted actions and rejoins, as records
+ *   shard-N.snap   every room of the shard at the last checkpoint
+ *
+ * Records for the coming tick are collected in memory and committed at
+ * the start of that tick, before any of them is applied: one write()
+ * and one fsync() per shard, followed by a TICK record that marks the
+ * batch complete.  Every JOURNAL_CHECKPOINT ticks the rooms of each
+ * shard are saved for a new checkpoint, one shard a tick, which the
+ * next commit writes before its batch, and the log starts over.  Every
+ * shard has a checkpoint of its own tick, so shards need not agree on
+ * when theirs was.  The server does the commit on a worker thread, and
+ * steps the tick once it is done.
+ *
+ * Both keep the tokens of the sessions that watch each room, so that
+ * its players can claim it back with REJOIN_ROOM once the server has
+ * come up again under new tokens.
+ *
+ * On startup, JournalRecover() loads each checkpoint and replays the
+ * committed batches of the log on top of it.  A torn or corrupt tail
+ * (a crash in the middle of a commit) ends the replay and is cut off.
+ */
+
+#define JOURNAL_MAGIC       0x4c57544eU     // "NTWL"
+#define JOURNAL_VERSION     2
+#define JOURNAL_CHECKPOINT  600             // ticks, 30 seconds
+
+enum {
+    JOURNAL_CREATE = 1,
+    JOURNAL_ACTION,
+    JOURNAL_TICK,
+    JOURNAL_REJOIN
+};
+
+typedef struct _JOURNAL_RECORD {
+    guint32 length;     // of the payload that follows, padded out to 8 bytes
+    guint32 sum;        // of the rest of the record and the payload
+    guint32 type;
+    guint32 room;
+    guint64 tick;       // the tick the record is applied at
+} JOURNAL_RECORD;
+
+typedef struct _JOURNAL_CREATE_RECORD {
+    guint64 seed;
+    guint32 players;
+    char name[ROOM_NAME_MAX + 1];
+    guint32 mode;       // ROOM_MODE_*, in what used to be padding
+    guint32 nwatchers;
+    guint32 pad;
+    guint64 watchers[ROOM_WATCHERS];
+} JOURNAL_CREATE_RECORD;
+
+typedef struct _JOURNAL_ACTION_RECORD {
+    guint32 action;
+} JOURNAL_ACTION_RECORD;
+
+typedef struct _JOURNAL_REJOIN_RECORD {
+    guint64 watcher;    // the token the room had
+    guint64 token;      // and the one it has now
+} JOURNAL_REJOIN_RECORD;
+
+typedef struct _JOURNAL_SNAP {
+    guint32 magic;
+    guint32 version;
+    guint32 shard, nshards;
+    guint64 tick;       // the checkpoint holds every tick up to this one
+    guint32 next_id;
+    guint32 nrooms;
+} JOURNAL_SNAP;
+
+typedef struct _JOURNAL_ROOM {
+    guint32 id;
+    guint32 players;
+    guint64 tick;
+    char name[ROOM_NAME_MAX + 1];
+    guint32 size;       // of the game snapshot that follows, see snap.h
+    guint32 mode;       // ROOM_MODE_*
+    guint32 nwatchers;
+    guint32 pad;
+    guint64 watchers[ROOM_WATCHERS];
+} JOURNAL_ROOM;
+
+typedef struct _SHARD {
+    int id;
+    int fd;             // the write-ahead log
+    char* wal;
+    char* snap;
+    GByteArray* batch;  // records of the coming tick
+    GByteArray* sealed; // records of the tick being committed
+    GByteArray* snapshot;   // a checkpoint to write, or NULL
+} SHARD;
+
+typedef struct _JOURNAL {
+    char* dir;
+    int nshards;
+    SHARD* shards;
+    unsigned long interval;     // ticks between checkpoints
+    guint64 checkpoint;         // tick the last round of them started
+    int next;                   // shard to checkpoint on the next tick
+} JOURNAL;
+
+JOURNAL* JournalOpen(const char* dir, int nshards, unsigned long interval);
+void JournalClose(JOURNAL*);
+int JournalRecover(JOURNAL*, ROOMS*);
+
+void JournalCreate(JOURNAL*, ROOM*, guint64 tick, guint64 seed);
+void JournalAction(JOURNAL*, ROOM*, guint64 tick, int action);
+void JournalRejoin(JOURNAL*, ROOM*, guint64 tick, guint64 watcher, guint64 token);
+int JournalCommit(JOURNAL*, guint64 tick);
+int JournalCheckpoint(JOURNAL*, ROOMS*);
+
+// JournalCommit() in two: JournalSeal() on the owner's thread, which
+// may then go on journaling the next tick while JournalFlush() does
+// the disk I/O on another; only one of the two runs at a time
+void JournalSeal(JOURNAL*, guint64 tick);
+int JournalFlush(JOURNAL*);
@@ -0,0 +1,356 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * ntetris_load: plays a server with many made-up clients at once, over
+ * UDP or, with --local, the shared memory transport.  Every client
+ * registers, asks for a room of its own and sends random actions until
+ * the time is up, with the reliability layer of channel.h as a real
+ * client would.  The report has the round trips of the registrations
+ * and room creations, the updates the rooms sent back, and the clients
+ * the server never answered.
+ *
+ * Over UDP all clients come from one address, which the server holds
+ * to its --source-rate; a server with the default one is swamped by
+ * more than a hundred or so.  The shared memory transport takes
+ * SHM_SLOTS (256) clients at most.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <poll.h>
+#include <glib.h>
+#include "packet.h"
+#include "channel.h"
+#include "transport.h"
+
+#define LOAD_CLIENTS    50
+#define LOAD_SECONDS    10
+#define LOAD_ACTIONS    5           // a second, per client
+#define LOAD_TICK       50000       // microseconds, as the server's
+
+enum {
+    LOAD_REGISTERING,
+    LOAD_CREATING,
+    LOAD_PLAYING,
+    LOAD_FAILED
+};
+
+typedef struct _LOAD_CLIENT {
+    TRANSPORT* transport;
+    CHANNEL channel;
+    guint64 token;
+    guint32 room;
+    int state;
+    gint64 asked;           // when the request it waits on was queued
+} LOAD_CLIENT;
+
+typedef struct _LOAD_STATS {
+    GArray* registered;     // gint64, round trips in microseconds
+    GArray* created;
+    guint64 sent, received, updates;
+    int failed;
+} LOAD_STATS;
+
+static LOAD_STATS stats;
+static int lockstep;
+
+static void LoadSend(LOAD_CLIENT* client, gint64 now, int type, const void* value,
+        guint16 length)
+{
+    guint64 packet[CHANNEL_PACKET / sizeof(guint64)];
+    size_t room = type < 0 ? CHANNEL_PACKET : CHANNEL_PACKET - sizeof(TLV) - length;
+    size_t size = ChannelWrite(&client->channel, packet, room, client->token, now);
+    TLV* tlv;
+
+    if (type >= 0) {
+        tlv = (TLV*)((char*)packet + size);
+        tlv->type = type;
+        tlv->length = length;
+        memcpy(tlv->value, value, length);
+        size += sizeof(TLV) + length;
+    }
+
+    if (! TransportSend(client->transport, NULL, packet, size))
+        stats.sent ++;
+
+    return;
+}
+
+static void LoadRequest(LOAD_CLIENT* client, gint64 now, guint8 type, const void* value,
+        guint16 length)
+{
+    ChannelQueue(&client->channel, type, value, length);
+    client->asked = now;
+    LoadSend(client, now, -1, NULL, 0);
+
+    return;
+}
+
+static void LoadRegister(LOAD_CLIENT* client, gint64 now)
+{
+    guint8 buffer[sizeof(msg_register_client) + 8];
+    msg_register_client* msg = (msg_register_client*)buffer;
+
+    msg->nameLength = snprintf((char*)msg->name, 8, "load");
+    LoadRequest(client, now, REGISTER_CLIENT, msg, sizeof(msg_register_client) + msg->nameLength);
+
+    return;
+}
+
+static void LoadCreate(LOAD_CLIENT* client, gint64 now)
+{
+    guint8 buffer[sizeof(msg_create_room) + 8];
+    msg_create_room* msg = (msg_create_room*)buffer;
+
+    // a room of its own, which the server makes at once
+    msg->numPlayers = 1;
+    msg->roomNameLen = snprintf((char*)msg->roomName, 6, "load");
+    msg->roomName[msg->roomNameLen] = lockstep ? ROOM_MODE_LOCKSTEP : ROOM_MODE_STATE;
+    LoadRequest(client, now, CREATE_ROOM, msg, sizeof(msg_create_room) + msg->roomNameLen + 1);
+
+    return;
+}
+
+static void LoadReliable(LOAD_CLIENT* client, const TLV* inner, gint64 now)
+{
+    gint64 rtt = now - client->asked;
+
+    if (inner->type == CLIENT_REGISTERED && client->state == LOAD_REGISTERING &&
+            inner->length >= sizeof(msg_client_registered)) {
+        client->token = ((const msg_client_registered*)inner->value)->token;
+        client->state = LOAD_CREATING;
+        g_array_append_val(stats.registered, rtt);
+        LoadCreate(client, now);
+    } else if (inner->type == ROOM_CREATED && client->state == LOAD_CREATING &&
+            inner->length >= sizeof(msg_room_created)) {
+        client->room = ((const msg_room_created*)inner->value)->room;
+        client->state = LOAD_PLAYING;
+        g_array_append_val(stats.created, rtt);
+    }
+
+    return;
+}
+
+static void LoadReceive(TRANSPORT* transport, const void* data, size_t length,
+        const struct sockaddr* from)
+{
+    LOAD_CLIENT* client = (LOAD_CLIENT*)transport->data;
+    const char* packet = (const char*)data;
+    const msg_reliable* reliable;
+    const TLV* tlv;
+    gint64 now = g_get_monotonic_time();
+    size_t offset = sizeof(PACKET_HEADER);
+
+    if (length < sizeof(PACKET_HEADER))
+        return;
+
+    stats.received ++;
+    ChannelReceive(&client->channel, (const PACKET_HEADER*)packet, now);
+
+    while (offset + sizeof(TLV) <= length) {
+        tlv = (const TLV*)(packet + offset);
+        if (offset + sizeof(TLV) + tlv->length > length)
+            break;
+        offset += sizeof(TLV) + tlv->length;
+
+        if (tlv->type == UPDATE_CLIENT_STATE || tlv->type == ROOM_INPUTS) {
+            stats.updates ++;
+            continue;
+        }
+        if (tlv->type != RELIABLE)
+            continue;
+
+        reliable = (const msg_reliable*)tlv->value;
+        if (tlv->length < sizeof(msg_reliable) + sizeof(TLV) ||
+                tlv->length < sizeof(msg_reliable) + sizeof(TLV) + reliable->message->length)
+            continue;
+
+        // copies are only acked
+        if (ChannelAccept(&client->channel, reliable->id))
+            LoadReliable(client, reliable->message, now);
+    }
+
+    return;
+}
+
+static void LoadTick(LOAD_CLIENT* clients, int n, gint64 now)
+{
+    msg_user_action action;
+    LOAD_CLIENT* client;
+    int X;
+
+    for (X = 0; X < n; X++) {
+        client = &clients[X];
+        if (client->state == LOAD_FAILED)
+            continue;
+
+        if (ChannelFailed(&client->channel, now)) {
+            client->state = LOAD_FAILED;
+            stats.failed ++;
+            continue;
+        }
+
+        if (client->state == LOAD_PLAYING &&
+                rand() % (G_USEC_PER_SEC / LOAD_TICK) < LOAD_ACTIONS) {
+            memset(&action, 0, sizeof(action));
+            action.room = client->room;
+            action.cmd = rand() % NUM_CMDS;
+            LoadSend(client, now, USER_ACTION, &action, sizeof(action));
+        } else if (ChannelDue(&client->channel, now)) {
+            LoadSend(client, now, -1, NULL, 0);
+        }
+    }
+
+    return;
+}
+
+static int Compare(const void* a, const void* b)
+{
+    gint64 x = *(const gint64*)a, y = *(const gint64*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void Report(const char* what, GArray* rtts)
+{
+    gint64* rtt = (gint64*)rtts->data;
+    guint n = rtts->len;
+
+    if (! n) {
+        printf("%-10s %7u\n", what, n);
+        return;
+    }
+
+    qsort(rtt, n, sizeof(gint64), Compare);
+    printf("%-10s %7u %9.2f %9.2f %9.2f\n", what, n, rtt[(n - 1) / 2] / 1000.0,
+            rtt[(99 * (n - 1)) / 100] / 1000.0, rtt[n - 1] / 1000.0);
+
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* host = "localhost";
+    const char* local = NULL;
+    LOAD_CLIENT* clients;
+    struct pollfd* fds;
+    gint64 start, now, next;
+    int go_ret, X, n = LOAD_CLIENTS, port = 48879, seconds = LOAD_SECONDS, playing = 0;
+
+    static struct option longopts[] = {
+         { "host",       required_argument,  NULL, 'h' },
+         { "port",       required_argument,  NULL, 'p' },
+         { "local",      required_argument,  NULL, 'l' },
+         { "clients",    required_argument,  NULL, 'n' },
+         { "seconds",    required_argument,  NULL, 't' },
+         { "lockstep",   no_argument,        NULL, 'L' },
+         { NULL,         0,                  NULL, 0 }
+    };
+
+    while ((go_ret = getopt_long(argc, argv, "h:p:l:n:t:L", longopts, NULL)) != -1) {
+        switch (go_ret) {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                if (port < 1 || port > 65535) {
+                    fprintf(stderr, "<ntetris>\tInvalid port: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                local = optarg;
+                break;
+            case 'n':
+                n = atoi(optarg);
+                if (n < 1) {
+                    fprintf(stderr, "<ntetris>\tInvalid number of clients: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                if (seconds < 1) {
+                    fprintf(stderr, "<ntetris>\tInvalid number of seconds: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'L':
+                lockstep = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [--host HOST] [--port PORT | --local PATH] "
+                        "[--clients N] [--seconds N] [--lockstep]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    clients = g_new0(LOAD_CLIENT, n);
+    fds = g_new0(struct pollfd, n);
+    stats.registered = g_array_new(FALSE, FALSE, sizeof(gint64));
+    stats.created = g_array_new(FALSE, FALSE, sizeof(gint64));
+    now = g_get_monotonic_time();
+
+    for (X = 0; X < n; X++) {
+        if (local)
+            clients[X].transport = TransportShmConnect(local, LoadReceive, &clients[X]);
+        else
+            clients[X].transport = TransportUdpConnect(host, port, LoadReceive, &clients[X]);
+        if (! clients[X].transport) {
+            fprintf(stderr, "<ntetris>\tCould not connect client %d to %s.\n", X,
+                    local ? local : host);
+            return 1;
+        }
+
+        ChannelInit(&clients[X].channel);
+        fds[X].fd = clients[X].transport->fd;
+        fds[X].events = POLLIN;
+        LoadRegister(&clients[X], now);
+    }
+
+    start = next = g_get_monotonic_time();
+    while ((now = g_get_monotonic_time()) < start + (gint64)seconds * G_USEC_PER_SEC) {
+        if (now >= next) {
+            LoadTick(clients, n, now);
+            next += LOAD_TICK;
+            continue;
+        }
+
+        if (poll(fds, n, (next - now + 999) / 1000) <= 0)
+            continue;
+
+        for (X = 0; X < n; X++) {
+            if (fds[X].revents & POLLIN)
+                TransportPump(clients[X].transport);
+        }
+    }
+
+    for (X = 0; X < n; X++) {
+        playing += clients[X].state == LOAD_PLAYING;
+        ChannelReset(&clients[X].channel);
+        TransportClose(clients[X].transport);
+    }
+
+    printf("%d clients over %s for %d seconds: %d playing, %d given up\n", n,
+            local ? "shm" : "udp", seconds, playing, stats.failed);
+    printf("%llu packets sent, %llu received, %.1f updates a second per room\n",
+            (unsigned long long)stats.sent, (unsigned long long)stats.received,
+            playing ? (double)stats.updates / seconds / playing : 0.0);
+    printf("%-10s %7s %9s %9s %9s\n", "ms", "n", "p50", "p99", "max");
+    Report("register", stats.registered);
+    Report("create", stats.created);
+
+    g_array_free(stats.registered, TRUE);
+    g_array_free(stats.created, TRUE);
+    g_free(clients);
+    g_free(fds);
+
+    return 0;
+}
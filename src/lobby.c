@@ -0,0 +1,232 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "room.h"
+#include "session.h"
+#include "lobby.h"
+
+static void LobbyQueueInit(LOBBY_QUEUE* queue, int players, int mode, int band)
+{
+    queue->head = queue->tail = LOBBY_NONE;
+    queue->count = 0;
+    queue->players = players;
+    queue->mode = mode;
+    queue->band = band;
+    queue->ready = 0;
+
+    return;
+}
+
+static void LobbyQueueFree(gpointer data)
+{
+    LOBBY_QUEUE* queue = (LOBBY_QUEUE*)data;
+
+    g_free(queue->name);
+    g_free(queue);
+
+    return;
+}
+
+LOBBY* LobbyAlloc(guint32 capacity)
+{
+    LOBBY* lobby;
+    int mode, players, band;
+
+    lobby = g_new0(LOBBY, 1);
+    lobby->entries = g_new0(LOBBY_ENTRY, capacity);
+    lobby->capacity = capacity;
+    lobby->names = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, LobbyQueueFree);
+    lobby->ready = g_ptr_array_new();
+
+    for (mode = 0; mode < 2; mode++)
+        for (players = 0; players <= LOBBY_PLAYERS; players++)
+            for (band = 0; band < LOBBY_BANDS; band++)
+                LobbyQueueInit(&lobby->bands[mode][players][band], players, mode, band);
+
+    return lobby;
+}
+
+void LobbyFree(LOBBY* lobby)
+{
+    g_hash_table_destroy(lobby->names);
+    g_ptr_array_free(lobby->ready, TRUE);
+    g_free(lobby->entries);
+    g_free(lobby);
+
+    return;
+}
+
+static void LobbyLink(LOBBY* lobby, LOBBY_QUEUE* queue, guint32 index, int front)
+{
+    LOBBY_ENTRY* entry = &lobby->entries[index];
+
+    entry->queue = queue;
+    if (front) {
+        entry->prev = LOBBY_NONE;
+        entry->next = queue->head;
+        if (queue->head != LOBBY_NONE)
+            lobby->entries[queue->head].prev = index;
+        else
+            queue->tail = index;
+        queue->head = index;
+    } else {
+        entry->prev = queue->tail;
+        entry->next = LOBBY_NONE;
+        if (queue->tail != LOBBY_NONE)
+            lobby->entries[queue->tail].next = index;
+        else
+            queue->head = index;
+        queue->tail = index;
+    }
+
+    queue->count ++;
+    lobby->count ++;
+
+    // complete: something for the next LobbyMatch()
+    if (queue->count >= (guint32)queue->players && ! queue->ready) {
+        queue->ready = 1;
+        g_ptr_array_add(lobby->ready, queue);
+    }
+
+    return;
+}
+
+static void LobbyUnlink(LOBBY* lobby, LOBBY_ENTRY* entry)
+{
+    LOBBY_QUEUE* queue = entry->queue;
+
+    if (entry->prev != LOBBY_NONE)
+        lobby->entries[entry->prev].next = entry->next;
+    else
+        queue->head = entry->next;
+
+    if (entry->next != LOBBY_NONE)
+        lobby->entries[entry->next].prev = entry->prev;
+    else
+        queue->tail = entry->prev;
+
+    entry->token = 0;
+    entry->queue = NULL;
+    queue->count --;
+    lobby->count --;
+
+    return;
+}
+
+// a name nobody waits for any more goes out of the index
+static void LobbyTidy(LOBBY* lobby, LOBBY_QUEUE* queue)
+{
+    if (queue->name && ! queue->count && ! queue->ready)
+        g_hash_table_remove(lobby->names, queue->name);
+
+    return;
+}
+
+int LobbyJoin(LOBBY* lobby, guint64 token, int players, int mode, int band,
+        const char* name, guint64 since)
+{
+    guint32 index = token & SESSION_INDEX_MASK;
+    LOBBY_QUEUE* queue;
+
+    if (index >= lobby->capacity || players < 2 || players > LOBBY_PLAYERS ||
+            mode < 0 || mode > ROOM_MODE_LOCKSTEP)
+        return 0;
+
+    // asking again takes the place of what was asked before
+    LobbyLeave(lobby, lobby->entries[index].token);
+
+    if (name && *name) {
+        queue = g_hash_table_lookup(lobby->names, name);
+        if (! queue) {
+            // whoever names the room first decides what it plays
+            queue = g_new0(LOBBY_QUEUE, 1);
+            LobbyQueueInit(queue, players, mode, 0);
+            queue->name = g_strndup(name, ROOM_NAME_MAX);
+            g_hash_table_insert(lobby->names, queue->name, queue);
+        }
+    } else {
+        queue = &lobby->bands[mode][players][CLAMP(band, 0, LOBBY_BANDS - 1)];
+    }
+
+    lobby->entries[index].token = token;
+    lobby->entries[index].since = since;
+    LobbyLink(lobby, queue, index, 0);
+
+    return 1;
+}
+
+void LobbyLeave(LOBBY* lobby, guint64 token)
+{
+    guint32 index = token & SESSION_INDEX_MASK;
+    LOBBY_ENTRY* entry;
+    LOBBY_QUEUE* queue;
+
+    if (! token || index >= lobby->capacity || lobby->entries[index].token != token)
+        return;
+
+    entry = &lobby->entries[index];
+    queue = entry->queue;
+    LobbyUnlink(lobby, entry);
+    LobbyTidy(lobby, queue);
+
+    return;
+}
+
+int LobbyMatch(LOBBY* lobby, SESSIONS* sessions, LOBBY_MATCH* match)
+{
+    guint64 since[LOBBY_PLAYERS];
+    LOBBY_QUEUE* queue;
+    LOBBY_ENTRY* entry;
+    guint32 index;
+    int take;
+
+    while (lobby->ready->len) {
+        queue = g_ptr_array_index(lobby->ready, lobby->ready->len - 1);
+
+        // the oldest that are still there
+        take = 0;
+        while (queue->count && take < queue->players) {
+            index = queue->head;
+            entry = &lobby->entries[index];
+            match->tokens[take] = entry->token;
+            since[take] = entry->since;
+            LobbyUnlink(lobby, entry);
+
+            if (SessionToken(sessions, match->tokens[take]))
+                take ++;
+        }
+
+        if (take == queue->players) {
+            match->players = queue->players;
+            match->mode = queue->mode;
+            g_strlcpy(match->name, queue->name ? queue->name : "", sizeof(match->name));
+
+            if (queue->count < (guint32)queue->players) {
+                queue->ready = 0;
+                g_ptr_array_remove_index(lobby->ready, lobby->ready->len - 1);
+                LobbyTidy(lobby, queue);
+            }
+            return 1;
+        }
+
+        // too many went away: the rest wait on, in front
+        queue->ready = 0;
+        g_ptr_array_remove_index(lobby->ready, lobby->ready->len - 1);
+        while (take--) {
+            index = match->tokens[take] & SESSION_INDEX_MASK;
+            lobby->entries[index].token = match->tokens[take];
+            lobby->entries[index].since = since[take];
+            LobbyLink(lobby, queue, index, 1);
+        }
+        LobbyTidy(lobby, queue);
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glib.h>
+#include "room.h"
+#include "session.h"
+
+/*
+ * Matchmaking.  A CREATE_ROOM for more than one player does not make a
+ * room right away: the session waits in the lobby until enough others
+ * asked for the same game, and once a tick LobbyMatch() hands out the
+ * groups that are complete, those who waited longest first, for the
+ * server to start a room for each.
+ *
+ * Sessions wait in queues: one per room mode, number of players and
+ * skill band for everyone who did not name a room, and one per name
+ * for those who did, found through a name index, so that friends meet
+ * whatever their skill.  Entries are kept by session slot (see
+ * session.h) in doubly linked lists, so joining, leaving and matching
+ * cost the same with ten or ten thousand waiting.  Only queues that
+ * have a match to make are looked at on a tick: they are on the ready
+ * list.  A session that went away meanwhile is dropped when its turn
+ * comes.
+ */
+
+#define LOBBY_PLAYERS   ROOM_WATCHERS   // most players in a match
+#define LOBBY_BANDS     16              // of skill
+#define LOBBY_NONE      ((guint32)-1)
+
+typedef struct _LOBBY_QUEUE {
+    guint32 head, tail;     // entries, oldest first
+    guint32 count;
+    int players;
+    int mode;               // ROOM_MODE_*
+    int band;
+    int ready;              // on the ready list
+    char* name;             // NULL for a skill band
+} LOBBY_QUEUE;
+
+typedef struct _LOBBY_ENTRY {
+    guint64 token;          // 0 while the slot's session is not waiting
+    guint64 since;          // tick it started waiting
+    guint32 prev, next;
+    LOBBY_QUEUE* queue;
+} LOBBY_ENTRY;
+
+typedef struct _LOBBY {
+    LOBBY_ENTRY* entries;   // one per session slot
+    guint32 capacity;
+    guint32 count;
+
+    LOBBY_QUEUE bands[2][LOBBY_PLAYERS + 1][LOBBY_BANDS];  // by mode, players, skill
+    GHashTable* names;      // name -> LOBBY_QUEUE*
+    GPtrArray* ready;       // LOBBY_QUEUE*, with at least players waiting
+} LOBBY;
+
+// what LobbyMatch() found
+typedef struct _LOBBY_MATCH {
+    guint64 tokens[LOBBY_PLAYERS];
+    int players;
+    int mode;
+    char name[ROOM_NAME_MAX + 1];
+} LOBBY_MATCH;
+
+LOBBY* LobbyAlloc(guint32 capacity);
+void LobbyFree(LOBBY*);
+
+int LobbyJoin(LOBBY*, guint64 token, int players, int mode, int band,
+        const char* name, guint64 since);
+void LobbyLeave(LOBBY*, guint64 token);
+int LobbyMatch(LOBBY*, SESSIONS*, LOBBY_MATCH*);
@@ -11,47 +11,154 @@ typedef enum _MSG_TYPE {
     KICK_CLIENT,
     CREATE_ROOM,
     USER_ACTION,
+    ROOM_CREATED,
+    CLIENT_REGISTERED,
+    RELIABLE,
+    ROOM_INPUTS,
+    ROOM_HASH,
+    ROOM_SNAPSHOT,
+    REJOIN_ROOM,
     NUM_MESSAGES
 } MSG_TYPE;
 
 typedef enum _USER_CMD {
    ROTCW = 0,
    ROTCCW = 1,
-   LOWER = 2
+   LOWER = 2,
+   LEFT = 3,
+   RIGHT = 4,
+   DROP = 5,
+   NUM_CMDS
 } USER_CMD;
 
+// every datagram starts with this, followed by TLVs; see channel.h
+typedef struct _PACKET_HEADER {
+    uint64_t token;     // the session's, 0 until CLIENT_REGISTERED
+    uint16_t seq;       // of this packet
+    uint16_t ack;       // newest packet received from the other side
+    uint32_t ack_bits;  // bit n: packet ack - 1 - n was received too
+} PACKET_HEADER;
+
 typedef struct _TLV {
     uint8_t type;
     uint16_t length;
     uint8_t value[0];
 } TLV;
 
+/*
+ * REGISTER_CLIENT, CREATE_ROOM, REJOIN_ROOM, KICK_CLIENT,
+ * DISCONNECT_CLIENT, their answers and ROOM_SNAPSHOT are sent inside a
+ * RELIABLE message,
+ * everything else (UPDATE_TETRAD and friends, USER_ACTION, ROOM_INPUTS,
+ * ROOM_HASH) as is.
+ */
+typedef struct _msg_reliable {
+    uint16_t id;        // per sender, to drop copies
+    uint16_t pad;
+    TLV message[0];
+} msg_reliable;
+
 typedef struct _msg_register_client {
     uint8_t nameLength;
     unsigned char name[0];
 } msg_register_client;
 
+typedef struct _msg_client_registered {
+    uint64_t token;
+} msg_client_registered;
+
 typedef struct _msg_update_tetrad {
     int x, y;
     int x0, y0;
     int rot;
 } msg_update_tetrad;
 
+#define CLIENT_STATE_OVER       1
+#define CLIENT_STATE_PAUSED     2
+
 typedef struct _msg_update_client_state {
     int nlines;
     int score;
     int level;
-    uint8_t status; 
+    uint8_t status;     // CLIENT_STATE_* bits
     uint8_t nLinesChanged; 
     uint16_t changedLines[0];
 } msg_update_client_state;
 
+/*
+ * Room modes.  A ROOM_MODE_STATE room sends UPDATE_CLIENT_STATE when
+ * the game changes.  A ROOM_MODE_LOCKSTEP room only sends the inputs
+ * (ROOM_INPUTS), stamped with the tick they were applied at, and every
+ * client steps its own copy of the game from the seed in ROOM_CREATED.
+ * Clients send the SnapHash() of their game every LOCKSTEP_HASH ticks
+ * (ROOM_HASH); a hash that differs from the server's, or a ROOM_HASH
+ * for tick 0, is answered with the game as it is (ROOM_SNAPSHOT).
+ */
+enum {
+    ROOM_MODE_STATE = 0,
+    ROOM_MODE_LOCKSTEP = 1
+};
+
+/*
+ * A room for one player is made at once.  One for more waits in the
+ * lobby until as many ask for the same: the same name, or without a
+ * name the same mode and skill band, and every one of them gets its
+ * ROOM_CREATED then.
+ *
+ * The name may be followed by a byte with the ROOM_MODE_*, and that by
+ * one with the skill band (0 to LOBBY_BANDS - 1); either is 0 when
+ * left out.
+ */
 typedef struct _msg_create_room {
     uint8_t numPlayers;
     uint8_t roomNameLen;
-    unsigned char roomName[0];
+    unsigned char roomName[0];  // then the mode and the band, if given
 } msg_create_room;
 
+typedef struct _msg_room_created {
+    uint32_t room;
+    uint32_t mode;
+    uint64_t seed;
+    uint64_t tick;      // the room's first step
+} msg_room_created;
+
+typedef struct _msg_room_inputs {
+    uint32_t room;
+    uint32_t ticks;     // how many, up to and including tick
+    uint64_t tick;      // every input up to here is in this or an earlier message
+    uint8_t inputs[0];  // for each tick, oldest first: a count, then the actions
+} msg_room_inputs;
+
+typedef struct _msg_room_hash {
+    uint32_t room;
+    uint32_t pad;
+    uint64_t tick;      // 0 asks for a ROOM_SNAPSHOT
+    uint64_t hash;
+} msg_room_hash;
+
+typedef struct _msg_room_snapshot {
+    uint32_t room;
+    uint32_t offset;    // of this piece
+    uint32_t size;      // of the whole snapshot, see snap.h
+    uint32_t pad;
+    uint64_t tick;      // the snapshot is of the game after this tick
+    uint8_t data[0];
+} msg_room_snapshot;
+
+/*
+ * A server that restarted from its journal has the rooms, but none of
+ * the sessions: a client registers again and claims its room back with
+ * the token it had before.  It is answered with ROOM_CREATED for the
+ * room as it is now, its tick the next step, and in lockstep with the
+ * game as well (ROOM_SNAPSHOT).
+ */
+typedef struct _msg_rejoin_room {
+    uint32_t room;
+    uint32_t pad;
+    uint64_t token;     // the client's, before the restart
+} msg_rejoin_room;
+
 typedef struct _msg_user_action {
+    uint32_t room;
     uint8_t cmd;
 } msg_user_action;
@@ -0,0 +1,195 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include "tetris.h"
+#include "prof.h"
+
+static const char* prof_names[PROF_PHASES] = {
+    "input",
+    "update",
+    "paint",
+    "refresh",
+    "action",
+    "spawn",
+    "lineclear",
+    "status",
+    "field"
+};
+
+const char* ProfName(int phase)
+{
+    return prof_names[phase];
+}
+
+static guint64 ProfNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (guint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static PROF_FRAME* ProfFrame(PROF* prof)
+{
+    return prof->n ? &prof->frames[(prof->n - 1) % PROF_FRAMES] : NULL;
+}
+
+PROF* ProfAlloc(void)
+{
+    PROF* prof;
+
+    prof = (PROF*)calloc(1, sizeof(PROF));
+    if (! prof)
+        return NULL;
+
+    prof->frames = (PROF_FRAME*)calloc(PROF_FRAMES, sizeof(PROF_FRAME));
+    if (! prof->frames) {
+        free(prof);
+        return NULL;
+    }
+
+    prof->origin = ProfNow();
+
+    return prof;
+}
+
+void ProfFree(PROF* prof)
+{
+    if (! prof)
+        return;
+
+    if (prof->trace) {
+        fprintf(prof->trace, "\n]}\n");
+        fclose(prof->trace);
+    }
+
+    free(prof->frames);
+    free(prof);
+
+    return;
+}
+
+int ProfTrace(PROF* prof, const char* path)
+{
+    if (prof->trace)
+        fclose(prof->trace);
+
+    prof->trace = fopen(path, "w");
+    if (! prof->trace)
+        return 0;
+
+    fprintf(prof->trace, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(prof->trace, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,"
+            "\"args\":{\"name\":\"%s\"}}", (int)getpid(), gs_appname);
+    prof->events = 1;
+
+    return 1;
+}
+
+void ProfFrameBegin(PROF* prof, unsigned long tick)
+{
+    PROF_FRAME* frame;
+
+    prof->n ++;
+    frame = ProfFrame(prof);
+    memset(frame, 0, sizeof(PROF_FRAME));
+
+    frame->tick = tick;
+    frame->start = ProfNow() - prof->origin;
+    prof->depth = 0;
+
+    return;
+}
+
+static void ProfWrite(PROF* prof, const char* name, unsigned long tick,
+        guint64 start, guint64 dur)
+{
+    // timestamps are in microseconds, keep the nanoseconds as decimals
+    fprintf(prof->trace, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":1,"
+            "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"tick\":%lu}}",
+            name, (int)getpid(),
+            (unsigned long long)(start / 1000), (unsigned)(start % 1000),
+            (unsigned long long)(dur / 1000), (unsigned)(dur % 1000),
+            tick);
+    prof->events ++;
+
+    return;
+}
+
+void ProfFrameEnd(PROF* prof)
+{
+    PROF_FRAME* frame = ProfFrame(prof);
+    int X;
+
+    if (! frame)
+        return;
+
+    frame->dur = ProfNow() - prof->origin - frame->start;
+
+    // the trace is written between frames, outside of any span
+    if (prof->trace) {
+        ProfWrite(prof, "frame", frame->tick, frame->start, frame->dur);
+        for (X = 0; X < frame->nspans; X++) {
+            ProfWrite(prof, prof_names[frame->spans[X].phase], frame->tick,
+                    frame->spans[X].start, frame->spans[X].dur);
+        }
+    }
+
+    return;
+}
+
+void ProfBegin(PROF* prof, int phase)
+{
+    PROF_FRAME* frame = ProfFrame(prof);
+    int span = -1;
+
+    if (! frame || prof->depth >= PROF_DEPTH)
+        return;
+
+    // spans are stored as they open, so parents come before children
+    if (frame->nspans < PROF_SPANS) {
+        span = frame->nspans ++;
+        frame->spans[span].phase = phase;
+        frame->spans[span].depth = prof->depth;
+    }
+
+    prof->open[prof->depth] = phase;
+    prof->open_span[prof->depth] = span;
+    prof->open_start[prof->depth] = ProfNow() - prof->origin;
+    prof->depth ++;
+
+    return;
+}
+
+void ProfEnd(PROF* prof, int phase)
+{
+    PROF_FRAME* frame = ProfFrame(prof);
+    guint64 start, dur;
+    int span;
+
+    if (! frame || ! prof->depth || prof->open[prof->depth - 1] != phase)
+        return;
+
+    prof->depth --;
+    start = prof->open_start[prof->depth];
+    dur = ProfNow() - prof->origin - start;
+    span = prof->open_span[prof->depth];
+
+    frame->phase[phase] += dur;
+    if (span >= 0) {
+        frame->spans[span].start = start;
+        frame->spans[span].dur = dur;
+    }
+
+    return;
+}
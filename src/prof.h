@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdio.h>
+#include "tetris.h"
+
+/*
+ * Frame profiler.  In a TETRIS_DEBUG build (scons debug=1) the main
+ * loop and the engine mark where each phase of a frame starts and
+ * ends.  Once profiling has been asked for (--profile, --trace) the
+ * spans of the last PROF_FRAMES frames are kept in a ring; --profile
+ * draws frame time percentiles on screen, and --trace writes every
+ * span to a file in the Chrome trace event format (chrome://tracing,
+ * Perfetto).  Other builds refuse both options.
+ *
+ * Without a PROF in the STATE, as in simulated games, every mark is a
+ * single test of a NULL pointer.
+ */
+
+#define PROF_FRAMES     256
+#define PROF_SPANS      64      // kept per frame, the rest only add up
+#define PROF_DEPTH      8
+
+enum {
+    PROF_INPUT = 0,
+    PROF_UPDATE,
+    PROF_PAINT,
+    PROF_REFRESH,
+    PROF_ACTION,
+    PROF_SPAWN,
+    PROF_LINE_CLEAR,
+    PROF_STATUS,
+    PROF_FIELD,
+    PROF_PHASES
+};
+
+typedef struct _PROF_SPAN {
+    int phase;
+    int depth;
+    guint64 start;  // ns since the profiler started
+    guint64 dur;
+} PROF_SPAN;
+
+typedef struct _PROF_FRAME {
+    unsigned long tick;
+    guint64 start, dur;
+    guint64 phase[PROF_PHASES];  // total time spent in each phase
+    int nspans;
+    PROF_SPAN spans[PROF_SPANS];
+} PROF_FRAME;
+
+typedef struct _PROF {
+    PROF_FRAME* frames;  // ring of PROF_FRAMES
+    unsigned long n;     // frames started so far
+    guint64 origin;
+
+    int depth;           // spans currently open
+    int open[PROF_DEPTH];
+    int open_span[PROF_DEPTH];  // -1 when the frame ran out of spans
+    guint64 open_start[PROF_DEPTH];
+
+    int overlay;
+    FILE* trace;
+    unsigned long events;  // written to the trace so far
+} PROF;
+
+#ifdef TETRIS_DEBUG
+#define PROF_BEGIN(state, phase) \
+    do { if ((state)->prof) ProfBegin((state)->prof, (phase)); } while (0)
+#define PROF_END(state, phase) \
+    do { if ((state)->prof) ProfEnd((state)->prof, (phase)); } while (0)
+#else
+#define PROF_BEGIN(state, phase)    do { } while (0)
+#define PROF_END(state, phase)      do { } while (0)
+#endif
+
+PROF* ProfAlloc(void);
+void ProfFree(PROF*);
+int ProfTrace(PROF*, const char* path);
+const char* ProfName(int phase);
+
+void ProfFrameBegin(PROF*, unsigned long tick);
+void ProfFrameEnd(PROF*);
+void ProfBegin(PROF*, int phase);
+void ProfEnd(PROF*, int phase);
+
@@ -0,0 +1,110 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "rate.h"
+
+#define RATE_UNIT   G_USEC_PER_SEC
+
+void RateLimit(RATE_LIMIT* limit, gint64 rate)
+{
+    // a quarter of a second's worth, enough for a key held down
+    limit->rate = rate;
+    limit->burst = MAX(rate / 4, 8);
+
+    return;
+}
+
+void RateInit(RATE* bucket, const RATE_LIMIT* limit, gint64 now)
+{
+    bucket->tokens = limit->burst * RATE_UNIT;
+    bucket->last = now;
+
+    return;
+}
+
+int RateTake(RATE* bucket, const RATE_LIMIT* limit, gint64 now)
+{
+    gint64 full = limit->burst * RATE_UNIT;
+    gint64 elapsed = now - bucket->last;
+
+    // microseconds times tokens a second is millionths of a token
+    if (elapsed > 0) {
+        if (elapsed >= full / MAX(limit->rate, 1))
+            bucket->tokens = full;
+        else
+            bucket->tokens = MIN(bucket->tokens + elapsed * limit->rate, full);
+        bucket->last = now;
+    }
+
+    if (bucket->tokens < RATE_UNIT)
+        return 0;
+
+    bucket->tokens -= RATE_UNIT;
+
+    return 1;
+}
+
+RATES* RatesAlloc(guint32 buckets, gint64 rate)
+{
+    RATES* rates;
+    guint32 X, size;
+
+    for (size = 1; size < buckets; size *= 2);
+
+    rates = g_new0(RATES, 1);
+    rates->buckets = g_new(RATE, size);
+    rates->mask = size - 1;
+    rates->basis = 2166136261U ^ g_random_int();
+    RateLimit(&rates->limit, rate);
+
+    for (X = 0; X < size; X++)
+        RateInit(&rates->buckets[X], &rates->limit, 0);
+
+    return rates;
+}
+
+void RatesFree(RATES* rates)
+{
+    g_free(rates->buckets);
+    g_free(rates);
+
+    return;
+}
+
+int RatesTake(RATES* rates, const struct sockaddr* addr, gint64 now)
+{
+    const guint8* p;
+    guint32 hash = rates->basis;
+    size_t X, length;
+
+    if (addr->sa_family == AF_INET) {
+        p = (const guint8*)&((const struct sockaddr_in*)addr)->sin_addr;
+        length = sizeof(struct in_addr);
+    } else if (addr->sa_family == AF_INET6) {
+        p = (const guint8*)&((const struct sockaddr_in6*)addr)->sin6_addr;
+        length = sizeof(struct in6_addr);
+    } else if (addr->sa_family == AF_UNIX) {
+        // a client of the shared memory transport, named by its slot
+        p = (const guint8*)((const struct sockaddr_un*)addr)->sun_path;
+        length = 16;
+    } else {
+        return 0;
+    }
+
+    // FNV-1a, as for sessions
+    for (X = 0; X < length; X++) {
+        hash ^= p[X];
+        hash *= 16777619U;
+    }
+
+    return RateTake(&rates->buckets[hash & rates->mask], &rates->limit, now);
+}
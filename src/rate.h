@@ -0,0 +1,45 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <glib.h>
+
+/*
+ * Token buckets, to hold every client to a packet rate.  A bucket
+ * fills at RATE_LIMIT.rate tokens a second, up to burst tokens, and
+ * every packet takes one; a packet that finds the bucket empty is
+ * dropped before anything else is done with it.
+ *
+ * Sessions have a bucket each.  Source addresses, which nothing
+ * bounds the number of, share a fixed table of buckets picked by a
+ * hash of the address (without the port): two addresses that collide
+ * only ever get less than their share, never more.
+ */
+
+#define RATE_SESSION            100         // packets a second
+#define RATE_SOURCE             1000
+#define RATE_SOURCE_BUCKETS     4096
+
+typedef struct _RATE_LIMIT {
+    gint64 rate;        // tokens a second
+    gint64 burst;       // tokens
+} RATE_LIMIT;
+
+typedef struct _RATE {
+    gint64 tokens;      // in millionths of a token
+    gint64 last;        // g_get_monotonic_time() of the last refill
+} RATE;
+
+typedef struct _RATES {
+    RATE_LIMIT limit;
+    RATE* buckets;
+    guint32 mask;       // buckets - 1, a power of two
+    guint32 basis;      // of the address hash, random per server
+} RATES;
+
+void RateLimit(RATE_LIMIT*, gint64 rate);
+void RateInit(RATE*, const RATE_LIMIT*, gint64 now);
+int RateTake(RATE*, const RATE_LIMIT*, gint64 now);
+
+RATES* RatesAlloc(guint32 buckets, gint64 rate);
+void RatesFree(RATES*);
+int RatesTake(RATES*, const struct sockaddr*, gint64 now);
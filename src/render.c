@@ -0,0 +1,49 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "tetris.h"
+#include "render.h"
+
+static const RENDERER* renderers[] = {
+    &curses_renderer,
+    &vt_renderer,
+    NULL
+};
+
+const RENDERER* RendererFind(const char* name)
+{
+    int X;
+
+    for (X = 0; renderers[X]; X++) {
+        if (! strcmp(renderers[X]->name, name))
+            return renderers[X];
+    }
+
+    return NULL;
+}
+
+int RenderPrint(STATE* state, int pane, int y, int x, chtype attr, const char* fmt, ...)
+{
+    char buffer[TETRIS_BUFSIZE];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return x;
+    if (len >= sizeof(buffer))
+        len = sizeof(buffer) - 1;
+
+    state->renderer->text(state, pane, y, x, attr, buffer);
+
+    return x + len;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "tetris.h"
+
+/*
+ * Render backends.  Paint() and friends only ever draw through these
+ * few primitives, in pane-relative coordinates, with curses chtype
+ * attributes (A_BOLD, A_REVERSE, COLOR_PAIR(n)) describing the cells.
+ * The curses backend maps them onto windows; the vt backend keeps its
+ * own frame buffers and writes escape sequences directly.
+ */
+
+typedef struct _RENDERER {
+    const char* name;
+
+    int (*init)(STATE*);
+    void (*cleanup)(STATE*);
+    void (*dimension)(STATE*);  // (re)create the panes set up in STATE
+    int (*getkey)(STATE*);      // next key, or ERR; drops any others
+    void (*bell)(STATE*);
+
+    void (*blank)(STATE*, int pane);
+    void (*outline)(STATE*, int pane, int y, int x, int h, int w, chtype attr);
+    void (*text)(STATE*, int pane, int y, int x, chtype attr, const char* str);
+    void (*cells)(STATE*, int pane, int y, int x, const chtype* cells, int n);
+    void (*flush)(STATE*);
+} RENDERER;
+
+extern const RENDERER curses_renderer;
+extern const RENDERER vt_renderer;
+
+const RENDERER* RendererFind(const char*);
+int RenderPrint(STATE*, int pane, int y, int x, chtype attr, const char* fmt, ...);
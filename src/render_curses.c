@@ -0,0 +1,190 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <ncurses.h>
+#include "tetris.h"
+#include "render.h"
+
+static WINDOW* CursesWindow(STATE* state, int pane)
+{
+    switch (pane) {
+        case PANE_FIELD:
+            return state->fieldwin;
+        case PANE_STATUS:
+            return state->statuswin;
+        default:
+            return stdscr;
+    }
+}
+
+static int CursesInit(STATE* state)
+{
+    initscr();
+    cbreak();
+    noecho();
+    nodelay(stdscr, true);
+    keypad(stdscr, true);
+    start_color();
+
+    if (has_colors()) {
+        start_color();
+        use_default_colors();
+    }
+
+    init_pair(0, COLOR_BLACK, COLOR_BLACK);
+    init_pair(1, COLOR_RED, COLOR_BLACK);
+    init_pair(2, COLOR_GREEN, COLOR_BLACK);
+    init_pair(3, COLOR_YELLOW, COLOR_BLACK);
+    init_pair(4, COLOR_BLUE, COLOR_BLACK);
+    init_pair(5, COLOR_MAGENTA, COLOR_BLACK);
+    init_pair(6, COLOR_CYAN, COLOR_BLACK);
+    init_pair(7, COLOR_WHITE, COLOR_BLACK);
+
+    getmaxyx(stdscr, state->Wy, state->Wx);
+
+    return 1;
+}
+
+static void CursesCleanup(STATE* state)
+{
+    endwin();
+
+    return;
+}
+
+static void CursesDimension(STATE* state)
+{
+    if (state->fieldwin) {
+        delwin(state->fieldwin);
+        erase();
+    }
+
+    if (state->statuswin) {
+        delwin(state->statuswin);
+        erase();
+    }
+
+    state->fieldwin = newwin(state->Ph[PANE_FIELD],
+            state->Pw[PANE_FIELD],
+            state->Py[PANE_FIELD],
+            state->Px[PANE_FIELD]);
+
+    if (state->Pw[PANE_STATUS]) {
+        state->statuswin = newwin(state->Ph[PANE_STATUS],
+                state->Pw[PANE_STATUS],
+                state->Py[PANE_STATUS],
+                state->Px[PANE_STATUS]);
+    }
+
+    //wbkgd(state->fieldwin, COLOR_PAIR(11));
+
+    return;
+}
+
+static int CursesGetKey(STATE* state)
+{
+    int c;
+
+    c = getch();
+    if (c != ERR)
+        flushinp();
+
+    return c;
+}
+
+static void CursesBell(STATE* state)
+{
+    beep();
+
+    return;
+}
+
+static void CursesErase(STATE* state, int pane)
+{
+    werase(CursesWindow(state, pane));
+
+    return;
+}
+
+static void CursesBox(STATE* state, int pane, int y, int x, int h, int w, chtype attr)
+{
+    WINDOW* window = CursesWindow(state, pane);
+    int X = 0;
+    int Y = 0;
+
+    wattrset(window, attr);
+
+    if (! y && ! x && h == state->Ph[pane] && w == state->Pw[pane]) {
+        box(window, 0, 0);
+        return;
+    }
+
+    // print the top line
+    for (Y = 0; Y < h; Y ++) {
+        for (X = 0; X < w; X ++) {
+            wmove(window, Y + y, X + x);
+
+            if (Y == 0 || Y == h - 1) {
+                if (X == 0) {
+                    waddch(window, Y == 0 ? ACS_ULCORNER : ACS_LLCORNER);
+                } else if (X == w - 1) {
+                    waddch(window, Y == 0 ? ACS_URCORNER : ACS_LRCORNER);
+                } else {
+                    waddch(window, ACS_HLINE);
+                }
+            } else {
+                waddch(window, ACS_VLINE);
+                if (X == 0) {
+                    X = w > 2 ? w - 2 : 0;
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+static void CursesText(STATE* state, int pane, int y, int x, chtype attr, const char* str)
+{
+    WINDOW* window = CursesWindow(state, pane);
+
+    wattrset(window, attr);
+    mvwaddstr(window, y, x, str);
+
+    return;
+}
+
+static void CursesCells(STATE* state, int pane, int y, int x, const chtype* cells, int n)
+{
+    mvwaddchnstr(CursesWindow(state, pane), y, x, cells, n);
+
+    return;
+}
+
+static void CursesRefresh(STATE* state)
+{
+    refresh();
+    wrefresh(state->fieldwin);
+    if (state->statuswin)
+        wrefresh(state->statuswin);
+
+    return;
+}
+
+const RENDERER curses_renderer = {
+    "curses",
+    CursesInit,
+    CursesCleanup,
+    CursesDimension,
+    CursesGetKey,
+    CursesBell,
+    CursesErase,
+    CursesBox,
+    CursesText,
+    CursesCells,
+    CursesRefresh
+};
@@ -0,0 +1,426 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * A renderer that talks to a VT100/ANSI terminal directly.  Frames
+ * are drawn into a back buffer of cells; Refresh() compares it with
+ * what the terminal is known to show, emits only the cursor movement
+ * and SGR changes needed for the cells that differ, and sends the
+ * whole frame with a single write().  This is for slow serial and ssh
+ * links, where bytes per frame matter more than anything else.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <curses.h>
+#include "tetris.h"
+#include "render.h"
+
+#define VT_BLANK        ((chtype)' ')
+#define VT_UNKNOWN      ((chtype)-1)
+
+// DEC special graphics characters for box drawing
+#define VT_ULCORNER     ('l' | A_ALTCHARSET)
+#define VT_URCORNER     ('k' | A_ALTCHARSET)
+#define VT_LLCORNER     ('m' | A_ALTCHARSET)
+#define VT_LRCORNER     ('j' | A_ALTCHARSET)
+#define VT_HLINE        ('q' | A_ALTCHARSET)
+#define VT_VLINE        ('x' | A_ALTCHARSET)
+
+typedef struct _VT {
+    struct termios saved;
+
+    int rows, cols;
+    chtype* front;  // what the terminal is showing
+    chtype* back;   // what the next frame should show
+
+    char* out;      // escape sequences for the frame being sent
+    size_t len, size;
+
+    int y, x;       // terminal cursor, x is -1 when unknown
+    chtype attr;    // terminal attributes, VT_UNKNOWN when unknown
+} VT;
+
+static void VtPut(VT* vt, const char* str, size_t n)
+{
+    if (vt->len + n > vt->size) {
+        vt->size = MAX(2 * vt->size, vt->len + n);
+        vt->out = (char*)realloc(vt->out, vt->size);
+    }
+
+    memcpy(vt->out + vt->len, str, n);
+    vt->len += n;
+
+    return;
+}
+
+static void VtPrint(VT* vt, const char* fmt, int a, int b)
+{
+    char buffer[32];
+    int len;
+
+    len = snprintf(buffer, sizeof(buffer), fmt, a, b);
+    VtPut(vt, buffer, len);
+
+    return;
+}
+
+static void VtFlush(VT* vt)
+{
+    size_t X = 0;
+    ssize_t n;
+
+    while (X < vt->len) {
+        n = write(STDOUT_FILENO, vt->out + X, vt->len - X);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        X += n;
+    }
+
+    vt->len = 0;
+
+    return;
+}
+
+static chtype VtCanon(chtype c)
+{
+    // spaces only differ by their background,
+    // which is always the terminal default here
+    if ((c & A_CHARTEXT) == ' ' && ! (c & (A_REVERSE | A_UNDERLINE)))
+        return VT_BLANK;
+
+    return c;
+}
+
+static void VtAttr(VT* vt, chtype attr)
+{
+    char sgr[32];
+    int len = 0, pair;
+
+    attr &= A_ATTRIBUTES;
+    if (attr == vt->attr)
+        return;
+
+    if ((attr & A_ALTCHARSET) != (vt->attr & A_ALTCHARSET) || vt->attr == VT_UNKNOWN)
+        VtPut(vt, attr & A_ALTCHARSET ? "\033(0" : "\033(B", 3);
+
+    if ((attr & ~A_ALTCHARSET) != (vt->attr & ~A_ALTCHARSET) || vt->attr == VT_UNKNOWN) {
+        len += sprintf(sgr + len, "\033[0");
+        if (attr & A_BOLD)
+            len += sprintf(sgr + len, ";1");
+        if (attr & A_UNDERLINE)
+            len += sprintf(sgr + len, ";4");
+        if (attr & A_REVERSE)
+            len += sprintf(sgr + len, ";7");
+
+        // the color pairs set up by the curses renderer are
+        // COLOR_x on black, and COLOR_x matches the ANSI numbering
+        pair = PAIR_NUMBER(attr);
+        if (pair > 0 && pair < 8)
+            len += sprintf(sgr + len, ";3%d", pair);
+
+        sgr[len++] = 'm';
+        VtPut(vt, sgr, len);
+    }
+
+    vt->attr = attr;
+
+    return;
+}
+
+static void VtMove(VT* vt, int y, int x)
+{
+    int X;
+
+    if (vt->y == y && vt->x == x)
+        return;
+
+    if (vt->y == y && vt->x >= 0 && x > vt->x && x - vt->x <= 4) {
+        // rewriting a few unchanged cells is cheaper than moving
+        for (X = vt->x; X < x; X++) {
+            if ((vt->back[y * vt->cols + X] & A_ATTRIBUTES) != vt->attr)
+                break;
+        }
+
+        if (X == x) {
+            for (X = vt->x; X < x; X++) {
+                char c = vt->back[y * vt->cols + X] & A_CHARTEXT;
+                VtPut(vt, &c, 1);
+            }
+            vt->x = x;
+            return;
+        }
+    }
+
+    if (vt->y == y && vt->x >= 0 && x > vt->x) {
+        VtPrint(vt, "\033[%dC", x - vt->x, 0);
+    } else if (x == 0 && vt->y + 1 == y && vt->x >= 0) {
+        VtPut(vt, "\r\n", 2);
+    } else {
+        VtPrint(vt, "\033[%d;%dH", y + 1, x + 1);
+    }
+
+    vt->y = y;
+    vt->x = x;
+
+    return;
+}
+
+static chtype* VtCell(STATE* state, int pane, int y, int x)
+{
+    VT* vt = (VT*)state->render_data;
+
+    if (y < 0 || x < 0 || y >= state->Ph[pane] || x >= state->Pw[pane])
+        return NULL;
+
+    y += state->Py[pane];
+    x += state->Px[pane];
+    if (y < 0 || x < 0 || y >= vt->rows || x >= vt->cols)
+        return NULL;
+
+    return &vt->back[y * vt->cols + x];
+}
+
+static int VtInit(STATE* state)
+{
+    struct termios raw;
+    struct winsize ws;
+    VT* vt;
+    int X;
+
+    if (! isatty(STDIN_FILENO) || ! isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "<ntetris>\tThe vt renderer needs a terminal.\n");
+        return 0;
+    }
+
+    vt = (VT*)calloc(1, sizeof(VT));
+    if (! vt)
+        return 0;
+
+    tcgetattr(STDIN_FILENO, &vt->saved);
+    raw = vt->saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) {
+        vt->rows = ws.ws_row;
+        vt->cols = ws.ws_col;
+    } else {
+        vt->rows = 24;
+        vt->cols = 80;
+    }
+
+    // like curses, let the environment override the size
+    if (getenv("LINES") && atoi(getenv("LINES")) > 0)
+        vt->rows = atoi(getenv("LINES"));
+    if (getenv("COLUMNS") && atoi(getenv("COLUMNS")) > 0)
+        vt->cols = atoi(getenv("COLUMNS"));
+
+    vt->front = (chtype*)malloc(vt->rows * vt->cols * sizeof(chtype));
+    vt->back = (chtype*)malloc(vt->rows * vt->cols * sizeof(chtype));
+    for (X = 0; X < vt->rows * vt->cols; X++) {
+        vt->front[X] = VT_BLANK;
+        vt->back[X] = VT_BLANK;
+    }
+
+    state->render_data = vt;
+    state->Wy = vt->rows;
+    state->Wx = vt->cols;
+
+    // alternate screen, no cursor, start from a blank screen
+    vt->attr = VT_UNKNOWN;
+    VtPut(vt, "\033[?1049h\033[?25l", 14);
+    VtAttr(vt, 0);
+    VtPut(vt, "\033[H\033[2J", 7);
+    vt->y = 0;
+    vt->x = 0;
+    VtFlush(vt);
+
+    return 1;
+}
+
+static void VtCleanup(STATE* state)
+{
+    VT* vt = (VT*)state->render_data;
+
+    if (! vt)
+        return;
+
+    VtAttr(vt, 0);
+    VtPut(vt, "\033[?25h\033[?1049l", 14);
+    VtFlush(vt);
+    tcsetattr(STDIN_FILENO, TCSANOW, &vt->saved);
+
+    free(vt->front);
+    free(vt->back);
+    free(vt->out);
+    free(vt);
+    state->render_data = NULL;
+
+    return;
+}
+
+static void VtDimension(STATE* state)
+{
+    // panes are nothing but rectangles of the back buffer
+    return;
+}
+
+static int VtGetKey(STATE* state)
+{
+    unsigned char buffer[64];
+    ssize_t n;
+
+    n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (n <= 0)
+        return ERR;
+
+    // anything after the first key is dropped, like flushinp()
+    if (buffer[0] == '\033' && n >= 3 && (buffer[1] == '[' || buffer[1] == 'O')) {
+        switch (buffer[2]) {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+            default: return ERR;
+        }
+    }
+
+    return buffer[0];
+}
+
+static void VtBell(STATE* state)
+{
+    VtPut((VT*)state->render_data, "\a", 1);
+
+    return;
+}
+
+static void VtErase(STATE* state, int pane)
+{
+    chtype* cell;
+    int X, Y;
+
+    for (Y = 0; Y < state->Ph[pane]; Y++) {
+        for (X = 0; X < state->Pw[pane]; X++) {
+            if ((cell = VtCell(state, pane, Y, X)))
+                *cell = VT_BLANK;
+        }
+    }
+
+    return;
+}
+
+static void VtBox(STATE* state, int pane, int y, int x, int h, int w, chtype attr)
+{
+    chtype* cell;
+    chtype c;
+    int X, Y;
+
+    attr &= A_ATTRIBUTES & ~A_ALTCHARSET;
+
+    for (Y = 0; Y < h; Y++) {
+        for (X = 0; X < w; X++) {
+            if (Y == 0 || Y == h - 1) {
+                if (X == 0)
+                    c = Y == 0 ? VT_ULCORNER : VT_LLCORNER;
+                else if (X == w - 1)
+                    c = Y == 0 ? VT_URCORNER : VT_LRCORNER;
+                else
+                    c = VT_HLINE;
+            } else if (X == 0 || X == w - 1) {
+                c = VT_VLINE;
+            } else {
+                continue;
+            }
+
+            if ((cell = VtCell(state, pane, y + Y, x + X)))
+                *cell = c | attr;
+        }
+    }
+
+    return;
+}
+
+static void VtText(STATE* state, int pane, int y, int x, chtype attr, const char* str)
+{
+    chtype* cell;
+    int X;
+
+    for (X = 0; str[X]; X++) {
+        if ((cell = VtCell(state, pane, y, x + X)))
+            *cell = VtCanon((unsigned char)str[X] | (attr & A_ATTRIBUTES));
+    }
+
+    return;
+}
+
+static void VtCells(STATE* state, int pane, int y, int x, const chtype* cells, int n)
+{
+    chtype* cell;
+    int X;
+
+    for (X = 0; X < n; X++) {
+        if ((cell = VtCell(state, pane, y, x + X)))
+            *cell = VtCanon(cells[X]);
+    }
+
+    return;
+}
+
+static void VtRefresh(STATE* state)
+{
+    VT* vt = (VT*)state->render_data;
+    int X, Y, i;
+    char c;
+
+    for (Y = 0; Y < vt->rows; Y++) {
+        for (X = 0; X < vt->cols; X++) {
+            i = Y * vt->cols + X;
+            if (vt->back[i] == vt->front[i])
+                continue;
+
+            VtMove(vt, Y, X);
+            VtAttr(vt, vt->back[i]);
+            c = vt->back[i] & A_CHARTEXT;
+            VtPut(vt, &c, 1);
+            vt->front[i] = vt->back[i];
+
+            // the cursor hangs in the margin after the last column
+            vt->x = X + 1 < vt->cols ? X + 1 : -1;
+        }
+    }
+
+    if (vt->len)
+        VtFlush(vt);
+
+    return;
+}
+
+const RENDERER vt_renderer = {
+    "vt",
+    VtInit,
+    VtCleanup,
+    VtDimension,
+    VtGetKey,
+    VtBell,
+    VtErase,
+    VtBox,
+    VtText,
+    VtCells,
+    VtRefresh
+};
@@ -0,0 +1,113 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "ring.h"
+
+// every message has a frame before it, which keeps it aligned
+typedef struct _RING_FRAME {
+    guint32 length;
+    guint32 pad;
+} RING_FRAME;
+
+#define RING_WRAP       0xFFFFFFFFU     // the rest up to the end is unused
+#define RingFrame(length) \
+    ((sizeof(RING_FRAME) + (guint64)(length) + RING_ALIGN - 1) & ~(guint64)(RING_ALIGN - 1))
+
+void RingInit(RING* ring, void* memory, guint64 size, int clear)
+{
+    ring->shared = (RING_SHARED*)memory;
+    ring->size = size;
+
+    if (clear)
+        memset(ring->shared, 0, sizeof(RING_SHARED));
+
+    return;
+}
+
+int RingWrite(RING* ring, const void* data, guint32 length)
+{
+    RING_SHARED* shared = ring->shared;
+    guint64 head = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+    guint64 tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+    guint64 need = RingFrame(length);
+    guint64 offset = head & (ring->size - 1);
+    guint64 skip = 0;
+    RING_FRAME* frame;
+
+    if (need > ring->size / 2)
+        return -1;
+
+    // a message never wraps around: it goes to the start instead
+    if (offset + need > ring->size)
+        skip = ring->size - offset;
+
+    if (head + skip + need - tail > ring->size)
+        return -1;
+
+    if (skip) {
+        frame = (RING_FRAME*)(shared->data + offset);
+        frame->length = RING_WRAP;
+        offset = 0;
+    }
+
+    frame = (RING_FRAME*)(shared->data + offset);
+    frame->length = length;
+    memcpy(frame + 1, data, length);
+
+    // ordered against the consumer's last RingPop(): either it sees
+    // this message, or we see it has read everything and wake it
+    __atomic_store_n(&shared->head, head + skip + need, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&shared->tail, __ATOMIC_SEQ_CST) == head;
+}
+
+const void* RingPeek(RING* ring, guint32* length)
+{
+    RING_SHARED* shared = ring->shared;
+    guint64 tail = __atomic_load_n(&shared->tail, __ATOMIC_RELAXED);
+    guint64 head = __atomic_load_n(&shared->head, __ATOMIC_SEQ_CST);
+    guint64 offset = tail & (ring->size - 1);
+    guint32 n;
+
+    if (head == tail)
+        return NULL;
+
+    n = ((volatile RING_FRAME*)(shared->data + offset))->length;
+    if (n == RING_WRAP) {
+        tail += ring->size - offset;
+        __atomic_store_n(&shared->tail, tail, __ATOMIC_SEQ_CST);
+        if (head == tail)
+            return NULL;
+
+        offset = 0;
+        n = ((volatile RING_FRAME*)shared->data)->length;
+    }
+
+    // a producer that writes nonsense only loses its messages
+    if (head - tail > ring->size || offset + RingFrame(n) > ring->size ||
+            RingFrame(n) > head - tail) {
+        __atomic_store_n(&shared->tail, head, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+
+    *length = n;
+
+    return shared->data + offset + sizeof(RING_FRAME);
+}
+
+void RingPop(RING* ring, guint32 length)
+{
+    RING_SHARED* shared = ring->shared;
+    guint64 tail = __atomic_load_n(&shared->tail, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&shared->tail, tail + RingFrame(length), __ATOMIC_SEQ_CST);
+
+    return;
+}
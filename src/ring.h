@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glib.h>
+
+/*
+ * A single producer, single consumer ring of variable length messages,
+ * laid out to live in memory shared between two processes.  Each side
+ * owns one index (the producer the head, the consumer the tail), so
+ * neither ever waits for the other or takes a lock.
+ *
+ * RingWrite() says when the consumer had read everything before the
+ * message it wrote: the consumer may be asleep and wants a wakeup.
+ * RingPeek() hands out the next message in place, valid until RingPop();
+ * the producer can still write there, so a consumer that does not
+ * trust it copies the message out before it looks inside.
+ *
+ * The RING itself is private to each side; only RING_SHARED and the
+ * data after it are shared.  What the other process writes there is
+ * never trusted beyond the bounds in the private half.
+ */
+
+#define RING_ALIGN      8
+
+typedef struct _RING_SHARED {
+    guint64 head;       // bytes ever written
+    guint8 pad0[56];
+    guint64 tail;       // bytes ever read
+    guint8 pad1[56];
+    guint8 data[];
+} RING_SHARED;
+
+typedef struct _RING {
+    RING_SHARED* shared;
+    guint64 size;       // of data, a power of two
+} RING;
+
+#define RingBytes(size) (sizeof(RING_SHARED) + (size))
+
+void RingInit(RING*, void* memory, guint64 size, int clear);
+int RingWrite(RING*, const void* data, guint32 length);
+const void* RingPeek(RING*, guint32* length);
+void RingPop(RING*, guint32 length);
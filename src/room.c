@@ -0,0 +1,440 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "room.h"
+#include "snap.h"
+#include "telemetry.h"
+
+static void RoomFree(gpointer data)
+{
+    ROOM* room = (ROOM*)data;
+    ROOMS* rooms = room->rooms;
+    ROOM* moved;
+    int last;
+
+    g_free(room->lockstep);
+
+    if (room->game < 0) {
+        g_ptr_array_remove_fast(rooms->joining, room);
+        g_free(room);
+        return;
+    }
+
+    BatchTelemetry(rooms->batch, room->game, TELEMETRY_END,
+            rooms->batch->lines[room->game], rooms->batch->pieces[room->game],
+            rooms->batch->level[room->game], 0);
+
+    // the last game moves into the hole, so its room moves too
+    last = BatchRemove(rooms->batch, room->game);
+    if (last >= 0) {
+        moved = g_ptr_array_index(rooms->games, last);
+        moved->game = room->game;
+        g_ptr_array_index(rooms->games, room->game) = moved;
+    }
+    g_ptr_array_set_size(rooms->games, rooms->batch->n);
+
+    g_free(room);
+
+    return;
+}
+
+ROOMS* RoomsAlloc(void)
+{
+    ROOMS* rooms;
+
+    rooms = g_new0(ROOMS, 1);
+
+    // every room plays the default game
+    rooms->scratch = GameAlloc();
+    if (! rooms->scratch || ! GameStart(rooms->scratch, 0) ||
+            ! (rooms->batch = BatchAlloc(rooms->scratch))) {
+        if (rooms->scratch)
+            GameFree(rooms->scratch);
+        g_free(rooms);
+        return NULL;
+    }
+
+    rooms->games = g_ptr_array_new();
+    rooms->joining = g_ptr_array_new();
+    rooms->table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+            NULL, RoomFree);
+    rooms->next_id = 1;
+
+    return rooms;
+}
+
+void RoomsFree(ROOMS* rooms)
+{
+    g_hash_table_destroy(rooms->table);
+    g_ptr_array_free(rooms->games, TRUE);
+    g_ptr_array_free(rooms->joining, TRUE);
+    BatchFree(rooms->batch);
+    GameFree(rooms->scratch);
+    g_free(rooms);
+
+    return;
+}
+
+static void RoomInput(ROOM* room)
+{
+    BATCH* batch = room->rooms->batch;
+    ROOM_LOCKSTEP* lockstep = room->lockstep;
+    int action, slot = 0;
+
+    room->tick ++;
+    batch->ticks[room->game] ++;
+
+    if (lockstep) {
+        slot = room->tick % LOCKSTEP_HISTORY;
+        lockstep->nactions[slot] = 0;
+    }
+
+    while (room->tail != room->until) {
+        action = room->pending[room->tail % (2 * ROOM_PENDING)];
+        BatchAction(batch, room->game, action);
+        if (lockstep)
+            lockstep->actions[slot][lockstep->nactions[slot]++] = action;
+        room->tail ++;
+    }
+
+    return;
+}
+
+static void RoomCutoff(ROOM* room)
+{
+    // what came so far is this tick's, what comes next the next's
+    room->until = room->head;
+    room->queued = 0;
+
+    return;
+}
+
+static void RoomOutput(ROOM* room)
+{
+    BATCH* batch = room->rooms->batch;
+    ROOM_LOCKSTEP* lockstep = room->lockstep;
+    msg_update_client_state* update = &room->update;
+    int i = room->game;
+    guint8 status;
+
+    // clients step the game themselves: they only need the inputs,
+    // and the hashes, to see that they still agree with us
+    if (lockstep) {
+        room->hash_due = room->tick % LOCKSTEP_HASH == 0 || BatchDone(batch, i);
+        if (lockstep->nactions[room->tick % LOCKSTEP_HISTORY] ||
+                room->tick - lockstep->sent >= LOCKSTEP_IDLE || room->hash_due)
+            room->updated = 1;
+        return;
+    }
+
+    status = (batch->over[i] || batch->quit[i] ? CLIENT_STATE_OVER : 0) |
+        (batch->pause[i] ? CLIENT_STATE_PAUSED : 0);
+
+    if (update->nlines == batch->lines[i] && update->score == batch->score[i] &&
+            update->level == batch->level[i] && update->status == status)
+        return;
+
+    update->nlines = batch->lines[i];
+    update->score = batch->score[i];
+    update->level = batch->level[i];
+    update->status = status;
+    update->nLinesChanged = 0;
+    room->updated = 1;
+
+    return;
+}
+
+static void RoomJoin(ROOM* room)
+{
+    ROOMS* rooms = room->rooms;
+
+    room->game = BatchAdd(rooms->batch, room->seed);
+    rooms->batch->tag[room->game] = room->id;
+    g_ptr_array_add(rooms->games, room);
+
+    BatchTelemetry(rooms->batch, room->game, TELEMETRY_START, rooms->batch->Bx,
+            rooms->batch->By, (int)(room->seed & 0xFFFFFFFFU), (int)(room->seed >> 32));
+
+    return;
+}
+
+void RoomsTickBegin(ROOMS* rooms)
+{
+    BATCH* batch = rooms->batch;
+    int X;
+
+    rooms->tick ++;
+    rooms->stepping = 1;
+
+    for (X = 0; X < batch->n; X++)
+        RoomCutoff(g_ptr_array_index(rooms->games, X));
+
+    return;
+}
+
+void RoomsStep(ROOMS* rooms, int lo, int hi, GPtrArray* updated)
+{
+    BATCH* batch = rooms->batch;
+    ROOM* room;
+    int X;
+
+    for (X = lo; X < hi; X++)
+        RoomInput(g_ptr_array_index(rooms->games, X));
+
+    BatchTick(batch, lo, hi);
+
+    for (X = lo; X < hi; X++) {
+        room = g_ptr_array_index(rooms->games, X);
+        RoomOutput(room);
+        if ((room->updated || room->hash_due) && updated)
+            g_ptr_array_add(updated, room);
+    }
+
+    return;
+}
+
+void RoomsTickEnd(ROOMS* rooms)
+{
+    BATCH* batch = rooms->batch;
+    int X;
+
+    // finished games leave the table; from the end, so that
+    // the game moved into a hole has been looked at already
+    for (X = batch->n - 1; X >= 0; X--) {
+        if (BatchDone(batch, X))
+            RoomRemove(rooms, g_ptr_array_index(rooms->games, X));
+    }
+
+    rooms->stepping = 0;
+    for (X = 0; X < rooms->joining->len; X++)
+        RoomJoin(g_ptr_array_index(rooms->joining, X));
+    g_ptr_array_set_size(rooms->joining, 0);
+
+    return;
+}
+
+void RoomsTick(ROOMS* rooms)
+{
+    RoomsTickBegin(rooms);
+    RoomsStep(rooms, 0, rooms->batch->n, NULL);
+    RoomsTickEnd(rooms);
+
+    return;
+}
+
+ROOM* RoomCreate(ROOMS* rooms, guint32 id, guint64 seed, int players, const char* name)
+{
+    ROOM* room;
+
+    if (! id)
+        id = rooms->next_id;
+    if (g_hash_table_contains(rooms->table, GUINT_TO_POINTER(id)))
+        return NULL;
+
+    room = g_new0(ROOM, 1);
+    room->id = id;
+    room->players = players;
+    room->tick = rooms->tick;
+    g_strlcpy(room->name, name, sizeof(room->name));
+
+    room->rooms = rooms;
+    room->seed = seed;
+    room->game = -1;
+    if (rooms->stepping)
+        g_ptr_array_add(rooms->joining, room);
+    else
+        RoomJoin(room);
+
+    g_hash_table_insert(rooms->table, GUINT_TO_POINTER(id), room);
+    if (id >= rooms->next_id)
+        rooms->next_id = id + 1;
+
+    return room;
+}
+
+ROOM* RoomFind(ROOMS* rooms, guint32 id)
+{
+    return (ROOM*)g_hash_table_lookup(rooms->table, GUINT_TO_POINTER(id));
+}
+
+void RoomRemove(ROOMS* rooms, ROOM* room)
+{
+    g_hash_table_remove(rooms->table, GUINT_TO_POINTER(room->id));
+
+    return;
+}
+
+int RoomAction(ROOM* room, int action)
+{
+    if (action < 0 || action >= TETRIS_KEYS || room->queued >= ROOM_PENDING)
+        return 0;
+
+    room->pending[room->head % (2 * ROOM_PENDING)] = action;
+    room->head ++;
+    room->queued ++;
+
+    return 1;
+}
+
+int RoomStep(ROOM* room)
+{
+    BATCH* batch = room->rooms->batch;
+
+    RoomCutoff(room);
+    RoomInput(room);
+    BatchTick(batch, room->game, room->game + 1);
+
+    return ! BatchDone(batch, room->game);
+}
+
+void RoomWatch(ROOM* room, guint64 watcher)
+{
+    int X;
+
+    for (X = 0; X < room->nwatchers; X++) {
+        if (room->watchers[X] == watcher)
+            return;
+    }
+
+    // the newest watcher takes the place of the oldest
+    if (room->nwatchers == ROOM_WATCHERS) {
+        memmove(room->watchers, room->watchers + 1,
+                (ROOM_WATCHERS - 1) * sizeof(guint64));
+        room->nwatchers --;
+    }
+    room->watchers[room->nwatchers++] = watcher;
+
+    return;
+}
+
+int RoomRejoin(ROOM* room, guint64 watcher, guint64 token)
+{
+    int X;
+
+    // only a token the room already had, from before a restart
+    for (X = 0; X < room->nwatchers; X++) {
+        if (room->watchers[X] == watcher) {
+            room->watchers[X] = token;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void RoomLockstep(ROOM* room)
+{
+    if (! room->lockstep)
+        room->lockstep = g_new0(ROOM_LOCKSTEP, 1);
+    room->mode = ROOM_MODE_LOCKSTEP;
+    room->lockstep->start = room->tick + 1;
+    room->lockstep->sent = room->tick;
+
+    return;
+}
+
+size_t RoomInputs(ROOM* room, void* buffer, size_t size)
+{
+    ROOM_LOCKSTEP* lockstep = room->lockstep;
+    msg_room_inputs* msg = (msg_room_inputs*)buffer;
+    guint8* p = msg->inputs;
+    guint8* end = (guint8*)buffer + size;
+    guint64 tick, first;
+    int slot;
+
+    // every message has the last LOCKSTEP_HISTORY ticks, so that
+    // a client can do without any LOCKSTEP_HISTORY - 1 lost in a row
+    first = room->tick >= LOCKSTEP_HISTORY ? room->tick - LOCKSTEP_HISTORY + 1 : 0;
+    first = MAX(first, lockstep->start);
+    if (size < sizeof(msg_room_inputs) || first > room->tick)
+        return 0;
+
+    msg->room = room->id;
+    msg->ticks = room->tick + 1 - first;
+    msg->tick = room->tick;
+
+    for (tick = first; tick <= room->tick; tick++) {
+        slot = tick % LOCKSTEP_HISTORY;
+        if (p + 1 + lockstep->nactions[slot] > end)
+            return 0;
+
+        *p++ = lockstep->nactions[slot];
+        memcpy(p, lockstep->actions[slot], lockstep->nactions[slot]);
+        p += lockstep->nactions[slot];
+    }
+
+    lockstep->sent = room->tick;
+
+    return p - (guint8*)buffer;
+}
+
+static int RoomHashSlot(guint64 tick)
+{
+    // the hash of a game that ended between two hashes goes where
+    // the next would have, not over the last one
+    return ((tick + LOCKSTEP_HASH - 1) / LOCKSTEP_HASH) % LOCKSTEP_HASHES;
+}
+
+void RoomHash(ROOM* room)
+{
+    ROOM_LOCKSTEP* lockstep = room->lockstep;
+    STATE* scratch = room->rooms->scratch;
+    int slot = RoomHashSlot(room->tick);
+
+    BatchStore(room->rooms->batch, room->game, scratch);
+    lockstep->hash_tick[slot] = room->tick;
+    lockstep->hash[slot] = SnapHash(scratch);
+
+    return;
+}
+
+int RoomHashAt(const ROOM* room, guint64 tick, guint64* hash)
+{
+    const ROOM_LOCKSTEP* lockstep = room->lockstep;
+    int slot = RoomHashSlot(tick);
+
+    if (! lockstep || ! tick || lockstep->hash_tick[slot] != tick)
+        return 0;
+
+    *hash = lockstep->hash[slot];
+
+    return 1;
+}
+
+size_t RoomSnapSize(ROOM* room)
+{
+    BATCH* batch = room->rooms->batch;
+
+    return sizeof(SNAP) + (size_t)batch->Bx * batch->By;
+}
+
+size_t RoomSnapSave(ROOM* room, void* buffer, size_t size)
+{
+    STATE* scratch = room->rooms->scratch;
+
+    BatchStore(room->rooms->batch, room->game, scratch);
+
+    return SnapSave(scratch, buffer, size);
+}
+
+int RoomSnapLoad(ROOM* room, const void* buffer, size_t size)
+{
+    const SNAP* snap = (const SNAP*)buffer;
+    STATE* scratch = room->rooms->scratch;
+
+    // the scratch game must keep the size of the batch
+    if (size < sizeof(SNAP) || snap->Bx != room->rooms->batch->Bx ||
+            snap->By != room->rooms->batch->By)
+        return 0;
+
+    return SnapLoad(scratch, buffer, size) &&
+        BatchLoad(room->rooms->batch, room->game, scratch);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glib.h>
+#include "tetris.h"
+#include "batch.h"
+#include "packet.h"
+
+/*
+ * Server rooms.  The games of all rooms live in one BATCH (batch.h),
+ * and all rooms are stepped together once per server tick.  Actions that arrive between
+ * two ticks are queued on their room and applied, in arrival order, at
+ * the start of the room's next step, so a room's game is completely
+ * determined by its seed and the (tick, action) pairs it was given.
+ *
+ * A tick may run on other threads while the owner goes on taking
+ * actions and creating rooms: RoomsTickBegin() fixes which actions
+ * belong to the tick, RoomsStep() steps any slice of the games, from
+ * any thread, and RoomsTickEnd() takes the owner's thread back.  Until
+ * then the batch is left alone: rooms created meanwhile join it at
+ * RoomsTickEnd(), and the pending actions are a ring with one writer,
+ * the owner, and one reader, the step, which never touch the same
+ * entries, so neither side ever locks.
+ */
+
+#define ROOM_NAME_MAX   63
+#define ROOM_PENDING    16      // actions per room and tick, the rest are dropped
+#define ROOM_WATCHERS   8
+
+#define LOCKSTEP_HISTORY    16      // ticks of inputs in every ROOM_INPUTS
+#define LOCKSTEP_IDLE       10      // ticks between ROOM_INPUTS without any
+#define LOCKSTEP_HASH       20      // ticks between hashes of the game
+#define LOCKSTEP_HASHES     8       // hashes kept, to check clients against
+
+// what a ROOM_MODE_LOCKSTEP room keeps of the last few ticks
+typedef struct _ROOM_LOCKSTEP {
+    guint8 actions[LOCKSTEP_HISTORY][ROOM_PENDING];
+    guint8 nactions[LOCKSTEP_HISTORY];      // of tick % LOCKSTEP_HISTORY
+    guint64 start;                          // first tick kept
+    guint64 sent;                           // tick of the last ROOM_INPUTS
+    guint64 hash_tick[LOCKSTEP_HASHES];
+    guint64 hash[LOCKSTEP_HASHES];
+} ROOM_LOCKSTEP;
+
+typedef struct _ROOM {
+    guint32 id;
+    int players;
+    char name[ROOM_NAME_MAX + 1];
+
+    guint64 tick;       // server tick of the last step
+    struct _ROOMS* rooms;
+    int game;           // index of the room's game in rooms->batch, -1 until it joins
+    guint64 seed;
+    int mode;           // ROOM_MODE_*
+    ROOM_LOCKSTEP* lockstep;
+
+    // the actions for this tick and, while it runs, for the next
+    int pending[2 * ROOM_PENDING];
+    guint32 head;       // written by the owner
+    guint32 until;      // end of this tick's actions
+    guint32 tail;       // read by the step
+    int queued;         // for the next tick
+
+    // what the step found changed, for the owner to send out: an
+    // update, or in lockstep inputs to send and maybe a hash to take
+    msg_update_client_state update;
+    int updated;
+    int hash_due;
+    guint64 watchers[ROOM_WATCHERS];
+    int nwatchers;
+} ROOM;
+
+typedef struct _ROOMS {
+    GHashTable* table;  // id -> ROOM*
+    guint32 next_id;
+    guint64 tick;       // server ticks so far
+
+    BATCH* batch;
+    GPtrArray* games;   // game index -> ROOM*
+    GPtrArray* joining; // ROOM* created while a tick ran
+    int stepping;       // between RoomsTickBegin() and RoomsTickEnd()
+    STATE* scratch;     // a game to take snapshots through
+} ROOMS;
+
+ROOMS* RoomsAlloc(void);
+void RoomsFree(ROOMS*);
+void RoomsTick(ROOMS*);
+void RoomsTickBegin(ROOMS*);
+void RoomsStep(ROOMS*, int lo, int hi, GPtrArray* updated);
+void RoomsTickEnd(ROOMS*);
+
+ROOM* RoomCreate(ROOMS*, guint32 id, guint64 seed, int players, const char* name);
+ROOM* RoomFind(ROOMS*, guint32 id);
+void RoomRemove(ROOMS*, ROOM*);
+int RoomAction(ROOM*, int action);
+int RoomStep(ROOM*);
+void RoomWatch(ROOM*, guint64 watcher);
+int RoomRejoin(ROOM*, guint64 watcher, guint64 token);
+void RoomLockstep(ROOM*);
+size_t RoomInputs(ROOM*, void* buffer, size_t size);
+void RoomHash(ROOM*);
+int RoomHashAt(const ROOM*, guint64 tick, guint64* hash);
+
+size_t RoomSnapSize(ROOM*);
+size_t RoomSnapSave(ROOM*, void* buffer, size_t size);
+int RoomSnapLoad(ROOM*, const void* buffer, size_t size);
@@ -0,0 +1,152 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <string.h>
+#include "row.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROW_X86
+#include <immintrin.h>
+#endif
+
+static int RowFullScalar(const char* row, int n)
+{
+    int X;
+
+    for (X = 0; X < n; X++) {
+        if (! row[X])
+            return 0;
+    }
+
+    return 1;
+}
+
+static int RowMatchScalar(const char* row, int n, char c)
+{
+    int X;
+
+    for (X = 0; X < n; X++) {
+        if (row[X] != c)
+            return 0;
+    }
+
+    return 1;
+}
+
+#ifdef ROW_X86
+
+__attribute__((target("sse2")))
+static int RowFullSSE2(const char* row, int n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v;
+    int X;
+
+    for (X = 0; X + 16 <= n; X += 16) {
+        v = _mm_loadu_si128((const __m128i*)(row + X));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+            return 0;
+    }
+
+    return RowFullScalar(row + X, n - X);
+}
+
+__attribute__((target("sse2")))
+static int RowMatchSSE2(const char* row, int n, char c)
+{
+    const __m128i m = _mm_set1_epi8(c);
+    __m128i v;
+    int X;
+
+    for (X = 0; X + 16 <= n; X += 16) {
+        v = _mm_loadu_si128((const __m128i*)(row + X));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, m)) != 0xFFFF)
+            return 0;
+    }
+
+    return RowMatchScalar(row + X, n - X, c);
+}
+
+__attribute__((target("avx2")))
+static int RowFullAVX2(const char* row, int n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i v;
+    int X;
+
+    for (X = 0; X + 32 <= n; X += 32) {
+        v = _mm256_loadu_si256((const __m256i*)(row + X));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)))
+            return 0;
+    }
+
+    return RowFullSSE2(row + X, n - X);
+}
+
+__attribute__((target("avx2")))
+static int RowMatchAVX2(const char* row, int n, char c)
+{
+    const __m256i m = _mm256_set1_epi8(c);
+    __m256i v;
+    int X;
+
+    for (X = 0; X + 32 <= n; X += 32) {
+        v = _mm256_loadu_si256((const __m256i*)(row + X));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, m)) != -1)
+            return 0;
+    }
+
+    return RowMatchSSE2(row + X, n - X, c);
+}
+
+#endif
+
+/* selected once by RowInit(), read-only afterwards */
+static int (*row_full)(const char*, int) = RowFullScalar;
+static int (*row_match)(const char*, int, char) = RowMatchScalar;
+static const char* row_kernel = "scalar";
+
+void RowInit(void)
+{
+#ifdef ROW_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        row_full = RowFullAVX2;
+        row_match = RowMatchAVX2;
+        row_kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        row_full = RowFullSSE2;
+        row_match = RowMatchSSE2;
+        row_kernel = "sse2";
+    }
+#endif
+
+    return;
+}
+
+const char* RowKernel(void)
+{
+    return row_kernel;
+}
+
+int RowFull(const char* row, int n)
+{
+    return row_full(row, n);
+}
+
+int RowMatch(const char* row, int n, char c)
+{
+    return row_match(row, n, c);
+}
+
+void RowFill(char* row, int n, char c)
+{
+    // the C library's memset is already vectorized for the running CPU
+    memset(row, c, n);
+
+    return;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/*
+ * Whole-row scans over the playfield.  On x86 the vectorized SSE2 or
+ * AVX2 versions are picked at startup by RowInit(), everywhere else
+ * (or before RowInit() is called) the scalar loops are used.
+ */
+
+void RowInit(void);
+const char* RowKernel(void);
+
+int RowFull(const char* row, int n);
+int RowMatch(const char* row, int n, char c);
+void RowFill(char* row, int n, char c);
+
+#define RowEmpty(row, n)    RowMatch((row), (n), 0)
+#define RowCleared(row, n)  RowMatch((row), (n), CLEARED)
@@ -0,0 +1,397 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "session.h"
+
+static int SessionKey(SESSION_KEY* key, const struct sockaddr* addr)
+{
+    memset(key, 0, sizeof(SESSION_KEY));
+    key->family = addr->sa_family;
+
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)addr;
+        memcpy(key->ip, &in->sin_addr, sizeof(in->sin_addr));
+        key->port = in->sin_port;
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+        memcpy(key->ip, &in6->sin6_addr, sizeof(in6->sin6_addr));
+        key->port = in6->sin6_port;
+    } else if (addr->sa_family == AF_UNIX) {
+        // the shared memory transport's made up names; see transport_shm.c
+        const struct sockaddr_un* un = (const struct sockaddr_un*)addr;
+        memcpy(key->ip, un->sun_path, sizeof(key->ip));
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+static guint32 SessionHash(const SESSIONS* sessions, const SESSION_KEY* key)
+{
+    // FNV-1a, started from a per-server random basis so that
+    // nobody can pick addresses that all land in one run
+    const guint8* p = (const guint8*)key;
+    guint32 hash = sessions->basis;
+    size_t X;
+
+    for (X = 0; X < sizeof(SESSION_KEY); X++) {
+        hash ^= p[X];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+SESSIONS* SessionsAlloc(guint32 capacity, gint64 idle, gint64 rate)
+{
+    SESSIONS* sessions;
+    guint32 X, size;
+
+    if (capacity < 1 || capacity > SESSION_INDEX_MASK)
+        return NULL;
+
+    for (size = 2; size < 2 * capacity; size *= 2);
+
+    sessions = g_new0(SESSIONS, 1);
+    sessions->pool = g_new0(SESSION, capacity);
+    sessions->slots = g_new(SESSION_SLOT, size);
+    sessions->capacity = capacity;
+    sessions->mask = size - 1;
+    sessions->idle = idle;
+    RateLimit(&sessions->limit, rate);
+    sessions->basis = 2166136261U ^ g_random_int();
+    sessions->oldest = sessions->newest = SESSION_NONE;
+
+    for (X = 0; X < size; X++)
+        sessions->slots[X].index = SESSION_NONE;
+
+    // every session starts out on the free list
+    for (X = 0; X < capacity; X++)
+        sessions->pool[X].next = X + 1 < capacity ? X + 1 : SESSION_NONE;
+    sessions->free = 0;
+
+    return sessions;
+}
+
+void SessionsFree(SESSIONS* sessions)
+{
+    guint32 X;
+
+    for (X = 0; X < sessions->capacity; X++) {
+        if (sessions->pool[X].used)
+            ChannelReset(&sessions->pool[X].channel);
+    }
+
+    g_free(sessions->slots);
+    g_free(sessions->pool);
+    g_free(sessions);
+
+    return;
+}
+
+static void SessionUnlink(SESSIONS* sessions, SESSION* session)
+{
+    if (session->prev != SESSION_NONE)
+        sessions->pool[session->prev].next = session->next;
+    else
+        sessions->oldest = session->next;
+
+    if (session->next != SESSION_NONE)
+        sessions->pool[session->next].prev = session->prev;
+    else
+        sessions->newest = session->prev;
+
+    return;
+}
+
+static void SessionAppend(SESSIONS* sessions, SESSION* session)
+{
+    guint32 index = session - sessions->pool;
+
+    session->prev = sessions->newest;
+    session->next = SESSION_NONE;
+
+    if (sessions->newest != SESSION_NONE)
+        sessions->pool[sessions->newest].next = index;
+    else
+        sessions->oldest = index;
+    sessions->newest = index;
+
+    return;
+}
+
+static guint32 SessionSlot(const SESSIONS* sessions, const SESSION_KEY* key, guint32 hash)
+{
+    const SESSION_SLOT* slot;
+    guint32 X;
+
+    for (X = hash & sessions->mask; ; X = (X + 1) & sessions->mask) {
+        slot = &sessions->slots[X];
+        if (slot->index == SESSION_NONE)
+            return X;
+        if (slot->hash == hash &&
+                ! memcmp(&sessions->pool[slot->index].key, key, sizeof(SESSION_KEY)))
+            return X;
+    }
+}
+
+static void SessionUnhash(SESSIONS* sessions, SESSION* session)
+{
+    SESSION_SLOT* slots = sessions->slots;
+    guint32 X, Y, home;
+
+    X = SessionSlot(sessions, &session->key, session->hash);
+    slots[X].index = SESSION_NONE;
+
+    // pull back every entry after the hole that would
+    // otherwise no longer be found from its home slot
+    for (Y = (X + 1) & sessions->mask; slots[Y].index != SESSION_NONE;
+            Y = (Y + 1) & sessions->mask) {
+        home = slots[Y].hash & sessions->mask;
+        if (((Y - home) & sessions->mask) >= ((Y - X) & sessions->mask)) {
+            slots[X] = slots[Y];
+            slots[Y].index = SESSION_NONE;
+            X = Y;
+        }
+    }
+
+    return;
+}
+
+static void SessionHashIn(SESSIONS* sessions, SESSION* session)
+{
+    guint32 X;
+
+    X = SessionSlot(sessions, &session->key, session->hash);
+    sessions->slots[X].hash = session->hash;
+    sessions->slots[X].index = session - sessions->pool;
+
+    return;
+}
+
+SESSION* SessionFind(SESSIONS* sessions, const struct sockaddr* addr)
+{
+    SESSION_KEY key;
+    guint32 X, hash;
+
+    if (! SessionKey(&key, addr))
+        return NULL;
+
+    hash = SessionHash(sessions, &key);
+    X = SessionSlot(sessions, &key, hash);
+    if (sessions->slots[X].index == SESSION_NONE)
+        return NULL;
+
+    return &sessions->pool[sessions->slots[X].index];
+}
+
+SESSION* SessionToken(SESSIONS* sessions, guint64 token)
+{
+    guint32 index = token & SESSION_INDEX_MASK;
+    SESSION* session;
+
+    if (index >= sessions->capacity)
+        return NULL;
+
+    session = &sessions->pool[index];
+    if (! session->used || session->token != token)
+        return NULL;
+
+    return session;
+}
+
+SESSION* SessionCreate(SESSIONS* sessions, const struct sockaddr* addr,
+        const char* name, gint64 now)
+{
+    SESSION* session;
+    SESSION_KEY key;
+    guint32 index;
+
+    // a client asking again, because our answer got lost,
+    // keeps the session and token it already has
+    session = SessionFind(sessions, addr);
+    if (session)
+        return session;
+
+    if (! SessionKey(&key, addr))
+        return NULL;
+
+    if (sessions->free == SESSION_NONE)
+        SessionsExpire(sessions, now);
+    if (sessions->free == SESSION_NONE)
+        return NULL;
+
+    index = sessions->free;
+    session = &sessions->pool[index];
+    sessions->free = session->next;
+
+    session->key = key;
+    session->hash = SessionHash(sessions, &key);
+    // never 0, so that no token is ever 0
+    session->generation = (session->generation + 1) & (0xFFFFFFFFU >> SESSION_INDEX_BITS);
+    if (! session->generation)
+        session->generation = 1;
+    session->token = (guint64)g_random_int() << 32 |
+        (guint64)session->generation << SESSION_INDEX_BITS | index;
+    session->last_seen = now;
+    session->used = 1;
+    g_strlcpy(session->name, name, sizeof(session->name));
+    session->room = 0;
+    ChannelInit(&session->channel);
+    RateInit(&session->rate, &sessions->limit, now);
+
+    SessionHashIn(sessions, session);
+    SessionAppend(sessions, session);
+    sessions->count ++;
+
+    return session;
+}
+
+SESSION* SessionLookup(SESSIONS* sessions, const struct sockaddr* addr,
+        guint64 token, gint64 now)
+{
+    SESSION_KEY key;
+    SESSION* session;
+
+    if (token) {
+        // a stale or forged token finds nothing, even from
+        // an address that has a session of its own
+        session = SessionToken(sessions, token);
+        if (! session || ! SessionKey(&key, addr))
+            return NULL;
+
+        if (memcmp(&session->key, &key, sizeof(SESSION_KEY))) {
+            if (SessionFind(sessions, addr))
+                return NULL;
+
+            SessionUnhash(sessions, session);
+            session->key = key;
+            session->hash = SessionHash(sessions, &key);
+            SessionHashIn(sessions, session);
+        }
+    } else {
+        session = SessionFind(sessions, addr);
+        if (! session)
+            return NULL;
+    }
+
+    session->last_seen = now;
+    SessionUnlink(sessions, session);
+    SessionAppend(sessions, session);
+
+    return session;
+}
+
+void SessionRemove(SESSIONS* sessions, SESSION* session)
+{
+    guint32 index = session - sessions->pool;
+
+    SessionUnhash(sessions, session);
+    SessionUnlink(sessions, session);
+
+    ChannelReset(&session->channel);
+    session->used = 0;
+    session->token = 0;
+    session->next = sessions->free;
+    sessions->free = index;
+    sessions->count --;
+
+    return;
+}
+
+int SessionsExpire(SESSIONS* sessions, gint64 now)
+{
+    SESSION* session;
+    int n = 0;
+
+    // the least recently used sessions are at the front
+    while (sessions->oldest != SESSION_NONE) {
+        session = &sessions->pool[sessions->oldest];
+        if (now - session->last_seen < sessions->idle)
+            break;
+
+        SessionRemove(sessions, session);
+        n ++;
+    }
+
+    return n;
+}
+
+SESSION* SessionRestore(SESSIONS* sessions, const SESSION* saved)
+{
+    guint32 index = saved->token & SESSION_INDEX_MASK;
+    guint32 hash;
+    SESSION* session;
+
+    if (index >= sessions->capacity || sessions->pool[index].used)
+        return NULL;
+
+    // the address hash has another basis in this server
+    hash = SessionHash(sessions, &saved->key);
+    if (sessions->slots[SessionSlot(sessions, &saved->key, hash)].index != SESSION_NONE)
+        return NULL;
+
+    session = &sessions->pool[index];
+    *session = *saved;
+    session->hash = hash;
+    session->used = 1;
+    session->channel.unacked = NULL;
+    session->channel.queued = 0;
+
+    SessionHashIn(sessions, session);
+    SessionAppend(sessions, session);
+    sessions->count ++;
+
+    return session;
+}
+
+void SessionsRelink(SESSIONS* sessions)
+{
+    guint32 X;
+
+    // restoring overwrote the links of whatever slots it took
+    sessions->free = SESSION_NONE;
+    for (X = sessions->capacity; X-- > 0; ) {
+        if (! sessions->pool[X].used) {
+            sessions->pool[X].next = sessions->free;
+            sessions->free = X;
+        }
+    }
+
+    return;
+}
+
+socklen_t SessionAddr(const SESSION* session, struct sockaddr_storage* addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+
+    if (session->key.family == AF_INET) {
+        struct sockaddr_in* in = (struct sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = session->key.port;
+        memcpy(&in->sin_addr, session->key.ip, sizeof(in->sin_addr));
+        return sizeof(struct sockaddr_in);
+    } else if (session->key.family == AF_UNIX) {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, session->key.ip, sizeof(session->key.ip));
+        return offsetof(struct sockaddr_un, sun_path) + sizeof(session->key.ip);
+    } else {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = session->key.port;
+        memcpy(&in6->sin6_addr, session->key.ip, sizeof(in6->sin6_addr));
+        return sizeof(struct sockaddr_in6);
+    }
+}
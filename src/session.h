@@ -0,0 +1,86 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <glib.h>
+#include "channel.h"
+#include "rate.h"
+
+/*
+ * Client sessions.  Every registered client has a SESSION, found either
+ * by the address and port its datagrams come from, through an open
+ * addressing (linear probing) table, or by the token the server handed
+ * it at REGISTER_CLIENT, which every packet carries.
+ *
+ * The token is the session's slot in the pool, the slot's generation
+ * and a random nonce, so a token of a session that has since gone away
+ * never finds the slot's next owner.  A packet with a valid token from
+ * a new address moves the session there (a NAT rebinding).
+ *
+ * All memory is taken up front for SESSIONS.capacity sessions: finding,
+ * creating and removing a session never allocates.  Sessions are kept
+ * in order of last use, so the idle ones are evicted from the front.
+ */
+
+#define SESSION_DEFAULT_MAX     65536
+#define SESSION_DEFAULT_IDLE    60          // seconds
+#define SESSION_NAME_MAX        31
+#define SESSION_INDEX_BITS      20          // at most 1M sessions
+#define SESSION_INDEX_MASK      ((1U << SESSION_INDEX_BITS) - 1)
+#define SESSION_NONE            ((guint32)-1)
+
+typedef struct _SESSION_KEY {
+    guint8 ip[16];
+    guint16 port;
+    guint16 family;
+} SESSION_KEY;
+
+typedef struct _SESSION {
+    SESSION_KEY key;
+    guint32 hash;
+    guint32 generation;
+    guint64 token;
+    gint64 last_seen;   // g_get_monotonic_time()
+    guint32 prev, next; // in order of last use, or the free list
+    int used;
+
+    char name[SESSION_NAME_MAX + 1];
+    guint32 room;       // the last room it created, 0 for none
+    CHANNEL channel;
+    RATE rate;
+} SESSION;
+
+typedef struct _SESSION_SLOT {
+    guint32 hash;
+    guint32 index;      // SESSION_NONE when the slot is empty
+} SESSION_SLOT;
+
+typedef struct _SESSIONS {
+    SESSION* pool;
+    guint32 capacity;
+    guint32 count;
+    guint32 free;       // first unused session
+    guint32 oldest, newest;
+
+    SESSION_SLOT* slots;
+    guint32 mask;       // slots - 1, a power of two at least 2 * capacity
+
+    guint32 basis;      // of the address hash, random per server
+    gint64 idle;        // microseconds a session may stay silent
+    RATE_LIMIT limit;   // on every session's packets
+} SESSIONS;
+
+SESSIONS* SessionsAlloc(guint32 capacity, gint64 idle, gint64 rate);
+void SessionsFree(SESSIONS*);
+int SessionsExpire(SESSIONS*, gint64 now);
+
+SESSION* SessionCreate(SESSIONS*, const struct sockaddr*, const char* name, gint64 now);
+SESSION* SessionFind(SESSIONS*, const struct sockaddr*);
+SESSION* SessionToken(SESSIONS*, guint64 token);
+SESSION* SessionLookup(SESSIONS*, const struct sockaddr*, guint64 token, gint64 now);
+void SessionRemove(SESSIONS*, SESSION*);
+socklen_t SessionAddr(const SESSION*, struct sockaddr_storage*);
+
+// for a hot restart (handoff.h): sessions go back in the slots their
+// tokens name, oldest first, and only then is the free list rebuilt
+SESSION* SessionRestore(SESSIONS*, const SESSION*);
+void SessionsRelink(SESSIONS*);
@@ -0,0 +1,412 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "bot.h"
+#include "sim.h"
+#include "row.h"
+#include "snap.h"
+#include "telemetry.h"
+
+/*
+ * Every worker owns a contiguous range of game indices and plays them
+ * from the front.  A worker that runs dry steals the back half of the
+ * next non-empty range it finds, so that a few very long games can't
+ * leave the rest of the pool idle.
+ */
+typedef struct _SIM_WORKER {
+    GMutex lock;
+    int lo, hi;     // games [lo, hi) still owned by this worker
+    int id;
+    struct _SIM* sim;
+    GThread* thread;
+} SIM_WORKER;
+
+typedef struct _SIM {
+    STATE* settings;
+    REPLAY** replays;
+    int nreplays;
+    SIM_RESULT* results;
+    SIM_WORKER* workers;
+    int nworkers;
+} SIM;
+
+static guint64 SimSeed(guint64 seed, int index)
+{
+    // splitmix64 finalizer, so neighbouring games get unrelated seeds
+    guint64 z = seed + (guint64)(index + 1) * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+static void SimGame(SIM* sim, int index, SIM_RESULT* result)
+{
+    STATE* game;
+    BOT* bot = NULL;
+    REPLAY* replay = NULL;
+    guint64 seed;
+    gint64 start;
+    unsigned long n;
+    int cursor = 0, action;
+
+    memset(result, 0, sizeof(SIM_RESULT));
+
+    game = (STATE*)malloc(sizeof(STATE));
+    if (! game)
+        return;
+
+    // every game gets its own copy of the settings, and nothing else
+    memcpy(game, sim->settings, sizeof(STATE));
+    game->queue = NULL;
+    game->field = NULL;
+    game->tetrad = NULL;
+    game->fieldwin = NULL;
+    game->statuswin = NULL;
+    game->linebuf = NULL;
+    game->effects = NULL;
+    game->render_data = NULL;
+    game->replays = NULL;
+    game->record = NULL;
+    game->prof = NULL;
+    game->game_id = index;
+
+    if (sim->nreplays) {
+        replay = sim->replays[index % sim->nreplays];
+        seed = replay->seed;
+    } else {
+        seed = SimSeed(sim->settings->seed, index);
+        bot = BotAlloc(game);
+    }
+
+    if ((! replay && ! bot) || ! GameStart(game, seed) ||
+            (replay && replay->snap && ! SnapLoad(game, replay->snap, replay->snap_size))) {
+        fprintf(stderr, "<ntetris>\tCould not start game %d.\n", index);
+        if (bot)
+            BotFree(bot);
+        GameFree(game);
+        return;
+    }
+
+    start = g_get_monotonic_time();
+    for (n = 0; n < game->sim_max_ticks; n++) {
+        // a replay may go on with a reset after the game is over
+        if (game->status == STATUS_GAMEOVER ||
+                (game->game_over_f && (! replay || cursor >= replay->length)))
+            break;
+
+        game->ticks ++;
+
+        if (replay) {
+            // every key of the frame; a reset starts the count again
+            while (cursor < replay->length && replay->ticks[cursor] == game->ticks) {
+                action = replay->actions[cursor++];
+                EventAction(game, action);
+                if (action == TETRIS_KEY_RESET)
+                    break;
+            }
+        } else {
+            action = BotInput(game, bot);
+            if (action >= 0)
+                EventAction(game, action);
+        }
+
+        Update(game);
+    }
+
+    GameTelemetry(game, TELEMETRY_END, game->lines, game->pieces, game->level, 0);
+
+    result->usec = g_get_monotonic_time() - start;
+    result->lines = game->lines;
+    result->score = game->score;
+    result->level = game->level;
+    result->pieces = game->pieces;
+    result->ticks = n;
+
+    if (bot)
+        BotFree(bot);
+    GameFree(game);
+
+    return;
+}
+
+static int SimTake(SIM_WORKER* worker)
+{
+    int game = -1;
+
+    g_mutex_lock(&worker->lock);
+    if (worker->lo < worker->hi)
+        game = worker->lo ++;
+    g_mutex_unlock(&worker->lock);
+
+    return game;
+}
+
+static int SimSteal(SIM* sim, SIM_WORKER* thief)
+{
+    SIM_WORKER* victim;
+    int A, lo, hi;
+
+    for (A = 1; A < sim->nworkers; A++) {
+        victim = &sim->workers[(thief->id + A) % sim->nworkers];
+
+        g_mutex_lock(&victim->lock);
+        hi = victim->hi;
+        lo = hi - (victim->hi - victim->lo + 1) / 2;
+        victim->hi = lo;
+        g_mutex_unlock(&victim->lock);
+
+        if (lo < hi) {
+            // keep the first stolen game, the rest can be stolen back
+            g_mutex_lock(&thief->lock);
+            thief->lo = lo + 1;
+            thief->hi = hi;
+            g_mutex_unlock(&thief->lock);
+
+            return lo;
+        }
+    }
+
+    return -1;
+}
+
+static gpointer SimWorker(gpointer data)
+{
+    SIM_WORKER* worker = (SIM_WORKER*)data;
+    SIM* sim = worker->sim;
+    int game;
+
+    while ((game = SimTake(worker)) >= 0 ||
+            (game = SimSteal(sim, worker)) >= 0) {
+        SimGame(sim, game, &sim->results[game]);
+    }
+
+    return NULL;
+}
+
+static int SimCompare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double SimPercentile(double* values, int n, int p)
+{
+    int X = (p * n + 99) / 100 - 1;
+
+    return values[X < 0 ? 0 : X];
+}
+
+static void SimReport(const char* name, double* values, int n)
+{
+    double mean = 0;
+    int X;
+
+    qsort(values, n, sizeof(double), SimCompare);
+    for (X = 0; X < n; X++)
+        mean += values[X];
+    mean /= n;
+
+    printf("%-10s %12.2f %12.2f %12.2f %12.2f %12.2f %12.2f\n", name,
+            mean, values[0],
+            SimPercentile(values, n, 50),
+            SimPercentile(values, n, 90),
+            SimPercentile(values, n, 99),
+            values[n - 1]);
+
+    return;
+}
+
+int Simulate(STATE* settings)
+{
+    SIM sim;
+    SIM_RESULT* result;
+    double* values;
+    double seconds, ticks = 0;
+    gint64 start;
+    int games, threads, A;
+
+    memset(&sim, 0, sizeof(SIM));
+    sim.settings = settings;
+
+    games = settings->sim_games;
+    threads = settings->sim_threads ?
+        settings->sim_threads : (int)g_get_num_processors();
+    if (threads > games)
+        threads = games;
+
+    if (settings->replays) {
+        sim.nreplays = g_queue_get_length(settings->replays);
+        sim.replays = g_new0(REPLAY*, sim.nreplays);
+
+        for (A = 0; A < sim.nreplays; A++) {
+            const char* path = g_queue_peek_nth(settings->replays, A);
+
+            sim.replays[A] = ReplayLoad(path);
+            if (! sim.replays[A]) {
+                fprintf(stderr, "<ntetris>\tCould not load replay \"%s\".\n", path);
+                while (A--)
+                    ReplayFree(sim.replays[A]);
+                g_free(sim.replays);
+                return 1;
+            }
+        }
+    }
+
+    sim.results = g_new0(SIM_RESULT, games);
+    sim.workers = g_new0(SIM_WORKER, threads);
+    sim.nworkers = threads;
+
+    for (A = 0; A < threads; A++) {
+        g_mutex_init(&sim.workers[A].lock);
+        sim.workers[A].id = A;
+        sim.workers[A].sim = &sim;
+        sim.workers[A].lo = (int)((gint64)games * A / threads);
+        sim.workers[A].hi = (int)((gint64)games * (A + 1) / threads);
+    }
+
+    start = g_get_monotonic_time();
+    for (A = 0; A < threads; A++)
+        sim.workers[A].thread = g_thread_new("ntetris-sim", SimWorker, &sim.workers[A]);
+    for (A = 0; A < threads; A++)
+        g_thread_join(sim.workers[A].thread);
+    seconds = (g_get_monotonic_time() - start) / 1e6;
+
+    for (A = 0; A < games; A++)
+        ticks += sim.results[A].ticks;
+
+    printf("%s: %d games on %d threads in %.2fs, seed %llu\n",
+            gs_appname, games, threads, seconds,
+            (unsigned long long)settings->seed);
+    printf("%.1f games/s, %.0f ticks/s, %s row kernels\n\n",
+            games / seconds, ticks / seconds, RowKernel());
+    printf("%-10s %12s %12s %12s %12s %12s %12s\n",
+            "", "mean", "min", "p50", "p90", "p99", "max");
+
+    values = g_new(double, games);
+
+#define SIM_REPORT(name, expr) \
+    do { \
+        for (A = 0; A < games; A++) { \
+            result = &sim.results[A]; \
+            values[A] = (expr); \
+        } \
+        SimReport(name, values, games); \
+    } while (0)
+
+    SIM_REPORT("lines", result->lines);
+    SIM_REPORT("score", result->score);
+    SIM_REPORT("level", result->level);
+    SIM_REPORT("pieces", result->pieces);
+    SIM_REPORT("pieces/s", result->ticks ?
+            result->pieces * 1000.0 / (result->ticks * REFRESH_DELAY) : 0);
+    SIM_REPORT("ticks", result->ticks);
+    SIM_REPORT("usec", result->usec);
+
+#undef SIM_REPORT
+
+    g_free(values);
+    for (A = 0; A < threads; A++)
+        g_mutex_clear(&sim.workers[A].lock);
+    for (A = 0; A < sim.nreplays; A++)
+        ReplayFree(sim.replays[A]);
+    g_free(sim.replays);
+    g_free(sim.workers);
+    g_free(sim.results);
+
+    return 0;
+}
+
+REPLAY* ReplayLoad(const char* path)
+{
+    FILE* file;
+    REPLAY* replay;
+    char line[TETRIS_BUFSIZE];
+    char name[TETRIS_BUFSIZE];
+    unsigned long long seed;
+    GString* snap;
+    unsigned long tick, last = 0;
+    int A, size = 0;
+
+    file = fopen(path, "r");
+    if (! file)
+        return NULL;
+
+    replay = g_new0(REPLAY, 1);
+    snap = g_string_new(NULL);
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "seed %llu", &seed) == 1) {
+            replay->seed = seed;
+            continue;
+        }
+
+        if (sscanf(line, "snap %255s", name) == 1) {
+            g_string_append(snap, name);
+            continue;
+        }
+
+        if (sscanf(line, "%lu %255s", &tick, name) != 2)
+            break;
+
+        for (A = 0; A < TETRIS_KEYS; A++) {
+            if (! strcmp(keymap_desc[A], name))
+                break;
+        }
+
+        // ticks only go back after a reset, which begins a new game
+        // whose ticks count from 1 again
+        if (A >= TETRIS_KEYS || tick == 0 || tick < last)
+            break;
+        last = A == TETRIS_KEY_RESET ? 0 : tick;
+
+        if (replay->length == size) {
+            size = size ? 2 * size : 64;
+            replay->ticks = g_realloc(replay->ticks, size * sizeof(unsigned long));
+            replay->actions = g_realloc(replay->actions, size * sizeof(int));
+        }
+
+        replay->ticks[replay->length] = tick;
+        replay->actions[replay->length] = A;
+        replay->length ++;
+    }
+
+    // stopped short of the end: not a recording
+    if (! feof(file)) {
+        g_string_free(snap, TRUE);
+        ReplayFree(replay);
+        fclose(file);
+        return NULL;
+    }
+
+    if (snap->len)
+        replay->snap = g_base64_decode(snap->str, &replay->snap_size);
+
+    g_string_free(snap, TRUE);
+    fclose(file);
+
+    return replay;
+}
+
+void ReplayFree(REPLAY* replay)
+{
+    g_free(replay->snap);
+    g_free(replay->ticks);
+    g_free(replay->actions);
+    g_free(replay);
+
+    return;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "tetris.h"
+
+/*
+ * Headless batch simulation: `ntetris --simulate N` plays N games
+ * without a terminal, spread over a work-stealing pool of threads,
+ * and prints the distribution of the results.  The games are not
+ * recorded: --record is refused with --simulate.
+ */
+
+#define REPLAY_SNAP_LINE    76  // base64 characters on a "snap" line
+
+typedef struct _REPLAY {
+    guint64 seed;
+    void* snap;         // of a resumed game, which starts from it
+    gsize snap_size;
+    int length;
+    unsigned long* ticks;
+    int* actions;
+} REPLAY;
+
+typedef struct _SIM_RESULT {
+    int lines;
+    int score;
+    int level;
+    int pieces;
+    unsigned long ticks;
+    gint64 usec;
+} SIM_RESULT;
+
+int Simulate(STATE*);
+
+REPLAY* ReplayLoad(const char*);
+void ReplayFree(REPLAY*);
@@ -0,0 +1,338 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "tetris.h"
+#include "snap.h"
+#include "row.h"
+
+static void SnapTetradSave(SNAP_TETRAD* snap, const TETRAD* tetrad)
+{
+    snap->shape = tetrad->shape;
+    snap->color = tetrad->color;
+    snap->x = tetrad->x;
+    snap->y = tetrad->y;
+    snap->x0 = tetrad->x0;
+    snap->y0 = tetrad->y0;
+    snap->t = tetrad->t;
+    snap->rot = tetrad->rot;
+
+    return;
+}
+
+static TETRAD* SnapTetradLoad(const SNAP_TETRAD* snap)
+{
+    TETRAD* tetrad;
+
+    tetrad = TetradAlloc(snap->shape, snap->x, snap->y);
+    if (! tetrad)
+        return NULL;
+
+    tetrad->color = snap->color;
+    tetrad->x0 = snap->x0;
+    tetrad->y0 = snap->y0;
+    tetrad->t = snap->t;
+    tetrad->rot = snap->rot;
+
+    return tetrad;
+}
+
+static int SnapTetradValid(const SNAP_TETRAD* snap)
+{
+    return snap->shape >= 0 && snap->shape < 7 &&
+        snap->rot >= 0 && snap->rot < 4;
+}
+
+size_t SnapSize(const STATE* state)
+{
+    return sizeof(SNAP) + (size_t)state->Bx * state->By;
+}
+
+size_t SnapSave(const STATE* state, void* buffer, size_t size)
+{
+    SNAP* snap = (SNAP*)buffer;
+    int X, n;
+
+    n = state->queue ? g_queue_get_length(state->queue) : 0;
+    if (size < SnapSize(state) || n > SNAP_QUEUE)
+        return 0;
+
+    memset(snap, 0, sizeof(SNAP));
+    snap->magic = SNAP_MAGIC;
+    snap->version = SNAP_VERSION;
+    snap->size = SnapSize(state);
+    snap->Bx = state->Bx;
+    snap->By = state->By;
+
+    snap->init_level = state->init_level;
+    snap->init_speed = state->init_speed;
+    snap->delta = state->delta;
+    snap->do_rotate_timeout_reset = state->do_rotate_timeout_reset;
+    snap->queue_size = state->queue_size;
+
+    snap->seed = state->seed;
+    snap->rng = state->rng;
+    snap->ticks = state->ticks;
+
+    snap->status = state->status;
+    snap->speed = state->speed;
+    snap->level = state->level;
+    snap->lines = state->lines;
+    snap->score = state->score;
+    snap->pieces = state->pieces;
+    snap->game_over_f = state->game_over_f;
+    snap->pause_f = state->pause_f;
+
+    if (state->tetrad) {
+        snap->has_tetrad = 1;
+        SnapTetradSave(&snap->tetrad, state->tetrad);
+    }
+
+    snap->queue_length = n;
+    for (X = 0; X < n; X++)
+        SnapTetradSave(&snap->queue[X], g_queue_peek_nth(state->queue, X));
+
+    // rows above the top are empty
+    memset(snap->field, 0, (size_t)state->Bx * state->field->top);
+    for (X = state->field->top; X < state->By; X++)
+        memcpy(snap->field + (size_t)X * state->Bx, FieldRow(state->field, X), state->Bx);
+
+    return snap->size;
+}
+
+static guint64 SnapMix(guint64 hash, guint64 value)
+{
+    int X;
+
+    // FNV-1a, a byte at a time, least significant first
+    for (X = 0; X < 8; X++) {
+        hash ^= (value >> (8 * X)) & 0xFF;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+guint64 SnapHash(const STATE* state)
+{
+    const TETRAD* tetrad;
+    const char* row;
+    guint64 hash = 14695981039346656037ULL;
+    guint64 bits;
+    int X, Y, n;
+
+    /*
+     * Only what decides how the game goes on, so that two copies of a
+     * game agree however they were kept: the colors, the tetrads'
+     * previous positions and the like are left out, and the field
+     * counts only as occupied or not.
+     */
+    hash = SnapMix(hash, state->rng);
+    hash = SnapMix(hash, state->ticks);
+    hash = SnapMix(hash, state->level);
+    hash = SnapMix(hash, state->lines);
+    hash = SnapMix(hash, state->score);
+    hash = SnapMix(hash, state->pieces);
+    hash = SnapMix(hash, state->game_over_f);
+    hash = SnapMix(hash, state->pause_f);
+
+    tetrad = state->tetrad;
+    if (tetrad) {
+        hash = SnapMix(hash, tetrad->shape);
+        hash = SnapMix(hash, tetrad->x);
+        hash = SnapMix(hash, tetrad->y);
+        hash = SnapMix(hash, tetrad->rot);
+        hash = SnapMix(hash, tetrad->t);
+    }
+
+    n = state->queue ? g_queue_get_length(state->queue) : 0;
+    for (X = 0; X < n; X++) {
+        tetrad = g_queue_peek_nth(state->queue, X);
+        hash = SnapMix(hash, tetrad->shape);
+    }
+
+    // empty rows count for nothing, wherever the field's top is
+    for (Y = state->field->top; Y < state->By; Y++) {
+        row = FieldRow(state->field, Y);
+        for (X = 0, bits = 0; X < state->Bx; X++) {
+            bits = bits << 1 | (row[X] != 0);
+            if (X % 64 == 63 || X == state->Bx - 1) {
+                if (bits)
+                    hash = SnapMix(SnapMix(hash, Y), (guint64)X << 56 ^ bits);
+                bits = 0;
+            }
+        }
+    }
+
+    return hash;
+}
+
+int SnapLoad(STATE* state, const void* buffer, size_t size)
+{
+    const SNAP* snap = (const SNAP*)buffer;
+    const char* row;
+    TETRAD* tetrad;
+    size_t cells;
+    int X, Y;
+
+    // check everything before touching the game
+    if (size < sizeof(SNAP) || snap->magic != SNAP_MAGIC ||
+            snap->version != SNAP_VERSION)
+        return 0;
+
+    if (snap->Bx < 1 || snap->Bx > 1000 || snap->By < 1 || snap->By > 1000)
+        return 0;
+
+    cells = (size_t)snap->Bx * snap->By;
+    if (snap->size != sizeof(SNAP) + cells || size < snap->size)
+        return 0;
+
+    // settings past what the options allow would not even start a game
+    if (snap->queue_size < 0 || snap->queue_size > SNAP_QUEUE ||
+            snap->init_speed < 1 || snap->init_speed > SNAP_SPEED ||
+            snap->delta < 0 || snap->delta > SNAP_SPEED ||
+            snap->init_level < 1 || snap->init_level > 1000)
+        return 0;
+    if (snap->lines < 0 || snap->lines / 10 > SNAP_LEVEL ||
+            snap->level < 0 || snap->level > SNAP_LEVEL + 1000)
+        return 0;
+
+    // between ticks the queue is always refilled to its size
+    if (snap->queue_length != snap->queue_size)
+        return 0;
+    if (snap->has_tetrad && ! SnapTetradValid(&snap->tetrad))
+        return 0;
+    for (X = 0; X < snap->queue_length; X++) {
+        if (! SnapTetradValid(&snap->queue[X]))
+            return 0;
+    }
+
+    for (X = 0; X < cells; X++) {
+        if ((snap->field[X] < 0 || snap->field[X] > 7) && snap->field[X] != CLEARED)
+            return 0;
+    }
+
+    if (state->field && (state->field->Bx != snap->Bx || state->field->By != snap->By)) {
+        FieldFree(state->field);
+        state->field = NULL;
+    }
+    if (! state->field)
+        state->field = FieldAlloc(snap->Bx, snap->By);
+
+    if (! state->queue)
+        state->queue = g_queue_new();
+    while ((tetrad = g_queue_pop_tail(state->queue)))
+        TetradFree(tetrad);
+    if (state->tetrad) {
+        TetradFree(state->tetrad);
+        state->tetrad = NULL;
+    }
+
+    state->Bx = snap->Bx;
+    state->By = snap->By;
+
+    state->init_level = snap->init_level;
+    state->init_speed = snap->init_speed;
+    state->delta = snap->delta;
+    state->do_rotate_timeout_reset = snap->do_rotate_timeout_reset;
+    state->queue_size = snap->queue_size;
+
+    state->seed = snap->seed;
+    state->rng = snap->rng;
+    state->ticks = snap->ticks;
+
+    state->status = snap->status;
+    state->speed = snap->speed;
+    state->level = snap->level;
+    state->lines = snap->lines;
+    state->score = snap->score;
+    state->pieces = snap->pieces;
+    state->game_over_f = snap->game_over_f;
+    state->pause_f = snap->pause_f;
+
+    if (snap->has_tetrad)
+        state->tetrad = SnapTetradLoad(&snap->tetrad);
+    for (X = 0; X < snap->queue_length; X++)
+        g_queue_push_tail(state->queue, SnapTetradLoad(&snap->queue[X]));
+
+    // only the occupied rows take up memory
+    FieldClear(state->field);
+    for (Y = 0; Y < snap->By; Y++) {
+        row = snap->field + (size_t)Y * snap->Bx;
+        if (! RowEmpty(row, snap->Bx))
+            memcpy(FieldWrite(state->field, Y), row, snap->Bx);
+    }
+
+    return 1;
+}
+
+int SnapWrite(const STATE* state, const char* path)
+{
+    char tmp[TETRIS_BUFSIZE];
+    void* buffer;
+    size_t size;
+    FILE* file;
+    int ret = 0;
+
+    size = SnapSize(state);
+    buffer = malloc(size);
+    if (! buffer)
+        return 0;
+
+    if (! SnapSave(state, buffer, size)) {
+        free(buffer);
+        return 0;
+    }
+
+    // write next to the old snapshot and swap, so a crash
+    // while saving never leaves a torn file behind
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    file = fopen(tmp, "wb");
+    if (file) {
+        ret = fwrite(buffer, size, 1, file) == 1;
+        ret = fclose(file) == 0 && ret;
+        ret = ret && rename(tmp, path) == 0;
+        if (! ret)
+            unlink(tmp);
+    }
+
+    free(buffer);
+
+    return ret;
+}
+
+int SnapRead(STATE* state, const char* path)
+{
+    struct stat st;
+    void* map;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(SNAP)) {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    ret = SnapLoad(state, map, st.st_size);
+    munmap(map, st.st_size);
+
+    return ret;
+}
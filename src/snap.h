@@ -0,0 +1,73 @@
+#pragma once
+
+#include "tetris.h"
+
+/*
+ * Game snapshots.  A snapshot is one flat, pointer-free block: a fixed
+ * header with the counters, flags, random state, current tetrad and
+ * queue, followed by the Bx * By field.  It can be copied, written to
+ * a file, mapped or sent over the network as is, and SnapLoad() turns
+ * it back into a running game in any STATE.
+ *
+ * Snapshots are stored in host byte order; a snapshot from a host of
+ * the other endianness fails the magic check.  Bump SNAP_VERSION
+ * whenever the layout changes.
+ */
+
+#define SNAP_MAGIC      0x4e53544eU     // "NTSN" on little-endian hosts
+#define SNAP_VERSION    2
+#define SNAP_QUEUE      32
+#define SNAP_SPEED      1000    // most ticks a tetrad can take to fall a row
+#define SNAP_LEVEL      1000000 // so that delta * level stays in an int
+
+typedef struct _SNAP_TETRAD {
+    gint32 shape;
+    gint32 color;
+    gint32 x, y;
+    gint32 x0, y0;
+    gint32 t;
+    gint32 rot;
+} SNAP_TETRAD;
+
+typedef struct _SNAP {
+    guint32 magic;
+    guint32 version;
+    guint32 size;       // of the whole snapshot, field included
+    guint32 Bx, By;
+
+    // settings that change how the game plays
+    gint32 init_level;
+    gint32 init_speed;
+    gint32 delta;
+    gint32 do_rotate_timeout_reset;
+    gint32 queue_size;
+
+    guint64 seed;
+    guint64 rng;
+    guint64 ticks;
+
+    gint32 status;
+    gint32 speed;
+    gint32 level;
+    gint32 lines;
+    gint32 score;
+    gint32 pieces;
+    gint32 game_over_f;
+    gint32 pause_f;
+
+    gint32 has_tetrad;
+    gint32 queue_length;    // queue[0] is the head of state->queue
+    SNAP_TETRAD tetrad;
+    SNAP_TETRAD queue[SNAP_QUEUE];
+
+    char field[];           // Bx * By, row by row
+} SNAP;
+
+size_t SnapSize(const STATE*);
+size_t SnapSave(const STATE*, void* buffer, size_t size);
+int SnapLoad(STATE*, const void* buffer, size_t size);
+
+guint64 SnapHash(const STATE*);
+
+int SnapWrite(const STATE*, const char* path);
+int SnapRead(STATE*, const char* path);
@@ -0,0 +1,342 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "telemetry.h"
+
+#define TELEMETRY_MASK      (TELEMETRY_RING - 1)
+#define TELEMETRY_VARINT    10  // bytes of the longest varint
+
+static gint64 TelemetryGet(const TELEMETRY_RECORD* record, int column)
+{
+    switch (column) {
+        case TELEMETRY_COL_GAME:    return (gint64)record->game;
+        case TELEMETRY_COL_TICK:    return (gint64)record->tick;
+        case TELEMETRY_COL_TYPE:    return record->type;
+        case TELEMETRY_COL_A:       return record->a;
+        case TELEMETRY_COL_B:       return record->b;
+        case TELEMETRY_COL_C:       return record->c;
+        case TELEMETRY_COL_D:       return record->d;
+        default:                    return record->score;
+    }
+}
+
+static void TelemetrySet(TELEMETRY_RECORD* record, int column, gint64 value)
+{
+    switch (column) {
+        case TELEMETRY_COL_GAME:    record->game = (guint64)value; break;
+        case TELEMETRY_COL_TICK:    record->tick = (guint64)value; break;
+        case TELEMETRY_COL_TYPE:    record->type = (gint32)value; break;
+        case TELEMETRY_COL_A:       record->a = (gint32)value; break;
+        case TELEMETRY_COL_B:       record->b = (gint32)value; break;
+        case TELEMETRY_COL_C:       record->c = (gint32)value; break;
+        case TELEMETRY_COL_D:       record->d = (gint32)value; break;
+        default:                    record->score = (gint32)value; break;
+    }
+
+    return;
+}
+
+void TelemetryPush(TELEMETRY* telemetry, const TELEMETRY_RECORD* record)
+{
+    TELEMETRY_SLOT* slot;
+    guint64 pos, seq;
+    gint64 diff;
+
+    // a slot is free for the producer that claims position pos
+    // once its seq is pos, and holds a record once it is pos + 1
+    pos = __atomic_load_n(&telemetry->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &telemetry->slots[pos & TELEMETRY_MASK];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        diff = (gint64)(seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&telemetry->head, &pos, pos + 1, TRUE,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            // the writer is a whole ring behind
+            __atomic_fetch_add(&telemetry->drops, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&telemetry->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->record = *record;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return;
+}
+
+void TelemetryEvent(TELEMETRY* telemetry, guint64 game, guint64 tick, int type,
+        int a, int b, int c, int d, int score)
+{
+    TELEMETRY_RECORD record;
+
+    record.game = game;
+    record.tick = tick;
+    record.type = type;
+    record.a = a;
+    record.b = b;
+    record.c = c;
+    record.d = d;
+    record.score = score;
+    TelemetryPush(telemetry, &record);
+
+    return;
+}
+
+static int TelemetryPop(TELEMETRY* telemetry, TELEMETRY_RECORD* record)
+{
+    guint64 pos = telemetry->tail;
+    TELEMETRY_SLOT* slot = &telemetry->slots[pos & TELEMETRY_MASK];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+        return 0;
+
+    *record = slot->record;
+    // free for whoever claims it on the next lap
+    __atomic_store_n(&slot->seq, pos + TELEMETRY_RING, __ATOMIC_RELEASE);
+    telemetry->tail = pos + 1;
+
+    return 1;
+}
+
+static gint TelemetryCompare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const TELEMETRY_RECORD* x = (const TELEMETRY_RECORD*)a;
+    const TELEMETRY_RECORD* y = (const TELEMETRY_RECORD*)b;
+
+    if (x->game != y->game)
+        return x->game < y->game ? -1 : 1;
+
+    return (x->tick > y->tick) - (x->tick < y->tick);
+}
+
+static guint32 TelemetryEncode(guint8* out, const TELEMETRY_RECORD* records,
+        guint32 count, int column)
+{
+    guint64 zigzag;
+    gint64 value, last = 0;
+    guint32 X, n = 0;
+
+    for (X = 0; X < count; X++) {
+        value = TelemetryGet(&records[X], column);
+        zigzag = ((guint64)(value - last) << 1) ^ (guint64)((value - last) >> 63);
+        last = value;
+
+        while (zigzag >= 0x80) {
+            out[n++] = (zigzag & 0x7F) | 0x80;
+            zigzag >>= 7;
+        }
+        out[n++] = zigzag;
+    }
+
+    return n;
+}
+
+static int TelemetryFlush(TELEMETRY* telemetry)
+{
+    TELEMETRY_BLOCK_HEADER header;
+    guint8* out = telemetry->column;
+    size_t total = 0;
+    int X;
+
+    // a stable sort: each game's records stay in the order they came
+    g_qsort_with_data(telemetry->block, telemetry->count, sizeof(TELEMETRY_RECORD),
+            TelemetryCompare, NULL);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TELEMETRY_BLOCK_MAGIC;
+    header.count = telemetry->count;
+    header.drops = __atomic_exchange_n(&telemetry->drops, 0, __ATOMIC_RELAXED);
+
+    for (X = 0; X < TELEMETRY_COLUMNS; X++) {
+        header.size[X] = TelemetryEncode(out + total, telemetry->block,
+                telemetry->count, X);
+        total += header.size[X];
+    }
+
+    telemetry->count = 0;
+
+    if (fwrite(&header, sizeof(header), 1, telemetry->file) != 1 ||
+            fwrite(out, 1, total, telemetry->file) != total)
+        return 0;
+
+    return fflush(telemetry->file) == 0;
+}
+
+static gpointer TelemetryWriter(gpointer data)
+{
+    TELEMETRY* telemetry = (TELEMETRY*)data;
+    TELEMETRY_RECORD* record;
+    gint64 now;
+    int quit, got;
+
+    for (;;) {
+        // seen before draining: whatever was pushed before
+        // TelemetryClose() is in the ring by now
+        quit = __atomic_load_n(&telemetry->quit, __ATOMIC_ACQUIRE);
+
+        got = 0;
+        while (telemetry->count < TELEMETRY_BLOCK) {
+            record = &telemetry->block[telemetry->count];
+            if (! TelemetryPop(telemetry, record))
+                break;
+            if (! telemetry->count)
+                telemetry->oldest = g_get_monotonic_time();
+            telemetry->count ++;
+            got = 1;
+        }
+
+        now = g_get_monotonic_time();
+        if (telemetry->count == TELEMETRY_BLOCK || (telemetry->count &&
+                    (quit || now - telemetry->oldest >= TELEMETRY_FLUSH))) {
+            if (! TelemetryFlush(telemetry))
+                fprintf(stderr, "<ntetris>\tCould not write telemetry.\n");
+            continue;
+        }
+
+        if (quit && ! got)
+            break;
+        if (! got)
+            g_usleep(TELEMETRY_IDLE);
+    }
+
+    return NULL;
+}
+
+TELEMETRY* TelemetryOpen(const char* path, guint32 tick_usec)
+{
+    TELEMETRY* telemetry;
+    TELEMETRY_HEADER header;
+    guint64 X;
+
+    telemetry = g_new0(TELEMETRY, 1);
+    telemetry->file = fopen(path, "wb");
+    if (! telemetry->file) {
+        g_free(telemetry);
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.tick_usec = tick_usec;
+    if (fwrite(&header, sizeof(header), 1, telemetry->file) != 1) {
+        fclose(telemetry->file);
+        g_free(telemetry);
+        return NULL;
+    }
+
+    telemetry->slots = g_new(TELEMETRY_SLOT, TELEMETRY_RING);
+    for (X = 0; X < TELEMETRY_RING; X++)
+        telemetry->slots[X].seq = X;
+    telemetry->block = g_new(TELEMETRY_RECORD, TELEMETRY_BLOCK);
+    telemetry->column = g_malloc((size_t)TELEMETRY_BLOCK * TELEMETRY_VARINT *
+            TELEMETRY_COLUMNS);
+
+    telemetry->thread = g_thread_new("ntetris-telemetry", TelemetryWriter, telemetry);
+
+    return telemetry;
+}
+
+void TelemetryClose(TELEMETRY* telemetry)
+{
+    if (! telemetry)
+        return;
+
+    __atomic_store_n(&telemetry->quit, 1, __ATOMIC_RELEASE);
+    g_thread_join(telemetry->thread);
+
+    fclose(telemetry->file);
+    g_free(telemetry->column);
+    g_free(telemetry->block);
+    g_free(telemetry->slots);
+    g_free(telemetry);
+
+    return;
+}
+
+int TelemetryReadHeader(FILE* file, TELEMETRY_HEADER* header)
+{
+    if (fread(header, sizeof(TELEMETRY_HEADER), 1, file) != 1)
+        return 0;
+
+    return header->magic == TELEMETRY_MAGIC && header->version == TELEMETRY_VERSION;
+}
+
+static int TelemetryDecode(const guint8* in, guint32 size, TELEMETRY_RECORD* records,
+        guint32 count, int column)
+{
+    guint64 zigzag;
+    gint64 last = 0;
+    guint32 X, n = 0;
+    int shift;
+
+    for (X = 0; X < count; X++) {
+        zigzag = 0;
+        for (shift = 0; ; shift += 7) {
+            if (n >= size || shift > 63)
+                return 0;
+            zigzag |= (guint64)(in[n] & 0x7F) << shift;
+            if (! (in[n++] & 0x80))
+                break;
+        }
+
+        last += (gint64)(zigzag >> 1) ^ -(gint64)(zigzag & 1);
+        TelemetrySet(&records[X], column, last);
+    }
+
+    return n == size;
+}
+
+int TelemetryReadBlock(FILE* file, TELEMETRY_RECORD** records, guint32* count,
+        guint32* drops)
+{
+    TELEMETRY_BLOCK_HEADER header;
+    guint8* data;
+    size_t total = 0, offset = 0;
+    int X;
+
+    if (fread(&header, sizeof(header), 1, file) != 1)
+        return feof(file) ? 0 : -1;
+    if (header.magic != TELEMETRY_BLOCK_MAGIC || header.count > TELEMETRY_BLOCK)
+        return -1;
+
+    for (X = 0; X < TELEMETRY_COLUMNS; X++) {
+        if (header.size[X] > (guint32)TELEMETRY_BLOCK * TELEMETRY_VARINT)
+            return -1;
+        total += header.size[X];
+    }
+
+    data = g_malloc(total ? total : 1);
+    if (fread(data, 1, total, file) != total) {
+        g_free(data);
+        return -1;
+    }
+
+    *records = g_renew(TELEMETRY_RECORD, *records, header.count ? header.count : 1);
+    for (X = 0; X < TELEMETRY_COLUMNS; X++) {
+        if (! TelemetryDecode(data + offset, header.size[X], *records,
+                    header.count, X)) {
+            g_free(data);
+            return -1;
+        }
+        offset += header.size[X];
+    }
+
+    g_free(data);
+    *count = header.count;
+    *drops = header.drops;
+
+    return 1;
+}
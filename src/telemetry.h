@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdio.h>
+#include <glib.h>
+
+/*
+ * Per-game telemetry.  Games push fixed-size TELEMETRY_RECORDs, from any
+ * thread, into a bounded lock-free ring (one sequence number per slot,
+ * so producers only ever race on a compare and swap of the head).  A
+ * writer thread of its own drains the ring, gathers up to TELEMETRY_BLOCK
+ * records, sorts them by game and writes them out as one block of
+ * columns.  When the ring is full the record is dropped and counted: a
+ * game never waits for the disk.
+ *
+ * The file is a TELEMETRY_HEADER and then blocks, each a
+ * TELEMETRY_BLOCK_HEADER followed by its columns, one after the other
+ * in the order of TELEMETRY_COLUMNS.  Every column is its values as
+ * zigzag varints of the difference from the value before it in the
+ * same column, so a run of records of one game costs a few bytes each.
+ * `ntetris_telemetry` reads it back; see telemetry_dump.c.
+ *
+ * Everything is stored in host byte order.
+ */
+
+#define TELEMETRY_MAGIC     0x4d54544eU     // "NTTM" on little-endian hosts
+#define TELEMETRY_BLOCK_MAGIC 0x4254544eU   // "NTTB"
+#define TELEMETRY_VERSION   1
+#define TELEMETRY_RING      65536           // records, a power of two
+#define TELEMETRY_BLOCK     8192            // records per block at most
+#define TELEMETRY_FLUSH     1000000         // microseconds a record may wait
+#define TELEMETRY_IDLE      2000            // microseconds the writer sleeps
+
+enum {
+    TELEMETRY_START = 0,    // a = Bx, b = By, c/d = seed, low and high half
+    TELEMETRY_PLACE,        // a = shape, b = x, c = y, d = rot
+    TELEMETRY_CLEAR,        // a = rows, b = score it gave, c = lines so far
+    TELEMETRY_INPUT,        // a = action
+    TELEMETRY_END,          // a = lines, b = pieces, c = level
+    TELEMETRY_TYPES
+};
+
+// score is the game's score once the record's event is done
+typedef struct _TELEMETRY_RECORD {
+    guint64 game;
+    guint64 tick;
+    gint32 type;
+    gint32 a, b, c, d;
+    gint32 score;
+} TELEMETRY_RECORD;
+
+enum {
+    TELEMETRY_COL_GAME = 0,
+    TELEMETRY_COL_TICK,
+    TELEMETRY_COL_TYPE,
+    TELEMETRY_COL_A,
+    TELEMETRY_COL_B,
+    TELEMETRY_COL_C,
+    TELEMETRY_COL_D,
+    TELEMETRY_COL_SCORE,
+    TELEMETRY_COLUMNS
+};
+
+typedef struct _TELEMETRY_HEADER {
+    guint32 magic;
+    guint32 version;
+    guint32 tick_usec;  // how long a tick lasts
+    guint32 pad;
+} TELEMETRY_HEADER;
+
+typedef struct _TELEMETRY_BLOCK_HEADER {
+    guint32 magic;
+    guint32 count;      // records in the block
+    guint32 drops;      // records lost to a full ring since the last block
+    guint32 size[TELEMETRY_COLUMNS];   // bytes of each column
+} TELEMETRY_BLOCK_HEADER;
+
+typedef struct _TELEMETRY_SLOT {
+    guint64 seq;
+    TELEMETRY_RECORD record;
+} TELEMETRY_SLOT;
+
+typedef struct _TELEMETRY {
+    TELEMETRY_SLOT* slots;
+    guint8 pad0[56];
+    guint64 head;       // records ever claimed by producers
+    guint8 pad1[56];
+    guint64 tail;       // records ever taken by the writer
+    guint8 pad2[56];
+    guint64 drops;
+
+    FILE* file;
+    GThread* thread;
+    int quit;
+
+    // the writer's own
+    TELEMETRY_RECORD* block;
+    guint32 count;
+    gint64 oldest;      // when the first record of the block came
+    guint8* column;     // encoding buffer
+} TELEMETRY;
+
+TELEMETRY* TelemetryOpen(const char* path, guint32 tick_usec);
+void TelemetryClose(TELEMETRY*);
+
+void TelemetryPush(TELEMETRY*, const TELEMETRY_RECORD*);
+void TelemetryEvent(TELEMETRY*, guint64 game, guint64 tick, int type,
+        int a, int b, int c, int d, int score);
+
+// for readers: the next block, decoded into records; 0 at the end
+int TelemetryReadHeader(FILE*, TELEMETRY_HEADER*);
+int TelemetryReadBlock(FILE*, TELEMETRY_RECORD** records, guint32* count, guint32* drops);
@@ -0,0 +1,253 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * ntetris_telemetry: reads what --telemetry wrote.  By default it prints
+ * one line per game; --csv prints every record instead, the score column
+ * of which is the game's score timeline, and --summary the distribution
+ * of the per-game numbers over all games.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <glib.h>
+#include "telemetry.h"
+
+static const char* type_names[TELEMETRY_TYPES] = {
+    "start",
+    "place",
+    "clear",
+    "input",
+    "end"
+};
+
+typedef struct _GAME_STATS {
+    guint64 game;
+    guint64 ticks;
+    int score;
+    int lines;
+    int pieces;
+    int inputs;
+    int clears[5];      // by rows cleared at once
+    int ended;
+} GAME_STATS;
+
+static GAME_STATS* StatsFind(GHashTable* games, guint64 game)
+{
+    GAME_STATS* stats;
+
+    stats = g_hash_table_lookup(games, &game);
+    if (! stats) {
+        stats = g_new0(GAME_STATS, 1);
+        stats->game = game;
+        g_hash_table_insert(games, &stats->game, stats);
+    }
+
+    return stats;
+}
+
+static void StatsAdd(GHashTable* games, const TELEMETRY_RECORD* record)
+{
+    GAME_STATS* stats = StatsFind(games, record->game);
+
+    stats->ticks = MAX(stats->ticks, record->tick);
+    stats->score = record->score;
+
+    switch (record->type) {
+        case TELEMETRY_PLACE:
+            stats->pieces ++;
+            break;
+        case TELEMETRY_CLEAR:
+            stats->lines += record->a;
+            stats->clears[CLAMP(record->a, 0, 4)] ++;
+            break;
+        case TELEMETRY_INPUT:
+            stats->inputs ++;
+            break;
+        case TELEMETRY_END:
+            stats->ended = 1;
+            break;
+        default:
+            break;
+    }
+
+    return;
+}
+
+static gint StatsCompare(gconstpointer a, gconstpointer b)
+{
+    const GAME_STATS* x = *(GAME_STATS* const*)a;
+    const GAME_STATS* y = *(GAME_STATS* const*)b;
+
+    return (x->game > y->game) - (x->game < y->game);
+}
+
+static int DoubleCompare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void Report(const char* name, double* values, int n)
+{
+    double mean = 0;
+    int X;
+
+    qsort(values, n, sizeof(double), DoubleCompare);
+    for (X = 0; X < n; X++)
+        mean += values[X];
+    mean /= n;
+
+    printf("%-10s %12.2f %12.2f %12.2f %12.2f %12.2f\n", name, mean, values[0],
+            values[(n - 1) / 2], values[(9 * (n - 1)) / 10], values[n - 1]);
+
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    TELEMETRY_HEADER header;
+    TELEMETRY_RECORD* records = NULL;
+    const TELEMETRY_RECORD* record;
+    GAME_STATS* stats;
+    GHashTable* games;
+    GPtrArray* list;
+    GHashTableIter iter;
+    gpointer value;
+    double* values;
+    double seconds;
+    guint64 total = 0, drops = 0;
+    guint32 count, dropped, X;
+    int go_ret, ret, csv = 0, summary = 0;
+    FILE* file;
+
+    static struct option longopts[] = {
+         { "csv",        no_argument,        NULL, 'c' },
+         { "summary",    no_argument,        NULL, 's' },
+         { NULL,         0,                  NULL, 0 }
+    };
+
+    while ((go_ret = getopt_long(argc, argv, "cs", longopts, NULL)) != -1) {
+        switch (go_ret) {
+            case 'c':
+                csv = 1;
+                break;
+            case 's':
+                summary = 1;
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [--csv | --summary] FILE\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[optind], "rb");
+    if (! file) {
+        fprintf(stderr, "<ntetris>\tCould not open \"%s\".\n", argv[optind]);
+        return 1;
+    }
+    if (! TelemetryReadHeader(file, &header)) {
+        fprintf(stderr, "<ntetris>\t\"%s\" is not a telemetry file.\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+
+    games = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    if (csv)
+        printf("game,tick,type,a,b,c,d,score\n");
+
+    while ((ret = TelemetryReadBlock(file, &records, &count, &dropped)) > 0) {
+        total += count;
+        drops += dropped;
+
+        for (X = 0; X < count; X++) {
+            record = &records[X];
+            if (csv) {
+                printf("%llu,%llu,%s,%d,%d,%d,%d,%d\n",
+                        (unsigned long long)record->game,
+                        (unsigned long long)record->tick,
+                        record->type >= 0 && record->type < TELEMETRY_TYPES ?
+                        type_names[record->type] : "?",
+                        record->a, record->b, record->c, record->d, record->score);
+            } else {
+                StatsAdd(games, record);
+            }
+        }
+    }
+
+    if (ret < 0)
+        fprintf(stderr, "<ntetris>\t\"%s\" is cut short or damaged.\n", argv[optind]);
+    fclose(file);
+    g_free(records);
+
+    if (! csv) {
+        list = g_ptr_array_new();
+        g_hash_table_iter_init(&iter, games);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_ptr_array_add(list, value);
+        g_ptr_array_sort(list, StatsCompare);
+
+        if (summary && list->len) {
+            values = g_new(double, list->len);
+
+#define DUMP_REPORT(name, expr) \
+            do { \
+                for (X = 0; X < list->len; X++) { \
+                    stats = g_ptr_array_index(list, X); \
+                    seconds = stats->ticks * (double)header.tick_usec / 1e6; \
+                    values[X] = (expr); \
+                } \
+                Report(name, values, list->len); \
+            } while (0)
+
+            printf("%u games, %llu records, %llu dropped\n\n", list->len,
+                    (unsigned long long)total, (unsigned long long)drops);
+            printf("%-10s %12s %12s %12s %12s %12s\n",
+                    "", "mean", "min", "p50", "p90", "max");
+            DUMP_REPORT("score", stats->score);
+            DUMP_REPORT("lines", stats->lines);
+            DUMP_REPORT("pieces", stats->pieces);
+            DUMP_REPORT("pieces/s", seconds > 0 ? stats->pieces / seconds : 0);
+            DUMP_REPORT("inputs/min", seconds > 0 ? stats->inputs * 60 / seconds : 0);
+            DUMP_REPORT("tetrises", stats->clears[4]);
+            DUMP_REPORT("seconds", seconds);
+
+#undef DUMP_REPORT
+
+            g_free(values);
+        } else if (! summary) {
+            printf("%-12s %10s %10s %8s %8s %10s %10s %s\n", "game", "ticks", "score",
+                    "lines", "pieces", "pieces/s", "inputs/min", "clears 1/2/3/4");
+            for (X = 0; X < list->len; X++) {
+                stats = g_ptr_array_index(list, X);
+                seconds = stats->ticks * (double)header.tick_usec / 1e6;
+                printf("%-12llu %10llu %10d %8d %8d %10.2f %10.1f %d/%d/%d/%d%s\n",
+                        (unsigned long long)stats->game,
+                        (unsigned long long)stats->ticks, stats->score,
+                        stats->lines, stats->pieces,
+                        seconds > 0 ? stats->pieces / seconds : 0,
+                        seconds > 0 ? stats->inputs * 60 / seconds : 0,
+                        stats->clears[1], stats->clears[2], stats->clears[3],
+                        stats->clears[4], stats->ended ? "" : " (running)");
+            }
+            if (drops)
+                printf("%llu records dropped\n", (unsigned long long)drops);
+        }
+
+        g_ptr_array_free(list, TRUE);
+    }
+
+    g_hash_table_destroy(games);
+
+    return ret < 0;
+}
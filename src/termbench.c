@@ -0,0 +1,501 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * ntetris_termbench: measures what drawing the game costs the terminal.
+ * It runs ntetris in a pseudo-terminal of the given size, once for
+ * every board size and renderer asked for, types a script of keys (or
+ * the keys of a --record file) into it, and reports the bytes and the
+ * write() calls of every frame and the frames a second the game could
+ * draw.
+ *
+ * ntetris is started with --frame-sync, so it sends a mark down a
+ * socket after each frame and waits for the go-ahead before the next:
+ * the counts come from the kernel's own (/proc/PID/io, so this is
+ * Linux only), and the frame rate only counts the time the game took,
+ * not ours.  Keys go through the terminal like anyone's, and the
+ * terminal may hand one over a frame late.  The first frame, which
+ * draws the whole screen and comes after setting the terminal up, is
+ * reported on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pty.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#define BENCH_FRAMES    500
+#define BENCH_KEYS      "jj.k..ll.e..d...kjj..s.ll...d..."
+#define BENCH_SYNC_FD   3
+#define BENCH_MARK      8       // bytes ntetris writes after each frame
+
+typedef struct _BENCH_SIZE {
+    int x, y;
+} BENCH_SIZE;
+
+// a key to type before the frame of the given tick
+typedef struct _BENCH_KEY {
+    unsigned long tick;
+    char key;
+} BENCH_KEY;
+
+typedef struct _BENCH_SCRIPT {
+    const char* keys;       // one a frame, '.' for none
+    GArray* replay;         // BENCH_KEY, in order of ticks, or NULL
+    guint replayed;
+    unsigned long long seed;
+} BENCH_SCRIPT;
+
+typedef struct _BENCH_RUN {
+    int frames;
+    guint64 first;          // bytes of the first frame and the setup
+    double seconds;         // in the game, from go-ahead to mark
+    guint64* bytes;         // per frame, the first one left out
+    guint64* writes;
+} BENCH_RUN;
+
+// ntetris's default keymap, see Init()
+static const struct {
+    const char* action;
+    char key;
+} bench_keymap[] = {
+    { "quit",   'q' },
+    { "drop",   'd' },
+    { "lower",  's' },
+    { "rotcw",  'k' },
+    { "rotccw", 'e' },
+    { "left",   'j' },
+    { "right",  'l' },
+    { "pause",  'p' },
+    { "reset",  'r' }
+};
+
+static int ParseSize(const char* str, BENCH_SIZE* size)
+{
+    char x;
+
+    return sscanf(str, "%d%c%d", &size->x, &x, &size->y) == 3 && x == 'x' &&
+        size->x > 0 && size->y > 0;
+}
+
+static int LoadReplay(const char* path, BENCH_SCRIPT* script)
+{
+    char line[256], name[64];
+    unsigned long tick;
+    BENCH_KEY key;
+    FILE* file;
+    size_t A;
+
+    file = fopen(path, "r");
+    if (! file)
+        return 0;
+
+    script->replay = g_array_new(FALSE, FALSE, sizeof(BENCH_KEY));
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "seed %llu", &script->seed) == 1)
+            continue;
+        if (sscanf(line, "%lu %63s", &tick, name) != 2)
+            continue;
+
+        // the game goes on after the replay has ended
+        for (A = 0; A < G_N_ELEMENTS(bench_keymap); A++) {
+            if (! strcmp(bench_keymap[A].action, name) && strcmp(name, "quit")) {
+                key.tick = tick;
+                key.key = bench_keymap[A].key;
+                g_array_append_val(script->replay, key);
+            }
+        }
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+static int ProcIo(pid_t pid, guint64* wchar, guint64* syscw)
+{
+    char path[64], line[128];
+    unsigned long long value;
+    FILE* file;
+    int found = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    file = fopen(path, "r");
+    if (! file)
+        return 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "wchar: %llu", &value) == 1) {
+            *wchar = value;
+            found |= 1;
+        } else if (sscanf(line, "syscw: %llu", &value) == 1) {
+            *syscw = value;
+            found |= 2;
+        }
+    }
+
+    fclose(file);
+
+    return found == 3;
+}
+
+// whatever the game drew so far; the terminal would block it otherwise
+static int Drain(int master)
+{
+    char buffer[65536];
+    ssize_t ret;
+
+    for (;;) {
+        ret = read(master, buffer, sizeof(buffer));
+        if (ret > 0)
+            continue;
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        // EIO once the game has let go of the terminal
+        return ret < 0 && errno == EAGAIN;
+    }
+}
+
+static char NextKey(BENCH_SCRIPT* script, unsigned long tick)
+{
+    const BENCH_KEY* key;
+    char c;
+
+    if (script->replay) {
+        // one key a frame: the rest of the tick's wait for the next
+        if (script->replayed >= script->replay->len)
+            return 0;
+        key = &g_array_index(script->replay, BENCH_KEY, script->replayed);
+        if (key->tick > tick)
+            return 0;
+        script->replayed ++;
+        return key->key;
+    }
+
+    c = script->keys[tick % strlen(script->keys)];
+
+    return c == '.' ? 0 : c;
+}
+
+static pid_t Spawn(char** args, const BENCH_SIZE* tty, int* master, int* sync)
+{
+    struct winsize ws;
+    int pair[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0)
+        return -1;
+
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = tty->x;
+    ws.ws_row = tty->y;
+
+    pid = forkpty(master, NULL, NULL, &ws);
+    if (pid < 0) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // the copy dup2() makes stays open across exec
+        if (pair[1] == BENCH_SYNC_FD)
+            fcntl(pair[1], F_SETFD, 0);
+        else
+            dup2(pair[1], BENCH_SYNC_FD);
+        execvp(args[0], args);
+        _exit(127);
+    }
+
+    close(pair[1]);
+    *sync = pair[0];
+    fcntl(*master, F_SETFL, fcntl(*master, F_GETFL) | O_NONBLOCK);
+
+    return pid;
+}
+
+static int Bench(char** args, const BENCH_SIZE* tty, BENCH_SCRIPT* script,
+        int frames, BENCH_RUN* run)
+{
+    struct pollfd fds[2];
+    guint64 wchar, syscw, last_wchar = 0, last_syscw = 0;
+    guint64 tick;
+    gint64 sent = 0;
+    int master, sync, status;
+    pid_t pid;
+    ssize_t ret;
+    char key, go = 1;
+
+    memset(run, 0, sizeof(BENCH_RUN));
+    run->bytes = g_new0(guint64, frames);
+    run->writes = g_new0(guint64, frames);
+    script->replayed = 0;
+
+    pid = Spawn(args, tty, &master, &sync);
+    if (pid < 0)
+        return 0;
+
+    fds[0].fd = master;
+    fds[0].events = POLLIN;
+    fds[1].fd = sync;
+    fds[1].events = POLLIN;
+
+    while (run->frames <= frames) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents && ! Drain(master))
+            fds[0].fd = -1;
+        if (! fds[1].revents)
+            continue;
+
+        ret = read(sync, &tick, sizeof(tick));
+        if (ret != sizeof(tick))
+            break;
+        if (! ProcIo(pid, &wchar, &syscw))
+            break;
+
+        // each count takes in the mark that ended the frame
+        if (run->frames == 0) {
+            run->first = wchar - BENCH_MARK;
+        } else {
+            run->seconds += (g_get_monotonic_time() - sent) / 1e6;
+            run->bytes[run->frames - 1] = wchar - last_wchar - BENCH_MARK;
+            run->writes[run->frames - 1] = syscw - last_syscw - 1;
+        }
+        last_wchar = wchar;
+        last_syscw = syscw;
+
+        if (run->frames++ == frames)
+            break;
+
+        key = NextKey(script, tick + 1);
+        if (key && write(master, &key, 1) < 0)
+            break;
+
+        sent = g_get_monotonic_time();
+        if (send(sync, &go, 1, MSG_NOSIGNAL) != 1)
+            break;
+    }
+
+    // hanging up ends the game; it still has to get out of the terminal
+    close(sync);
+    while (fds[0].fd >= 0) {
+        fds[1].fd = -1;
+        if (poll(fds, 1, 1000) <= 0 || ! Drain(master))
+            break;
+    }
+    close(master);
+    waitpid(pid, &status, 0);
+
+    // the count ended with a frame, not a setup
+    run->frames = MAX(run->frames - 1, 0);
+
+    return 1;
+}
+
+static int Compare(const void* a, const void* b)
+{
+    guint64 x = *(const guint64*)a, y = *(const guint64*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void Report(const BENCH_SIZE* tty, const BENCH_SIZE* board,
+        const char* renderer, BENCH_RUN* run)
+{
+    char size[32], field[32];
+    double bytes = 0, writes = 0;
+    int X, n = run->frames;
+
+    snprintf(size, sizeof(size), "%dx%d", tty->x, tty->y);
+    snprintf(field, sizeof(field), "%dx%d", board->x, board->y);
+    if (! n) {
+        printf("%-9s %-9s %-8s %7s\n", size, field, renderer, "failed");
+        return;
+    }
+
+    for (X = 0; X < n; X++) {
+        bytes += run->bytes[X];
+        writes += run->writes[X];
+    }
+    qsort(run->bytes, n, sizeof(guint64), Compare);
+    qsort(run->writes, n, sizeof(guint64), Compare);
+
+    printf("%-9s %-9s %-8s %7d %9.0f %8llu %9.1f %7llu %7llu %7llu %7.2f %5llu\n",
+            size, field, renderer, n, run->seconds > 0 ? n / run->seconds : 0,
+            (unsigned long long)run->first, bytes / n,
+            (unsigned long long)run->bytes[(n - 1) / 2],
+            (unsigned long long)run->bytes[(99 * (n - 1)) / 100],
+            (unsigned long long)run->bytes[n - 1], writes / n,
+            (unsigned long long)run->writes[n - 1]);
+
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    BENCH_SCRIPT script = { BENCH_KEYS, NULL, 0, 1 };
+    GArray* ttys = g_array_new(FALSE, FALSE, sizeof(BENCH_SIZE));
+    GArray* boards = g_array_new(FALSE, FALSE, sizeof(BENCH_SIZE));
+    GPtrArray* renderers = g_ptr_array_new();
+    GPtrArray* args;
+    const char* exe = "./ntetris";
+    char width[16], height[16], seed[32];
+    const BENCH_SIZE *tty, *board;
+    BENCH_SIZE size;
+    BENCH_RUN run;
+    int go_ret, frames = BENCH_FRAMES, extra, T, B, R, args_base, ret = 0;
+
+    static struct option longopts[] = {
+         { "exec",       required_argument,  NULL, 'e' },
+         { "tty",        required_argument,  NULL, 'g' },
+         { "board",      required_argument,  NULL, 'b' },
+         { "renderer",   required_argument,  NULL, 'o' },
+         { "frames",     required_argument,  NULL, 'n' },
+         { "keys",       required_argument,  NULL, 'k' },
+         { "replay",     required_argument,  NULL, 'R' },
+         { "seed",       required_argument,  NULL, 's' },
+         { NULL,         0,                  NULL, 0 }
+    };
+
+    while ((go_ret = getopt_long(argc, argv, "e:g:b:o:n:k:R:s:", longopts, NULL)) != -1) {
+        switch (go_ret) {
+            case 'e':
+                exe = optarg;
+                break;
+            case 'g':
+            case 'b':
+                if (! ParseSize(optarg, &size)) {
+                    fprintf(stderr, "<ntetris>\tInvalid size: \"%s\"\n", optarg);
+                    return 1;
+                }
+                g_array_append_val(go_ret == 'g' ? ttys : boards, size);
+                break;
+            case 'o':
+                g_ptr_array_add(renderers, optarg);
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                if (frames < 1) {
+                    fprintf(stderr, "<ntetris>\tInvalid number of frames: \"%s\"\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                if (! *optarg) {
+                    fprintf(stderr, "<ntetris>\tThe key script is empty.\n");
+                    return 1;
+                }
+                script.keys = optarg;
+                break;
+            case 'R':
+                if (! LoadReplay(optarg, &script)) {
+                    fprintf(stderr, "<ntetris>\tCould not load replay \"%s\".\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                script.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [--exec NTETRIS] [--tty WxH]... [--board WxH]... "
+                        "[--renderer NAME]... [--frames N] [--keys KEYS | --replay FILE] "
+                        "[--seed N] [-- NTETRIS OPTIONS]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (! ttys->len) {
+        size.x = 80;
+        size.y = 24;
+        g_array_append_val(ttys, size);
+    }
+    if (! boards->len) {
+        size.x = 10;
+        size.y = 20;
+        g_array_append_val(boards, size);
+    }
+    if (! renderers->len) {
+        g_ptr_array_add(renderers, "curses");
+        g_ptr_array_add(renderers, "vt");
+    }
+
+    // the same game every time, on a terminal curses knows
+    if (! getenv("TERM") || ! strcmp(getenv("TERM"), "dumb"))
+        setenv("TERM", "xterm", 1);
+    snprintf(seed, sizeof(seed), "%llu", script.seed);
+
+    args = g_ptr_array_new();
+    g_ptr_array_add(args, (gpointer)exe);
+    g_ptr_array_add(args, "--frame-sync");
+    g_ptr_array_add(args, G_STRINGIFY(BENCH_SYNC_FD));
+    g_ptr_array_add(args, "--seed");
+    g_ptr_array_add(args, seed);
+    for (extra = optind; extra < argc; extra++)
+        g_ptr_array_add(args, argv[extra]);
+    args_base = args->len;
+
+    printf("%-9s %-9s %-8s %7s %9s %8s %9s %7s %7s %7s %7s %5s\n", "tty", "board",
+            "renderer", "frames", "fps", "first", "bytes", "p50", "p99", "max",
+            "writes", "max");
+
+    for (T = 0; T < (int)ttys->len; T++) {
+        tty = &g_array_index(ttys, BENCH_SIZE, T);
+        for (B = 0; B < (int)boards->len; B++) {
+            board = &g_array_index(boards, BENCH_SIZE, B);
+            for (R = 0; R < (int)renderers->len; R++) {
+                snprintf(width, sizeof(width), "%d", board->x);
+                snprintf(height, sizeof(height), "%d", board->y);
+
+                g_ptr_array_set_size(args, args_base);
+                g_ptr_array_add(args, "--renderer");
+                g_ptr_array_add(args, g_ptr_array_index(renderers, R));
+                g_ptr_array_add(args, "--width");
+                g_ptr_array_add(args, width);
+                g_ptr_array_add(args, "--height");
+                g_ptr_array_add(args, height);
+                g_ptr_array_add(args, NULL);
+
+                if (! Bench((char**)args->pdata, tty, &script, frames, &run)) {
+                    fprintf(stderr, "<ntetris>\tCould not run \"%s\".\n", exe);
+                    return 1;
+                }
+                if (run.frames < frames) {
+                    fprintf(stderr, "<ntetris>\t%s stopped after %d frames.\n", exe,
+                            run.frames);
+                    ret = 1;
+                }
+
+                Report(tty, board, g_ptr_array_index(renderers, R), &run);
+                fflush(stdout);
+                g_free(run.bytes);
+                g_free(run.writes);
+            }
+        }
+    }
+
+    g_ptr_array_free(args, TRUE);
+    g_ptr_array_free(renderers, TRUE);
+    g_array_free(boards, TRUE);
+    g_array_free(ttys, TRUE);
+    if (script.replay)
+        g_array_free(script.replay, TRUE);
+
+    return ret;
+}
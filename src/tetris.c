@@ -14,6 +14,12 @@
 #include <ncurses.h>
 #include <glib.h>
 #include "tetris.h"
+#include "sim.h"
+#include "row.h"
+#include "render.h"
+#include "prof.h"
+#include "snap.h"
+#include "telemetry.h"
 #include <limits.h>
 
 #ifdef __linux__
@@ -24,11 +30,24 @@
 #include "strtonum.h"
 #endif
 
-#define TETRIS_DEBUG
+const char* keymap_desc[] = {
+    "quit",
+    "drop",
+    "lower",
+    "rotcw",
+    "rotccw",
+    "left",
+    "right",
+    "pause",
+    "reset"
+};
 
 int main(int argc, char* argv[])
 {
     STATE* state;
+    int ret;
+
+    RowInit();
 
     state = Init(argc, argv);
     if (!state) {
@@ -36,15 +55,45 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+    if (state->sim_games) {
+        // headless batch mode, see sim.c
+        ret = Simulate(state);
+        TelemetryClose(state->telemetry);
+        ProfFree(state->prof);
+        GameFree(state);
+        return ret;
+    }
+
     while(state->status != STATUS_GAMEOVER) {
         state->ticks ++;
 
+        if (state->prof)
+            ProfFrameBegin(state->prof, state->ticks);
+
+        PROF_BEGIN(state, PROF_INPUT);
         Input(state);
+        PROF_END(state, PROF_INPUT);
+
+        PROF_BEGIN(state, PROF_UPDATE);
         Update(state);
+        PROF_END(state, PROF_UPDATE);
+
+        PROF_BEGIN(state, PROF_PAINT);
         Paint(state);
+        PROF_END(state, PROF_PAINT);
+
+        PROF_BEGIN(state, PROF_REFRESH);
         Refresh(state);
+        PROF_END(state, PROF_REFRESH);
+
+        if (state->prof)
+            ProfFrameEnd(state->prof);
 
-        napms(REFRESH_DELAY);
+        // a benchmark runs the frames as fast as it takes them
+        if (state->frame_sync >= 0)
+            FrameSync(state);
+        else
+            napms(REFRESH_DELAY);
     }
 
     Cleanup(state);
@@ -54,7 +103,8 @@ int main(int argc, char* argv[])
 
 int ParseOptions(STATE *state, int argc, char *argv[])
 {
-    int go_ret, width, height, delay, level;
+    int go_ret, width, height, delay, level, games, threads, fd;
+    long long seed, ticks;
     const char *err_str;
     char *next_key = NULL;
     char *next_key_val = NULL;
@@ -67,11 +117,24 @@ int ParseOptions(STATE *state, int argc, char *argv[])
          { "delay",      required_argument,  NULL, 'd' },
          { "pause-show", no_argument,        NULL, 'p' },
          { "keys",       required_argument,  NULL, 'k' },
+         { "keymap",     required_argument,  NULL, 'K' },
+         { "seed",       required_argument,  NULL, 's' },
+         { "simulate",   required_argument,  NULL, 'S' },
+         { "threads",    required_argument,  NULL, 'T' },
+         { "max-ticks",  required_argument,  NULL, 'M' },
+         { "replay",     required_argument,  NULL, 'R' },
+         { "record",     required_argument,  NULL, 'r' },
+         { "renderer",   required_argument,  NULL, 'o' },
+         { "profile",    no_argument,        NULL, 'P' },
+         { "trace",      required_argument,  NULL, 't' },
+         { "save",       required_argument,  NULL, 'f' },
+         { "telemetry",  required_argument,  NULL, 'A' },
+         { "frame-sync", required_argument,  NULL, 'F' },
          { NULL,         0,                  NULL, 0 }
     };
 
 
-    while ((go_ret = getopt_long(argc, argv, "c:L:x:y:d:k:p", longopts, NULL)) != -1) {
+    while ((go_ret = getopt_long(argc, argv, "c:L:x:y:d:k:K:ps:S:T:M:R:r:o:Pt:f:A:F:", longopts, NULL)) != -1) {
         switch (go_ret) {
             case 'c':
                 if (! strcmp(optarg, "none")) {
@@ -128,25 +191,116 @@ int ParseOptions(STATE *state, int argc, char *argv[])
                 state->do_pause_blocks = !state->do_pause_blocks;
                 break;
             case 'k':
-                    while ((next_key = strsep(&optarg, " ")) != NULL) {
-
-                        size_t A;
-                        next_key_val = strsep(&optarg, " ");
-
-                        for (A = 0; A < TETRIS_KEYS; A++) {
-                            if (! strcmp(keymap_desc[A], next_key)) {
-                                state->keymap[A] = KeyParse(next_key_val);
-                                break;
-                            }
-                        }
-
-                        if (A >= TETRIS_KEYS) {
-                            fprintf(stderr, "<ntetris>\tAction not supported: \"%s\".\n",
-                                    next_key);
-                            return 0;
-                        }
+                while ((next_key = strsep(&optarg, " ")) != NULL) {
+                    next_key_val = strsep(&optarg, " ");
+                    if (! KeymapBind(state, next_key, next_key_val))
+                        return 0;
                 }
                 break;
+            case 'K':
+                if (! KeymapLoad(state, optarg))
+                    return 0;
+                break;
+            case 's':
+                seed = strtonum(optarg, 0, LLONG_MAX, &err_str);
+                if (err_str) {
+                    fprintf(stderr, "error parsing seed field: %s\n", err_str);
+                    return 0;
+                }
+
+                state->seed = seed;
+                state->do_seed = 1;
+                break;
+            case 'S':
+                games = strtonum(optarg, 1, INT_MAX, &err_str);
+                if (err_str) {
+                    fprintf(stderr, "error parsing simulate field: %s\n", err_str);
+                    return 0;
+                }
+
+                state->sim_games = games;
+                break;
+            case 'T':
+                threads = strtonum(optarg, 1, 1024, &err_str);
+                if (err_str) {
+                    fprintf(stderr, "error parsing threads field: %s\n", err_str);
+                    return 0;
+                }
+
+                state->sim_threads = threads;
+                break;
+            case 'M':
+                ticks = strtonum(optarg, 1, LONG_MAX, &err_str);
+                if (err_str) {
+                    fprintf(stderr, "error parsing max-ticks field: %s\n", err_str);
+                    return 0;
+                }
+
+                state->sim_max_ticks = ticks;
+                break;
+            case 'R':
+                if (! state->replays)
+                    state->replays = g_queue_new();
+                g_queue_push_tail(state->replays, optarg);
+                break;
+            case 'r':
+                if (state->record)
+                    fclose(state->record);
+                state->record = fopen(optarg, "w");
+                if (! state->record) {
+                    fprintf(stderr, "<ntetris>\tCould not open \"%s\" for recording.\n",
+                            optarg);
+                    return 0;
+                }
+                break;
+            case 'o':
+                state->renderer = RendererFind(optarg);
+                if (! state->renderer) {
+                    fprintf(stderr, "<ntetris>\tInvalid renderer: \"%s\"\n",
+                            optarg);
+                    return 0;
+                }
+                break;
+            case 'P':
+            case 't':
+#ifndef TETRIS_DEBUG
+                fprintf(stderr, "<ntetris>\tProfiling needs a TETRIS_DEBUG build.\n");
+                return 0;
+#endif
+                if (! state->prof)
+                    state->prof = ProfAlloc();
+                if (! state->prof)
+                    return 0;
+
+                if (go_ret == 'P') {
+                    state->prof->overlay = 1;
+                } else if (! ProfTrace(state->prof, optarg)) {
+                    fprintf(stderr, "<ntetris>\tCould not open \"%s\" for tracing.\n",
+                            optarg);
+                    return 0;
+                }
+                break;
+            case 'f':
+                state->save = optarg;
+                break;
+            case 'A':
+                TelemetryClose(state->telemetry);
+                state->telemetry = TelemetryOpen(optarg, REFRESH_DELAY * 1000);
+                if (! state->telemetry) {
+                    fprintf(stderr, "<ntetris>\tCould not open \"%s\" for telemetry.\n",
+                            optarg);
+                    return 0;
+                }
+                break;
+            case 'F':
+                fd = strtonum(optarg, 0, INT_MAX, &err_str);
+                if (err_str) {
+                    fprintf(stderr, "error parsing frame-sync field: %s\n", err_str);
+                    return 0;
+                }
+
+                state->frame_sync = fd;
+                break;
             default:
                 return 0;
                 break;
@@ -154,59 +308,122 @@ int ParseOptions(STATE *state, int argc, char *argv[])
 
     }
 
+    // simulated games are not recorded, see sim.c
+    if (state->sim_games && state->record) {
+        fprintf(stderr, "<ntetris>\t--record cannot be used with --simulate.\n");
+        return 0;
+    }
+
     return 1;
 
 }
 
+/*
+ * A recording starts with the seed; a resumed game also needs where it
+ * was resumed, so the snapshot follows, base64 in lines of its own,
+ * for ReplayLoad() to start from.
+ */
+static int RecordStart(STATE* state, int resumed)
+{
+    void* snap;
+    gchar* text;
+    size_t size, X, n;
+
+    fprintf(state->record, "seed %llu\n", (unsigned long long)state->seed);
+    if (! resumed)
+        return 1;
+
+    size = SnapSize(state);
+    snap = g_malloc(size);
+    if (! SnapSave(state, snap, size)) {
+        g_free(snap);
+        return 0;
+    }
+
+    text = g_base64_encode(snap, size);
+    n = strlen(text);
+    for (X = 0; X < n; X += REPLAY_SNAP_LINE)
+        fprintf(state->record, "snap %.*s\n", (int)MIN(n - X, REPLAY_SNAP_LINE), text + X);
+
+    g_free(text);
+    g_free(snap);
+
+    return 1;
+}
+
 STATE* Init(int argc, char* argv[])
 {
     STATE* state;
+    int resumed;
 
-    state = (STATE*)malloc(sizeof(STATE));
+    state = GameAlloc();
     if (!state)
         return NULL;
 
-    memset(state, 0, sizeof(STATE));
     srand(time(0));
 
-    state->Bx = 10;
-    state->By = 20;
-    state->queue = g_queue_new();
-    state->fieldwin = NULL;
-    state->queue_size = 5;
-    state->init_speed = INIT_SPEED;
-    state->delta = DELTA_SPEED;
-
-    state->init_level = 1;
-    state->line_clear_timeout = 0;
-
-    state->do_clear = CLEAR_FLASH;
-    state->do_rotate_timeout_reset = 0;
-    state->do_dissolve = 1;
-    state->do_pause_blocks = 0;
+    state->sim_max_ticks = TETRIS_SIM_MAX_TICKS;
+    state->frame_sync = -1;
 
     // setup the default keymap
-    state->keymap[TETRIS_KEY_QUIT]              = KeyParse("q");
-    state->keymap[TETRIS_KEY_DROP]              = KeyParse("d");
-    state->keymap[TETRIS_KEY_LOWER]             = KeyParse("s");
-    state->keymap[TETRIS_KEY_ROTATE_CW]         = KeyParse("k");
-    state->keymap[TETRIS_KEY_ROTATE_CCW]        = KeyParse("e");
-    state->keymap[TETRIS_KEY_MOVE_LEFT]         = KeyParse("j");
-    state->keymap[TETRIS_KEY_MOVE_RIGHT]        = KeyParse("l");
-    state->keymap[TETRIS_KEY_PAUSE]             = KeyParse("p");
-    state->keymap[TETRIS_KEY_RESET]             = KeyParse("r");
+    memset(state->keymap, -1, sizeof(state->keymap));
+    state->keymap[TETRIS_KEY_QUIT][0]           = KeyParse("q");
+    state->keymap[TETRIS_KEY_DROP][0]           = KeyParse("d");
+    state->keymap[TETRIS_KEY_LOWER][0]          = KeyParse("s");
+    state->keymap[TETRIS_KEY_ROTATE_CW][0]      = KeyParse("k");
+    state->keymap[TETRIS_KEY_ROTATE_CCW][0]     = KeyParse("e");
+    state->keymap[TETRIS_KEY_MOVE_LEFT][0]      = KeyParse("j");
+    state->keymap[TETRIS_KEY_MOVE_RIGHT][0]     = KeyParse("l");
+    state->keymap[TETRIS_KEY_PAUSE][0]          = KeyParse("p");
+    state->keymap[TETRIS_KEY_RESET][0]          = KeyParse("r");
 
     if (! ParseOptions(state, argc, argv)) {
-        Cleanup(state);
+        if (state->record)
+            fclose(state->record);
+        TelemetryClose(state->telemetry);
+        ProfFree(state->prof);
+        GameFree(state);
+        return NULL;
+    }
+
+    if (! state->do_seed)
+        state->seed = time(0) ^ getpid();
+
+    KeymapBuild(state);
+
+    // simulated games are allocated by Simulate()
+    if (state->sim_games)
+        return state;
+
+    // allocate the field data and do the game instance
+    // specific initialization
+    if (! GameStart(state, state->seed)) {
+        GameFree(state);
+        return NULL;
+    }
+
+    // pick up a suspended game where it was left
+    resumed = state->save && access(state->save, F_OK) == 0;
+    if (resumed && ! SnapRead(state, state->save)) {
+        fprintf(stderr, "<ntetris>\tCould not resume from \"%s\".\n", state->save);
+        GameFree(state);
         return NULL;
     }
 
-    // allocate the field data
-    state->field = (char*)malloc(state->Bx * state->By);
-    // game instance specific initiailzation
-    Reset(state);
-    // initialize the curses session
-    InitTerminal(state);
+    // the snapshot was taken on the way out
+    state->status = STATUS_GAME;
+
+    if (state->record && ! RecordStart(state, resumed)) {
+        fprintf(stderr, "<ntetris>\tCould not start the recording.\n");
+        GameFree(state);
+        return NULL;
+    }
+
+    // initialize the terminal session
+    if (! InitTerminal(state)) {
+        GameFree(state);
+        return NULL;
+    }
     // orient the windows
     DimensionWindows(state);
 
@@ -217,107 +434,82 @@ STATE* Init(int argc, char* argv[])
     return state;
 }
 
-void InitTerminal(STATE* state)
+int InitTerminal(STATE* state)
 {
-    size_t X = 0;
-
-    initscr();
-    cbreak();
-    noecho();
-    nodelay(stdscr, true);
-    keypad(stdscr, true);
-    start_color();
-
-    if (has_colors()) {
-        start_color();
-        use_default_colors();
-    }
+    if (! state->renderer)
+        state->renderer = &curses_renderer;
 
-    init_pair(0, COLOR_BLACK, COLOR_BLACK);
-    init_pair(1, COLOR_RED, COLOR_BLACK);
-    init_pair(2, COLOR_GREEN, COLOR_BLACK);
-    init_pair(3, COLOR_YELLOW, COLOR_BLACK);
-    init_pair(4, COLOR_BLUE, COLOR_BLACK);
-    init_pair(5, COLOR_MAGENTA, COLOR_BLACK);
-    init_pair(6, COLOR_CYAN, COLOR_BLACK);
-    init_pair(7, COLOR_WHITE, COLOR_BLACK);
-    return;
+    return state->renderer->init(state);
 }
 
 void DimensionWindows(STATE* state)
 {
-    if (state->fieldwin) {
-        delwin(state->fieldwin);
-        erase();
-    }
-
-    if (state->statuswin) {
-        delwin(state->statuswin);
-        erase();
-    }
-
-    getmaxyx(stdscr, state->Wy, state->Wx);
     state->Sy = state->By + 2;
     state->Sx = 2 * state->Bx + 2;
-    state->fieldwin = newwin(state->Sy,
-            state->Sx,
-            (state->Wy - state->Sy) / 2,
-            (state->Wx - state->Sx) / 2);
+
+    // big fields only get a scrolling window onto them,
+    // leaving room for the title and the key bar
+    if (state->Sy > state->Wy - 2)
+        state->Sy = MAX(state->Wy - 2, 3);
+    if (state->Sx > state->Wx)
+        state->Sx = MAX(state->Wx - state->Wx % 2, 4);
+
+    state->Vh = state->Sy - 2;
+    state->Vw = (state->Sx - 2) / 2;
+    state->linebuf = (chtype*)realloc(state->linebuf,
+            state->Sx * sizeof(chtype));
+    state->Vx = 0;
+    state->Vy = 0;
+    ViewportUpdate(state);
 
     state->Sby = TETRIS_STATUS_HEIGHT;
     state->Sbx = TETRIS_STATUS_WIDTH;
 
-    if (state->Sbx) {
-        state->statuswin = newwin(state->Sby,
-                state->Sbx,
-                2, 2);
-    }
-
-    //wbkgd(state->fieldwin, COLOR_PAIR(11));
-
-    return;
-}
-
-void Reset(STATE* state)
-{
-    TETRAD* tetrad;
-    size_t X = 0;
-
-    state->status = STATUS_GAME;
-
-    state->ticks = 0;
-    state->speed = state->init_speed;
-    state->level = state->init_level;
-    state->lines = 0;
-    state->score = 0;
-    state->line_clear_t = 0;
-    state->line_clear_f = 0;
-    state->game_over_f = 0;
-    state->pause_f = 0;
-
-    for(X = 0; X < state->Bx * state->By; X++) {
-        state->field[X] = 0;
-    }
+    state->Py[PANE_SCREEN] = 0;
+    state->Px[PANE_SCREEN] = 0;
+    state->Ph[PANE_SCREEN] = state->Wy;
+    state->Pw[PANE_SCREEN] = state->Wx;
 
-    while((tetrad = g_queue_pop_tail(state->queue)))
-        TetradFree(tetrad);
+    state->Py[PANE_FIELD] = (state->Wy - state->Sy) / 2;
+    state->Px[PANE_FIELD] = (state->Wx - state->Sx) / 2;
+    state->Ph[PANE_FIELD] = state->Sy;
+    state->Pw[PANE_FIELD] = state->Sx;
 
-    // push several new tetrads onto the stack
-    while (g_queue_get_length(state->queue) < state->queue_size + 1)
-        TetradQueue(state);
+    state->Py[PANE_STATUS] = 2;
+    state->Px[PANE_STATUS] = 2;
+    state->Ph[PANE_STATUS] = state->Sby;
+    state->Pw[PANE_STATUS] = state->Sbx;
 
-    state->tetrad = g_queue_pop_tail(state->queue);
+    state->renderer->dimension(state);
 
     return;
 }
 
 void Cleanup(STATE* state)
 {
-    endwin();
-    free(state->field);
-    if (state->tetrad)
-        TetradFree(state->tetrad);
-    free(state);
+    state->renderer->cleanup(state);
+
+    // suspend the game, unless there is nothing left to resume
+    if (state->save) {
+        if (state->game_over_f) {
+            unlink(state->save);
+        } else if (! SnapWrite(state, state->save)) {
+            fprintf(stderr, "<ntetris>\tCould not save to \"%s\".\n", state->save);
+        }
+    }
+
+    if (state->record)
+        fclose(state->record);
+    GameTelemetry(state, TELEMETRY_END, state->lines, state->pieces, state->level, 0);
+    TelemetryClose(state->telemetry);
+    ProfFree(state->prof);
+    free(state->linebuf);
+    if (state->effects) {
+        while (! g_queue_is_empty(state->effects))
+            g_free(g_queue_pop_head(state->effects));
+        g_queue_free(state->effects);
+    }
+    GameFree(state);
 
     return;
 }
@@ -325,168 +517,207 @@ void Cleanup(STATE* state)
 void Input(STATE* state)
 {
     int c = 0;
+    int A;
 
-    c = getch();
+    c = state->renderer->getkey(state);
     if (c == ERR)
         return;
 
 
-    if (c == state->keymap[TETRIS_KEY_QUIT]) {
-        state->status = STATUS_GAMEOVER;
-    } else if (c == state->keymap[TETRIS_KEY_DROP]) {
-        EventDrop(state);
-    } else if (c == state->keymap[TETRIS_KEY_LOWER]) {
-        EventLower(state);
-    } else if (c == state->keymap[TETRIS_KEY_ROTATE_CW]) {
-        EventRotate(state, 1);
-    } else if (c == state->keymap[TETRIS_KEY_ROTATE_CCW]) {
-        EventRotate(state, -1);
-    } else if (c == state->keymap[TETRIS_KEY_MOVE_LEFT]) {
-        EventMove(state, -1);
-    } else if (c == state->keymap[TETRIS_KEY_MOVE_RIGHT]) {
-        EventMove(state, 1);
-    } else if (c == state->keymap[TETRIS_KEY_PAUSE]) {
-        if (! state->game_over_f) {
-            if (state->pause_f)
-                EventUnpause(state);
-            else
-                EventPause(state);
-        }
-    } else if (c == state->keymap[TETRIS_KEY_RESET]) {
-        Reset(state);
+    A = (c >= 0 && c <= TETRIS_MAX_KEYCODE) ? state->keyaction[c] : -1;
+
+    if (A >= 0) {
+        if (state->record)
+            fprintf(state->record, "%lu %s\n", state->ticks, keymap_desc[A]);
+        EventAction(state, A);
     } else {
-        printw("\a");
+        state->renderer->bell(state);
     }
 
-    flushinp();
     return;
 }
 
 void Paint(STATE* state)
 {
     size_t X = 0, Y = 0;
+    time_t rawtime;
+    struct tm* timeinfo;
+    int x;
+
+    // update the clock
+    time(&rawtime);
+    timeinfo = localtime(&rawtime);
+    strftime(state->clock, TETRIS_CLOCK_BUFSIZE, "[%H.%M:%S]", timeinfo);
 
-    attrset(COLOR_PAIR(2) | A_BOLD);
-    mvprintw(0, 0, "%s\n", gs_appname);
-
-    move(state->Wy - 1, 0);
-    for (X = 0; X < sizeof(state->keymap) / sizeof(int); X++) {
-        attrset(COLOR_PAIR(5));
-        printw("%s", keymap_desc[X]);
-        attrset(COLOR_PAIR(7));
-        printw("[");
-        attrset(COLOR_PAIR(4));
-        printw("%s", keyname(state->keymap[X]));
-        attrset(COLOR_PAIR(7));
-        printw("] ");
+    RenderPrint(state, PANE_SCREEN, 0, 0, COLOR_PAIR(2) | A_BOLD,
+            "%s", gs_appname);
+
+    x = 0;
+    for (X = 0; X < TETRIS_KEYS; X++) {
+        x = RenderPrint(state, PANE_SCREEN, state->Wy - 1, x, COLOR_PAIR(5),
+                "%s", keymap_desc[X]);
+        x = RenderPrint(state, PANE_SCREEN, state->Wy - 1, x, COLOR_PAIR(7), "[");
+        for (Y = 0; Y < TETRIS_KEY_BINDINGS && state->keymap[X][Y] >= 0; Y++) {
+            x = RenderPrint(state, PANE_SCREEN, state->Wy - 1, x, COLOR_PAIR(7),
+                    "%s", Y ? "/" : "");
+            x = RenderPrint(state, PANE_SCREEN, state->Wy - 1, x, COLOR_PAIR(4),
+                    "%s", keyname(state->keymap[X][Y]));
+        }
+        x = RenderPrint(state, PANE_SCREEN, state->Wy - 1, x, COLOR_PAIR(7), "] ");
     }
 
-    attroff(A_BOLD);
-    attrset(COLOR_PAIR(3));
-    mvprintw(state->Wy - 1, state->Wx - strlen(state->clock),
+    RenderPrint(state, PANE_SCREEN, state->Wy - 1,
+            state->Wx - strlen(state->clock), COLOR_PAIR(3),
             "%s", state->clock);
 
     // begin painting the status window
-    if (state->statuswin) {
+    if (state->Sbx) {
+        PROF_BEGIN(state, PROF_STATUS);
         StatusWindowPaint(state);
+        PROF_END(state, PROF_STATUS);
     }
 
     // begin painting the board
-    werase(state->fieldwin);
-    wattrset(state->fieldwin, A_NORMAL | COLOR_PAIR(7));
-    box(state->fieldwin, 0, 0);
+    PROF_BEGIN(state, PROF_FIELD);
+    EffectsUpdate(state);
+    ViewportUpdate(state);
+    state->renderer->blank(state, PANE_FIELD);
+    state->renderer->outline(state, PANE_FIELD, 0, 0, state->Sy, state->Sx,
+            A_NORMAL | COLOR_PAIR(7));
+
+    if (state->Vw < state->Bx || state->Vh < state->By) {
+        RenderPrint(state, PANE_FIELD, 0, 1, A_NORMAL | COLOR_PAIR(7),
+                "%d,%d", state->Vx, state->Vy);
+    }
 
     if (! state->pause_f || state->do_pause_blocks) {
-        for (Y = 0; Y < state->By; Y++) {
-            wmove(state->fieldwin, Y + 1, 1);
-            for (X = 0; X < state->Bx; X++) {
-                wattrset(state->fieldwin, A_NORMAL | COLOR_PAIR(7));
-                if (state->field[state->Bx * Y + X] == CLEARED) {
-                        switch (state->do_clear) {
-                        case CLEAR_FLASH:
-                            wattrset(state->fieldwin, COLOR_PAIR(rand() % 7 + 1) | A_REVERSE);
-                            break;
-                        case CLEAR_BLANK:
-                        default:
-                            break;
-                    }
-                } else {
-                    if (state->field[state->Bx * Y + X] != 0) {
-                        wattrset(state->fieldwin, COLOR_PAIR(state->field[state->Bx * Y + X]) | A_REVERSE);
-                    }
+        // only the cells inside the viewport are visited,
+        // and each row goes out in one call
+        for (Y = state->Vy; Y < state->Vy + state->Vh; Y++) {
+            int live = EffectsRow(state, Y);
+            const char* row;
+            chtype* cell = state->linebuf;
+
+            if (live < 0)
+                continue;
+
+            row = FieldRow(state->field, live);
+
+            for (X = state->Vx; X < state->Vx + state->Vw; X++) {
+                chtype attr = A_NORMAL | COLOR_PAIR(7);
+
+                if (row[X] != 0) {
+                    attr = COLOR_PAIR(row[X]) | A_REVERSE;
                 }
 
-                waddch(state->fieldwin, ' ');
-                waddch(state->fieldwin, ' ');
-                wattrset(state->fieldwin, A_NORMAL | COLOR_PAIR(7));
+                *cell++ = ' ' | attr;
+                *cell++ = ' ' | attr;
             }
+
+            state->renderer->cells(state, PANE_FIELD, Y - state->Vy + 1, 1,
+                    state->linebuf, 2 * state->Vw);
         }
 
+        EffectsPaint(state);
     }
 
     if (state->pause_f) {
-        StatusMessage(state, state->fieldwin, gs_pause);
+        StatusMessage(state, PANE_FIELD, gs_pause);
     }
 
-    wattrset(state->fieldwin, A_NORMAL | COLOR_PAIR(7));
     if (state->game_over_f) {
-        StatusMessage(state, state->fieldwin, gs_gameover);
+        StatusMessage(state, PANE_FIELD, gs_gameover);
     }
 
 
-    // paint the tetrad
-    if (state->tetrad)
-        TetradPaint(state->fieldwin,
-                state->tetrad->y + 1,
-                state->tetrad->x + 1,
+    // paint the tetrad, where it is in the field as it is drawn
+    if (state->tetrad && (Y = EffectsTetradRow(state)) != INT_MIN)
+        TetradPaint(state, PANE_FIELD,
+                Y - state->Vy + 1,
+                state->tetrad->x - state->Vx + 1,
                 state->tetrad);
+    PROF_END(state, PROF_FIELD);
+
+    OverlayPaint(state);
 
     return;
 }
 
-void Update(STATE* state)
+static int OverlayCompare(const void* a, const void* b)
 {
-    time_t rawtime;
-    struct tm* timeinfo;
+    guint64 x = *(const guint64*)a, y = *(const guint64*)b;
 
-    // update the clock
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    strftime(state->clock, TETRIS_CLOCK_BUFSIZE, "[%H.%M:%S]", timeinfo);
+    return (x > y) - (x < y);
+}
 
-    state->level = state->lines / 10 + state->init_level;
-    state->speed = state->init_speed - (state->delta * state->level);
+void OverlayPaint(STATE* state)
+{
+    PROF* prof = state->prof;
+    guint64 values[PROF_FRAMES];
+    guint64 phase[PROF_PHASES];
+    char line[TETRIS_BUFSIZE];
+    int n, X, Y, len;
 
-    if (state->game_over_f || state->pause_f)
+    if (! prof || ! prof->overlay)
         return;
 
-    if (state->line_clear_f) {
-        if (state->line_clear_t >=
-                (state->line_clear_timeout ? state->line_clear_timeout : state->speed)
-                || ! state->do_clear) {
+    // the frame being painted is still open, so it is left out
+    n = prof->n > 1 ? MIN(prof->n - 1, PROF_FRAMES - 1) : 0;
+    if (! n)
+        return;
 
-            state->line_clear_f = 0;
-            LineClear(state);
-            EventQuery(state);
+    memset(phase, 0, sizeof(phase));
+    for (X = 0; X < n; X++) {
+        const PROF_FRAME* frame = &prof->frames[(prof->n - 2 - X) % PROF_FRAMES];
 
-        } else if (! state->pause_f) {
-            state->line_clear_t ++;
-        }
+        values[X] = frame->dur;
+        for (Y = 0; Y < PROF_PHASES; Y++)
+            phase[Y] += frame->phase[Y];
     }
 
-    if (state->tetrad && !TetradUpdate(state)) {
-        EventTetrad(state);
-    }
+    qsort(values, n, sizeof(guint64), OverlayCompare);
+
+#define PROF_MS(ns) ((ns) / 1e6)
+
+    len = snprintf(line, sizeof(line), "frame %6.2f p50 %6.2f p90 %6.2f p99 %6.2f max %6.2f ms",
+            PROF_MS(prof->frames[(prof->n - 2) % PROF_FRAMES].dur),
+            PROF_MS(values[(50 * n + 99) / 100 - 1]),
+            PROF_MS(values[(90 * n + 99) / 100 - 1]),
+            PROF_MS(values[(99 * n + 99) / 100 - 1]),
+            PROF_MS(values[n - 1]));
+    RenderPrint(state, PANE_SCREEN, 0, MAX(state->Wx - len, 0),
+            COLOR_PAIR(6) | A_BOLD, "%s", line);
+
+    len = snprintf(line, sizeof(line), "%s %6.2f %s %6.2f %s %6.2f %s %6.2f ms/frame",
+            ProfName(PROF_INPUT), PROF_MS(phase[PROF_INPUT] / n),
+            ProfName(PROF_UPDATE), PROF_MS(phase[PROF_UPDATE] / n),
+            ProfName(PROF_PAINT), PROF_MS(phase[PROF_PAINT] / n),
+            ProfName(PROF_REFRESH), PROF_MS(phase[PROF_REFRESH] / n));
+    RenderPrint(state, PANE_SCREEN, 1, MAX(state->Wx - len, 0),
+            COLOR_PAIR(6), "%s", line);
+
+#undef PROF_MS
 
     return;
 }
 
 void Refresh(STATE* state)
 {
-    refresh();
-    wrefresh(state->fieldwin);
-    if (state->statuswin)
-        wrefresh(state->statuswin);
+    state->renderer->flush(state);
+
+    return;
+}
+
+void FrameSync(STATE* state)
+{
+    guint64 tick = state->ticks;
+    char go;
+
+    // the frame is out; the benchmark lets the next one go once it
+    // has counted this one, and quits by hanging up
+    if (write(state->frame_sync, &tick, sizeof(tick)) != sizeof(tick) ||
+            read(state->frame_sync, &go, 1) != 1)
+        state->status = STATUS_GAMEOVER;
 
     return;
 }
@@ -496,537 +727,420 @@ void StatusWindowPaint(STATE* state)
     size_t Y;
     gint X = 0;
 
-    werase(state->statuswin);
-    wattrset(state->statuswin, A_NORMAL | COLOR_PAIR(7));
-    box(state->statuswin, 0, 0);
+    state->renderer->blank(state, PANE_STATUS);
+    state->renderer->outline(state, PANE_STATUS, 0, 0, state->Sby, state->Sbx,
+            A_NORMAL | COLOR_PAIR(7));
 
-    wmove(state->statuswin, 1, 1);
-    wattrset(state->statuswin, A_BOLD);
-    wprintw(state->statuswin, "Level:\t");
-    wattrset(state->statuswin, COLOR_PAIR((state->level % 7) + 1) | A_BOLD);
-    wprintw(state->statuswin, "%d", state->level);
+    RenderPrint(state, PANE_STATUS, 1, 1, A_BOLD, "Level:");
+    RenderPrint(state, PANE_STATUS, 1, 8,
+            COLOR_PAIR((state->level % 7) + 1) | A_BOLD,
+            "%d", state->level);
 
-    wmove(state->statuswin, 2, 1);
-    wattrset(state->statuswin, A_BOLD);
-    wprintw(state->statuswin, "Lines:\t");
-    wattrset(state->statuswin, COLOR_PAIR(((state->lines / 10) % 7) + 1) | A_BOLD);
-    wprintw(state->statuswin, "%d", state->lines);
+    RenderPrint(state, PANE_STATUS, 2, 1, A_BOLD, "Lines:");
+    RenderPrint(state, PANE_STATUS, 2, 8,
+            COLOR_PAIR(((state->lines / 10) % 7) + 1) | A_BOLD,
+            "%d", state->lines);
 
-    wmove(state->statuswin, 3, 1);
-    wattrset(state->statuswin, A_BOLD);
-    wprintw(state->statuswin, "Score:\t");
-    wattrset(state->statuswin, COLOR_PAIR((state->score / 10000 % 7) + 1) | A_BOLD);
-    wprintw(state->statuswin, "%d", state->score);
+    RenderPrint(state, PANE_STATUS, 3, 1, A_BOLD, "Score:");
+    RenderPrint(state, PANE_STATUS, 3, 8,
+            COLOR_PAIR((state->score / 10000 % 7) + 1) | A_BOLD,
+            "%d", state->score);
 
-    wmove(state->statuswin, 4, 1);
-    wattrset(state->statuswin, A_BOLD);
-    wprintw(state->statuswin, "Next:");
+    RenderPrint(state, PANE_STATUS, 4, 1, A_BOLD, "Next:");
 
     Y = 6;
     for (X = g_queue_get_length(state->queue) - 1; X > 0; X--) {
-       TetradPaint(state->statuswin, Y, 1, (TETRAD*)g_queue_peek_nth(state->queue, X));
+       TetradPaint(state, PANE_STATUS, Y, 1, (TETRAD*)g_queue_peek_nth(state->queue, X));
        Y += 3;
     }
 
     return;
 }
 
-int SignalHandler(int sig)
-{
-    // TODO: Handle SIGWINCH, maybe SIGSEGV
-    // NOTE: signal(sigwinch, SignalHandler);
-    return 1;
-}
-
-TETRAD* TetradAlloc(int shape, int x, int y)
-{
-    TETRAD* tetrad = NULL;
-
-    tetrad = (TETRAD*)malloc(sizeof(TETRAD));
-    if (!tetrad)
-        return NULL;
-
-    tetrad->shape = shape;
-    tetrad->x = x;
-    tetrad->y = y;
-    tetrad->x0 = x;
-    tetrad->y0 = y;
-    tetrad->t = 0;
-    tetrad->rot = 0;
-
-    return tetrad;
-}
-
-TETRAD* TetradRandomAlloc(STATE* state)
-{
-    TETRAD* tetrad;
-    int rot = 0;
-
-    rot = rand() % 4;
-    tetrad = TetradAlloc(rand() % 7, rand() % state->Bx, 0);
-
-    return tetrad;
-}
-
-void TetradFree(TETRAD* tetrad)
+void EffectsUpdate(STATE* state)
 {
-    free(tetrad);
-
-    return;
-}
-
-int TetradUpdate(STATE* state)
-{
-    if (! state->tetrad) {
-        // there is no tetrad
-        return 0;
-    }
-
-    if (state->tetrad->t >= state->speed) {
-        // lower the tetrad
-        state->tetrad->y ++;
-        if (TetradFieldOverlap(state)) {
-            // replace the tetrad
-            state->tetrad->y --;
-
-            return 0;
+    EFFECT* effect;
+
+    if (! state->effects)
+        state->effects = g_queue_new();
+
+    // a line clear the engine has committed since the last frame
+    if (state->clears != state->clears_seen) {
+        if (state->clears > state->clears_seen &&
+                state->ncleared && state->do_clear != CLEAR_NONE) {
+            // a clear moves the rows an older effect was drawn from
+            while (! g_queue_is_empty(state->effects))
+                g_free(g_queue_pop_head(state->effects));
+
+            effect = g_new0(EFFECT, 1);
+            memcpy(effect->rows, state->cleared, sizeof(effect->rows));
+            effect->n = MIN(state->ncleared, TETRIS_CLEAR_ROWS);
+            effect->start = state->ticks;
+            effect->duration = state->line_clear_timeout ?
+                state->line_clear_timeout : state->speed;
+            g_queue_push_tail(state->effects, effect);
         }
 
-        state->tetrad->t = 0;
+        state->clears_seen = state->clears;
     }
 
-    state->tetrad->t ++;
-    return 1;
-}
-
-void TetradQueue(STATE* state)
-{
-    TETRAD* tetrad = NULL;
-
-    tetrad = TetradAlloc(rand() % 7,
-            state->Bx / 2 - 2,
-            0);
-    g_queue_push_head(state->queue, tetrad);
-
-    return;
-}
-
-void TetradPaint(WINDOW* window, int y, int x, TETRAD* tetrad)
-{
-    size_t X = 0;
-    int Z = 0;
-    int W = 0;
-
-    Z = tetrad->rot % 2 ? 2 : 4;
-    W = RotateCorrection(tetrad);
-
-    for(X = 8 * tetrad->rot; X < 8 * tetrad->rot + 8; X ++) {
-        wmove(window, y + X / Z - W, 2 * (x + X % Z) - 1);
-        if (shapes[tetrad->shape][X] == '#') {
-            wattrset(window, A_REVERSE | COLOR_PAIR(tetrad->shape + 1));
-            waddch(window, ' ');
-            waddch(window, ' ');
-        }
-        wattrset(window, A_NORMAL | COLOR_PAIR(7));
-    }
+    // effects finish in the order they started
+    while ((effect = g_queue_peek_head(state->effects)) &&
+            state->ticks - effect->start >= effect->duration)
+        g_free(g_queue_pop_head(state->effects));
 
     return;
 }
 
-void TetradTranslate(STATE* state, TETRAD* tetrad)
+/*
+ * The engine has taken the cleared rows out already, so while their
+ * effect plays the field is drawn as it was before: display row Y
+ * shows the live row it moved down to, and the cleared rows, for which
+ * this returns -1, are left to EffectsPaint().
+ */
+int EffectsRow(STATE* state, int Y)
 {
-    size_t X = 0, offset = 0;
-    int Z = 0;
-    int W = 0;
-
-    Z = tetrad->rot % 2 ? 2 : 4;
-    W = RotateCorrection(tetrad);
-
-    for(X = 8 * tetrad->rot; X < 8 * tetrad->rot + 8; X ++) {
-        offset = state->Bx *
-            (tetrad->y + X / Z - W) +
-            (tetrad->x + X % Z);
-
-        if (shapes[tetrad->shape][X] == '#' &&
-                (offset / state->Bx < state->By &&
-                 tetrad->x + X % Z < state->Bx)) {
-            state->field[offset] = tetrad->shape + 1;
-        }
+    EFFECT* effect;
+    int A, below = 0;
+
+    effect = state->effects ? g_queue_peek_tail(state->effects) : NULL;
+    if (! effect)
+        return Y;
+
+    // the rows cleared below Y are what it moved down by
+    for (A = 0; A < effect->n; A++) {
+        if (effect->rows[A] == Y)
+            return -1;
+        if (effect->rows[A] > Y)
+            below ++;
     }
 
-    return;
+    return Y + below;
 }
 
-int TetradFieldOverlap(STATE* state)
+/*
+ * The inverse of EffectsRow(): the display row of live row Y, above
+ * the field for the rows the clear brought in at the top.
+ */
+int EffectsLiveRow(STATE* state, int Y)
 {
-    size_t X = 0, offset = 0;
-    int Z = 0;
-    int W = 0;
-
-    // calculate the orientation divisor of the tetrad
-    Z = state->tetrad->rot % 2 ? 2 : 4;
-    W = RotateCorrection(state->tetrad);
-
-    // check for collision (overlapping)
-    for(X = 8 * state->tetrad->rot; X < 8 * state->tetrad->rot + 8; X ++) {
-        offset = state->Bx *
-            (state->tetrad->y + X / Z - W) +
-            (state->tetrad->x + X % Z);
-
-        if (shapes[state->tetrad->shape][X] == '#' &&
-                ((offset / state->Bx >= state->By
-                  || state->tetrad->x + X % Z >= state->Bx) ||
-                 (state->field[offset]))) {
-            // collision has occured
-            return 1;
+    EFFECT* effect;
+    int A, k, D, below;
+
+    effect = state->effects ? g_queue_peek_tail(state->effects) : NULL;
+    if (! effect)
+        return Y;
+
+    // D is Y less the cleared rows below D, and only one D fits
+    for (k = effect->n; k > 0; k--) {
+        D = Y - k;
+        for (A = 0, below = 0; A < effect->n && below >= 0; A++) {
+            if (effect->rows[A] == D)
+                below = -1;
+            else if (effect->rows[A] > D)
+                below ++;
         }
+        if (below == k)
+            return D;
     }
 
-    return 0;
+    return Y;
 }
 
-int TetradDrop(STATE* state)
+/*
+ * Where the tetrad is drawn while a clear plays, so that it stays put
+ * against the field drawn as it was before: INT_MIN when its rows are
+ * split by the cleared ones, and it is not drawn until they are gone.
+ */
+int EffectsTetradRow(STATE* state)
 {
-    int n = 0;
-
-    if (! state->tetrad)
-        return 0;
+    int x[4], y[4];
+    int top, bottom, n, X;
 
-    for(n = 0; ! TetradFieldOverlap(state); n ++)
-        state->tetrad->y ++;
-
-    state->tetrad->y --;
-
-    return n;
-}
-
-int RotateCorrection(TETRAD* tetrad)
-{
-    // NOTE: HEY! Don't fix it if its not broken! >_<
-    // TODO: Maybe its not broken, but the math is
-    // wrong somewhere.  Fix this!
-    int W = 0;
-
-    switch(tetrad->rot) {
-        case 0:
-            W = 0;
-            break;
-        case 1:
-        case 2:
-            W = 4;
-            break;
-        case 3:
-            W = 12;
-            break;
-        default:
-            // ???
-            return 0;
+    n = TetradCells(state->tetrad, x, y);
+    for (X = 0, top = INT_MAX, bottom = INT_MIN; X < n; X++) {
+        top = MIN(top, y[X]);
+        bottom = MAX(bottom, y[X]);
     }
 
-    return W;
+    if (! n || EffectsLiveRow(state, bottom) - EffectsLiveRow(state, top) != bottom - top)
+        return INT_MIN;
+
+    return EffectsLiveRow(state, top) - (top - state->tetrad->y);
 }
 
-int LineMark(STATE* state, int y, int h)
+void EffectsPaint(STATE* state)
 {
-    size_t Y = 0, X = 0;
-    int b = 0;
-    int n = 0;
-
-    for (Y = y; Y < y + h; Y ++) {
-        b = 1;
-        for (X = 0; X < state->Bx; X ++) {
-            if (! state->field[Y * state->Bx + X]) {
-                b = 0;
-                break;
+    EFFECT* effect;
+    chtype* cell;
+    chtype attr;
+    GList* node;
+    int A, X, Y;
+
+    for (node = state->effects->head; node; node = node->next) {
+        effect = (EFFECT*)node->data;
+
+        for (A = 0; A < effect->n; A++) {
+            Y = effect->rows[A];
+            if (Y < state->Vy || Y >= state->Vy + state->Vh)
+                continue;
+
+            // the flash walks through the colors, column by column
+            cell = state->linebuf;
+            for (X = state->Vx; X < state->Vx + state->Vw; X++) {
+                attr = A_NORMAL | COLOR_PAIR(7);
+                if (state->do_clear == CLEAR_FLASH)
+                    attr = COLOR_PAIR((state->ticks - effect->start + X) % 7 + 1) | A_REVERSE;
+
+                *cell++ = ' ' | attr;
+                *cell++ = ' ' | attr;
             }
-        }
 
-        if (b) {
-            for (X = 0; X < state->Bx; X ++) {
-                state->field[Y * state->Bx + X] = CLEARED;
-            }
-            n ++;
+            state->renderer->cells(state, PANE_FIELD, Y - state->Vy + 1, 1,
+                    state->linebuf, 2 * state->Vw);
         }
     }
 
-    return n;
+    return;
 }
 
-void LineClear(STATE* state)
+void ViewportUpdate(STATE* state)
 {
-    size_t Y = 0;
-    int n = 0, x = 0;
-
-    for (Y = 0; Y < state->By; Y += n) {
-        n = 1;
-        if (state->field[Y * state->Bx] == CLEARED) {
-            // how many consecutive lines are cleared?
-            for (n = 1; state->field[(Y + n) * state->Bx] == CLEARED; n ++);
-            // move all above lines down by n lines
-            for (x = Y * state->Bx - 1; x >= 0; x --) {
-                state->field[x + n * state->Bx] = state->field[x];
-                state->field[x] = 0;
-            }
-            state->lines += n;
-            state->score += Power(2, n - 1) * 1000;
-        }
+    int mx, my;
+
+    // scroll so that the tetrad and a few cells around it stay in sight
+    if (state->tetrad) {
+        mx = MIN(4, MAX(state->Vw - 4, 0) / 2);
+        my = MIN(4, MAX(state->Vh - 4, 0) / 2);
+
+        if (state->tetrad->x - mx < state->Vx)
+            state->Vx = state->tetrad->x - mx;
+        if (state->tetrad->x + 4 + mx > state->Vx + state->Vw)
+            state->Vx = state->tetrad->x + 4 + mx - state->Vw;
+        if (state->tetrad->y - my < state->Vy)
+            state->Vy = state->tetrad->y - my;
+        if (state->tetrad->y + 4 + my > state->Vy + state->Vh)
+            state->Vy = state->tetrad->y + 4 + my - state->Vh;
     }
 
-    return;
-}
+    state->Vx = CLAMP(state->Vx, 0, state->Bx - state->Vw);
+    state->Vy = CLAMP(state->Vy, 0, state->By - state->Vh);
 
-// some useless function
-/*
-   int PrintTetrad(FILE* file, tetrad_t tetrad, int rot)
-   {
-   int n = 0;
-   size_t X = 0, Y = 0;
-
-   if (rot % 2) {
-   for(X = 8 * rot; X < 8 * rot + 8; X += 2) {
-   fprintf(file, "%.2s\n", shapes[tetrad] + X);
-   }
-   } else {
-   for(X = 8 * rot; X < 8 * rot + 8; X += 4) {
-   fprintf(file, "%.4s\n", shapes[tetrad] + X);
-   }
-   }
-
-   fputc('\n', file);
-   ++ n;
-
-   return n;
-   }
-   */
-
-void EventQuit(STATE* state)
-{
-    state->status = STATUS_GAMEOVER;
     return;
 }
 
-void EventDrop(STATE* state)
+int SignalHandler(int sig)
 {
-    if (! state->tetrad || state->pause_f || state->game_over_f)
-        return;
-
-    state->score += TetradDrop(state) * 10;
-    EventTetrad(state);
-
-    return;
+    // TODO: Handle SIGWINCH, maybe SIGSEGV
+    // NOTE: signal(sigwinch, SignalHandler);
+    return 1;
 }
 
-void EventLower(STATE* state)
+void TetradPaint(STATE* state, int pane, int y, int x, TETRAD* tetrad)
 {
-    if (! state->tetrad || state->pause_f)
-        return;
+    chtype line[8];
+    const char* shape;
+    int Z = 0;
+    int X, Y, a, b, row, maxy, maxx;
 
-    state->tetrad->y ++;
-    if (TetradFieldOverlap(state)) {
-        state->tetrad->y --;
+    Z = tetrad->rot % 2 ? 2 : 4;
+    maxy = state->Ph[pane];
+    maxx = state->Pw[pane];
+
+    // every row of a tetrad is a single run of blocks,
+    // so each row is written with one call
+    for (Y = 0; Y < 8 / Z; Y++) {
+        shape = shapes[tetrad->shape] + 8 * tetrad->rot + Y * Z;
+        row = y + Y;
+
+        for (a = 0; a < Z && shape[a] != '#'; a++);
+        for (b = a; b < Z && shape[b] == '#'; b++);
+        if (a == b)
+            continue;
+
+        // clip to the inside of the window border
+        if (row < 1 || row > maxy - 2)
+            continue;
+        a = MAX(a, 1 - x);
+        b = MIN(b, (maxx - 2) / 2 - x + 1);
+        if (a >= b)
+            continue;
+
+        for (X = 0; X < 2 * (b - a); X++)
+            line[X] = ' ' | A_REVERSE | COLOR_PAIR(tetrad->shape + 1);
+
+        state->renderer->cells(state, pane, row, 2 * (x + a) - 1,
+                line, 2 * (b - a));
     }
 
     return;
 }
 
-void EventRotate(STATE* state, int rot)
+void StatusMessage(STATE* state, int pane, const char* str)
 {
-    if (! state->tetrad || state->pause_f)
-        return;
-
-    state->tetrad->rot = (state->tetrad->rot + rot + 4) % 4;
-    // TODO: implement smart rotation.
-    if (TetradFieldOverlap(state)) {
-        // could not rotate
-        state->tetrad->rot = (state->tetrad->rot - rot + 4) % 4;
-    } else if (state->do_rotate_timeout_reset) {
-        state->tetrad->t = 0;
-    }
-
-    return;
-}
+    int x, y, w, h, len;
 
-void EventMove(STATE* state, int x)
-{
-    if (! state->tetrad || state->pause_f)
-        return;
+    len = strlen(str);
+    w = len + 2;
+    h = 3;
+    x = (state->Sx - w) / 2;
+    y = (state->Sy - 3) / 2;
 
-    state->tetrad->x += x;
-    if (TetradFieldOverlap(state))
-        state->tetrad->x -= x;
+    state->renderer->outline(state, pane, y, x, h, w, A_NORMAL | COLOR_PAIR(7));
+    CarouselPrint(state, pane, y + 1, x + 1, 3, str);
 
     return;
 }
 
-void EventTetrad(STATE* state)
+void CarouselPrint(STATE* state,
+        int pane,
+        int y,
+        int x,
+        int s,
+        const char* str)
 {
-    // NOTE: scoring for cleared lines occurs
-    //       in LineClear();
-
-    int y = 0, h = 0;
-
-    // translate the tetrad to the field as tiles
-    TetradTranslate(state, state->tetrad);
-    // gather information about tetrad dimensions
-    y = state->tetrad->y;
-    h = state->tetrad->rot % 2 ? 4 : 2;
-    // free the tetrad
-    TetradFree(state->tetrad);
-    state->tetrad = NULL;
-
-    if (LineMark(state, y, h)) {
-        state->line_clear_t = 0;
-        state->line_clear_f = 1;
-    } else {
-        EventQuery(state);
-    }
+    chtype line[TETRIS_BUFSIZE];
+    size_t X = 0;
+    int len = 0;
 
-    /*
-       TetradQueue(state);
-       state->tetrad = ListDequeue(state->queue);
-       */
-    return;
-}
+    len = MIN(strlen(str), TETRIS_BUFSIZE);
 
-void EventQuery(STATE* state)
-{
-    TetradQueue(state);
-    state->tetrad = g_queue_pop_tail(state->queue);
-    if (TetradFieldOverlap(state)) {
-        state->game_over_f = 1;
+    for (X = 0; X < len; X++) {
+        line[X] = (unsigned char)str[X] |
+            COLOR_PAIR(((state->ticks / s) + X) % 7 + 1) | A_BOLD;
     }
 
-    return;
-}
-
-void EventPause(STATE* state)
-{
-    state->pause_f = 1;
+    state->renderer->cells(state, pane, y, x, line, len);
 
-    return;
 }
 
-void EventUnpause(STATE* state)
+/* keyname(3X) -> keycode, built on first use by KeyParse() */
+static GHashTable* key_index = NULL;
+
+int KeyParse(const char* str)
 {
-    state->pause_f = 0;
+    const char* name;
+    unsigned char c;
+    int X;
 
-    return;
-}
+    if (str[0] == ':') {
+        // numerical character
+        if (sscanf(str, ":%c", &c) != 1)
+            return -1;
+        return (unsigned char)c;
+    }
 
-void DebugPrintTetrad(TETRAD* tetrad, FILE* file)
-{
-    fprintf(file, "%p", tetrad);
-    return;
+    if (! key_index) {
+        // keyname(3X) sucks, so call it once per keycode and remember.
+        // walk downwards so that the lowest code wins for duplicate names
+        key_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        for (X = TETRIS_MAX_KEYCODE; X >= 0; X--) {
+            if ((name = keyname(X)) != NULL)
+                g_hash_table_insert(key_index, g_strdup(name), GINT_TO_POINTER(X + 1));
+        }
+    }
+
+    // we could not find the key code if this is -1. :(
+    return GPOINTER_TO_INT(g_hash_table_lookup(key_index, str)) - 1;
 }
 
-void StatusMessage(STATE* state, WINDOW* window, const char* str)
+int KeymapBind(STATE* state, const char* action, char* keys)
 {
-    int x, y, w, h, len;
+    char *key, *next;
+    int A, X = 0;
 
-    len = strlen(str);
-    w = len + 2;
-    h = 3;
-    x = (state->Sx - w) / 2;
-    y = (state->Sy - 3) / 2;
+    for (A = 0; A < TETRIS_KEYS; A++) {
+        if (! strcmp(keymap_desc[A], action))
+            break;
+    }
 
-    BoxPrint(state->fieldwin, y, x, h, w);
-    CarouselPrint(state, window, y + 1, x + 1, 3, str);
+    if (A >= TETRIS_KEYS) {
+        fprintf(stderr, "<ntetris>\tAction not supported: \"%s\".\n", action);
+        return 0;
+    }
 
-    wattrset(window, A_NORMAL | COLOR_PAIR(7));
+    if (! keys) {
+        fprintf(stderr, "<ntetris>\tNo key given for action \"%s\".\n", action);
+        return 0;
+    }
 
-    return;
-}
+    // the new bindings replace the old ones, several keys can
+    // be given separated by commas; ":c" names any character c,
+    // even a comma
+    memset(state->keymap[A], -1, sizeof(state->keymap[A]));
+    for (key = keys; *key; key = next) {
+        next = key + (key[0] == ':' && key[1] ? 2 : 0);
+        next += strcspn(next, ", \t\n");
+        if (*next)
+            *next++ = '\0';
+
+        if (! *key)
+            continue;
+
+        if (X >= TETRIS_KEY_BINDINGS) {
+            fprintf(stderr, "<ntetris>\tToo many keys for action \"%s\".\n", action);
+            return 0;
+        }
 
-void BoxPrint(WINDOW* window, int y, int x, int h, int w)
-{
-    int X = 0;
-    int Y = 0;
-
-    // print the top line
-    for (Y = 0; Y < h; Y ++) {
-        for (X = 0; X < w; X ++) {
-            wmove(window, Y + y, X + x);
-
-            if (Y == 0 || Y == h - 1) {
-                if (X == 0) {
-                    waddch(window, Y == 0 ? ACS_ULCORNER : ACS_LLCORNER);
-                } else if (X == w - 1) {
-                    waddch(window, Y == 0 ? ACS_URCORNER : ACS_LRCORNER);
-                } else {
-                    waddch(window, ACS_HLINE);
-                }
-            } else {
-                waddch(window, ACS_VLINE);
-                if (X == 0) {
-                    X = w > 2 ? w - 2 : 0;
-                }
-            }
+        state->keymap[A][X] = KeyParse(key);
+        if (state->keymap[A][X] < 0 || state->keymap[A][X] > TETRIS_MAX_KEYCODE) {
+            fprintf(stderr, "<ntetris>\tKey not supported: \"%s\".\n", key);
+            return 0;
         }
+
+        X ++;
     }
 
-    return;
+    return 1;
 }
 
-void CarouselPrint(STATE* state,
-        WINDOW* window,
-        int y,
-        int x,
-        int s,
-        const char* str)
+int KeymapLoad(STATE* state, const char* path)
 {
-    size_t X = 0;
-    int len = 0;
+    FILE* file;
+    char line[TETRIS_BUFSIZE];
+    char *action, *keys;
+    int n = 0;
 
-    len = strlen(str);
+    file = fopen(path, "r");
+    if (! file) {
+        fprintf(stderr, "<ntetris>\tCould not open keymap \"%s\".\n", path);
+        return 0;
+    }
 
-    wmove(window, y, x);
-    for (X = 0; X < len; X++) {
-        wattrset(window, A_NORMAL | COLOR_PAIR(7));
-        wattrset(window, COLOR_PAIR(((state->ticks / s) + X) % 7 + 1) |
-                A_BOLD);
-        waddch(window, str[X]);
+    // one action per line, followed by its keys:
+    //   left j KEY_LEFT
+    while (fgets(line, sizeof(line), file)) {
+        n ++;
+        keys = line + strspn(line, " \t");
+        if (*keys == '#' || *keys == '\n' || ! *keys)
+            continue;
+
+        action = strsep(&keys, " \t\n");
+        if (! KeymapBind(state, action, keys)) {
+            fprintf(stderr, "<ntetris>\t... on line %d of \"%s\".\n", n, path);
+            fclose(file);
+            return 0;
+        }
     }
 
-}
+    fclose(file);
 
-int Power(int a, int x)
-{
-    return x ? a * Power(a, x - 1) : 1;
+    return 1;
 }
 
-int KeyParse(const char* str)
+void KeymapBuild(STATE* state)
 {
-    unsigned char c;
-    int i;
-
-    if (str[0] == ':') {
-        // numerical character
-        sscanf(str, ":%c", &c);
-        i = (unsigned char)c;
-    } else {
-        // read from string
-        int X;
-
-        for (X = 0; X <= TETRIS_MAX_KEYCODE; X++) {
-            char buffer[TETRIS_BUFSIZE];
-
-            // keyname(3X) sucks.
-            if (keyname(X) != NULL) {
-                strncpy(buffer, keyname(X), TETRIS_BUFSIZE);
-                if (! strcmp(str, buffer)) {
-                    // we found the key code!
-                    i = X;
-                    break;
-                }
-            }
-        }
-
-        if (X > TETRIS_MAX_KEYCODE) {
-            // we could not find the key code. :(
-            i = 0;
+    int A, X, c;
+
+    // the first action bound to a key wins
+    memset(state->keyaction, -1, sizeof(state->keyaction));
+    for (A = TETRIS_KEYS - 1; A >= 0; A--) {
+        for (X = 0; X < TETRIS_KEY_BINDINGS; X++) {
+            c = state->keymap[A][X];
+            if (c >= 0 && c <= TETRIS_MAX_KEYCODE)
+                state->keyaction[c] = A;
         }
     }
 
-    return i;
+    return;
 }
-
@@ -4,8 +4,11 @@
  * Released under the GNU General Public License
  */
 
+#pragma once
+
 #include <curses.h>
 #include <glib.h>
+#include "field.h"
 
 /*
  * The Tetrads
@@ -14,15 +17,7 @@
  * (I)   (J)   (L)   (O) (S)  (T)  (Z)
  */
 
-const char* shapes[] = {
-    "####----#-#-#-#-####----#-#-#-#-", // I
-    "#---###-###-#---###---#--#-###--", // J
-    "--#-###-#-#-##--###-#---##-#-#--", // L
-    "##--##--####----##--##--####----", // O
-    "-##-##--#-##-#---##-##--#-##-#--", // S
-    "-#--###-#-###---###--#---###-#--", // T
-    "##---##--####---##---##--####---"  // Z
-};
+extern const char* shapes[];
 
 #define TETRIS_CLOCK_BUFSIZE    16
 #define CLEARED                 127
@@ -33,20 +28,20 @@ const char* shapes[] = {
 #define TETRIS_STATUS_HEIGHT    20
 #define TETRIS_STATUS_WIDTH     17
 #define TETRIS_KEYS             9
+#define TETRIS_KEY_BINDINGS     4
 #define TETRIS_MAX_KEYCODE      410
 #define TETRIS_BUFSIZE          256
+#define TETRIS_SIM_MAX_TICKS    72000
+#define TETRIS_CLEAR_ROWS       4
+#define TETRIS_STD_WIDTH        10
+#define TETRIS_STD_HEIGHT       20
+#define TETRIS_KICKS            5
 
-const char* keymap_desc[] = {
-    "quit",
-    "drop",
-    "lower",
-    "rotcw",
-    "rotccw",
-    "left",
-    "right",
-    "pause",
-    "reset"
-};
+extern const char* keymap_desc[];
+
+// SRS rotation, see engine.c
+extern const signed char tetrad_origin[7][4][2];
+extern const signed char tetrad_kicks[7][4][2][TETRIS_KICKS][2];
 
 enum {
     TETRIS_KEY_QUIT = 0,
@@ -70,6 +65,13 @@ enum {
     STATUS_MENU
 };
 
+enum {
+    PANE_SCREEN = 0,
+    PANE_FIELD,
+    PANE_STATUS,
+    TETRIS_PANES
+};
+
 enum {
     CLEAR_NONE = 0,
     CLEAR_FLASH = 1,
@@ -85,22 +87,51 @@ typedef struct _TETRAD {
     int rot;      // current rotation
 } TETRAD;
 
+// a line clear being animated, see EffectsUpdate()
+typedef struct _EFFECT {
+    int rows[TETRIS_CLEAR_ROWS];
+    int n;
+    unsigned long start;    // tick it started on
+    int duration;           // in ticks
+} EFFECT;
+
 typedef struct _STATE {
     GQueue* queue;
-    char* field;
+    FIELD* field;
+
+    guint64 seed; // seed the game was started with
+    guint64 rng;  // per-game random state, see Random()
+
+    const struct _RENDERER* renderer;
+    void* render_data; // private to the renderer
 
     WINDOW* fieldwin;
     WINDOW* statuswin;
+    chtype* linebuf; // one row of the playfield window
+    GQueue* effects; // EFFECTs still playing
+    int clears_seen; // clears already turned into effects
 
-    int keymap[9];
+    int keymap[TETRIS_KEYS][TETRIS_KEY_BINDINGS]; // -1 when unbound
+    signed char keyaction[TETRIS_MAX_KEYCODE + 1]; // keycode -> action
 
     /* settings */
     int init_level;
     int line_clear_timeout;
 
+    /* batch simulation settings */
+    int sim_games;
+    int sim_threads;
+    unsigned long sim_max_ticks;
+    GQueue* replays; // replay file names, owned by argv
+    FILE* record;
+
+    struct _PROF* prof; // NULL unless profiling, see prof.h
+    struct _TELEMETRY* telemetry; // NULL unless --telemetry, see telemetry.h
+    guint64 game_id;    // of the game in the telemetry
+    const char* save;   // snapshot to resume from and suspend to, see snap.h
+    int frame_sync;     // socket a benchmark steps the frames with, or -1; see termbench.c
+
     unsigned long ticks;
-    int line_clear_t;
-    int line_clear_f;
     int game_over_f;
     int pause_f;
 
@@ -113,37 +144,66 @@ typedef struct _STATE {
     int level;
     int lines;
     int score;
+    int pieces;
     int queue_size;
 
+    // the rows taken out by the last line clear,
+    // for the renderer to animate
+    int clears;
+    int cleared[TETRIS_CLEAR_ROWS];
+    int ncleared;
+
     char clock[TETRIS_CLOCK_BUFSIZE];
 
     int Bx, By; // playfield size vector
     int Sx, Sy; // size of playfield window, in characters
+    int Vx, Vy; // origin of the visible part of the playfield
+    int Vw, Vh; // size of the visible part of the playfield, in cells
     int Sbx, Sby; // size of status window, in characters
     int Wx, Wy; // size of standard window
 
+    // placement of each pane on the screen
+    int Px[TETRIS_PANES], Py[TETRIS_PANES];
+    int Pw[TETRIS_PANES], Ph[TETRIS_PANES];
+
     // boolean switches
     int do_clear;
     int do_rotate_timeout_reset;
     int do_dissolve;
     int do_pause_blocks;
+    int do_seed;
 
 } STATE;
 
 int ParseOptions(STATE*, int, char**);
 
 STATE* Init(int, char**);
-void InitTerminal(STATE*);
+int InitTerminal(STATE*);
 void DimensionWindows(STATE*);
 void Reset(STATE*);
 void Cleanup(STATE*);
 
+STATE* GameAlloc(void);
+int GameStart(STATE*, guint64);
+void GameFree(STATE*);
+void GameTelemetry(STATE*, int type, int a, int b, int c, int d);
+void RandomSeed(STATE*, guint64);
+guint32 Random(STATE*);
+
 void Paint(STATE*);
 void Update(STATE*);
 void Input(STATE*);
 void Refresh(STATE*);
+void FrameSync(STATE*);
 
 void StatusWindowPaint(STATE*);
+void EffectsUpdate(STATE*);
+int EffectsRow(STATE*, int Y);
+int EffectsLiveRow(STATE*, int Y);
+int EffectsTetradRow(STATE*);
+void EffectsPaint(STATE*);
+void OverlayPaint(STATE*);
+void ViewportUpdate(STATE*);
 int SignalHandler(int);
 
 TETRAD* TetradAlloc(int, int, int);
@@ -152,13 +212,13 @@ TETRAD* TetradRandomAlloc(STATE* state);
 void TetradFree(TETRAD*);
 int TetradUpdate(STATE*);
 void TetradQueue(STATE*);
-void TetradPaint(WINDOW*, int, int, TETRAD*);
+void TetradPaint(STATE*, int, int, int, TETRAD*);
 void TetradTranslate(STATE*, TETRAD*);
 int TetradFieldOverlap(STATE*);
+int TetradOverlap(STATE*, TETRAD*);
+int TetradCells(TETRAD*, int*, int*);
 int TetradDrop(STATE*);
 
-int RotateCorrection(TETRAD*);
-
 int LineMark(STATE*, int y, int h);
 void LineClear(STATE*);
 
@@ -171,12 +231,15 @@ void EventTetrad(STATE*);
 void EventQuery(STATE*);
 void EventPause(STATE*);
 void EventUnpause(STATE*);
+void EventAction(STATE*, int);
 
 void DebugPrintTetrad(TETRAD*, FILE*);
 
-void StatusMessage(STATE*, WINDOW*, const char*);
-void BoxPrint(WINDOW*, int, int, int, int);
-void CarouselPrint(STATE*, WINDOW*, int, int, int, const char*);
+void StatusMessage(STATE*, int, const char*);
+void CarouselPrint(STATE*, int, int, int, int, const char*);
 
 int Power(int, int);
 int KeyParse(const char*);
+int KeymapBind(STATE*, const char*, char*);
+int KeymapLoad(STATE*, const char*);
+void KeymapBuild(STATE*);
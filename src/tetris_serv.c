@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <getopt.h>
 
@@ -13,9 +14,28 @@
 
 #include <limits.h>
 #include <uv.h>
+#include <glib.h>
 #include "packet.h"
+#include "tetris.h"
+#include "row.h"
+#include "room.h"
+#include "journal.h"
+#include "session.h"
+#include "rate.h"
+#include "transport.h"
+#include "telemetry.h"
+#include "handoff.h"
+#include "lobby.h"
 
 #define DEFAULT_PORT 48879
+#define DEFAULT_SHARDS 4
+#define DEFAULT_WORKERS 4
+#define TICK_BUDGET (REFRESH_DELAY * 1000)  // microseconds
+#define SHED_HOLD 20                        // ticks
+#define TICK_CHUNK_MIN 1024                 // games, per worker
+
+// curses' ERR, which comes in with tetris.h
+#undef ERR
 
 #define ERROR(fmt, ...) \
         do { fprintf(stderr, "%s:%d:%s(): " fmt "\n", __FILE__, \
@@ -31,65 +51,961 @@
 
 #define WARN(msg) WARNING("%s", msg);
 
-void onrecv(uv_udp_t *req, ssize_t nread, const uv_buf_t *buf,
-            const struct sockaddr *addr, unsigned flags)
+struct _SERVER;
+
+// a slice of the rooms' games, stepped on a worker thread
+typedef struct _TICK_CHUNK {
+    uv_work_t work;
+    struct _SERVER *server;
+    int lo, hi;
+    GPtrArray *updated; // ROOM*, with an update to send
+} TICK_CHUNK;
+
+// a lockstep client to send its room's game to
+typedef struct _RESYNC {
+    guint64 token;
+    guint32 room;
+} RESYNC;
+
+typedef struct _SERVER {
+    TRANSPORT *udp;
+    TRANSPORT *shm;     // NULL without --local
+    uv_poll_t udp_poll, shm_poll;
+    uv_timer_t timer;
+    ROOMS *rooms;
+    JOURNAL *journal;   // NULL without --journal
+    SESSIONS *sessions;
+    LOBBY *lobby;       // sessions waiting for a match
+    GArray *busy;       // tokens of sessions with a channel to flush
+    RATES *sources;     // per source address
+    gint64 last_tick;   // g_get_monotonic_time() at the last tick
+    guint64 shed_until; // tick
+    guint64 shed;       // packets dropped while shedding
+
+    uv_work_t commit;   // of the journal, before the tick steps
+    int committed;      // JournalFlush() went well
+
+    TICK_CHUNK *chunks;
+    int nchunks;        // one per worker
+    int stepping;       // chunks of the tick still running, or its commit
+    int behind;         // the timer fired while they did
+    GArray *resyncs;    // RESYNC, sent at the end of the tick
+
+    int handoff;        // listening, -1 without --handoff
+    int handoff_peer;   // a new server, waiting for the end of the tick
+    uv_poll_t handoff_poll;
+} SERVER;
+
+static const int user_cmd_action[NUM_CMDS] = {
+    [ROTCW]  = TETRIS_KEY_ROTATE_CW,
+    [ROTCCW] = TETRIS_KEY_ROTATE_CCW,
+    [LOWER]  = TETRIS_KEY_LOWER,
+    [LEFT]   = TETRIS_KEY_MOVE_LEFT,
+    [RIGHT]  = TETRIS_KEY_MOVE_RIGHT,
+    [DROP]   = TETRIS_KEY_DROP
+};
+
+static void send_packet(SERVER *server, SESSION *session, gint64 now,
+                        int type, const void *value, uint16_t length)
+{
+    struct sockaddr_storage addr;
+    guint64 packet[CHANNEL_PACKET / sizeof(guint64)];
+
+    // acks and whatever reliable messages are due, then the
+    // unreliable one, if any, which is never sent again
+    size_t room = type < 0 ? CHANNEL_PACKET : CHANNEL_PACKET - sizeof(TLV) - length;
+    size_t size = ChannelWrite(&session->channel, packet, room, session->token, now);
+
+    if (type >= 0) {
+        TLV *tlv = (TLV*)((char*)packet + size);
+        tlv->type = type;
+        tlv->length = length;
+        memcpy(tlv->value, value, length);
+        size += sizeof(TLV) + length;
+    }
+
+    // a datagram that cannot go is as good as lost on the way
+    SessionAddr(session, &addr);
+    TRANSPORT *transport = addr.ss_family == AF_UNIX ? server->shm : server->udp;
+    TransportSend(transport, (const struct sockaddr*)&addr, packet, size);
+}
+
+// see that the session's channel gets flushed on the next ticks
+static void mark_busy(SERVER *server, SESSION *session)
+{
+    if (!session->channel.queued && ChannelBusy(&session->channel)) {
+        session->channel.queued = 1;
+        g_array_append_val(server->busy, session->token);
+    }
+}
+
+static void send_reliable(SERVER *server, SESSION *session, gint64 now,
+                          uint8_t type, const void *value, uint16_t length)
+{
+    ChannelQueue(&session->channel, type, value, length);
+    send_packet(server, session, now, -1, NULL, 0);
+    mark_busy(server, session);
+}
+
+static SESSION *on_register_client(SERVER *server, const struct sockaddr *addr,
+                                   const PACKET_HEADER *header, uint16_t id,
+                                   const TLV *tlv, gint64 now)
+{
+    const msg_register_client *msg = (const msg_register_client*)tlv->value;
+    char name[SESSION_NAME_MAX + 1];
+
+    if (tlv->length < sizeof(msg_register_client) ||
+            tlv->length < sizeof(msg_register_client) + msg->nameLength) {
+        WARN("Short REGISTER_CLIENT message");
+        return NULL;
+    }
+
+    snprintf(name, sizeof(name), "%.*s", msg->nameLength, msg->name);
+
+    SESSION *session = SessionCreate(server->sessions, addr, name, now);
+    if (!session) {
+        WARN("Out of sessions");
+        return NULL;
+    }
+
+    // without a token the client has started over, numbering its
+    // packets and messages from the beginning; registering again
+    // is harmless, so it is answered whether or not it is a copy
+    if (!header->token) {
+        ChannelRestart(&session->channel);
+        ChannelReceive(&session->channel, header, now);
+    }
+    ChannelAccept(&session->channel, id);
+
+    msg_client_registered reply = { session->token };
+    send_reliable(server, session, now, CLIENT_REGISTERED, &reply, sizeof(reply));
+
+    return session;
+}
+
+// a room for everyone in tokens, which all of them get to play in
+static void start_room(SERVER *server, const guint64 *tokens, int n, int players,
+                       int mode, const char *name, gint64 now)
+{
+    guint64 seed = g_get_real_time() ^ ((guint64)server->rooms->next_id << 32);
+    int X;
+
+    ROOM *room = RoomCreate(server->rooms, 0, seed, players, name);
+    if (!room) {
+        WARN("Could not create a room");
+        return;
+    }
+    if (mode == ROOM_MODE_LOCKSTEP)
+        RoomLockstep(room);
+
+    msg_room_created reply = { room->id, room->mode, seed, server->rooms->tick + 1 };
+    for (X = 0; X < n; X++) {
+        SESSION *session = SessionToken(server->sessions, tokens[X]);
+        session->room = room->id;
+        RoomWatch(room, session->token);
+        send_reliable(server, session, now, ROOM_CREATED, &reply, sizeof(reply));
+    }
+
+    // the room takes its first step on the next tick, and the
+    // journal keeps its watchers for them to rejoin it
+    if (server->journal)
+        JournalCreate(server->journal, room, server->rooms->tick + 1, seed);
+}
+
+static void on_create_room(SERVER *server, SESSION *session,
+                           const TLV *tlv, gint64 now)
+{
+    const msg_create_room *msg = (const msg_create_room*)tlv->value;
+    char name[ROOM_NAME_MAX + 1];
+    int mode = ROOM_MODE_STATE, band = 0;
+    size_t extra;
+
+    if (tlv->length < sizeof(msg_create_room) ||
+            tlv->length < sizeof(msg_create_room) + msg->roomNameLen ||
+            msg->numPlayers > LOBBY_PLAYERS) {
+        WARN("Bad CREATE_ROOM message");
+        return;
+    }
+
+    // the mode and the band are optional, after the name
+    extra = tlv->length - sizeof(msg_create_room) - msg->roomNameLen;
+    if (extra > 0)
+        mode = msg->roomName[msg->roomNameLen];
+    if (extra > 1)
+        band = msg->roomName[msg->roomNameLen + 1];
+
+    if (mode > ROOM_MODE_LOCKSTEP) {
+        WARN("Bad CREATE_ROOM message");
+        return;
+    }
+
+    snprintf(name, sizeof(name), "%.*s", msg->roomNameLen, msg->roomName);
+
+    // a room of its own takes the place of any match it waited for
+    if (msg->numPlayers < 2) {
+        LobbyLeave(server->lobby, session->token);
+        start_room(server, &session->token, 1, msg->numPlayers, mode, name, now);
+        return;
+    }
+
+    // the others come along on some later tick, see match_lobby()
+    session->room = 0;
+    LobbyJoin(server->lobby, session->token, msg->numPlayers, mode, band,
+              name, server->rooms->tick);
+}
+
+// everyone who has found enough others to play with gets a room
+static void match_lobby(SERVER *server, gint64 now)
+{
+    LOBBY_MATCH match;
+
+    while (LobbyMatch(server->lobby, server->sessions, &match))
+        start_room(server, match.tokens, match.players, match.players,
+                   match.mode, match.name, now);
+}
+
+// a room recovered from the journal, claimed by one of its watchers
+static void on_rejoin_room(SERVER *server, SESSION *session,
+                           const TLV *tlv, gint64 now)
+{
+    const msg_rejoin_room *msg = (const msg_rejoin_room*)tlv->value;
+
+    if (tlv->length < sizeof(msg_rejoin_room)) {
+        WARN("Short REJOIN_ROOM message");
+        return;
+    }
+
+    ROOM *room = RoomFind(server->rooms, msg->room);
+    if (!room || !msg->token || !RoomRejoin(room, msg->token, session->token))
+        return;
+
+    if (server->journal)
+        JournalRejoin(server->journal, room, server->rooms->tick + 1,
+                      msg->token, session->token);
+
+    LobbyLeave(server->lobby, session->token);
+    session->room = room->id;
+
+    msg_room_created reply = { room->id, room->mode, room->seed, room->tick + 1 };
+    send_reliable(server, session, now, ROOM_CREATED, &reply, sizeof(reply));
+
+    if (room->lockstep) {
+        RESYNC resync = { session->token, room->id };
+        g_array_append_val(server->resyncs, resync);
+    }
+}
+
+static void on_user_action(SERVER *server, SESSION *session, const TLV *tlv)
 {
-    if (nread < 0) {
-        WARNING("WARNING: %s\n", uv_err_name(nread));
-        uv_close((uv_handle_t*)req, NULL);
-        free(buf->base);
+    const msg_user_action *msg = (const msg_user_action*)tlv->value;
+
+    if (tlv->length < sizeof(msg_user_action) || msg->cmd >= NUM_CMDS) {
+        WARN("Bad USER_ACTION message");
         return;
     }
 
-    if (nread == 0) {
-        if(flags & UV_UDP_PARTIAL) {
-            WARN("Lost some of the buffer\n");
+    // only into the room start_room() put the session in
+    if (!msg->room || msg->room != session->room)
+        return;
+
+    ROOM *room = RoomFind(server->rooms, msg->room);
+    if (!room)
+        return;
+
+    int action = user_cmd_action[msg->cmd];
+    if (RoomAction(room, action) && server->journal)
+        JournalAction(server->journal, room, server->rooms->tick + 1, action);
+}
+
+static void flush_channels(SERVER *server, gint64 now)
+{
+    guint X, n = server->busy->len;
+
+    // sessions still busy are put back at the end, for the next tick
+    for (X = 0; X < n; X++) {
+        guint64 token = g_array_index(server->busy, guint64, X);
+        SESSION *session = SessionToken(server->sessions, token);
+        if (!session)
+            continue;
+
+        session->channel.queued = 0;
+        if (ChannelFailed(&session->channel, now)) {
+            SessionRemove(server->sessions, session);
+            continue;
         }
-        free(buf->base);
+
+        if (ChannelDue(&session->channel, now))
+            send_packet(server, session, now, -1, NULL, 0);
+        mark_busy(server, session);
+    }
+
+    g_array_remove_range(server->busy, 0, n);
+}
+
+static int shedding(const SERVER *server)
+{
+    return server->rooms->tick < server->shed_until;
+}
+
+static void overrun(SERVER *server, gint64 late)
+{
+    if (!shedding(server))
+        WARNING("Tick overran by %lldus, shedding load", (long long)late);
+    server->shed_until = server->rooms->tick + SHED_HOLD;
+}
+
+static void start_tick(SERVER *server);
+
+static void step_chunk(uv_work_t *work)
+{
+    TICK_CHUNK *chunk = (TICK_CHUNK*)work->data;
+
+    RoomsStep(chunk->server->rooms, chunk->lo, chunk->hi, chunk->updated);
+}
+
+static void send_updates(SERVER *server, GPtrArray *updated, gint64 now)
+{
+    guint64 buffer[512 / sizeof(guint64)];
+    const void *msg;
+    size_t length;
+    guint X;
+    int Y, type;
+
+    for (X = 0; X < updated->len; X++) {
+        ROOM *room = g_ptr_array_index(updated, X);
+
+        if (room->hash_due)
+            RoomHash(room);
+        room->hash_due = 0;
+
+        if (!room->updated)
+            continue;
+        room->updated = 0;
+
+        if (room->lockstep) {
+            type = ROOM_INPUTS;
+            msg = buffer;
+            length = RoomInputs(room, buffer, sizeof(buffer));
+            if (!length)
+                continue;
+        } else {
+            type = UPDATE_CLIENT_STATE;
+            msg = &room->update;
+            length = sizeof(room->update);
+        }
+
+        for (Y = 0; Y < room->nwatchers; Y++) {
+            SESSION *session = SessionToken(server->sessions, room->watchers[Y]);
+            if (session && session->room == room->id)
+                send_packet(server, session, now, type, msg, length);
+        }
+    }
+
+    g_ptr_array_set_size(updated, 0);
+}
+
+/*
+ * A lockstep client that is out of step gets the game as the server has
+ * it, in pieces that fit a packet.  Only between ticks, when the batch
+ * holds still, and not to a client that has not taken the last one yet.
+ */
+static void send_snapshots(SERVER *server, gint64 now)
+{
+    guint64 buffer[(CHANNEL_PACKET - 256) / sizeof(guint64)];
+    msg_room_snapshot *piece = (msg_room_snapshot*)buffer;
+    size_t chunk = sizeof(buffer) - sizeof(msg_room_snapshot);
+    guint X;
+
+    for (X = 0; X < server->resyncs->len; X++) {
+        RESYNC *resync = &g_array_index(server->resyncs, RESYNC, X);
+        SESSION *session = SessionToken(server->sessions, resync->token);
+        ROOM *room = RoomFind(server->rooms, resync->room);
+        if (!session || !room || !room->lockstep ||
+                (session->channel.unacked &&
+                 g_queue_get_length(session->channel.unacked) > CHANNEL_WINDOW / 2))
+            continue;
+
+        size_t size = RoomSnapSize(room);
+        char *snap = g_malloc(size);
+        size = RoomSnapSave(room, snap, size);
+
+        for (piece->offset = 0; piece->offset < size; piece->offset += chunk) {
+            size_t length = MIN(chunk, size - piece->offset);
+            piece->room = room->id;
+            piece->size = size;
+            piece->pad = 0;
+            piece->tick = room->tick;
+            memcpy(piece->data, snap + piece->offset, length);
+            send_reliable(server, session, now, ROOM_SNAPSHOT, piece,
+                          sizeof(msg_room_snapshot) + length);
+        }
+
+        g_free(snap);
+    }
+
+    g_array_set_size(server->resyncs, 0);
+}
+
+static void on_room_hash(SERVER *server, SESSION *session, const TLV *tlv)
+{
+    const msg_room_hash *msg = (const msg_room_hash*)tlv->value;
+    guint64 hash;
+
+    if (tlv->length < sizeof(msg_room_hash)) {
+        WARN("Short ROOM_HASH message");
         return;
     }
 
-    char senderIP[20] = { 0 };
-    uv_ip4_name((const struct sockaddr_in*)addr, senderIP, 19);
-    fprintf(stderr, "Received %s : from %s\n", buf->base, senderIP);
+    ROOM *room = RoomFind(server->rooms, msg->room);
+    if (!room || !room->lockstep || session->room != room->id)
+        return;
+
+    // a hash for a tick we no longer (or do not yet) have says nothing
+    if (msg->tick && (!RoomHashAt(room, msg->tick, &hash) || hash == msg->hash))
+        return;
+
+    RESYNC resync = { session->token, room->id };
+    g_array_append_val(server->resyncs, resync);
 }
 
-static void malloc_cb(uv_handle_t *h, size_t s, uv_buf_t *b)
+static void hand_off(SERVER *server);
+
+static void finish_tick(SERVER *server)
 {
-    b->base = (char*)malloc(s * sizeof(char));
-    assert(b->base != NULL);
-    b->len = s;
+    gint64 now = g_get_monotonic_time();
+    int X;
+
+    // back on the loop: the outputs go out before finished rooms go
+    for (X = 0; X < server->nchunks; X++)
+        send_updates(server, server->chunks[X].updated, now);
+
+    RoomsTickEnd(server->rooms);
+    send_snapshots(server, now);
+    match_lobby(server, now);
+
+    // saved now, while the rooms hold still, and written with the next commit
+    if (server->journal &&
+            !JournalCheckpoint(server->journal, server->rooms))
+        WARN("Could not save a checkpoint");
+
+    flush_channels(server, now);
+    SessionsExpire(server->sessions, now);
+
+    if (now - server->last_tick > TICK_BUDGET)
+        overrun(server, now - server->last_tick - TICK_BUDGET);
+
+    // a new server takes over between two ticks
+    if (server->handoff_peer >= 0)
+        hand_off(server);
+
+    // a tick that came due meanwhile runs now, rather than never
+    if (server->behind) {
+        server->behind = 0;
+        start_tick(server);
+    }
+}
+
+static void after_chunk(uv_work_t *work, int status)
+{
+    TICK_CHUNK *chunk = (TICK_CHUNK*)work->data;
+    SERVER *server = chunk->server;
+
+    if (--server->stepping == 0)
+        finish_tick(server);
+}
+
+static void step_tick(SERVER *server)
+{
+    ROOMS *rooms = server->rooms;
+    int X, n, per;
+
+    // slices big enough to be worth a thread each
+    n = rooms->batch->n;
+    per = MAX((n + server->nchunks - 1) / server->nchunks, TICK_CHUNK_MIN);
+    for (X = 0; X * per < n; X++) {
+        TICK_CHUNK *chunk = &server->chunks[X];
+        chunk->lo = X * per;
+        chunk->hi = MIN(n, chunk->lo + per);
+    }
+
+    if (X == 0) {
+        server->stepping = 0;
+        finish_tick(server);
+        return;
+    }
+
+    server->stepping = X;
+    while (X--)
+        uv_queue_work(uv_default_loop(), &server->chunks[X].work,
+                      step_chunk, after_chunk);
+}
+
+static void commit_journal(uv_work_t *work)
+{
+    SERVER *server = (SERVER*)work->data;
+
+    server->committed = JournalFlush(server->journal);
+}
+
+static void after_commit(uv_work_t *work, int status)
+{
+    SERVER *server = (SERVER*)work->data;
+
+    if (!server->committed)
+        WARN("Could not commit the journal");
+
+    step_tick(server);
+}
+
+static void start_tick(SERVER *server)
+{
+    ROOMS *rooms = server->rooms;
+    gint64 start = g_get_monotonic_time();
+
+    // a tick that comes late means the loop spent its time on
+    // packets instead; either way players would see it
+    if (server->last_tick && start - server->last_tick > TICK_BUDGET * 3 / 2)
+        overrun(server, start - server->last_tick - TICK_BUDGET);
+    else if (!shedding(server) && server->shed) {
+        fprintf(stderr, "Dropped %llu packets while shedding load\n",
+                (unsigned long long)server->shed);
+        server->shed = 0;
+    }
+    server->last_tick = start;
+
+    // the tick's actions are the ones journaled so far; the next
+    // ones go on while these are made durable, off the loop, and
+    // none of them is applied before they are
+    if (server->journal)
+        JournalSeal(server->journal, rooms->tick + 1);
+    RoomsTickBegin(rooms);
+
+    if (server->journal) {
+        server->stepping = 1;
+        uv_queue_work(uv_default_loop(), &server->commit,
+                      commit_journal, after_commit);
+        return;
+    }
+
+    step_tick(server);
+}
+
+static void ontick(uv_timer_t *timer)
+{
+    SERVER *server = (SERVER*)timer->data;
+
+    if (server->stepping)
+        server->behind = 1;
+    else
+        start_tick(server);
+}
+
+/*
+ * Whether a packet gets any further than its header.  Every source
+ * address and every session is held to a rate, and while the server is
+ * overloaded only the sessions playing in a room are let through:
+ * registrations and everyone else wait (their reliable messages are
+ * sent again) so that the rooms' ticks stay on time.
+ */
+static int admit_packet(SERVER *server, const struct sockaddr *addr,
+                        const PACKET_HEADER *header, SESSION **session,
+                        gint64 now)
+{
+    *session = NULL;
+
+    if (!RatesTake(server->sources, addr, now))
+        return 0;
+
+    if (!header->token && shedding(server)) {
+        server->shed ++;
+        return 0;
+    }
+
+    *session = SessionLookup(server->sessions, addr, header->token, now);
+    if (*session && !RateTake(&(*session)->rate, &server->sessions->limit, now))
+        return 0;
+
+    if ((!*session || !(*session)->room) && shedding(server)) {
+        server->shed ++;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void ondatagram(TRANSPORT *transport, const void *data, size_t length,
+                       const struct sockaddr *addr)
+{
+    SERVER *server = (SERVER*)transport->data;
+    const char *packet = (const char*)data;
+    ssize_t nread = length;
+
+    if (nread < (ssize_t)sizeof(PACKET_HEADER))
+        return;
+
+    // everything but REGISTER_CLIENT needs a session
+    const PACKET_HEADER *header = (const PACKET_HEADER*)packet;
+    gint64 now = g_get_monotonic_time();
+    SESSION *session;
+    if (!admit_packet(server, addr, header, &session, now))
+        return;
+
+    if (session)
+        ChannelReceive(&session->channel, header, now);
+
+    ssize_t offset = sizeof(PACKET_HEADER);
+    while (offset + (ssize_t)sizeof(TLV) <= nread) {
+        const TLV *tlv = (const TLV*)(packet + offset);
+        if (offset + (ssize_t)sizeof(TLV) + tlv->length > nread) {
+            char senderIP[20] = "local";
+            if (addr->sa_family == AF_INET)
+                uv_ip4_name((const struct sockaddr_in*)addr, senderIP, 19);
+            WARNING("Truncated message from %s", senderIP);
+            break;
+        }
+        offset += sizeof(TLV) + tlv->length;
+
+        if (tlv->type == USER_ACTION) {
+            if (session)
+                on_user_action(server, session, tlv);
+            continue;
+        }
+
+        if (tlv->type == ROOM_HASH) {
+            if (session)
+                on_room_hash(server, session, tlv);
+            continue;
+        }
+
+        if (tlv->type != RELIABLE)
+            continue;
+
+        const msg_reliable *msg = (const msg_reliable*)tlv->value;
+        const TLV *inner = msg->message;
+        if (tlv->length < sizeof(msg_reliable) + sizeof(TLV) ||
+                tlv->length < sizeof(msg_reliable) + sizeof(TLV) + inner->length) {
+            WARN("Short RELIABLE message");
+            continue;
+        }
+
+        if (inner->type == REGISTER_CLIENT) {
+            session = on_register_client(server, addr, header, msg->id, inner, now);
+            continue;
+        }
+
+        // a copy of a message already handled is only acked
+        if (!session || !ChannelAccept(&session->channel, msg->id))
+            continue;
+
+        switch (inner->type) {
+            case DISCONNECT_CLIENT:
+                // the client still gets the ack for its goodbye
+                send_packet(server, session, now, -1, NULL, 0);
+                LobbyLeave(server->lobby, session->token);
+                SessionRemove(server->sessions, session);
+                session = NULL;
+                break;
+            case CREATE_ROOM:
+                on_create_room(server, session, inner, now);
+                break;
+            case REJOIN_ROOM:
+                on_rejoin_room(server, session, inner, now);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (session)
+        mark_busy(server, session);
+}
+
+static void onpoll(uv_poll_t *handle, int status, int events)
+{
+    TRANSPORT *transport = (TRANSPORT*)handle->data;
+
+    if (status < 0) {
+        WARNING("%s transport: %s", transport->ops->name, uv_err_name(status));
+        return;
+    }
+
+    TransportPump(transport);
+}
+
+static void poll_transport(uv_loop_t *loop, uv_poll_t *handle, TRANSPORT *transport)
+{
+    uv_poll_init(loop, handle, transport->fd);
+    handle->data = transport;
+    uv_poll_start(handle, UV_READABLE, onpoll);
+}
+
+/*
+ * Hands everything over to a new server (see handoff.h) and exits, or,
+ * should the new server not make it, carries on as if it never came.
+ */
+static void hand_off(SERVER *server)
+{
+    gint64 start = g_get_monotonic_time();
+    int fds[1] = { server->udp->fd };
+    int peer = server->handoff_peer;
+    guint32 nrooms = g_hash_table_size(server->rooms->table);
+
+    server->handoff_peer = -1;
+
+    // the checkpoint saved at the end of the tick goes out first
+    if (server->journal && !JournalFlush(server->journal))
+        WARN("Could not write a checkpoint");
+
+    if (!HandoffSend(peer, fds, 1, server->rooms, server->sessions,
+                     server->lobby, server->journal)) {
+        WARN("Could not hand off to the new server");
+        close(peer);
+        return;
+    }
+
+    fprintf(stderr, "Handed off %u rooms at tick %llu in %.1fms\n", nrooms,
+            (unsigned long long)server->rooms->tick,
+            (g_get_monotonic_time() - start) / 1000.0);
+
+    // whatever telemetry is still on its way gets written
+    TelemetryClose(server->rooms->batch->telemetry);
+    exit(0);
+}
+
+static void onhandoff(uv_poll_t *handle, int status, int events)
+{
+    SERVER *server = (SERVER*)handle->data;
+    int fd;
+
+    if (status < 0) {
+        WARNING("handoff: %s", uv_err_name(status));
+        return;
+    }
+
+    fd = accept4(server->handoff, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    // one new server at a time; the transfer itself blocks
+    if (server->handoff_peer >= 0) {
+        close(fd);
+        return;
+    }
+    server->handoff_peer = fd;
+
+    if (!server->stepping)
+        hand_off(server);
 }
 
 int main(int argc, char *argv[])
 {
-    int go_ret;
+    int go_ret, X;
     int port = DEFAULT_PORT;
+    int shards = DEFAULT_SHARDS;
+    unsigned long checkpoint = JOURNAL_CHECKPOINT;
+    long max_sessions = SESSION_DEFAULT_MAX;
+    long idle = SESSION_DEFAULT_IDLE;
+    long rate = RATE_SESSION;
+    long source_rate = RATE_SOURCE;
+    long workers = DEFAULT_WORKERS;
+    const char *journal_dir = NULL;
+    const char *local_path = NULL;
+    const char *telemetry_path = NULL;
+    const char *handoff_path = NULL;
+    int handoff_fd = -1, fds[HANDOFF_FDS], nfds = 0;
     const char *err_str = NULL;
+    SERVER server = { 0 };
 
     static struct option longopts[] = {
-        {"port",      required_argument,     NULL,     'p'},
-        {NULL,        0,                     NULL,     0}
+        {"port",       required_argument,     NULL,     'p'},
+        {"journal",    required_argument,     NULL,     'j'},
+        {"shards",     required_argument,     NULL,     's'},
+        {"checkpoint", required_argument,     NULL,     'c'},
+        {"max-sessions", required_argument,   NULL,     'm'},
+        {"idle",       required_argument,     NULL,     'i'},
+        {"rate",       required_argument,     NULL,     'r'},
+        {"source-rate", required_argument,    NULL,     'R'},
+        {"local",      required_argument,     NULL,     'l'},
+        {"workers",    required_argument,     NULL,     'w'},
+        {"telemetry",  required_argument,     NULL,     'A'},
+        {"handoff",    required_argument,     NULL,     'H'},
+        {NULL,         0,                     NULL,     0}
     };
 
-    while ((go_ret = getopt_long(argc, argv, "p:", longopts, NULL)) != -1) {
+    while ((go_ret = getopt_long(argc, argv, "p:j:s:c:m:i:r:R:l:w:A:H:", longopts, NULL)) != -1) {
        switch (go_ret) {
             case 'p':
                 port = strtonum(optarg, 1, UINT16_MAX, &err_str);
                 if (err_str) {
                     ERR("Bad value for port");
                 }
+                break;
+            case 'j':
+                journal_dir = optarg;
+                break;
+            case 'l':
+                local_path = optarg;
+                break;
+            case 'A':
+                telemetry_path = optarg;
+                break;
+            case 'H':
+                handoff_path = optarg;
+                break;
+            case 'w':
+                workers = strtonum(optarg, 1, 128, &err_str);
+                if (err_str) {
+                    ERR("Bad value for workers");
+                }
+                break;
+            case 's':
+                shards = strtonum(optarg, 1, 1024, &err_str);
+                if (err_str) {
+                    ERR("Bad value for shards");
+                }
+                break;
+            case 'c':
+                checkpoint = strtonum(optarg, 1, LONG_MAX, &err_str);
+                if (err_str) {
+                    ERR("Bad value for checkpoint");
+                }
+                break;
+            case 'm':
+                max_sessions = strtonum(optarg, 1, (1 << SESSION_INDEX_BITS) - 1, &err_str);
+                if (err_str) {
+                    ERR("Bad value for max-sessions");
+                }
+                break;
+            case 'i':
+                idle = strtonum(optarg, 1, 86400, &err_str);
+                if (err_str) {
+                    ERR("Bad value for idle");
+                }
+                break;
+            case 'r':
+                rate = strtonum(optarg, 1, 1000000, &err_str);
+                if (err_str) {
+                    ERR("Bad value for rate");
+                }
+                break;
+            case 'R':
+                source_rate = strtonum(optarg, 1, 1000000, &err_str);
+                if (err_str) {
+                    ERR("Bad value for source-rate");
+                }
+                break;
        }
     }
 
+    // libuv sizes its pool when first used, from the environment
+    char pool_size[8];
+    snprintf(pool_size, sizeof(pool_size), "%ld", workers);
+    setenv("UV_THREADPOOL_SIZE", pool_size, 1);
+
+    server.nchunks = workers;
+    server.chunks = g_new0(TICK_CHUNK, workers);
+    for (X = 0; X < workers; X++) {
+        server.chunks[X].work.data = &server.chunks[X];
+        server.chunks[X].server = &server;
+        server.chunks[X].updated = g_ptr_array_new();
+    }
+
+    RowInit();
+    server.rooms = RoomsAlloc();
+    if (!server.rooms) {
+        ERROR("Could not allocate the rooms");
+    }
+
+    server.sessions = SessionsAlloc(max_sessions, idle * G_USEC_PER_SEC, rate);
+    if (!server.sessions) {
+        ERROR("Could not allocate %ld sessions", max_sessions);
+    }
+    server.lobby = LobbyAlloc(max_sessions);
+    server.busy = g_array_new(FALSE, FALSE, sizeof(guint64));
+    server.resyncs = g_array_new(FALSE, FALSE, sizeof(RESYNC));
+    server.sources = RatesAlloc(RATE_SOURCE_BUCKETS, source_rate);
+    server.handoff = server.handoff_peer = -1;
+    server.commit.data = &server;
+
+    // a server already running there hands everything over
+    if (handoff_path)
+        handoff_fd = HandoffConnect(handoff_path);
+
+    if (journal_dir) {
+        server.journal = JournalOpen(journal_dir, shards, checkpoint);
+        if (!server.journal) {
+            ERROR("Could not open the journal in %s", journal_dir);
+        }
+    }
+
+    if (handoff_fd >= 0) {
+        gint64 start = g_get_monotonic_time();
+        if (!HandoffReceive(handoff_fd, fds, &nfds, server.rooms,
+                            server.sessions, server.lobby, server.journal)) {
+            ERROR("Could not take over from the server at %s", handoff_path);
+        }
+        close(handoff_fd);
+
+        // their channels still have to be flushed
+        for (X = 0; X < (int)server.sessions->capacity; X++)
+            if (server.sessions->pool[X].used)
+                mark_busy(&server, &server.sessions->pool[X]);
+
+        fprintf(stderr, "Took over %u rooms and %u sessions at tick %llu in %.1fms\n",
+                g_hash_table_size(server.rooms->table), server.sessions->count,
+                (unsigned long long)server.rooms->tick,
+                (g_get_monotonic_time() - start) / 1000.0);
+    } else if (server.journal) {
+        gint64 start = g_get_monotonic_time();
+        int n = JournalRecover(server.journal, server.rooms);
+        if (n < 0) {
+            ERROR("Could not recover the journal in %s", journal_dir);
+        }
+
+        fprintf(stderr, "Recovered %d rooms at tick %llu in %.1fms\n", n,
+                (unsigned long long)server.rooms->tick,
+                (g_get_monotonic_time() - start) / 1000.0);
+    }
+
+    // after recovery or a handoff: the rooms they bring back started in an earlier run
+    if (telemetry_path) {
+        server.rooms->batch->telemetry = TelemetryOpen(telemetry_path, TICK_BUDGET);
+        if (!server.rooms->batch->telemetry) {
+            ERROR("Could not open %s for telemetry", telemetry_path);
+        }
+    }
+
     uv_loop_t *loop = uv_default_loop();
-    uv_udp_t recv_sock;
-    uv_udp_init(loop, &recv_sock);
-    struct sockaddr_in recaddr;
+    if (nfds)
+        server.udp = TransportUdpAdopt(fds[0], ondatagram, &server);
+    else
+        server.udp = TransportUdpListen(port, ondatagram, &server);
+    if (!server.udp) {
+        ERROR("Could not listen on port %d", port);
+    }
+    poll_transport(loop, &server.udp_poll, server.udp);
+
+    if (local_path) {
+        server.shm = TransportShmListen(local_path, ondatagram, &server);
+        if (!server.shm) {
+            ERROR("Could not listen on %s", local_path);
+        }
+        poll_transport(loop, &server.shm_poll, server.shm);
+    }
+
+    if (handoff_path) {
+        server.handoff = HandoffListen(handoff_path);
+        if (server.handoff < 0) {
+            ERROR("Could not listen for a handoff on %s", handoff_path);
+        }
+        uv_poll_init(loop, &server.handoff_poll, server.handoff);
+        server.handoff_poll.data = &server;
+        uv_poll_start(&server.handoff_poll, UV_READABLE, onhandoff);
+    }
 
-    uv_ip4_addr("0.0.0.0", port, &recaddr);
-    uv_udp_bind(&recv_sock, (const struct sockaddr*)&recaddr, UV_UDP_REUSEADDR);
-    uv_udp_recv_start(&recv_sock, malloc_cb, onrecv);
+    uv_timer_init(loop, &server.timer);
+    server.timer.data = &server;
+    uv_timer_start(&server.timer, ontick, REFRESH_DELAY, REFRESH_DELAY);
 
     return uv_run(loop, UV_RUN_DEFAULT);
 }
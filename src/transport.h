@@ -0,0 +1,49 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <glib.h>
+
+/*
+ * Transports carry the datagrams of packet.h between client and server.
+ * Whatever the transport, its owner polls TRANSPORT.fd for reading
+ * (with poll() or a uv_poll_t) and calls TransportPump() when it is
+ * readable, which hands every datagram that arrived to recv().
+ *
+ * Peers are named by socket addresses, as for UDP.  The shared memory
+ * transport makes up an AF_UNIX address for each client; see
+ * transport_shm.c.  A client's transport is connected: it sends to the
+ * server whatever the address given, and NULL will do.
+ */
+
+#define TRANSPORT_DATAGRAM  65536
+
+struct _TRANSPORT;
+
+typedef void (*TRANSPORT_RECV)(struct _TRANSPORT*, const void* data, size_t length,
+        const struct sockaddr* from);
+
+typedef struct _TRANSPORT_OPS {
+    const char* name;
+
+    int (*pump)(struct _TRANSPORT*);    // datagrams handed to recv(), or -1
+    int (*send)(struct _TRANSPORT*, const struct sockaddr* to, const void* data, size_t length);
+    void (*close)(struct _TRANSPORT*);
+} TRANSPORT_OPS;
+
+typedef struct _TRANSPORT {
+    const TRANSPORT_OPS* ops;
+    int fd;                 // readable when there is something to pump
+    TRANSPORT_RECV recv;
+    void* data;             // the owner's
+} TRANSPORT;
+
+#define TransportPump(t)                ((t)->ops->pump(t))
+#define TransportSend(t, to, d, n)      ((t)->ops->send((t), (to), (d), (n)))
+#define TransportClose(t)               ((t)->ops->close(t))
+
+TRANSPORT* TransportUdpListen(int port, TRANSPORT_RECV, void* data);
+TRANSPORT* TransportUdpConnect(const char* host, int port, TRANSPORT_RECV, void* data);
+TRANSPORT* TransportUdpAdopt(int fd, TRANSPORT_RECV, void* data);
+
+TRANSPORT* TransportShmListen(const char* path, TRANSPORT_RECV, void* data);
+TRANSPORT* TransportShmConnect(const char* path, TRANSPORT_RECV, void* data);
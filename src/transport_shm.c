@@ -0,0 +1,445 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "ring.h"
+#include "transport.h"
+
+/*
+ * Shared memory between processes on one host.  The server listens on
+ * a unix socket; for each client that connects it makes a memfd with
+ * two RINGs in it, one each way, and two eventfds to wake either side,
+ * and passes all three over the socket.  From then on datagrams never
+ * go through the kernel: a send is a copy into the ring, plus a write
+ * to the eventfd only when the other side had read everything and may
+ * be waiting, and a receive is a copy out of it, as the other side can
+ * still write where the datagram was while it is being parsed.  The
+ * socket stays open just to tell when the client goes.
+ *
+ * Clients are named by an abstract AF_UNIX address holding their slot
+ * and its generation, so a session never outlives its client's slot.
+ */
+
+#define SHM_MAGIC       0x6e746574      // "ntet"
+#define SHM_SLOTS       256
+#define SHM_RING        (256 * 1024)    // bytes each way
+#define SHM_EVENTS      64
+
+enum { SHM_LISTEN, SHM_CONN, SHM_WAKE };
+
+typedef struct _SHM_HELLO {
+    guint32 magic;
+    guint32 slot;
+    guint64 size;       // of each ring
+} SHM_HELLO;
+
+typedef struct _SHM_PEER {
+    int conn;           // the client's socket, -1 when the slot is free
+    int in, out;        // eventfds: for the server, for the client
+    void* memory;
+    RING rx, tx;
+    guint32 generation;
+} SHM_PEER;
+
+typedef struct _SHM_TRANSPORT {
+    TRANSPORT transport;
+    int listen;         // -1 for a client
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    guint8 datagram[TRANSPORT_DATAGRAM];    // what recv() is handed
+    SHM_PEER peers[];   // SHM_SLOTS of them, one for a client
+} SHM_TRANSPORT;
+
+#define ShmBytes(size)  (2 * RingBytes(size))
+
+static socklen_t ShmAddr(struct sockaddr_un* addr, guint32 slot, guint32 generation)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + 1, &slot, sizeof(slot));
+    memcpy(addr->sun_path + 1 + sizeof(slot), &generation, sizeof(generation));
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + sizeof(slot) + sizeof(generation);
+}
+
+static SHM_PEER* ShmPeer(SHM_TRANSPORT* shm, const struct sockaddr* to)
+{
+    const struct sockaddr_un* addr = (const struct sockaddr_un*)to;
+    guint32 slot, generation;
+
+    if (shm->listen < 0)
+        return &shm->peers[0];
+    if (! to || to->sa_family != AF_UNIX)
+        return NULL;
+
+    memcpy(&slot, addr->sun_path + 1, sizeof(slot));
+    memcpy(&generation, addr->sun_path + 1 + sizeof(slot), sizeof(generation));
+    if (slot >= SHM_SLOTS || shm->peers[slot].conn < 0 ||
+            shm->peers[slot].generation != generation)
+        return NULL;
+
+    return &shm->peers[slot];
+}
+
+static void ShmDrop(SHM_PEER* peer)
+{
+    if (peer->memory)
+        munmap(peer->memory, ShmBytes(peer->rx.size));
+    if (peer->in >= 0)
+        close(peer->in);
+    if (peer->out >= 0)
+        close(peer->out);
+    if (peer->conn >= 0)
+        close(peer->conn);
+
+    peer->memory = NULL;
+    peer->conn = peer->in = peer->out = -1;
+
+    return;
+}
+
+static int ShmDrain(SHM_TRANSPORT* shm, SHM_PEER* peer)
+{
+    struct sockaddr_un addr;
+    const struct sockaddr* from = NULL;
+    const void* data;
+    guint64 count;
+    guint32 length;
+    int n = 0;
+
+    // reset the wakeup first: whatever is written after this wakes us again
+    if (read(shm->listen < 0 ? peer->out : peer->in, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN)
+        return -1;
+
+    if (shm->listen >= 0) {
+        ShmAddr(&addr, peer - shm->peers, peer->generation);
+        from = (const struct sockaddr*)&addr;
+    }
+
+    while ((data = RingPeek(&peer->rx, &length))) {
+        // nothing a peer writes afterwards can change what is parsed
+        if (length <= sizeof(shm->datagram)) {
+            memcpy(shm->datagram, data, length);
+            shm->transport.recv(&shm->transport, shm->datagram, length, from);
+        }
+        RingPop(&peer->rx, length);
+        n ++;
+    }
+
+    return n;
+}
+
+static void ShmAccept(SHM_TRANSPORT* shm)
+{
+    struct epoll_event ev;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    SHM_HELLO hello;
+    SHM_PEER* peer;
+    int conn, memfd, fds[3];
+    guint32 slot;
+
+    while ((conn = accept4(shm->listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        for (slot = 0; slot < SHM_SLOTS && shm->peers[slot].conn >= 0; slot++);
+        if (slot == SHM_SLOTS) {
+            close(conn);
+            continue;
+        }
+
+        peer = &shm->peers[slot];
+        peer->conn = conn;
+        peer->generation ++;
+        peer->in = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        peer->out = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        memfd = memfd_create("ntetris", MFD_CLOEXEC);
+        if (peer->in < 0 || peer->out < 0 || memfd < 0 ||
+                ftruncate(memfd, ShmBytes(SHM_RING)) < 0) {
+            if (memfd >= 0)
+                close(memfd);
+            ShmDrop(peer);
+            continue;
+        }
+
+        peer->memory = mmap(NULL, ShmBytes(SHM_RING), PROT_READ | PROT_WRITE,
+                MAP_SHARED, memfd, 0);
+        if (peer->memory == MAP_FAILED) {
+            peer->memory = NULL;
+            close(memfd);
+            ShmDrop(peer);
+            continue;
+        }
+
+        // the client's ring out comes first
+        RingInit(&peer->rx, peer->memory, SHM_RING, 1);
+        RingInit(&peer->tx, (char*)peer->memory + RingBytes(SHM_RING), SHM_RING, 1);
+
+        hello.magic = SHM_MAGIC;
+        hello.slot = slot;
+        hello.size = SHM_RING;
+        iov.iov_base = &hello;
+        iov.iov_len = sizeof(hello);
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        fds[0] = memfd;
+        fds[1] = peer->in;
+        fds[2] = peer->out;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        int sent = sendmsg(conn, &msg, MSG_NOSIGNAL);
+        close(memfd);
+        if (sent != sizeof(hello)) {
+            ShmDrop(peer);
+            continue;
+        }
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = (guint64)SHM_CONN << 32 | slot;
+        epoll_ctl(shm->transport.fd, EPOLL_CTL_ADD, conn, &ev);
+        ev.events = EPOLLIN;
+        ev.data.u64 = (guint64)SHM_WAKE << 32 | slot;
+        epoll_ctl(shm->transport.fd, EPOLL_CTL_ADD, peer->in, &ev);
+    }
+
+    return;
+}
+
+static int ShmPump(TRANSPORT* transport)
+{
+    SHM_TRANSPORT* shm = (SHM_TRANSPORT*)transport;
+    struct epoll_event events[SHM_EVENTS];
+    SHM_PEER* peer;
+    int X, n, total = 0;
+
+    if (shm->listen < 0)
+        return ShmDrain(shm, &shm->peers[0]);
+
+    n = epoll_wait(transport->fd, events, SHM_EVENTS, 0);
+    for (X = 0; X < n; X++) {
+        peer = &shm->peers[(guint32)events[X].data.u64];
+
+        switch (events[X].data.u64 >> 32) {
+            case SHM_LISTEN:
+                ShmAccept(shm);
+                break;
+            case SHM_CONN:
+                // clients never write to the socket: this is them leaving
+                if (peer->conn >= 0)
+                    ShmDrop(peer);
+                break;
+            case SHM_WAKE:
+                if (peer->conn >= 0)
+                    total += MAX(ShmDrain(shm, peer), 0);
+                break;
+        }
+    }
+
+    return total;
+}
+
+static int ShmSend(TRANSPORT* transport, const struct sockaddr* to,
+        const void* data, size_t length)
+{
+    SHM_TRANSPORT* shm = (SHM_TRANSPORT*)transport;
+    SHM_PEER* peer = ShmPeer(shm, to);
+    guint64 one = 1;
+    int woke;
+
+    if (! peer || length > TRANSPORT_DATAGRAM)
+        return -1;
+
+    // a full ring drops the datagram, as a full socket buffer would
+    woke = RingWrite(&peer->tx, data, length);
+    if (woke < 0)
+        return -1;
+    if (woke && write(shm->listen < 0 ? peer->in : peer->out, &one, sizeof(one)) < 0 &&
+            errno != EAGAIN)
+        return -1;
+
+    return 0;
+}
+
+static void ShmClose(TRANSPORT* transport)
+{
+    SHM_TRANSPORT* shm = (SHM_TRANSPORT*)transport;
+    int X;
+
+    if (shm->listen < 0) {
+        ShmDrop(&shm->peers[0]);
+    } else {
+        for (X = 0; X < SHM_SLOTS; X++) {
+            if (shm->peers[X].conn >= 0)
+                ShmDrop(&shm->peers[X]);
+        }
+        close(shm->listen);
+        close(transport->fd);
+        unlink(shm->path);
+    }
+
+    g_free(shm);
+
+    return;
+}
+
+static const TRANSPORT_OPS shm_ops = {
+    .name = "shm",
+    .pump = ShmPump,
+    .send = ShmSend,
+    .close = ShmClose
+};
+
+static SHM_TRANSPORT* ShmNew(const char* path, int slots, TRANSPORT_RECV recv, void* data)
+{
+    SHM_TRANSPORT* shm;
+    int X;
+
+    if (strlen(path) >= sizeof(shm->path))
+        return NULL;
+
+    shm = g_malloc0(sizeof(SHM_TRANSPORT) + slots * sizeof(SHM_PEER));
+    shm->transport.ops = &shm_ops;
+    shm->transport.fd = -1;
+    shm->transport.recv = recv;
+    shm->transport.data = data;
+    shm->listen = -1;
+    g_strlcpy(shm->path, path, sizeof(shm->path));
+
+    for (X = 0; X < slots; X++)
+        shm->peers[X].conn = shm->peers[X].in = shm->peers[X].out = -1;
+
+    return shm;
+}
+
+TRANSPORT* TransportShmListen(const char* path, TRANSPORT_RECV recv, void* data)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    SHM_TRANSPORT* shm;
+
+    shm = ShmNew(path, SHM_SLOTS, recv, data);
+    if (! shm)
+        return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    unlink(path);
+
+    shm->listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    shm->transport.fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shm->listen < 0 || shm->transport.fd < 0 ||
+            bind(shm->listen, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(shm->listen, SOMAXCONN) < 0) {
+        if (shm->listen >= 0)
+            close(shm->listen);
+        if (shm->transport.fd >= 0)
+            close(shm->transport.fd);
+        g_free(shm);
+        return NULL;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (guint64)SHM_LISTEN << 32;
+    epoll_ctl(shm->transport.fd, EPOLL_CTL_ADD, shm->listen, &ev);
+
+    return &shm->transport;
+}
+
+static int ShmHandshake(SHM_PEER* peer, const char* path)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    SHM_HELLO hello;
+    int fds[3];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+    peer->conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (peer->conn < 0 || connect(peer->conn, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        return 0;
+
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(peer->conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(hello))
+        return 0;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (! cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return 0;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    peer->in = fds[1];
+    peer->out = fds[2];
+
+    if (hello.magic != SHM_MAGIC || hello.size > G_MAXUINT32 ||
+            (hello.size & (hello.size - 1))) {
+        close(fds[0]);
+        return 0;
+    }
+
+    peer->memory = mmap(NULL, ShmBytes(hello.size), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (peer->memory == MAP_FAILED) {
+        peer->memory = NULL;
+        return 0;
+    }
+
+    // the other way round from the server
+    RingInit(&peer->tx, peer->memory, hello.size, 0);
+    RingInit(&peer->rx, (char*)peer->memory + RingBytes(hello.size), hello.size, 0);
+
+    return 1;
+}
+
+TRANSPORT* TransportShmConnect(const char* path, TRANSPORT_RECV recv, void* data)
+{
+    SHM_TRANSPORT* shm;
+
+    shm = ShmNew(path, 1, recv, data);
+    if (! shm)
+        return NULL;
+
+    if (! ShmHandshake(&shm->peers[0], path)) {
+        ShmDrop(&shm->peers[0]);
+        g_free(shm);
+        return NULL;
+    }
+
+    shm->transport.fd = shm->peers[0].out;
+
+    return &shm->transport;
+}
@@ -0,0 +1,165 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <glib.h>
+#include "transport.h"
+
+#define UDP_BATCH   64      // datagrams a pump, before the loop moves on
+
+typedef struct _UDP_TRANSPORT {
+    TRANSPORT transport;
+    int connected;
+    guint64 buffer[TRANSPORT_DATAGRAM / sizeof(guint64)];
+} UDP_TRANSPORT;
+
+static int UdpPump(TRANSPORT* transport)
+{
+    UDP_TRANSPORT* udp = (UDP_TRANSPORT*)transport;
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    ssize_t n;
+    int X;
+
+    for (X = 0; X < UDP_BATCH; ) {
+        fromlen = sizeof(from);
+        n = recvfrom(transport->fd, udp->buffer, sizeof(udp->buffer), MSG_DONTWAIT,
+                (struct sockaddr*)&from, &fromlen);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            // EAGAIN, or an ICMP error from some earlier send
+            break;
+        }
+
+        transport->recv(transport, udp->buffer, n,
+                udp->connected ? NULL : (const struct sockaddr*)&from);
+        X ++;
+    }
+
+    return X;
+}
+
+static int UdpSend(TRANSPORT* transport, const struct sockaddr* to,
+        const void* data, size_t length)
+{
+    UDP_TRANSPORT* udp = (UDP_TRANSPORT*)transport;
+    socklen_t tolen = 0;
+
+    if (udp->connected)
+        to = NULL;
+    else if (to->sa_family == AF_INET)
+        tolen = sizeof(struct sockaddr_in);
+    else if (to->sa_family == AF_INET6)
+        tolen = sizeof(struct sockaddr_in6);
+    else
+        return -1;
+
+    if (sendto(transport->fd, data, length, 0, to, tolen) < 0)
+        return -1;
+
+    return 0;
+}
+
+static void UdpClose(TRANSPORT* transport)
+{
+    close(transport->fd);
+    g_free(transport);
+
+    return;
+}
+
+static const TRANSPORT_OPS udp_ops = {
+    .name = "udp",
+    .pump = UdpPump,
+    .send = UdpSend,
+    .close = UdpClose
+};
+
+static TRANSPORT* UdpOpen(int fd, int connected, TRANSPORT_RECV recv, void* data)
+{
+    UDP_TRANSPORT* udp = g_new0(UDP_TRANSPORT, 1);
+
+    udp->transport.ops = &udp_ops;
+    udp->transport.fd = fd;
+    udp->transport.recv = recv;
+    udp->transport.data = data;
+    udp->connected = connected;
+
+    return &udp->transport;
+}
+
+TRANSPORT* TransportUdpListen(int port, TRANSPORT_RECV recv, void* data)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    return UdpOpen(fd, 0, recv, data);
+}
+
+// a socket some other process bound, such as the server this one took over from
+TRANSPORT* TransportUdpAdopt(int fd, TRANSPORT_RECV recv, void* data)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+            fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+        return NULL;
+
+    return UdpOpen(fd, 0, recv, data);
+}
+
+TRANSPORT* TransportUdpConnect(const char* host, int port, TRANSPORT_RECV recv, void* data)
+{
+    struct addrinfo hints, *res, *ai;
+    char service[8];
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res))
+        return NULL;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (! connect(fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0)
+        return NULL;
+
+    return UdpOpen(fd, 1, recv, data);
+}
@@ -0,0 +1,140 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The batch engine against the STATE engine: games with the same seeds
+ * get the same actions, from bots and at random, resets and pauses
+ * among them, and after every tick each game of the batch, stored to a
+ * STATE, must snapshot to the same bytes as its STATE twin.  Run on the
+ * standard board and on a small one, where games end and reset often,
+ * and with the scalar kernel as well as the one the CPU would get.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "bot.h"
+#include "batch.h"
+#include "snap.h"
+#include "test.h"
+
+// for BatchGravity(), to try the scalar kernel where AVX2 would be taken
+#include "batch.c"
+
+#define TEST_GAMES      37      // not a multiple of eight, for the tail
+
+static void CheckBatch(int Bx, int By, int queue_size, int ticks, int scalar)
+{
+    STATE* games[TEST_GAMES];
+    BOT* bots[TEST_GAMES];
+    STATE *settings, *stored;
+    BATCH* batch;
+    char *a, *b;
+    size_t size;
+    int X, tick, action, differ = 0;
+
+    settings = GameAlloc();
+    settings->Bx = Bx;
+    settings->By = By;
+    settings->queue_size = queue_size;
+
+    batch = BatchAlloc(settings);
+    CHECK(batch, "no batch for a %dx%d board", Bx, By);
+    if (! batch)
+        return;
+    if (scalar)
+        batch->gravity = BatchGravity;
+
+    stored = GameAlloc();
+    stored->Bx = Bx;
+    stored->By = By;
+    stored->queue_size = queue_size;
+    GameStart(stored, 0);
+
+    for (X = 0; X < TEST_GAMES; X++) {
+        games[X] = GameAlloc();
+        games[X]->Bx = Bx;
+        games[X]->By = By;
+        games[X]->queue_size = queue_size;
+        GameStart(games[X], X * 7919 + 1);
+        bots[X] = BotAlloc(games[X]);
+        CHECK(BatchAdd(batch, X * 7919 + 1) == X, "game %d got another index", X);
+    }
+
+    size = SnapSize(stored);
+    a = g_malloc(size);
+    b = g_malloc(size);
+    srand(Bx * By);
+
+    for (tick = 0; tick < ticks && differ < 5; tick++) {
+        for (X = 0; X < TEST_GAMES; X++) {
+            games[X]->ticks ++;
+            batch->ticks[X] ++;
+
+            action = rand() % 40;
+            if (action > TETRIS_KEY_RESET)
+                action = -1;
+            if (X % 3 && rand() % 8)
+                action = BotInput(games[X], bots[X]);
+            if (action == TETRIS_KEY_QUIT ||
+                    (action == TETRIS_KEY_RESET && rand() % 50) ||
+                    (action == TETRIS_KEY_PAUSE && rand() % 5))
+                action = -1;
+
+            if (action >= 0) {
+                EventAction(games[X], action);
+                BatchAction(batch, X, action);
+            }
+            Update(games[X]);
+        }
+
+        BatchTick(batch, 0, TEST_GAMES);
+
+        for (X = 0; X < TEST_GAMES; X++) {
+            if (games[X]->game_over_f && rand() % 20 == 0) {
+                EventAction(games[X], TETRIS_KEY_RESET);
+                BatchAction(batch, X, TETRIS_KEY_RESET);
+            }
+
+            BatchStore(batch, X, stored);
+            SnapSave(stored, a, size);
+            SnapSave(games[X], b, size);
+            if (memcmp(a, b, size)) {
+                CHECK(0, "%dx%d: game %d differs at tick %d (kernel %s)", Bx, By, X, tick,
+                        BatchKernel(batch));
+                differ ++;
+            }
+        }
+    }
+
+    for (X = 0; X < TEST_GAMES; X++) {
+        BotFree(bots[X]);
+        GameFree(games[X]);
+    }
+    g_free(a);
+    g_free(b);
+    GameFree(stored);
+    GameFree(settings);
+    BatchFree(batch);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    RowInit();
+
+    CheckBatch(TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT, 3, 20000, 0);
+    CheckBatch(TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT, 3, 5000, 1);
+    CheckBatch(6, 12, 1, 5000, 0);
+
+    if (! failures)
+        printf("batch_test: ok\n");
+
+    return failures;
+}
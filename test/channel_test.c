@@ -0,0 +1,455 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The reliability layer.  First the acks against a model of what came
+ * in: a million packets, past the wrap of the sequence numbers, lost,
+ * duplicated and held back, some of them for longer than the ack field
+ * reaches, and gaps of exactly its length; after every packet, ack and
+ * ack_bits must say what the model says was received.  The same for
+ * the ids of reliable messages and ChannelAccept().
+ *
+ * Then the timers: the RFC 6298 estimate from samples of known round
+ * trips, with its clamps, Karn's rule (a message sent more than once
+ * is no sample), the backoff and the peer given up after CHANNEL_TRIES.
+ *
+ * Then two channels talking over a network that loses, duplicates and
+ * reorders, each with thousands of reliable messages for the other,
+ * which must all arrive exactly once, and with a round trip estimate
+ * within what the network takes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "packet.h"
+#include "channel.h"
+#include "test.h"
+
+#define TEST_PACKETS    1000000
+#define TEST_HOLD       40          // packets one may be held back by, more than the ack field
+#define TEST_MESSAGES   3000        // each way
+#define TEST_STEP       1000        // microseconds of the network's time
+#define TEST_LATENCY    20000       // and at most three times it, one way
+
+typedef struct _TEST_PACKET {
+    gint64 at;          // when it arrives
+    int to;
+    size_t length;
+    guint8 data[CHANNEL_PACKET];
+} TEST_PACKET;
+
+static guint8 received[TEST_PACKETS + TEST_HOLD + 1];
+
+// the sender numbers its packets from 1 and skips 0
+static guint16 Seq(guint64 u)
+{
+    return (u - 1) % 65535 + 1;
+}
+
+static PACKET_HEADER Header(guint16 seq, guint16 ack, guint32 ack_bits)
+{
+    PACKET_HEADER header;
+
+    memset(&header, 0, sizeof(header));
+    header.seq = seq;
+    header.ack = ack;
+    header.ack_bits = ack_bits;
+
+    return header;
+}
+
+// what the bits should be, after newest, from what the model received
+static guint32 ExpectBits(guint64 newest, int width)
+{
+    guint32 bits = 0;
+    guint64 u;
+    guint16 age;
+
+    for (u = newest - 1; u >= 1 && newest - u <= (guint64)width + 1; u--) {
+        age = Seq(newest) - Seq(u);
+        if (age >= 1 && age <= width && received[u])
+            bits |= 1U << (age - 1);
+    }
+
+    return bits;
+}
+
+static void CheckAcks(void)
+{
+    guint64 held[TEST_HOLD], newest = 0, u;
+    PACKET_HEADER header;
+    CHANNEL channel;
+    int X, nheld = 0, burst = 0, gaps = 0, late = 0, ret;
+
+    srand(40);
+    ChannelInit(&channel);
+
+    // the field's whole length, one way and the other
+    header = Header(1, 0, 0);
+    ChannelReceive(&channel, &header, 0);
+    header = Header(33, 0, 0);
+    ChannelReceive(&channel, &header, 0);
+    CHECK(channel.ack == 33 && channel.ack_bits == 1U << 31,
+            "a gap of 32 left bits %08x", channel.ack_bits);
+    header = Header(66, 0, 0);
+    ChannelReceive(&channel, &header, 0);
+    CHECK(channel.ack == 66 && channel.ack_bits == 0, "a gap of 33 left bits %08x",
+            channel.ack_bits);
+
+    ChannelInit(&channel);
+    for (u = 1; u <= TEST_PACKETS; u++) {
+        // now and then a gap that takes the newest to the end of the
+        // field or just past it
+        if (! burst && rand() % 5000 == 0) {
+            burst = 30 + rand() % 4;
+            gaps ++;
+        }
+        if (burst) {
+            burst --;
+            continue;
+        }
+
+        X = rand() % 100;
+        if (X < 10)
+            continue;
+        if (X < 20 && nheld < TEST_HOLD) {
+            held[nheld++] = u;
+            continue;
+        }
+
+        for (X = 0; X < 1 + (rand() % 20 == 0); X++) {
+            header = Header(Seq(u), 0, 0);
+            ret = ChannelReceive(&channel, &header, 0);
+            CHECK(ret == (u > newest), "packet %llu: %s", (unsigned long long)u,
+                    ret ? "taken for the newest" : "not taken for the newest");
+            if (u > newest)
+                newest = u;
+            received[u] = 1;
+        }
+
+        // and maybe one held back comes in, late or much too late
+        if (nheld && rand() % 3 == 0) {
+            X = rand() % nheld;
+            header = Header(Seq(held[X]), 0, 0);
+            CHECK(! ChannelReceive(&channel, &header, 0), "late packet %llu taken for the newest",
+                    (unsigned long long)held[X]);
+            received[held[X]] = 1;
+            late += newest - held[X] > 32;
+            held[X] = held[--nheld];
+        }
+
+        CHECK(channel.ack == Seq(newest), "packet %llu: ack %u, not %u", (unsigned long long)u,
+                channel.ack, Seq(newest));
+        CHECK(channel.ack_bits == ExpectBits(newest, 32), "packet %llu: ack_bits %08x, not %08x",
+                (unsigned long long)u, channel.ack_bits, ExpectBits(newest, 32));
+        if (failures > 10)
+            return;
+    }
+
+    CHECK(gaps > 100 && late > 1000, "only %d gaps and %d packets too late", gaps, late);
+    return;
+}
+
+// a message's id, and whether ChannelAccept() must take it
+static void Accept(CHANNEL* channel, guint64 u, guint64* newest)
+{
+    guint64 age = u > *newest ? 0 : *newest - u;
+    int expect = u > *newest || (age && age <= 64 && ! received[u]);
+
+    // ids start at 0, and take every value
+    CHECK(ChannelAccept(channel, (guint16)(u - 1)) == expect, "message %llu, %llu behind: %s",
+            (unsigned long long)u, (unsigned long long)age, expect ? "refused" : "taken twice");
+    if (expect)
+        received[u] = 1;
+    if (u > *newest)
+        *newest = u;
+
+    return;
+}
+
+static void CheckAccept(void)
+{
+    guint64 newest = 0, u;
+    CHANNEL channel;
+    int burst = 0;
+
+    // the field's whole length: the old newest is still known
+    ChannelInit(&channel);
+    CHECK(ChannelAccept(&channel, 0) && ChannelAccept(&channel, 64) &&
+            ! ChannelAccept(&channel, 0) && ChannelAccept(&channel, 63),
+            "a gap of 64 forgot message 0");
+
+    srand(41);
+    memset(received, 0, sizeof(received));
+    ChannelInit(&channel);
+
+    for (u = 1; u <= TEST_PACKETS; u++) {
+        // gaps to the end of the field and just past it
+        if (! burst && rand() % 2000 == 0)
+            burst = 62 + rand() % 4;
+        if (burst) {
+            burst --;
+            continue;
+        }
+
+        if (rand() % 10)
+            Accept(&channel, u, &newest);
+        if (rand() % 20 == 0)
+            Accept(&channel, u, &newest);
+
+        // an older one, new or again, up to just past the field
+        if (u > 70 && rand() % 3 == 0)
+            Accept(&channel, u - 1 - rand() % 66, &newest);
+
+        if (failures > 10)
+            return;
+    }
+
+    return;
+}
+
+// one message queued and sent, at once
+static CHANNEL_MESSAGE* Send(CHANNEL* channel, gint64 now)
+{
+    guint8 packet[CHANNEL_PACKET];
+    guint32 value = 0;
+
+    ChannelQueue(channel, CLIENT_REGISTERED, &value, sizeof(value));
+    CHECK(ChannelWrite(channel, packet, sizeof(packet), 0, now) > sizeof(PACKET_HEADER),
+            "nothing sent");
+
+    return g_queue_peek_tail(channel->unacked);
+}
+
+static void Ack(CHANNEL* channel, guint16 seq, guint32 bits, gint64 now)
+{
+    static guint16 next = 1;
+    PACKET_HEADER header = Header(next++, seq, bits);
+
+    ChannelReceive(channel, &header, now);
+
+    return;
+}
+
+static void CheckTimers(void)
+{
+    guint8 packet[CHANNEL_PACKET];
+    CHANNEL_MESSAGE *message, *again;
+    CHANNEL channel;
+    gint64 now = 1000000, due;
+    guint16 seq;
+    int X;
+
+    // the first sample, and one more: RFC 6298 2.2 and 2.3
+    ChannelInit(&channel);
+    CHECK(channel.rto == CHANNEL_RTO_INIT, "rto %lld before any sample", (long long)channel.rto);
+    message = Send(&channel, now);
+    Ack(&channel, message->seq, 0, now + 80000);
+    CHECK(channel.srtt == 80000 && channel.rttvar == 40000 && channel.rto == 240000,
+            "first sample: srtt %lld rttvar %lld rto %lld", (long long)channel.srtt,
+            (long long)channel.rttvar, (long long)channel.rto);
+
+    now += 100000;
+    message = Send(&channel, now);
+    Ack(&channel, message->seq, 0, now + 40000);
+    CHECK(channel.srtt == 75000 && channel.rttvar == 40000 && channel.rto == 235000,
+            "second sample: srtt %lld rttvar %lld rto %lld", (long long)channel.srtt,
+            (long long)channel.rttvar, (long long)channel.rto);
+    CHECK(g_queue_is_empty(channel.unacked), "acked messages kept");
+
+    // a message acked through ack_bits, in a packet that acks a later one
+    now += 100000;
+    message = Send(&channel, now);
+    again = Send(&channel, now + 10000);
+    Ack(&channel, again->seq, 1U << (guint16)(again->seq - message->seq - 1), now + 50000);
+    CHECK(g_queue_is_empty(channel.unacked), "a message acked in ack_bits kept");
+    message = Send(&channel, now);
+    Ack(&channel, message->seq + 32, 1U << 31, now + 50000);
+    CHECK(g_queue_is_empty(channel.unacked), "a message acked in the last bit kept");
+
+    // clamped at both ends
+    ChannelReset(&channel);
+    message = Send(&channel, now);
+    Ack(&channel, message->seq, 0, now + 1000);
+    CHECK(channel.rto == CHANNEL_RTO_MIN, "rto %lld for a round trip of 1ms",
+            (long long)channel.rto);
+    ChannelReset(&channel);
+    message = Send(&channel, now);
+    Ack(&channel, message->seq, 0, now + 3000000);
+    CHECK(channel.rto == CHANNEL_RTO_MAX, "rto %lld for a round trip of 3s",
+            (long long)channel.rto);
+
+    // Karn: a message that went out twice says nothing of the round
+    // trip, whichever of its copies the ack is for
+    ChannelReset(&channel);
+    message = Send(&channel, now);
+    Ack(&channel, message->seq, 0, now + 100000);
+    due = now + 1000000 + channel.rto;
+    now += 1000000;
+    message = Send(&channel, now);
+    CHECK(! ChannelDue(&channel, due - 1) && ChannelDue(&channel, due),
+            "not due after its rto of %lld", (long long)channel.rto);
+    ChannelWrite(&channel, packet, sizeof(packet), 0, due);
+    CHECK(message->tries == 2 && ! ChannelDue(&channel, due + 2 * channel.rto - 1) &&
+            ChannelDue(&channel, due + 2 * channel.rto), "no backoff on the second try");
+    again = Send(&channel, due + 5000);
+    CHECK(again->tries == 1, "a new message sent with the old one");
+    seq = message->seq;
+    Ack(&channel, seq, 0, due + 10000);
+    CHECK(channel.srtt == 100000 && channel.rttvar == 50000,
+            "a message sent twice sampled: srtt %lld rttvar %lld", (long long)channel.srtt,
+            (long long)channel.rttvar);
+
+    // while one that went out once, acked in the same packet, is
+    Ack(&channel, again->seq, 1U << (guint16)(again->seq - seq - 1), due + 25000);
+    CHECK(channel.srtt == (7 * 100000 + 20000) / 8, "the message sent once not sampled");
+    CHECK(g_queue_is_empty(channel.unacked), "acked messages kept");
+
+    // given up once the last try went unacked for as long as it was given
+    ChannelReset(&channel);
+    message = Send(&channel, now);
+    for (X = 1; X < CHANNEL_TRIES; X++) {
+        due = message->sent + (channel.rto << MIN(message->tries - 1, 4));
+        CHECK(! ChannelFailed(&channel, due), "given up after %d tries", X);
+        ChannelWrite(&channel, packet, sizeof(packet), 0, due);
+    }
+    due = message->sent + (channel.rto << MIN(message->tries - 1, 4));
+    CHECK(message->tries == CHANNEL_TRIES && ! ChannelFailed(&channel, due - 1) &&
+            ChannelFailed(&channel, due), "not given up after %d tries", message->tries);
+
+    ChannelReset(&channel);
+    return;
+}
+
+static void Deliver(CHANNEL* channel, const TEST_PACKET* packet, guint8* got, int* twice,
+        gint64 now)
+{
+    const msg_reliable* reliable;
+    const TLV* tlv;
+    guint32 value;
+    size_t offset = sizeof(PACKET_HEADER);
+
+    ChannelReceive(channel, (const PACKET_HEADER*)packet->data, now);
+
+    while (offset + sizeof(TLV) <= packet->length) {
+        tlv = (const TLV*)(packet->data + offset);
+        offset += sizeof(TLV) + tlv->length;
+        if (tlv->type != RELIABLE)
+            continue;
+
+        reliable = (const msg_reliable*)tlv->value;
+        if (! ChannelAccept(channel, reliable->id))
+            continue;
+
+        memcpy(&value, reliable->message->value, sizeof(value));
+        if (got[value])
+            (*twice) ++;
+        got[value] = 1;
+    }
+
+    return;
+}
+
+static void CheckNetwork(void)
+{
+    static guint8 got[2][TEST_MESSAGES];
+    GQueue* network = g_queue_new();
+    TEST_PACKET* packet, *copy;
+    CHANNEL channels[2];
+    GList *link, *next;
+    gint64 now;
+    guint32 queued[2] = { 0, 0 };
+    int X, twice = 0, lost = 0, sent = 0, missing = 0;
+
+    srand(42);
+    ChannelInit(&channels[0]);
+    ChannelInit(&channels[1]);
+
+    for (now = TEST_STEP; now < 600 * G_USEC_PER_SEC / 10; now += TEST_STEP) {
+        for (X = 0; X < 2; X++) {
+            // a burst of messages now and then, more than the window
+            if (queued[X] < TEST_MESSAGES && rand() % 10 == 0) {
+                do {
+                    ChannelQueue(&channels[X], CLIENT_REGISTERED, &queued[X], sizeof(guint32));
+                } while (++queued[X] < TEST_MESSAGES && rand() % 50);
+            }
+
+            CHECK(! ChannelFailed(&channels[X], now), "side %d gave up at %lldms", X,
+                    (long long)now / 1000);
+            if (! ChannelDue(&channels[X], now))
+                continue;
+
+            packet = g_new(TEST_PACKET, 1);
+            packet->to = ! X;
+            packet->length = ChannelWrite(&channels[X], packet->data, CHANNEL_PACKET, 0, now);
+            packet->at = now + TEST_LATENCY + rand() % (2 * TEST_LATENCY);
+            sent ++;
+
+            if (rand() % 100 < 15) {
+                g_free(packet);
+                lost ++;
+                continue;
+            }
+            if (rand() % 100 < 5) {
+                copy = g_new(TEST_PACKET, 1);
+                *copy = *packet;
+                copy->at += rand() % (2 * TEST_LATENCY);
+                g_queue_push_tail(network, copy);
+            }
+            g_queue_push_tail(network, packet);
+        }
+
+        for (link = network->head; link; link = next) {
+            next = link->next;
+            packet = (TEST_PACKET*)link->data;
+            if (packet->at > now)
+                continue;
+
+            Deliver(&channels[packet->to], packet, got[packet->to], &twice, now);
+            g_queue_delete_link(network, link);
+            g_free(packet);
+        }
+
+        if (queued[0] == TEST_MESSAGES && queued[1] == TEST_MESSAGES &&
+                ! ChannelBusy(&channels[0]) && ! ChannelBusy(&channels[1]) &&
+                g_queue_is_empty(network))
+            break;
+    }
+
+    for (X = 0; X < TEST_MESSAGES; X++)
+        missing += ! got[0][X] + ! got[1][X];
+
+    CHECK(! missing && ! twice, "%d messages missing, %d taken twice", missing, twice);
+    CHECK(lost > sent / 10, "only %d of %d packets lost", lost, sent);
+    for (X = 0; X < 2; X++) {
+        CHECK(channels[X].unacked && g_queue_is_empty(channels[X].unacked),
+                "side %d: messages never acked", X);
+        CHECK(channels[X].srtt >= 2 * TEST_LATENCY &&
+                channels[X].srtt <= 6 * TEST_LATENCY + 2 * TEST_STEP,
+                "side %d: srtt %lld outside the network's round trips", X,
+                (long long)channels[X].srtt);
+    }
+
+    g_queue_free_full(network, g_free);
+    ChannelReset(&channels[0]);
+    ChannelReset(&channels[1]);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    CheckAcks();
+    CheckAccept();
+    CheckTimers();
+    CheckNetwork();
+
+    if (! failures)
+        printf("channel_test: ok\n");
+
+    return failures;
+}
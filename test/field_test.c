@@ -0,0 +1,171 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The sparse field against a dense one: random writes, releases and
+ * clears must leave the same cells as a plain array would, with no row
+ * buffer in two places and none lost.  Then line clears through the
+ * engine, on the standard board and a tall one, against clearing the
+ * dense array by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "field.h"
+#include "test.h"
+
+#define TEST_OPS        200000
+
+// every row as the dense array has it, buffers in use once each
+static int FieldMatches(FIELD* field, const char* dense)
+{
+    GHashTable* seen = g_hash_table_new(NULL, NULL);
+    int Y, used = 0, ok = 1;
+
+    for (Y = 0; Y < field->By && ok; Y++) {
+        if (memcmp(FieldRow(field, Y), dense + Y * field->Bx, field->Bx))
+            ok = 0;
+        if (Y < field->top && memcmp(FieldRow(field, Y), field->empty, field->Bx))
+            ok = 0;
+        if (field->rows[Y] == field->empty)
+            continue;
+        if (g_hash_table_contains(seen, field->rows[Y]))
+            ok = 0;
+        g_hash_table_add(seen, field->rows[Y]);
+        used ++;
+    }
+
+    for (Y = 0; Y < field->nspare && ok; Y++) {
+        if (g_hash_table_contains(seen, field->spare[Y]))
+            ok = 0;
+        g_hash_table_add(seen, field->spare[Y]);
+    }
+
+    if (used + field->nspare > field->By)
+        ok = 0;
+    for (Y = 0; Y < field->Bx; Y++)
+        if (field->empty[Y])
+            ok = 0;
+
+    g_hash_table_destroy(seen);
+    return ok;
+}
+
+static void CheckField(int Bx, int By)
+{
+    FIELD* field = FieldAlloc(Bx, By);
+    char* dense = g_malloc0((size_t)Bx * By);
+    int X, x, y, op;
+
+    for (X = 0; X < TEST_OPS; X++) {
+        op = rand() % 100;
+        // writes cluster near the bottom, as they do in a game
+        y = By - 1 - (rand() % By) * (rand() % By) / By;
+        x = rand() % Bx;
+
+        if (op < 70) {
+            FieldWrite(field, y)[x] = dense[y * Bx + x] = 1 + rand() % 7;
+        } else if (op < 95) {
+            FieldRelease(field, y);
+            memset(dense + y * Bx, 0, Bx);
+        } else if (op < 96) {
+            FieldClear(field);
+            memset(dense, 0, (size_t)Bx * By);
+        } else {
+            // a row written but left empty still reads as one
+            FieldWrite(field, y);
+        }
+
+        if (! FieldMatches(field, dense)) {
+            CHECK(0, "%dx%d: field differs after op %d", Bx, By, X);
+            break;
+        }
+    }
+
+    FieldFree(field);
+    g_free(dense);
+    return;
+}
+
+static void CheckLineClear(int Bx, int By)
+{
+    STATE* state = GameAlloc();
+    char* dense = g_malloc0((size_t)Bx * By);
+    char* row;
+    int X, Y, x, top, full, lines = 0;
+
+    state->Bx = Bx;
+    state->By = By;
+    GameStart(state, 1);
+
+    for (X = 0; X < 2000; X++) {
+        // a heap of random height, a third of its rows full
+        top = By - 1 - rand() % MIN(By, 40);
+        for (Y = top; Y < By; Y++) {
+            full = rand() % 3 == 0;
+            for (x = 0; x < Bx; x++) {
+                if (full || rand() % 2) {
+                    FieldWrite(state->field, Y)[x] = 1 + rand() % 7;
+                    dense[Y * Bx + x] = FieldCell(state->field, x, Y);
+                }
+            }
+        }
+
+        // cleared rows go, the ones above come down
+        for (Y = By - 1, top = By - 1; Y >= 0; Y--) {
+            row = dense + Y * Bx;
+            for (x = 0; x < Bx && row[x]; x++);
+            if (x == Bx) {
+                lines ++;
+                continue;
+            }
+            memmove(dense + top * Bx, row, Bx);
+            top --;
+        }
+        memset(dense, 0, (size_t)(top + 1) * Bx);
+
+        LineMark(state, 0, By);
+        LineClear(state);
+
+        CHECK(state->lines == lines, "%dx%d: %d lines cleared, not %d", Bx, By,
+                state->lines, lines);
+        if (! FieldMatches(state->field, dense)) {
+            CHECK(0, "%dx%d: field differs after clear %d", Bx, By, X);
+            break;
+        }
+
+        if (rand() % 10 == 0) {
+            FieldClear(state->field);
+            memset(dense, 0, (size_t)Bx * By);
+        }
+    }
+
+    GameFree(state);
+    g_free(dense);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    RowInit();
+    srand(38);
+
+    CheckField(TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+    CheckField(7, FIELD_CHUNK_ROWS * 3 + 5);
+    CheckField(64, 1000);
+
+    CheckLineClear(TETRIS_STD_WIDTH, TETRIS_STD_HEIGHT);
+    CheckLineClear(12, 500);
+
+    if (! failures)
+        printf("field_test: ok\n");
+
+    return failures;
+}
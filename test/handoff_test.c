@@ -0,0 +1,451 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * A hot restart over a socketpair.  A server's worth of rooms of both
+ * modes, sessions with messages still unacked, a lobby with sessions
+ * that went away, and a journal with records not yet committed, all in
+ * the middle of a game, are handed over from a forked copy of them to
+ * a new server in this process.  What comes over must be what was
+ * sent: the rooms byte for byte with their modes, lockstep history and
+ * watchers, the sessions with their channels, the lobby in its order.
+ *
+ * Then both copies go on with the same actions: every tick the rooms
+ * of the new server must step as the old ones do, and the lobby must
+ * match the same groups.  In the end the journal the new server went
+ * on with, starting from the old server's records, must recover the
+ * rooms it played.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "room.h"
+#include "session.h"
+#include "lobby.h"
+#include "journal.h"
+#include "handoff.h"
+#include "test.h"
+
+#define TEST_SESSIONS   64
+#define TEST_ROOMS      12
+#define TEST_SHARDS     3
+#define TEST_CHECKPOINT 30
+#define TEST_BEFORE     100     // ticks played before the handoff
+#define TEST_AFTER      200     // and after it
+
+typedef struct _TEST_SERVER {
+    ROOMS* rooms;
+    SESSIONS* sessions;
+    LOBBY* lobby;
+    JOURNAL* journal;
+} TEST_SERVER;
+
+static const struct sockaddr* Addr(int i)
+{
+    static struct sockaddr_in in;
+
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = htonl(0x0a000000 + i);
+    in.sin_port = htons(1000 + i);
+
+    return (const struct sockaddr*)&in;
+}
+
+static void RemoveDir(const char* dir)
+{
+    struct dirent* entry;
+    char* path;
+    DIR* d;
+
+    if (! (d = opendir(dir)))
+        return;
+
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        path = g_strdup_printf("%s/%s", dir, entry->d_name);
+        unlink(path);
+        g_free(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+    return;
+}
+
+static void Alloc(TEST_SERVER* server, const char* dir)
+{
+    server->rooms = RoomsAlloc();
+    server->sessions = SessionsAlloc(TEST_SESSIONS, G_MAXINT64 / 2, 0);
+    server->lobby = LobbyAlloc(TEST_SESSIONS);
+    server->journal = dir ? JournalOpen(dir, TEST_SHARDS, TEST_CHECKPOINT) : NULL;
+
+    return;
+}
+
+static void Free(TEST_SERVER* server)
+{
+    if (server->journal)
+        JournalClose(server->journal);
+    LobbyFree(server->lobby);
+    SessionsFree(server->sessions);
+    RoomsFree(server->rooms);
+
+    return;
+}
+
+// random actions, and the same ones for the other copy if there is
+// one; the journal is that of the last copy
+static void Actions(ROOMS* rooms, ROOMS* other, JOURNAL* journal, unsigned int seed)
+{
+    ROOM *room, *twin;
+    guint32 id;
+    int X, action, taken;
+
+    srand(seed);
+    for (X = 0; X < 2 * TEST_ROOMS; X++) {
+        // no hard drops, or the games would be over before long
+        id = 1 + rand() % rooms->next_id;
+        action = 2 + rand() % 5;
+
+        room = RoomFind(rooms, id);
+        taken = room && RoomAction(room, action);
+
+        if (other) {
+            twin = RoomFind(other, id);
+            CHECK((twin && RoomAction(twin, action)) == taken,
+                    "tick %llu: room %u took action %d in only one copy",
+                    (unsigned long long)rooms->tick, id, action);
+            room = twin;
+        }
+
+        if (taken && room && journal)
+            JournalAction(journal, room, rooms->tick + 1, action);
+    }
+
+    return;
+}
+
+// a tick as the server takes it, with the lockstep inputs it sends
+static void Tick(ROOMS* rooms, JOURNAL* journal, GByteArray* inputs)
+{
+    GHashTableIter iter;
+    gpointer value;
+    ROOM* room;
+    guint8 buffer[512];
+    size_t length;
+
+    if (journal)
+        CHECK(JournalCommit(journal, rooms->tick + 1), "commit failed at tick %llu",
+                (unsigned long long)rooms->tick);
+    RoomsTick(rooms);
+    if (journal)
+        CHECK(JournalCheckpoint(journal, rooms), "checkpoint failed at tick %llu",
+                (unsigned long long)rooms->tick);
+
+    g_byte_array_set_size(inputs, 0);
+    g_hash_table_iter_init(&iter, rooms->table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        room = (ROOM*)value;
+        if (room->hash_due)
+            RoomHash(room);
+        room->hash_due = 0;
+
+        if (room->updated && room->lockstep) {
+            length = RoomInputs(room, buffer, sizeof(buffer));
+            g_byte_array_append(inputs, (const guint8*)&room->id, sizeof(room->id));
+            g_byte_array_append(inputs, buffer, length);
+        }
+        room->updated = 0;
+    }
+
+    return;
+}
+
+// whether other holds the rooms of rooms, byte for byte, and with
+// history their seeds and the lockstep inputs and hashes they sent,
+// which the journal does not keep
+static void CompareRooms(ROOMS* rooms, ROOMS* other, int history, const char* when)
+{
+    GHashTableIter iter;
+    gpointer value;
+    ROOM *room, *twin;
+    size_t size;
+    char *a, *b;
+
+    CHECK(g_hash_table_size(rooms->table) == g_hash_table_size(other->table) &&
+            rooms->tick == other->tick && rooms->next_id == other->next_id,
+            "%s: %u rooms at tick %llu, not %u at %llu", when,
+            g_hash_table_size(other->table), (unsigned long long)other->tick,
+            g_hash_table_size(rooms->table), (unsigned long long)rooms->tick);
+
+    g_hash_table_iter_init(&iter, rooms->table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        room = (ROOM*)value;
+        twin = RoomFind(other, room->id);
+        CHECK(twin, "%s: room %u lost", when, room->id);
+        if (! twin)
+            continue;
+
+        size = RoomSnapSize(room);
+        a = g_malloc(size);
+        b = g_malloc0(size);
+        RoomSnapSave(room, a, size);
+        CHECK(RoomSnapSave(twin, b, size) == size && ! memcmp(a, b, size) &&
+                twin->tick == room->tick, "%s: room %u differs", when, room->id);
+        g_free(a);
+        g_free(b);
+
+        CHECK(twin->mode == room->mode && twin->players == room->players &&
+                (! history || twin->seed == room->seed) && ! strcmp(twin->name, room->name),
+                "%s: room %u is another game", when, room->id);
+        CHECK(twin->nwatchers == room->nwatchers &&
+                ! memcmp(twin->watchers, room->watchers, sizeof(room->watchers)),
+                "%s: room %u has other watchers", when, room->id);
+        CHECK((twin->lockstep != NULL) == (room->lockstep != NULL) &&
+                (! room->lockstep || ! history ||
+                 ! memcmp(twin->lockstep, room->lockstep, sizeof(ROOM_LOCKSTEP))),
+                "%s: room %u has another lockstep history", when, room->id);
+    }
+
+    return;
+}
+
+static void CompareSessions(SESSIONS* sessions, SESSIONS* other)
+{
+    SESSION *session, *twin;
+    CHANNEL *a, *b;
+    GList *x, *y;
+    CHANNEL_MESSAGE *m, *n;
+    guint32 X;
+
+    CHECK(other->count == sessions->count, "%u sessions came over, not %u",
+            other->count, sessions->count);
+
+    for (X = 0; X < sessions->capacity; X++) {
+        session = &sessions->pool[X];
+        if (! session->used)
+            continue;
+
+        twin = SessionToken(other, session->token);
+        CHECK(twin == &other->pool[X], "session %u lost", X);
+        if (twin != &other->pool[X])
+            continue;
+
+        CHECK(twin == SessionFind(other, Addr(X)), "session %u not found by its address", X);
+        CHECK(! memcmp(&twin->key, &session->key, sizeof(SESSION_KEY)) &&
+                twin->last_seen == session->last_seen && twin->room == session->room &&
+                ! strcmp(twin->name, session->name) &&
+                ! memcmp(&twin->rate, &session->rate, sizeof(RATE)),
+                "session %u came over changed", X);
+
+        a = &session->channel;
+        b = &twin->channel;
+        CHECK(a->seq == b->seq && a->ack == b->ack && a->ack_bits == b->ack_bits &&
+                a->received == b->received && a->ack_pending == b->ack_pending &&
+                a->next_id == b->next_id && a->recv_id == b->recv_id &&
+                a->recv_bits == b->recv_bits && a->accepted == b->accepted &&
+                a->srtt == b->srtt && a->rttvar == b->rttvar && a->rto == b->rto,
+                "session %u: channel came over changed", X);
+
+        x = session->channel.unacked ? session->channel.unacked->head : NULL;
+        y = twin->channel.unacked ? twin->channel.unacked->head : NULL;
+        for (; x && y; x = x->next, y = y->next) {
+            m = (CHANNEL_MESSAGE*)x->data;
+            n = (CHANNEL_MESSAGE*)y->data;
+            CHECK(m->id == n->id && m->seq == n->seq && m->sent == n->sent &&
+                    m->tries == n->tries && m->length == n->length &&
+                    ! memcmp(m->data, n->data, m->length),
+                    "session %u: message %u came over changed", X, m->id);
+        }
+        CHECK(! x && ! y, "session %u: unacked messages lost", X);
+    }
+
+    return;
+}
+
+// the old server's state, in the middle of a game
+static void Populate(TEST_SERVER* server)
+{
+    guint8 packet[CHANNEL_PACKET];
+    PACKET_HEADER header;
+    guint64 tokens[TEST_SESSIONS];
+    SESSION* session;
+    ROOM* room;
+    guint64 seed;
+    int X, Y, band;
+
+    for (X = 0; X < TEST_SESSIONS; X++) {
+        session = SessionCreate(server->sessions, Addr(X), "handoff", X + 1);
+        tokens[X] = session->token;
+
+        // messages out, some of them sent and one acked, and packets in
+        for (Y = 0; Y < X % 4; Y++)
+            ChannelQueue(&session->channel, CLIENT_REGISTERED, &tokens[X], sizeof(guint64));
+        if (X % 3)
+            ChannelWrite(&session->channel, packet, sizeof(packet), session->token, X + 1);
+        for (Y = 0; Y < X % 5; Y++) {
+            memset(&header, 0, sizeof(header));
+            header.seq = 1 + Y * 3;
+            header.ack = Y == 1;
+            ChannelReceive(&session->channel, &header, X + 2);
+            ChannelAccept(&session->channel, Y * 2);
+        }
+    }
+
+    for (X = 0; X < TEST_ROOMS; X++) {
+        seed = rand();
+        room = RoomCreate(server->rooms, 0, seed, 1 + X % 3, X % 2 ? "named" : "");
+        if (X % 2)
+            RoomLockstep(room);
+        for (Y = 0; Y <= X % 3; Y++) {
+            RoomWatch(room, tokens[(X * 3 + Y) % TEST_SESSIONS]);
+            SessionToken(server->sessions, tokens[(X * 3 + Y) % TEST_SESSIONS])->room = room->id;
+        }
+        JournalCreate(server->journal, room, server->rooms->tick + 1, seed);
+    }
+
+    // in bands, under names, and some who go away before their turn
+    for (X = 0; X < TEST_SESSIONS; X++) {
+        band = X % 3;
+        if (X % 7 == 0)
+            LobbyJoin(server->lobby, tokens[X], 3, ROOM_MODE_LOCKSTEP, 0, "friends", X);
+        else
+            LobbyJoin(server->lobby, tokens[X], 2 + X % 2, X % 2, band, NULL, X);
+    }
+    for (X = 5; X < TEST_SESSIONS; X += 9)
+        SessionRemove(server->sessions, SessionToken(server->sessions, tokens[X]));
+
+    return;
+}
+
+static void CheckHandoff(void)
+{
+    char dir[] = "/tmp/ntetris-handoff-XXXXXX";
+    TEST_SERVER old, new, recovered;
+    GByteArray *a, *b;
+    GArray* matches = g_array_new(FALSE, FALSE, sizeof(LOBBY_MATCH));
+    LOBBY_MATCH x, y;
+    int sv[2], fds[HANDOFF_FDS], nfds, status = -1, ok, X, n;
+    pid_t pid;
+
+    CHECK(mkdtemp(dir), "no temporary directory");
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "no socketpair");
+
+    srand(48);
+    Alloc(&old, dir);
+    Populate(&old);
+
+    a = g_byte_array_new();
+    b = g_byte_array_new();
+    for (X = 0; X < TEST_BEFORE; X++) {
+        Actions(old.rooms, NULL, old.journal, 1000 + X);
+        Tick(old.rooms, old.journal, a);
+    }
+
+    // accepted for the next tick, not committed yet
+    Actions(old.rooms, NULL, old.journal, 1000 + X);
+    CHECK(JournalFlush(old.journal), "flush failed");
+
+    // the new server opens the journal before it takes over, as the server does
+    Alloc(&new, dir);
+
+    // each end with the other's closed, so that a new server that gives
+    // up is seen going away rather than waited for
+    pid = fork();
+    if (pid == 0) {
+        close(sv[1]);
+        fds[0] = sv[0];
+        _exit(HandoffSend(sv[0], fds, 1, old.rooms, old.sessions, old.lobby, old.journal) ? 0 : 1);
+    }
+    close(sv[0]);
+
+    ok = HandoffReceive(sv[1], fds, &nfds, new.rooms, new.sessions, new.lobby, new.journal);
+    close(sv[1]);
+    waitpid(pid, &status, 0);
+    CHECK(ok && nfds == 1, "nothing taken over");
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the old server saw no ack");
+    if (nfds == 1)
+        close(fds[0]);
+
+    CompareRooms(old.rooms, new.rooms, 1, "handoff");
+    CompareSessions(old.sessions, new.sessions);
+    for (X = 0; X < TEST_SHARDS; X++)
+        CHECK(new.journal->shards[X].batch->len == old.journal->shards[X].batch->len &&
+                ! memcmp(new.journal->shards[X].batch->data, old.journal->shards[X].batch->data,
+                    old.journal->shards[X].batch->len),
+                "shard %d: uncommitted records lost", X);
+    CHECK(new.journal->checkpoint == old.journal->checkpoint &&
+            new.journal->next == old.journal->next, "the checkpoint round starts over");
+
+    // the old copy goes on without its journal, which is the new server's now
+    for (X = 0; X < TEST_AFTER; X++) {
+        Tick(old.rooms, NULL, a);
+        Tick(new.rooms, new.journal, b);
+        CHECK(a->len == b->len && ! memcmp(a->data, b->data, a->len),
+                "tick %llu: other lockstep inputs", (unsigned long long)new.rooms->tick);
+        CompareRooms(old.rooms, new.rooms, 1, "after the handoff");
+
+        Actions(old.rooms, new.rooms, new.journal, 2000 + X);
+    }
+
+    // the same groups, each in the order it waited, though the queues
+    // that are ready on a tick may take their turns in another order
+    while (LobbyMatch(old.lobby, old.sessions, &x))
+        g_array_append_val(matches, x);
+    for (n = 0; LobbyMatch(new.lobby, new.sessions, &y); n++) {
+        for (X = 0; X < (int)matches->len; X++) {
+            x = g_array_index(matches, LOBBY_MATCH, X);
+            if (x.players == y.players && x.mode == y.mode && ! strcmp(x.name, y.name) &&
+                    ! memcmp(x.tokens, y.tokens, x.players * sizeof(guint64)))
+                break;
+        }
+        CHECK(X < (int)matches->len, "match %d is a group the old server never made", n);
+        if (X < (int)matches->len)
+            g_array_remove_index_fast(matches, X);
+    }
+    CHECK(n > 3 && ! matches->len, "%d matches, and %u lost", n, matches->len);
+
+    // what the new server went on with, from what the old one left
+    Tick(new.rooms, new.journal, b);
+    JournalClose(new.journal);
+    new.journal = NULL;
+    Alloc(&recovered, dir);
+    CHECK(JournalRecover(recovered.journal, recovered.rooms) >= 0, "recovery failed");
+    CompareRooms(new.rooms, recovered.rooms, 0, "recovery");
+
+    JournalClose(old.journal);
+    old.journal = NULL;
+    Free(&old);
+    Free(&new);
+    Free(&recovered);
+    g_byte_array_free(a, TRUE);
+    g_byte_array_free(b, TRUE);
+    g_array_free(matches, TRUE);
+    RemoveDir(dir);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    RowInit();
+
+    CheckHandoff();
+
+    if (! failures)
+        printf("handoff_test: ok\n");
+
+    return failures;
+}
@@ -0,0 +1,197 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * Journal recovery: rooms are played with random actions through the
+ * journal, the log is left with a torn record at its end as a crash
+ * would leave it, and the rooms recovered from the journal must be the
+ * live ones byte for byte.  Run at checkpoint intervals shorter and
+ * longer than a round of shards, and longer than the run.
+ *
+ * The rooms' players come back under new tokens now and then, as they
+ * would after a restart, and every recovered room must still have its
+ * players: the newest token of each claims it back, and its actions
+ * are taken, while a token it never had is turned away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "room.h"
+#include "journal.h"
+#include "test.h"
+
+#define TEST_SHARDS     3
+#define TEST_TICKS      1000
+
+static guint64 Token(void)
+{
+    return ((guint64)rand() << 32) | rand() | 1;
+}
+
+static void RemoveDir(const char* dir)
+{
+    struct dirent* entry;
+    char* path;
+    DIR* d;
+
+    if (! (d = opendir(dir)))
+        return;
+
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        path = g_strdup_printf("%s/%s", dir, entry->d_name);
+        unlink(path);
+        g_free(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+    return;
+}
+
+static void CheckRecovery(unsigned long interval)
+{
+    char dir[] = "/tmp/ntetris-journal-XXXXXX";
+    ROOMS *live, *recovered;
+    JOURNAL* journal;
+    GHashTableIter iter;
+    gpointer value;
+    ROOM *room, *other;
+    guint64 seed;
+    size_t size;
+    char *a, *b, *wal;
+    FILE* file;
+    guint64 token;
+    int X, action, nrooms;
+    guint32 id;
+
+    CHECK(mkdtemp(dir), "no temporary directory");
+    srand(interval);
+
+    live = RoomsAlloc();
+    journal = JournalOpen(dir, TEST_SHARDS, interval);
+    CHECK(journal, "JournalOpen(%s) failed", dir);
+    if (! journal)
+        return;
+
+    while (live->tick < TEST_TICKS) {
+        if (live->tick % 50 == 0) {
+            seed = rand();
+            room = RoomCreate(live, 0, seed, 1, "journal");
+            for (X = rand() % 3; X < 3; X++)
+                RoomWatch(room, Token());
+            JournalCreate(journal, room, live->tick + 1, seed);
+        }
+
+        // a player back after a restart, with a new token
+        room = RoomFind(live, 1 + rand() % live->next_id);
+        if (room && rand() % 4 == 0) {
+            token = Token();
+            X = rand() % room->nwatchers;
+            JournalRejoin(journal, room, live->tick + 1, room->watchers[X], token);
+            CHECK(RoomRejoin(room, room->watchers[X], token), "room %u: watcher %d refused",
+                    room->id, X);
+        }
+
+        for (X = 0; X < 5; X++) {
+            id = 1 + rand() % live->next_id;
+            action = 1 + rand() % 6;
+            room = RoomFind(live, id);
+            if (room && RoomAction(room, action))
+                JournalAction(journal, room, live->tick + 1, action);
+        }
+
+        CHECK(JournalCommit(journal, live->tick + 1), "commit failed at tick %llu",
+                (unsigned long long)live->tick);
+        RoomsTick(live);
+        CHECK(JournalCheckpoint(journal, live), "checkpoint failed at tick %llu",
+                (unsigned long long)live->tick);
+    }
+
+    JournalClose(journal);
+
+    // a crash in the middle of a commit
+    wal = g_strdup_printf("%s/shard-0.wal", dir);
+    if ((file = fopen(wal, "ab"))) {
+        fwrite("torn record", 1, 11, file);
+        fclose(file);
+    }
+    g_free(wal);
+
+    recovered = RoomsAlloc();
+    journal = JournalOpen(dir, TEST_SHARDS, interval);
+    CHECK(journal, "JournalOpen(%s) failed the second time", dir);
+    if (! journal)
+        return;
+
+    nrooms = JournalRecover(journal, recovered);
+    CHECK(nrooms == g_hash_table_size(live->table), "interval %lu: recovered %d of %u rooms",
+            interval, nrooms, g_hash_table_size(live->table));
+    CHECK(recovered->tick == live->tick, "interval %lu: recovered at tick %llu, not %llu",
+            interval, (unsigned long long)recovered->tick, (unsigned long long)live->tick);
+
+    g_hash_table_iter_init(&iter, live->table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        room = (ROOM*)value;
+        other = RoomFind(recovered, room->id);
+        CHECK(other, "interval %lu: room %u lost", interval, room->id);
+        if (! other)
+            continue;
+
+        size = RoomSnapSize(room);
+        a = g_malloc(size);
+        b = g_malloc0(size);
+        RoomSnapSave(room, a, size);
+        CHECK(RoomSnapSave(other, b, size) == size, "interval %lu: room %u has another size",
+                interval, room->id);
+        CHECK(! memcmp(a, b, size) && room->tick == other->tick,
+                "interval %lu: room %u differs from the live one", interval, room->id);
+        g_free(a);
+        g_free(b);
+
+        CHECK(other->nwatchers == room->nwatchers &&
+                ! memcmp(other->watchers, room->watchers, room->nwatchers * sizeof(guint64)),
+                "interval %lu: room %u has other watchers", interval, room->id);
+        CHECK(! RoomRejoin(other, Token() << 1, Token()),
+                "interval %lu: room %u taken by a stranger", interval, room->id);
+        for (X = 0; X < room->nwatchers; X++) {
+            token = Token();
+            CHECK(RoomRejoin(other, room->watchers[X], token) &&
+                    RoomAction(other, 1 + rand() % 6),
+                    "interval %lu: room %u turned watcher %d away", interval, room->id, X);
+            CHECK(! RoomRejoin(other, room->watchers[X], Token()),
+                    "interval %lu: room %u taken twice by watcher %d", interval, room->id, X);
+        }
+    }
+
+    JournalClose(journal);
+    RoomsFree(live);
+    RoomsFree(recovered);
+    RemoveDir(dir);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    RowInit();
+
+    CheckRecovery(7);
+    CheckRecovery(20);
+    CheckRecovery(100);
+    CheckRecovery(2000);
+
+    if (! failures)
+        printf("journal_test: ok\n");
+
+    return failures;
+}
@@ -0,0 +1,194 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * Rotation against the SRS guideline, written out here apart from the
+ * engine's own tables: the cells of every tetrad in each of its four
+ * states in its SRS box, and the wall kicks.  For every shape, state,
+ * direction and set of kicks, the field is filled but for the tetrad
+ * and the cells those kicks would put it on, and the tetrad must end up
+ * on the cells of the first kick that fits, as SRS has it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "field.h"
+#include "test.h"
+
+#define TEST_BX         16
+#define TEST_BY         24
+#define TEST_X          6       // of the SRS box, far from the walls
+#define TEST_Y          10
+
+// [shape][state][cell], x and y in the SRS box, y growing downwards
+static const signed char srs_cells[7][4][4][2] = {
+    { { { 0, 1 }, { 1, 1 }, { 2, 1 }, { 3, 1 } }, { { 2, 0 }, { 2, 1 }, { 2, 2 }, { 2, 3 } },
+      { { 0, 2 }, { 1, 2 }, { 2, 2 }, { 3, 2 } }, { { 1, 0 }, { 1, 1 }, { 1, 2 }, { 1, 3 } } }, // I
+    { { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } }, { { 1, 0 }, { 2, 0 }, { 1, 1 }, { 1, 2 } },
+      { { 0, 1 }, { 1, 1 }, { 2, 1 }, { 2, 2 } }, { { 1, 0 }, { 1, 1 }, { 0, 2 }, { 1, 2 } } }, // J
+    { { { 2, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } }, { { 1, 0 }, { 1, 1 }, { 1, 2 }, { 2, 2 } },
+      { { 0, 1 }, { 1, 1 }, { 2, 1 }, { 0, 2 } }, { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 1, 2 } } }, // L
+    { { { 1, 0 }, { 2, 0 }, { 1, 1 }, { 2, 1 } }, { { 1, 0 }, { 2, 0 }, { 1, 1 }, { 2, 1 } },
+      { { 1, 0 }, { 2, 0 }, { 1, 1 }, { 2, 1 } }, { { 1, 0 }, { 2, 0 }, { 1, 1 }, { 2, 1 } } }, // O
+    { { { 1, 0 }, { 2, 0 }, { 0, 1 }, { 1, 1 } }, { { 1, 0 }, { 1, 1 }, { 2, 1 }, { 2, 2 } },
+      { { 1, 1 }, { 2, 1 }, { 0, 2 }, { 1, 2 } }, { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 2 } } }, // S
+    { { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } }, { { 1, 0 }, { 1, 1 }, { 2, 1 }, { 1, 2 } },
+      { { 0, 1 }, { 1, 1 }, { 2, 1 }, { 1, 2 } }, { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 1, 2 } } }, // T
+    { { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 2, 1 } }, { { 2, 0 }, { 1, 1 }, { 2, 1 }, { 1, 2 } },
+      { { 0, 1 }, { 1, 1 }, { 1, 2 }, { 2, 2 } }, { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 0, 2 } } }  // Z
+};
+
+// [state][ccw][kick], as the guideline has them: y growing upwards
+static const signed char srs_jlstz[4][2][5][2] = {
+    { { { 0, 0 }, { -1, 0 }, { -1,  1 }, { 0, -2 }, { -1, -2 } },      // 0 -> R
+      { { 0, 0 }, {  1, 0 }, {  1,  1 }, { 0, -2 }, {  1, -2 } } },    // 0 -> L
+    { { { 0, 0 }, {  1, 0 }, {  1, -1 }, { 0,  2 }, {  1,  2 } },      // R -> 2
+      { { 0, 0 }, {  1, 0 }, {  1, -1 }, { 0,  2 }, {  1,  2 } } },    // R -> 0
+    { { { 0, 0 }, {  1, 0 }, {  1,  1 }, { 0, -2 }, {  1, -2 } },      // 2 -> L
+      { { 0, 0 }, { -1, 0 }, { -1,  1 }, { 0, -2 }, { -1, -2 } } },    // 2 -> R
+    { { { 0, 0 }, { -1, 0 }, { -1, -1 }, { 0,  2 }, { -1,  2 } },      // L -> 0
+      { { 0, 0 }, { -1, 0 }, { -1, -1 }, { 0,  2 }, { -1,  2 } } }     // L -> 2
+};
+
+static const signed char srs_i[4][2][5][2] = {
+    { { { 0, 0 }, { -2, 0 }, {  1, 0 }, { -2, -1 }, {  1,  2 } },      // 0 -> R
+      { { 0, 0 }, { -1, 0 }, {  2, 0 }, { -1,  2 }, {  2, -1 } } },    // 0 -> L
+    { { { 0, 0 }, { -1, 0 }, {  2, 0 }, { -1,  2 }, {  2, -1 } },      // R -> 2
+      { { 0, 0 }, {  2, 0 }, { -1, 0 }, {  2,  1 }, { -1, -2 } } },    // R -> 0
+    { { { 0, 0 }, {  2, 0 }, { -1, 0 }, {  2,  1 }, { -1, -2 } },      // 2 -> L
+      { { 0, 0 }, {  1, 0 }, { -2, 0 }, {  1, -2 }, { -2,  1 } } },    // 2 -> R
+    { { { 0, 0 }, {  1, 0 }, { -2, 0 }, {  1, -2 }, { -2,  1 } },      // L -> 0
+      { { 0, 0 }, { -2, 0 }, {  1, 0 }, { -2, -1 }, {  1,  2 } } }     // L -> 2
+};
+
+static const char* names = "IJLOSTZ";
+
+// the field cells of a tetrad in state rot, its SRS box at x, y
+static void SrsCells(int shape, int rot, int x, int y, int* cx, int* cy)
+{
+    int X;
+
+    for (X = 0; X < 4; X++) {
+        cx[X] = x + srs_cells[shape][rot][X][0];
+        cy[X] = y + srs_cells[shape][rot][X][1];
+    }
+
+    return;
+}
+
+static const signed char* SrsKick(int shape, int rot, int ccw, int kick)
+{
+    static const signed char none[2] = { 0, 0 };
+
+    // the O does not kick, nor move as it turns
+    if (names[shape] == 'O')
+        return none;
+
+    return names[shape] == 'I' ? srs_i[rot][ccw][kick] : srs_jlstz[rot][ccw][kick];
+}
+
+static int SameCells(const int* ax, const int* ay, const int* bx, const int* by)
+{
+    int X, Y, found;
+
+    for (X = 0; X < 4; X++) {
+        for (Y = 0, found = 0; Y < 4; Y++)
+            found |= ax[X] == bx[Y] && ay[X] == by[Y];
+        if (! found)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void CheckKicks(STATE* state, int shape, int rot, int ccw, int kicks)
+{
+    TETRAD* tetrad = state->tetrad;
+    char open[TEST_BY][TEST_BX];
+    int to = (rot + (ccw ? 3 : 1)) % 4;
+    int cx[4], cy[4], kx[5][4], ky[5][4], tx[4], ty[4];
+    const signed char* offset;
+    int X, Y, fits, first;
+
+    // where the tetrad is, and where each kick would put it
+    memset(open, 0, sizeof(open));
+    SrsCells(shape, rot, TEST_X, TEST_Y, cx, cy);
+    for (X = 0; X < 4; X++)
+        open[cy[X]][cx[X]] = 1;
+
+    for (Y = 0; Y < 5; Y++) {
+        offset = SrsKick(shape, rot, ccw, Y);
+        SrsCells(shape, to, TEST_X + offset[0], TEST_Y - offset[1], kx[Y], ky[Y]);
+        for (X = 0; X < 4 && (kicks & 1 << Y); X++)
+            open[ky[Y][X]][kx[Y][X]] = 1;
+    }
+
+    // one of the kicks not left open may fit as well
+    for (first = 0; first < 5; first++) {
+        for (X = 0, fits = 1; X < 4; X++)
+            fits &= open[ky[first][X]][kx[first][X]];
+        if (fits)
+            break;
+    }
+
+    FieldClear(state->field);
+    for (Y = 0; Y < TEST_BY; Y++) {
+        for (X = 0; X < TEST_BX; X++) {
+            if (! open[Y][X])
+                FieldWrite(state->field, Y)[X] = 1;
+        }
+    }
+
+    // the tetrad's own box starts at its first column and row
+    tetrad->shape = shape;
+    tetrad->rot = rot;
+    tetrad->x = MIN(MIN(cx[0], cx[1]), MIN(cx[2], cx[3]));
+    tetrad->y = MIN(MIN(cy[0], cy[1]), MIN(cy[2], cy[3]));
+    TetradCells(tetrad, tx, ty);
+    CHECK(SameCells(tx, ty, cx, cy), "%c state %d: not on its SRS cells", names[shape], rot);
+
+    EventRotate(state, ccw ? -1 : 1);
+
+    TetradCells(tetrad, tx, ty);
+    CHECK(tetrad->rot == to && SameCells(tx, ty, kx[first], ky[first]),
+            "%c %d -> %d, kicks %#x open: not on the cells of kick %d", names[shape], rot, to,
+            kicks, first);
+
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    STATE* state;
+    int shape, rot, ccw, kicks;
+
+    RowInit();
+
+    state = GameAlloc();
+    state->Bx = TEST_BX;
+    state->By = TEST_BY;
+    GameStart(state, 1);
+
+    for (shape = 0; shape < 7; shape++) {
+        for (rot = 0; rot < 4; rot++) {
+            for (ccw = 0; ccw < 2; ccw++) {
+                for (kicks = 1; kicks < 1 << 5; kicks++)
+                    CheckKicks(state, shape, rot, ccw, kicks);
+            }
+        }
+    }
+
+    GameFree(state);
+
+    if (! failures)
+        printf("kick_test: ok\n");
+
+    return failures;
+}
@@ -0,0 +1,390 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * Matchmaking.  First the rules one at a time: a queue matches those
+ * who waited longest, in the order they came; a session that went away
+ * is skipped at its turn; too few left over go back to the front, in
+ * their order, and wait for whoever comes next; asking again, leaving
+ * and a stale token leaving do what they should, and a name nobody
+ * waits for goes out of the index.
+ *
+ * Then the lobby against a model of its queues: sessions join, ask
+ * again, leave and go away at random, slots are taken over by new
+ * sessions, and every few steps everything that can be matched is;
+ * the groups must be the ones the model makes, and every queue must
+ * hold whoever the model says waits in it, in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <glib.h>
+#include "room.h"
+#include "session.h"
+#include "lobby.h"
+#include "test.h"
+
+#define TEST_SESSIONS   256
+#define TEST_OPS        200000
+#define TEST_BANDS      3
+#define TEST_NAMES      3
+#define TEST_QUEUES     (3 * 2 * TEST_BANDS + TEST_NAMES)
+
+typedef struct _TEST_QUEUE {
+    int players, mode, band;
+    const char* name;       // NULL for a skill band
+    GQueue* tokens;         // who waits, oldest first, the dead too
+} TEST_QUEUE;
+
+static TEST_QUEUE queues[TEST_QUEUES];
+static int waiting[TEST_SESSIONS];     // the queue of the slot's token, or -1
+
+static const struct sockaddr* Addr(int i)
+{
+    static struct sockaddr_in in;
+
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = htonl(0x0a000000 + i);
+    in.sin_port = htons(1000 + i % 1000);
+
+    return (const struct sockaddr*)&in;
+}
+
+static guint64 Session(SESSIONS* sessions)
+{
+    static int next;
+    SESSION* session = SessionCreate(sessions, Addr(next++), "lobby", 1);
+
+    return session ? session->token : 0;
+}
+
+static int Alive(SESSIONS* sessions, guint64 token)
+{
+    return SessionToken(sessions, token) != NULL;
+}
+
+static int Join(LOBBY* lobby, guint64 token, const TEST_QUEUE* queue)
+{
+    return LobbyJoin(lobby, token, queue->players, queue->mode, queue->band, queue->name, 0);
+}
+
+// the tokens of a match, in order, as a string to compare and print
+static char* Group(const guint64* tokens, int n)
+{
+    GString* s = g_string_new("");
+    int X;
+
+    for (X = 0; X < n; X++)
+        g_string_append_printf(s, "%s%llx", X ? " " : "", (unsigned long long)tokens[X]);
+
+    return g_string_free(s, FALSE);
+}
+
+static void CheckRules(void)
+{
+    SESSIONS* sessions = SessionsAlloc(TEST_SESSIONS, G_USEC_PER_SEC * 1000, 0);
+    LOBBY* lobby = LobbyAlloc(TEST_SESSIONS);
+    TEST_QUEUE three = { 3, ROOM_MODE_STATE, 1, NULL, NULL };
+    TEST_QUEUE named = { 2, ROOM_MODE_LOCKSTEP, 0, "friends", NULL };
+    LOBBY_MATCH match;
+    guint64 t[8], old;
+    int X;
+
+    for (X = 0; X < 8; X++)
+        t[X] = Session(sessions);
+
+    // nothing for a game that cannot be
+    CHECK(! LobbyJoin(lobby, t[0], 1, ROOM_MODE_STATE, 0, NULL, 0) &&
+            ! LobbyJoin(lobby, t[0], LOBBY_PLAYERS + 1, ROOM_MODE_STATE, 0, NULL, 0) &&
+            ! LobbyJoin(lobby, t[0], 2, ROOM_MODE_LOCKSTEP + 1, 0, NULL, 0) &&
+            ! LobbyJoin(lobby, (guint64)TEST_SESSIONS, 2, ROOM_MODE_STATE, 0, NULL, 0) &&
+            lobby->count == 0, "a join for no game taken");
+
+    // in the order they came, and no match until there are enough
+    for (X = 0; X < 5; X++) {
+        CHECK(Join(lobby, t[X], &three), "join %d refused", X);
+        if (X < 2)
+            CHECK(! LobbyMatch(lobby, sessions, &match), "a match of %d", X + 1);
+    }
+    CHECK(LobbyMatch(lobby, sessions, &match) && match.players == 3 &&
+            match.mode == ROOM_MODE_STATE && ! match.name[0] &&
+            match.tokens[0] == t[0] && match.tokens[1] == t[1] && match.tokens[2] == t[2],
+            "not the first three, in order");
+    CHECK(! LobbyMatch(lobby, sessions, &match) && lobby->count == 2, "%u left waiting",
+            lobby->count);
+
+    // a dead token is skipped at its turn: t[3] went away, so t[4],
+    // t[5] and t[6] play
+    SessionRemove(sessions, SessionToken(sessions, t[3]));
+    Join(lobby, t[5], &three);
+    Join(lobby, t[6], &three);
+    CHECK(LobbyMatch(lobby, sessions, &match) && match.tokens[0] == t[4] &&
+            match.tokens[1] == t[5] && match.tokens[2] == t[6], "the dead token not skipped");
+    CHECK(! LobbyMatch(lobby, sessions, &match) && lobby->count == 0,
+            "%u left after the dead one", lobby->count);
+
+    // too few left over go back to the front, in their order: t[0] and
+    // t[2] wait on in front of t[7], who came after them
+    t[3] = Session(sessions);
+    for (X = 0; X < 3; X++)
+        Join(lobby, t[X], &three);
+    SessionRemove(sessions, SessionToken(sessions, t[1]));
+    CHECK(! LobbyMatch(lobby, sessions, &match), "a match with a dead token in it");
+    CHECK(lobby->count == 2 && lobby->ready->len == 0, "%u waiting, %u queues ready",
+            lobby->count, lobby->ready->len);
+    Join(lobby, t[7], &three);
+    CHECK(LobbyMatch(lobby, sessions, &match) && match.tokens[0] == t[0] &&
+            match.tokens[1] == t[2] && match.tokens[2] == t[7], "the ones left over not in front");
+
+    // asking again takes the place of what was asked before; leaving,
+    // and a stale token of the slot leaving, do nothing to the rest
+    Join(lobby, t[0], &three);
+    Join(lobby, t[0], &named);
+    Join(lobby, t[2], &three);
+    Join(lobby, t[3], &three);
+    CHECK(! LobbyMatch(lobby, sessions, &match), "a match with someone who asked again");
+    old = t[2];
+    SessionRemove(sessions, SessionToken(sessions, old));
+    t[2] = Session(sessions);
+    CHECK((t[2] & SESSION_INDEX_MASK) == (old & SESSION_INDEX_MASK), "the slot not taken over");
+    Join(lobby, t[2], &named);
+    LobbyLeave(lobby, old);
+    CHECK(LobbyMatch(lobby, sessions, &match) && match.players == 2 &&
+            match.mode == ROOM_MODE_LOCKSTEP && ! strcmp(match.name, "friends") &&
+            match.tokens[0] == t[0] && match.tokens[1] == t[2], "not the two friends");
+    CHECK(g_hash_table_size(lobby->names) == 0, "a name nobody waits for still in the index");
+    LobbyLeave(lobby, t[3]);
+    CHECK(lobby->count == 0 && ! LobbyMatch(lobby, sessions, &match), "%u left after leaving",
+            lobby->count);
+
+    // a name stays while its queue is ready, even with nobody left in it
+    Join(lobby, t[0], &named);
+    Join(lobby, t[2], &named);
+    LobbyLeave(lobby, t[0]);
+    LobbyLeave(lobby, t[2]);
+    CHECK(lobby->ready->len == 1 && g_hash_table_size(lobby->names) == 1,
+            "%u queues ready, %u names", lobby->ready->len, g_hash_table_size(lobby->names));
+    CHECK(! LobbyMatch(lobby, sessions, &match) && g_hash_table_size(lobby->names) == 0,
+            "a name left behind by a queue nobody waits in");
+
+    LobbyFree(lobby);
+    SessionsFree(sessions);
+    return;
+}
+
+// the groups the lobby should make, and who it should leave waiting
+static void ModelMatch(SESSIONS* sessions, GPtrArray* groups)
+{
+    guint64 tokens[LOBBY_PLAYERS], token;
+    TEST_QUEUE* queue;
+    int X, take;
+
+    for (X = 0; X < TEST_QUEUES; X++) {
+        queue = &queues[X];
+        while (g_queue_get_length(queue->tokens) >= (guint)queue->players) {
+            take = 0;
+            while (! g_queue_is_empty(queue->tokens) && take < queue->players) {
+                token = (guint64)(gsize)g_queue_pop_head(queue->tokens);
+                waiting[token & SESSION_INDEX_MASK] = -1;
+                if (Alive(sessions, token))
+                    tokens[take++] = token;
+            }
+
+            if (take == queue->players) {
+                g_ptr_array_add(groups, Group(tokens, take));
+                continue;
+            }
+
+            while (take--) {
+                g_queue_push_head(queue->tokens, (gpointer)(gsize)tokens[take]);
+                waiting[tokens[take] & SESSION_INDEX_MASK] = X;
+            }
+            break;
+        }
+    }
+
+    return;
+}
+
+static void ModelLeave(guint32 slot)
+{
+    GList* link;
+
+    if (waiting[slot] < 0)
+        return;
+
+    for (link = queues[waiting[slot]].tokens->head; link; link = link->next) {
+        if (((guint64)(gsize)link->data & SESSION_INDEX_MASK) == slot) {
+            g_queue_delete_link(queues[waiting[slot]].tokens, link);
+            break;
+        }
+    }
+    waiting[slot] = -1;
+
+    return;
+}
+
+// every queue holds who the model says, in order, but for the dead
+static void CompareQueues(LOBBY* lobby, SESSIONS* sessions, int op)
+{
+    const LOBBY_QUEUE* queue;
+    const TEST_QUEUE* model;
+    GList* link;
+    guint32 index;
+    guint64 token;
+    int X;
+
+    for (X = 0; X < TEST_QUEUES; X++) {
+        model = &queues[X];
+        queue = model->name ? g_hash_table_lookup(lobby->names, model->name) :
+            &lobby->bands[model->mode][model->players][model->band];
+        link = model->tokens->head;
+        index = queue ? queue->head : LOBBY_NONE;
+
+        while (1) {
+            while (link && ! Alive(sessions, (guint64)(gsize)link->data))
+                link = link->next;
+            while (index != LOBBY_NONE && ! Alive(sessions, lobby->entries[index].token))
+                index = lobby->entries[index].next;
+            if (! link || index == LOBBY_NONE)
+                break;
+
+            token = (guint64)(gsize)link->data;
+            if (lobby->entries[index].token != token)
+                break;
+            link = link->next;
+            index = lobby->entries[index].next;
+        }
+
+        CHECK(! link && index == LOBBY_NONE, "op %d: queue %d waits for others, or in another order",
+                op, X);
+    }
+
+    return;
+}
+
+static void CheckModel(void)
+{
+    SESSIONS* sessions = SessionsAlloc(TEST_SESSIONS, G_USEC_PER_SEC * 1000, 0);
+    LOBBY* lobby = LobbyAlloc(TEST_SESSIONS);
+    static const char* names[TEST_NAMES] = { "two", "three", "four" };
+    GPtrArray* groups = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray* expect = g_ptr_array_new_with_free_func(g_free);
+    LOBBY_MATCH match;
+    guint64 tokens[TEST_SESSIONS];
+    int X, Y, op, slot, matched = 0, dead = 0;
+    guint64 token;
+    char* group;
+
+    srand(49);
+
+    for (X = 0; X < 3 * 2 * TEST_BANDS; X++) {
+        queues[X].players = 2 + X / (2 * TEST_BANDS);
+        queues[X].mode = (X / TEST_BANDS) % 2;
+        queues[X].band = X % TEST_BANDS;
+    }
+    for (X = 0; X < TEST_NAMES; X++) {
+        queues[3 * 2 * TEST_BANDS + X].players = 2 + X;
+        queues[3 * 2 * TEST_BANDS + X].mode = X % 2;
+        queues[3 * 2 * TEST_BANDS + X].name = names[X];
+    }
+    for (X = 0; X < TEST_QUEUES; X++)
+        queues[X].tokens = g_queue_new();
+
+    for (X = 0; X < TEST_SESSIONS; X++) {
+        tokens[X] = Session(sessions);
+        waiting[X] = -1;
+    }
+
+    for (op = 0; op < TEST_OPS; op++) {
+        X = rand() % TEST_SESSIONS;
+        token = tokens[X];
+        slot = token & SESSION_INDEX_MASK;
+        Y = rand() % 100;
+
+        if (! Alive(sessions, token)) {
+            // its slot goes to someone new, who may wait in the dead one's place
+            if (Y < 30) {
+                tokens[X] = Session(sessions);
+                CHECK(tokens[X], "op %d: no session", op);
+            }
+        } else if (Y < 50) {
+            // asking again moves it to the back of its new queue
+            Y = rand() % TEST_QUEUES;
+            ModelLeave(slot);
+            CHECK(Join(lobby, token, &queues[Y]), "op %d: join refused", op);
+            g_queue_push_tail(queues[Y].tokens, (gpointer)(gsize)token);
+            waiting[slot] = Y;
+        } else if (Y < 60) {
+            LobbyLeave(lobby, token);
+            ModelLeave(slot);
+        } else if (Y < 65) {
+            SessionRemove(sessions, SessionToken(sessions, token));
+            dead += waiting[slot] >= 0;
+        }
+
+        if (op % 16)
+            continue;
+
+        while (LobbyMatch(lobby, sessions, &match)) {
+            group = Group(match.tokens, match.players);
+            for (Y = 0; Y < match.players; Y++) {
+                slot = match.tokens[Y] & SESSION_INDEX_MASK;
+                CHECK(waiting[slot] >= 0 && queues[waiting[slot]].players == match.players &&
+                        queues[waiting[slot]].mode == match.mode &&
+                        ! strcmp(queues[waiting[slot]].name ? queues[waiting[slot]].name : "",
+                            match.name), "op %d: %s matched for another game", op, group);
+            }
+            g_ptr_array_add(groups, group);
+        }
+        ModelMatch(sessions, expect);
+
+        // queues take their turns in no particular order
+        for (X = 0; X < (int)expect->len; X++) {
+            for (Y = 0; Y < (int)groups->len; Y++)
+                if (! strcmp(g_ptr_array_index(expect, X), g_ptr_array_index(groups, Y)))
+                    break;
+            CHECK(Y < (int)groups->len, "op %d: %s not matched", op,
+                    (char*)g_ptr_array_index(expect, X));
+            if (Y < (int)groups->len)
+                g_ptr_array_remove_index_fast(groups, Y);
+        }
+        CHECK(groups->len == 0, "op %d: %u groups the model never made, %s first", op,
+                groups->len, groups->len ? (char*)g_ptr_array_index(groups, 0) : "");
+        matched += expect->len;
+        g_ptr_array_set_size(groups, 0);
+        g_ptr_array_set_size(expect, 0);
+
+        CompareQueues(lobby, sessions, op);
+        if (failures > 10)
+            break;
+    }
+
+    CHECK(matched > TEST_OPS / 100 && dead > TEST_OPS / 1000, "only %d matches and %d dead",
+            matched, dead);
+
+    for (X = 0; X < TEST_QUEUES; X++)
+        g_queue_free(queues[X].tokens);
+    g_ptr_array_free(groups, TRUE);
+    g_ptr_array_free(expect, TRUE);
+    LobbyFree(lobby);
+    SessionsFree(sessions);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    CheckRules();
+    CheckModel();
+
+    if (! failures)
+        printf("lobby_test: ok\n");
+
+    return failures;
+}
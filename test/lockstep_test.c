@@ -0,0 +1,239 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * Lockstep rooms against clients that only get their ROOM_INPUTS: each
+ * client steps its own copy of the game from the room's seed and the
+ * inputs, as a lockstep client does, while some of the messages are
+ * lost, and some come again.  At every hash the client's game must hash
+ * as the room's did, and whenever it has caught up it must be the
+ * room's game byte for byte, up to the last tick of a game that ended.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "row.h"
+#include "room.h"
+#include "batch.h"
+#include "snap.h"
+#include "test.h"
+
+#define TEST_ROOMS      12
+#define TEST_TICKS      20000
+
+typedef struct _CLIENT {
+    ROOM* room;
+    STATE* game;
+    guint64 tick;       // the last one stepped
+    guint8 last[512];   // the last message, to have it come again
+    size_t length;
+} CLIENT;
+
+static CLIENT clients[TEST_ROOMS];
+static int hashes, games;
+
+static void ClientStart(ROOMS* rooms, CLIENT* client)
+{
+    guint64 seed = ((guint64)rand() << 32) | rand();
+
+    client->room = RoomCreate(rooms, 0, seed, 1, "lockstep");
+    RoomLockstep(client->room);
+
+    // the room takes its first step on the next tick
+    if (! client->game)
+        client->game = GameAlloc();
+    GameStart(client->game, seed);
+    client->tick = rooms->tick;
+    client->length = 0;
+
+    return;
+}
+
+static void ClientCheck(CLIENT* client)
+{
+    ROOM* room = client->room;
+    guint64 hash;
+    size_t size;
+    char *a, *b;
+
+    if (client->tick % LOCKSTEP_HASH == 0 || client->tick == room->tick) {
+        if (RoomHashAt(room, client->tick, &hash)) {
+            CHECK(hash == SnapHash(client->game), "room %u: hash differs at tick %llu",
+                    room->id, (unsigned long long)client->tick);
+            hashes ++;
+        } else {
+            CHECK(client->tick % LOCKSTEP_HASH, "room %u: no hash for tick %llu", room->id,
+                    (unsigned long long)client->tick);
+        }
+    }
+
+    if (client->tick != room->tick)
+        return;
+
+    size = RoomSnapSize(room);
+    a = g_malloc0(size);
+    b = g_malloc0(size);
+    RoomSnapSave(room, a, size);
+    SnapSave(client->game, b, size);
+    CHECK(! memcmp(a, b, size), "room %u: game differs at tick %llu", room->id,
+            (unsigned long long)client->tick);
+    g_free(a);
+    g_free(b);
+
+    return;
+}
+
+static void ClientReceive(CLIENT* client, const void* buffer, size_t length)
+{
+    const msg_room_inputs* msg = (const msg_room_inputs*)buffer;
+    const guint8* p = msg->inputs;
+    const guint8* end = (const guint8*)buffer + length;
+    guint64 tick = msg->tick - msg->ticks + 1;
+    int X, n;
+
+    CHECK(msg->room == client->room->id, "room %u: inputs of room %u", client->room->id,
+            msg->room);
+    CHECK(tick <= client->tick + 1, "room %u: inputs from tick %llu after %llu",
+            client->room->id, (unsigned long long)tick, (unsigned long long)client->tick);
+
+    for (; tick <= msg->tick && p < end; tick++) {
+        n = *p++;
+        CHECK(p + n <= end && n <= ROOM_PENDING, "room %u: %d actions at tick %llu overrun",
+                client->room->id, n, (unsigned long long)tick);
+        if (p + n > end)
+            return;
+
+        // what the client already has, it steps over
+        if (tick == client->tick + 1) {
+            client->game->ticks ++;
+            for (X = 0; X < n; X++)
+                EventAction(client->game, p[X]);
+            Update(client->game);
+            client->tick = tick;
+            ClientCheck(client);
+        }
+        p += n;
+    }
+
+    CHECK(p == end && tick == msg->tick + 1, "room %u: inputs of %u ticks do not add up",
+            client->room->id, msg->ticks);
+    return;
+}
+
+static int RandomAction(void)
+{
+    int r = rand() % 1000;
+
+    if (r < 2)
+        return TETRIS_KEY_QUIT;
+    if (r < 5)
+        return TETRIS_KEY_RESET;
+    if (r < 15)
+        return TETRIS_KEY_PAUSE;
+
+    return TETRIS_KEY_DROP + r % (TETRIS_KEY_MOVE_RIGHT - TETRIS_KEY_DROP + 1);
+}
+
+int main(int argc, char* argv[])
+{
+    ROOMS* rooms;
+    GPtrArray* updated = g_ptr_array_new();
+    guint8 buffer[512];
+    CLIENT* client;
+    ROOM* room;
+    size_t length;
+    int X, Y, tick, behind;
+
+    RowInit();
+    srand(44);
+
+    rooms = RoomsAlloc();
+    for (X = 0; X < TEST_ROOMS; X++)
+        ClientStart(rooms, &clients[X]);
+
+    for (tick = 0; tick < TEST_TICKS; tick++) {
+        for (X = 0; X < TEST_ROOMS; X++) {
+            for (Y = rand() % 4; Y < 2; Y++)
+                RoomAction(clients[X].room, RandomAction());
+        }
+
+        RoomsTickBegin(rooms);
+        RoomsStep(rooms, 0, rooms->batch->n, updated);
+
+        for (X = 0; X < updated->len; X++) {
+            room = g_ptr_array_index(updated, X);
+            for (Y = 0; clients[Y].room != room; Y++);
+            client = &clients[Y];
+
+            if (room->hash_due)
+                RoomHash(room);
+            room->hash_due = 0;
+
+            if (! room->updated)
+                continue;
+            room->updated = 0;
+
+            length = RoomInputs(room, buffer, sizeof(buffer));
+            CHECK(length, "room %u: no inputs to send at tick %llu", room->id,
+                    (unsigned long long)room->tick);
+            if (! length)
+                continue;
+
+            // lost, while the next message still reaches back far
+            // enough; the last of a game never is
+            behind = room->tick - client->tick;
+            if (behind < LOCKSTEP_HISTORY - LOCKSTEP_IDLE && rand() % 3 == 0 &&
+                    ! BatchDone(rooms->batch, room->game))
+                continue;
+
+            // an old one coming late
+            if (client->length && rand() % 8 == 0)
+                ClientReceive(client, client->last, client->length);
+
+            ClientReceive(client, buffer, length);
+            memcpy(client->last, buffer, length);
+            client->length = length;
+        }
+        g_ptr_array_set_size(updated, 0);
+
+        for (X = 0; X < TEST_ROOMS; X++) {
+            client = &clients[X];
+            if (! BatchDone(rooms->batch, client->room->game))
+                continue;
+
+            CHECK(client->tick == client->room->tick, "room %u: ended at tick %llu, client at %llu",
+                    client->room->id, (unsigned long long)client->room->tick,
+                    (unsigned long long)client->tick);
+            CHECK(client->game->game_over_f || client->game->status == STATUS_GAMEOVER,
+                    "room %u: ended, but not for the client", client->room->id);
+            client->room = NULL;
+            games ++;
+        }
+
+        RoomsTickEnd(rooms);
+
+        for (X = 0; X < TEST_ROOMS; X++) {
+            if (! clients[X].room)
+                ClientStart(rooms, &clients[X]);
+        }
+    }
+
+    CHECK(games > TEST_ROOMS, "only %d games ended", games);
+    CHECK(hashes > TEST_TICKS / LOCKSTEP_HASH * TEST_ROOMS / 2, "only %d hashes checked", hashes);
+
+    for (X = 0; X < TEST_ROOMS; X++)
+        GameFree(clients[X].game);
+    g_ptr_array_free(updated, TRUE);
+    RoomsFree(rooms);
+
+    if (! failures)
+        printf("lockstep_test: ok (%d games, %d hashes)\n", games, hashes);
+
+    return failures;
+}
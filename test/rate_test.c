@@ -0,0 +1,232 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * Token buckets.  A full bucket takes its burst at once and nothing
+ * more; an empty one gives a token back every 1/rate seconds, and
+ * never more than the burst however long it was left alone, nor any
+ * for a clock that went back.  Under packets at random times, faster
+ * and slower than the rate, no window of any length ever lets more
+ * through than the burst and the rate allow, and a client within the
+ * rate is never dropped.
+ *
+ * Then the table of buckets by source address: the port does not
+ * matter, addresses of every family are held to the rate, and
+ * addresses that share a bucket get no more between them than one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "rate.h"
+#include "test.h"
+
+#define TEST_PACKETS    200000
+#define TEST_ADDRS      2000
+
+static gint64 taken[TEST_PACKETS];
+
+// no window of the given length holds more than the bucket allows
+static void CheckWindows(const RATE_LIMIT* limit, int n, const char* what)
+{
+    gint64 windows[] = { 1, 1000, 50000, 250000, G_USEC_PER_SEC, 10 * G_USEC_PER_SEC };
+    gint64 most;
+    int X, Y, lo;
+
+    for (X = 0; X < (int)G_N_ELEMENTS(windows); X++) {
+        most = limit->burst + windows[X] * limit->rate / G_USEC_PER_SEC + 1;
+        for (lo = 0, Y = 0; Y < n; Y++) {
+            while (taken[Y] - taken[lo] >= windows[X])
+                lo ++;
+            if (Y - lo + 1 > most) {
+                CHECK(0, "%s: %d packets in %lldus up to %lld, at most %lld", what, Y - lo + 1,
+                        (long long)windows[X], (long long)taken[Y], (long long)most);
+                break;
+            }
+        }
+    }
+
+    return;
+}
+
+static void CheckBucket(gint64 rate)
+{
+    RATE_LIMIT limit;
+    RATE bucket;
+    gint64 alone[] = { 10, 3600, 365 * 86400, 10000LL * 365 * 86400 };     // seconds
+    gint64 now = 5 * G_USEC_PER_SEC;
+    gint64 period = (G_USEC_PER_SEC + rate - 1) / rate;    // microseconds a token
+    int X, n, refused;
+
+    RateLimit(&limit, rate);
+    CHECK(limit.rate == rate && limit.burst == MAX(rate / 4, 8), "rate %lld: burst %lld",
+            (long long)rate, (long long)limit.burst);
+
+    // a full bucket: the burst at once, and not one more
+    RateInit(&bucket, &limit, now);
+    for (X = 0; X < limit.burst; X++)
+        CHECK(RateTake(&bucket, &limit, now), "rate %lld: packet %d of the burst dropped",
+                (long long)rate, X);
+    CHECK(! RateTake(&bucket, &limit, now), "rate %lld: more than the burst", (long long)rate);
+
+    // a token back after 1/rate seconds, not before
+    CHECK(! RateTake(&bucket, &limit, now + period - 1), "rate %lld: a token back too soon",
+            (long long)rate);
+    now += period;
+    CHECK(RateTake(&bucket, &limit, now) && ! RateTake(&bucket, &limit, now),
+            "rate %lld: not one token back after %lldus", (long long)rate, (long long)period);
+
+    // a clock that went back gives nothing, then or once it is back
+    CHECK(! RateTake(&bucket, &limit, now - G_USEC_PER_SEC) && ! RateTake(&bucket, &limit, now),
+            "rate %lld: a token from the past", (long long)rate);
+
+    // nearly full, and topped up: the burst, not a token more
+    now += 10 * G_USEC_PER_SEC;
+    RateTake(&bucket, &limit, now);
+    now += 2 * period;
+    for (n = 0; RateTake(&bucket, &limit, now); n++);
+    CHECK(n == limit.burst, "rate %lld: %d tokens in a bucket topped up", (long long)rate, n);
+
+    // left alone long enough to fill, and for ages: never more than the burst
+    for (X = 0; X < (int)G_N_ELEMENTS(alone); X++) {
+        now += alone[X] * G_USEC_PER_SEC;
+        for (n = 0; RateTake(&bucket, &limit, now); n++);
+        CHECK(n == limit.burst, "rate %lld: %d tokens after %llds alone", (long long)rate, n,
+                (long long)alone[X]);
+    }
+
+    // packets at random, faster than the rate: nothing but what the
+    // bucket allows, and all of it
+    now = 0;
+    RateInit(&bucket, &limit, now);
+    for (X = n = 0; X < TEST_PACKETS; X++) {
+        now += rand() % period;
+        if (RateTake(&bucket, &limit, now))
+            taken[n++] = now;
+    }
+    CheckWindows(&limit, n, "too fast");
+    CHECK(n >= limit.burst + (now - period) * rate / G_USEC_PER_SEC - 1,
+            "rate %lld: %d packets of %d in %lldus", (long long)rate, n, TEST_PACKETS,
+            (long long)now);
+
+    // and slower than the rate: none dropped
+    RateInit(&bucket, &limit, now);
+    for (X = refused = 0; X < TEST_PACKETS / 10; X++) {
+        now += period + rand() % period;
+        refused += ! RateTake(&bucket, &limit, now);
+    }
+    CHECK(! refused, "rate %lld: %d packets within the rate dropped", (long long)rate, refused);
+
+    return;
+}
+
+static const struct sockaddr* Addr(int i, int port)
+{
+    static struct sockaddr_storage addr;
+    struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+    struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+
+    memset(&addr, 0, sizeof(addr));
+    if (i % 3 == 0) {
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(0x0a000000 + i);
+        in->sin_port = htons(port);
+    } else if (i % 3 == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr.s6_addr[0] = 0xfd;
+        memcpy(&in6->sin6_addr.s6_addr[12], &i, sizeof(i));
+        in6->sin6_port = htons(port);
+    } else {
+        // what the shared memory transport names its clients
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path + 1, &i, sizeof(i));
+    }
+
+    return (const struct sockaddr*)&addr;
+}
+
+static void CheckSources(void)
+{
+    RATES* rates = RatesAlloc(RATE_SOURCE_BUCKETS, RATE_SOURCE);
+    struct sockaddr other;
+    guint32 bucket, size = rates->mask + 1;
+    gint64 now = G_USEC_PER_SEC;
+    int X, n, alone, burst = rates->limit.burst;
+    int* counts = g_new0(int, TEST_ADDRS);
+    int* buckets = g_new(int, TEST_ADDRS);
+    int* sharing = g_new0(int, size);
+    int* total = g_new0(int, size);
+
+    CHECK(size == RATE_SOURCE_BUCKETS, "%u buckets", size);
+
+    // one address, from any port, is one client
+    for (n = 0; n < 2 * burst; n++)
+        counts[0] += RatesTake(rates, Addr(0, 1000 + n), now);
+    CHECK(counts[0] == burst, "%d packets from one address on %d ports", counts[0], n);
+
+    // the bucket of each address: the one its packet refilled last
+    for (X = 0; X < TEST_ADDRS; X++) {
+        now += 1;
+        RatesTake(rates, Addr(X, 1), now);
+        for (bucket = 0; bucket < size && rates->buckets[bucket].last != now; bucket++);
+        CHECK(bucket < size, "address %d in no bucket", X);
+        buckets[X] = bucket % size;
+        sharing[buckets[X]] ++;
+    }
+
+    // a burst each, all at once: those in a bucket of their own get
+    // all of it, and those that share one no more than one between them
+    now += 10 * G_USEC_PER_SEC;
+    for (X = 0; X < TEST_ADDRS; X++) {
+        for (n = counts[X] = 0; n < burst + 5; n++)
+            counts[X] += RatesTake(rates, Addr(X, X), now);
+        total[buckets[X]] += counts[X];
+    }
+
+    for (X = alone = 0; X < TEST_ADDRS; X++) {
+        if (sharing[buckets[X]] == 1) {
+            CHECK(counts[X] == burst, "address %d: %d packets of its burst", X, counts[X]);
+            alone ++;
+        }
+    }
+    for (bucket = 0; bucket < size; bucket++)
+        CHECK(! sharing[bucket] || total[bucket] == burst,
+                "bucket %u: %d packets for %d addresses", bucket, total[bucket], sharing[bucket]);
+    CHECK(alone > TEST_ADDRS / 4 && alone < TEST_ADDRS, "%d of %d addresses alone in a bucket",
+            alone, TEST_ADDRS);
+
+    // and nothing it cannot tell apart
+    memset(&other, 0, sizeof(other));
+    other.sa_family = AF_UNSPEC;
+    CHECK(! RatesTake(rates, &other, now), "a packet from no known family taken");
+
+    g_free(counts);
+    g_free(buckets);
+    g_free(sharing);
+    g_free(total);
+    RatesFree(rates);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    srand(41);
+
+    CheckBucket(RATE_SESSION);
+    CheckBucket(RATE_SOURCE);
+    CheckBucket(7);
+    CheckBucket(400000);
+    CheckSources();
+
+    if (! failures)
+        printf("rate_test: ok\n");
+
+    return failures;
+}
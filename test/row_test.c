@@ -0,0 +1,104 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The vectorized row scans against the scalar ones: every kernel the
+ * CPU can run, over widths 1 to 1000 at every alignment in a vector,
+ * on full, empty and CLEARED rows with one odd cell anywhere, the
+ * first and last among them.  The bytes past the row always read the
+ * other way, so a kernel that looks beyond the width gets it wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "tetris.h"
+#include "test.h"
+
+// for the kernels themselves, which RowInit() only picks one of
+#include "row.c"
+
+#define TEST_WIDTH      1000
+#define TEST_ALIGN      32
+
+typedef struct _KERNEL {
+    const char* name;
+    int (*full)(const char*, int);
+    int (*match)(const char*, int, char);
+} KERNEL;
+
+static char buffer[TEST_ALIGN + TEST_WIDTH + TEST_ALIGN];
+
+static void CheckRow(const KERNEL* kernel, const char* row, int n)
+{
+    CHECK(kernel->full(row, n) == RowFullScalar(row, n), "%s: RowFull differs at width %d",
+            kernel->name, n);
+    CHECK(kernel->match(row, n, 0) == RowMatchScalar(row, n, 0),
+            "%s: RowEmpty differs at width %d", kernel->name, n);
+    CHECK(kernel->match(row, n, CLEARED) == RowMatchScalar(row, n, CLEARED),
+            "%s: RowCleared differs at width %d", kernel->name, n);
+    return;
+}
+
+static void CheckKernel(const KERNEL* kernel)
+{
+    char fill[] = { 0, CLEARED, 1 };
+    char* row;
+    int n, align, X, odd;
+
+    for (n = 1; n <= TEST_WIDTH; n++) {
+        for (align = 0; align < TEST_ALIGN; align++) {
+            row = buffer + align;
+
+            for (X = 0; X < 3; X++) {
+                // the row as it is, and then with one cell that is not
+                memset(buffer, fill[X] ? 0 : 1, sizeof(buffer));
+                if (fill[X] == 1) {
+                    for (odd = 0; odd < n; odd++)
+                        row[odd] = 1 + rand() % 7;
+                } else {
+                    memset(row, fill[X], n);
+                }
+                CheckRow(kernel, row, n);
+
+                odd = align % 3 == 0 ? 0 : align % 3 == 1 ? n - 1 : rand() % n;
+                row[odd] = fill[X] ? 0 : CLEARED;
+                CheckRow(kernel, row, n);
+            }
+        }
+    }
+
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    KERNEL kernels[3];
+    int X, n = 0;
+
+    srand(27);
+
+#ifdef ROW_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[n++] = (KERNEL){ "sse2", RowFullSSE2, RowMatchSSE2 };
+    if (__builtin_cpu_supports("avx2"))
+        kernels[n++] = (KERNEL){ "avx2", RowFullAVX2, RowMatchAVX2 };
+#endif
+
+    // and the one RowInit() picks, through the public calls
+    RowInit();
+    kernels[n++] = (KERNEL){ RowKernel(), RowFull, RowMatch };
+
+    for (X = 0; X < n; X++)
+        CheckKernel(&kernels[X]);
+
+    if (! failures)
+        printf("row_test: ok (%d kernels)\n", n);
+
+    return failures;
+}
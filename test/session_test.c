@@ -0,0 +1,196 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The session table against a model of it: 500000 addresses, half of
+ * them IPv6, and two million random creations, lookups, removals,
+ * forged and stale tokens, migrations to a new address and idle
+ * evictions, each checked against what the model says the table holds.
+ * Then a full table, which must evict its idlest session to make room,
+ * and only once it is idle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <glib.h>
+#include "session.h"
+#include "test.h"
+
+#define TEST_ADDRS      500000
+#define TEST_OPS        2000000
+#define TEST_IDLE       300000      // in ops, one microsecond each
+#define TEST_DEAD       1024        // stale tokens kept to try again
+
+typedef struct _MODEL {
+    SESSION* session;
+    guint64 token;
+    gint64 last_seen;
+} MODEL;
+
+static MODEL model[TEST_ADDRS];
+static guint64 dead[TEST_DEAD];
+
+// two at a time, for a session moving from one to the other
+static const struct sockaddr* Addr(int i)
+{
+    static struct sockaddr_storage addrs[2];
+    static int next;
+    struct sockaddr_storage* addr = &addrs[next++ % 2];
+    struct sockaddr_in* in = (struct sockaddr_in*)addr;
+    struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+
+    memset(addr, 0, sizeof(*addr));
+    if (i % 2) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr.s6_addr[0] = 0xfd;
+        memcpy(&in6->sin6_addr.s6_addr[12], &i, sizeof(i));
+        in6->sin6_port = htons(1000 + i % 7);
+    } else {
+        // addresses that differ only in the port
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(0x0a000000 + (i >> 4));
+        in->sin_port = htons(1000 + (i & 15));
+    }
+
+    return (const struct sockaddr*)addr;
+}
+
+static void Expire(SESSIONS* sessions, gint64 now)
+{
+    int X, n = 0;
+
+    for (X = 0; X < TEST_ADDRS; X++) {
+        if (model[X].session && now - model[X].last_seen >= TEST_IDLE) {
+            model[X].session = NULL;
+            n ++;
+        }
+    }
+
+    CHECK(SessionsExpire(sessions, now) == n, "at %lld: not the %d idle sessions expired",
+            (long long)now, n);
+    return;
+}
+
+static void CheckModel(void)
+{
+    SESSIONS* sessions = SessionsAlloc(TEST_ADDRS, TEST_IDLE, 0);
+    SESSION* session;
+    gint64 now;
+    guint32 count = 0;
+    int X, a, b, op, ndead = 0;
+
+    srand(39);
+
+    for (now = 1; now <= TEST_OPS; now++) {
+        a = rand() % TEST_ADDRS;
+        op = rand() % 100;
+
+        if (op < 50) {
+            session = SessionFind(sessions, Addr(a));
+            CHECK(session == model[a].session, "op %lld: address %d found another session",
+                    (long long)now, a);
+            if (session)
+                CHECK(SessionToken(sessions, model[a].token) == session,
+                        "op %lld: token of address %d lost", (long long)now, a);
+        } else if (op < 60) {
+            if (model[a].session) {
+                SessionRemove(sessions, model[a].session);
+                model[a].session = NULL;
+                dead[ndead++ % TEST_DEAD] = model[a].token;
+                CHECK(! SessionToken(sessions, model[a].token),
+                        "op %lld: token of a removed session found", (long long)now);
+            }
+        } else if (op < 85) {
+            if (! model[a].session) {
+                session = SessionCreate(sessions, Addr(a), "model", now);
+                CHECK(session, "op %lld: no session for address %d", (long long)now, a);
+                model[a].session = session;
+                model[a].token = session ? session->token : 0;
+            } else {
+                CHECK(SessionLookup(sessions, Addr(a), model[a].token, now) == model[a].session,
+                        "op %lld: token of address %d refused", (long long)now, a);
+            }
+            model[a].last_seen = now;
+        } else if (op < 90) {
+            // forged, or left over from a session that went away
+            if (model[a].session)
+                CHECK(! SessionLookup(sessions, Addr(a),
+                            model[a].token ^ (1ULL << (32 + rand() % 32)), now),
+                        "op %lld: forged token taken", (long long)now);
+            if (ndead)
+                CHECK(! SessionLookup(sessions, Addr(a),
+                            dead[rand() % MIN(ndead, TEST_DEAD)], now),
+                        "op %lld: stale token taken", (long long)now);
+        } else if (model[a].session) {
+            // a NAT rebinding, which must not take an address in use
+            b = (a + 1 + rand() % (TEST_ADDRS - 1)) % TEST_ADDRS;
+            session = SessionLookup(sessions, Addr(b), model[a].token, now);
+
+            if (model[b].session) {
+                CHECK(! session, "op %lld: session moved onto address %d in use",
+                        (long long)now, b);
+            } else {
+                CHECK(session == model[a].session, "op %lld: session did not move",
+                        (long long)now);
+                CHECK(! SessionFind(sessions, Addr(a)), "op %lld: old address still found",
+                        (long long)now);
+                model[b] = model[a];
+                model[b].last_seen = now;
+                model[a].session = NULL;
+            }
+        }
+
+        if (now % (TEST_IDLE / 3) == 0)
+            Expire(sessions, now);
+    }
+
+    for (X = 0; X < TEST_ADDRS; X++)
+        count += model[X].session != NULL;
+    CHECK(sessions->count == count, "%u sessions, not %u", sessions->count, count);
+
+    Expire(sessions, now + TEST_IDLE / 2);
+    Expire(sessions, now + TEST_IDLE);
+    CHECK(sessions->count == 0, "%u sessions left after all went idle", sessions->count);
+
+    SessionsFree(sessions);
+    return;
+}
+
+static void CheckFull(void)
+{
+    SESSIONS* sessions = SessionsAlloc(4, 100, 0);
+    guint64 token;
+    int X;
+
+    for (X = 0; X < 4; X++)
+        CHECK(SessionCreate(sessions, Addr(X), "full", X), "session %d not created", X);
+    token = SessionFind(sessions, Addr(0))->token;
+
+    CHECK(! SessionCreate(sessions, Addr(4), "full", 99), "a fifth session in a table of four");
+
+    // the first is the idlest once the second was heard from again
+    SessionLookup(sessions, Addr(1), 0, 50);
+    CHECK(SessionCreate(sessions, Addr(4), "full", 101), "idle session not evicted");
+    CHECK(! SessionFind(sessions, Addr(0)), "the idlest session was not the one evicted");
+    CHECK(SessionFind(sessions, Addr(1)), "a session heard from was evicted");
+    CHECK(! SessionToken(sessions, token), "the evicted session's token still works");
+
+    SessionsFree(sessions);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    CheckModel();
+    CheckFull();
+
+    if (! failures)
+        printf("session_test: ok\n");
+
+    return failures;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * The regression tests are programs of their own, one a file, built
+ * and run by "scons check".  A CHECK that fails says where and why,
+ * and main() returns the number that did, so a test passes only if
+ * none of them failed.
+ */
+
+static int failures;
+
+#define CHECK(cond, ...)                                                \
+    do {                                                                \
+        if (! (cond)) {                                                 \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);             \
+            fprintf(stderr, __VA_ARGS__);                               \
+            fputc('\n', stderr);                                        \
+            failures ++;                                                \
+        }                                                               \
+    } while (0)
@@ -0,0 +1,322 @@
+/*
+ * ntetris: a tetris clone
+ * (c) 2008 Lee Supe (lain_proliant)
+ * Released under the GNU General Public License
+ */
+
+/*
+ * The transports, from both ends.  First the ring alone, small enough
+ * to wrap every few messages, against a queue of what went in: every
+ * message that was taken must come out whole and in order, a message
+ * is only refused when it cannot fit, and RingWrite() asks for a wakeup
+ * exactly when the reader had read everything.  Then a ring whose
+ * producer writes nonsense over its head and frames, which must only
+ * cost those messages.
+ *
+ * Then datagrams to a listening transport and back, from a client in
+ * another process: over shared memory, thousands of them of every size
+ * up to TRANSPORT_DATAGRAM, wrapping the rings many times over, and
+ * again after the client scribbles over its ring's head index and a
+ * frame; and over UDP, through a socket on the loopback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <glib.h>
+#include "ring.h"
+#include "transport.h"
+#include "test.h"
+
+// for the client's own rings, to scribble over
+#include "transport_shm.c"
+
+#define TEST_RING       256
+#define TEST_OPS        200000
+#define TEST_DATAGRAMS  3000
+#define TEST_WINDOW     24      // datagrams in flight, which the ring always has room for
+#define TEST_LONGEST    4000
+#define TEST_PORT       48950
+#define TEST_FRAME      112     // in the ring, for a datagram of 100 bytes
+
+typedef struct _TEST_PEER {
+    guint32 next;       // datagram expected back
+    int received;
+    int bad;
+} TEST_PEER;
+
+static guint8 sent[TEST_WINDOW][TRANSPORT_DATAGRAM];
+static size_t lengths[TEST_WINDOW];
+
+static void Fill(guint8* data, size_t length, guint32 seq)
+{
+    size_t X;
+
+    for (X = 0; X < length; X++)
+        data[X] = (guint8)(seq * 31 + X * 7);
+    if (length >= sizeof(seq))
+        memcpy(data, &seq, sizeof(seq));
+
+    return;
+}
+
+static void CheckRing(void)
+{
+    guint8* memory = g_malloc0(RingBytes(TEST_RING));
+    GQueue* model = g_queue_new();
+    guint8 message[TEST_RING];
+    const guint8* out;
+    GBytes* expect;
+    RING writer, reader;
+    guint32 length;
+    int X, woke, empty, taken = 0, refused = 0;
+
+    RingInit(&writer, memory, TEST_RING, 1);
+    RingInit(&reader, memory, TEST_RING, 0);
+
+    for (X = 0; X < TEST_OPS; X++) {
+        if (rand() % 2) {
+            length = rand() % (TEST_RING / 2 + 16);
+            Fill(message, length, X);
+            empty = g_queue_is_empty(model);
+            woke = RingWrite(&writer, message, length);
+
+            if (length + 8 > TEST_RING / 2) {
+                CHECK(woke < 0, "op %d: %u bytes taken by a ring of %d", X, length, TEST_RING);
+                continue;
+            }
+
+            // refused only when it does not fit, which it always does
+            // in an empty ring
+            CHECK(woke >= 0 || ! empty, "op %d: %u bytes refused by an empty ring", X, length);
+            if (woke < 0) {
+                refused ++;
+                continue;
+            }
+
+            CHECK(woke == empty, "op %d: asked %s wakeup", X, woke ? "for a" : "for no");
+            g_queue_push_tail(model, g_bytes_new(message, length));
+            taken ++;
+        } else {
+            out = RingPeek(&reader, &length);
+            expect = g_queue_pop_head(model);
+            CHECK((out != NULL) == (expect != NULL), "op %d: %s", X,
+                    out ? "a message out of an empty ring" : "a message lost");
+            if (out && expect)
+                CHECK(length == g_bytes_get_size(expect) &&
+                        ! memcmp(out, g_bytes_get_data(expect, NULL), length),
+                        "op %d: message of %u bytes differs", X, length);
+            if (out)
+                RingPop(&reader, length);
+            if (expect)
+                g_bytes_unref(expect);
+        }
+    }
+
+    CHECK(taken > TEST_OPS / 8 && refused, "%d messages taken and %d refused", taken, refused);
+
+    // a head from nowhere, past a message that is really there:
+    // whatever it claims is dropped
+    while ((out = RingPeek(&reader, &length)))
+        RingPop(&reader, length);
+    g_queue_free_full(model, (GDestroyNotify)g_bytes_unref);
+    Fill(message, 16, 0);
+    CHECK(RingWrite(&writer, message, 16) > 0, "a message refused by an empty ring");
+    reader.shared->head += 3 * TEST_RING + 5;
+    CHECK(! RingPeek(&reader, &length), "a message behind a head from nowhere");
+
+    // a frame longer than what was written, and one longer than the
+    // ring, in a ring started over so that neither message wraps
+    RingInit(&writer, memory, TEST_RING, 1);
+    for (X = 0; X < 2; X++) {
+        Fill(message, 16, X);
+        CHECK(RingWrite(&writer, message, 16) >= 0, "a message refused after the scribbling");
+        *(guint32*)(memory + sizeof(RING_SHARED) + (reader.shared->tail & (TEST_RING - 1))) =
+                X ? 0x7FFFFFF0U : 40;
+        CHECK(! RingPeek(&reader, &length), "a frame of nonsense read");
+    }
+
+    // and after all of it, the ring still works
+    Fill(message, 40, 7);
+    CHECK(RingWrite(&writer, message, 40) >= 0, "a message refused after the scribbling");
+    out = RingPeek(&reader, &length);
+    CHECK(out && length == 40 && ! memcmp(out, message, 40), "the ring broke after the scribbling");
+
+    g_free(memory);
+    return;
+}
+
+// the listening side sends everything straight back
+static void Echo(TRANSPORT* transport, const void* data, size_t length,
+        const struct sockaddr* from)
+{
+    int* count = (int*)transport->data;
+
+    CHECK(TransportSend(transport, from, data, length) == 0, "echo of %zu bytes refused", length);
+    (*count) ++;
+
+    return;
+}
+
+static void Back(TRANSPORT* transport, const void* data, size_t length,
+        const struct sockaddr* from)
+{
+    TEST_PEER* peer = (TEST_PEER*)transport->data;
+    int slot = peer->next % TEST_WINDOW;
+
+    if (length != lengths[slot] || memcmp(data, sent[slot], length))
+        peer->bad ++;
+    peer->next ++;
+    peer->received ++;
+
+    return;
+}
+
+static int Wait(TRANSPORT* transport, TEST_PEER* peer, int until)
+{
+    struct pollfd fd = { transport->fd, POLLIN, 0 };
+
+    while (peer->received < until) {
+        if (poll(&fd, 1, 2000) <= 0)
+            return 0;
+        TransportPump(transport);
+    }
+
+    return 1;
+}
+
+static int Send(TRANSPORT* transport, guint32 seq, size_t length)
+{
+    int slot = seq % TEST_WINDOW;
+
+    Fill(sent[slot], length, seq);
+    lengths[slot] = length;
+
+    return TransportSend(transport, NULL, sent[slot], length);
+}
+
+// the client, in a process of its own; what it returns is its failures
+static int Client(const char* path, int port)
+{
+    TEST_PEER peer = { 0 };
+    TRANSPORT* transport;
+    SHM_PEER* shm;
+    RING_SHARED* shared;
+    guint64 head, frame, one = 1;
+    guint32 seq = 0;
+    size_t length;
+    int X;
+
+    // not the parent's
+    failures = 0;
+
+    if (path)
+        transport = TransportShmConnect(path, Back, &peer);
+    else
+        transport = TransportUdpConnect("127.0.0.1", port, Back, &peer);
+    CHECK(transport, "%s: could not connect", path ? "shm" : "udp");
+    if (! transport)
+        return failures;
+
+    for (; seq < (path ? TEST_DATAGRAMS : TEST_DATAGRAMS / 10); seq++) {
+        if (seq >= TEST_WINDOW && ! Wait(transport, &peer, seq - TEST_WINDOW + 1))
+            break;
+
+        length = 1 + rand() % TEST_LONGEST;
+        if (seq % 500 == 0)
+            length = path ? TRANSPORT_DATAGRAM : 1400;
+        CHECK(Send(transport, seq, length) == 0, "datagram %u of %zu bytes refused", seq, length);
+    }
+    CHECK(Wait(transport, &peer, seq), "%u of %u datagrams came back", peer.received, seq);
+    CHECK(! peer.bad, "%d datagrams came back changed", peer.bad);
+
+    if (path) {
+        CHECK(TransportSend(transport, NULL, sent[0], TRANSPORT_DATAGRAM + 1) < 0,
+                "a datagram longer than TRANSPORT_DATAGRAM taken");
+
+        // a datagram with a head from nowhere after it, then one
+        // with a frame of nonsense, which the server must drop; what
+        // comes after them must still get through
+        shm = &((SHM_TRANSPORT*)transport)->peers[0];
+        shared = shm->tx.shared;
+        for (X = 0; X < 2; X++) {
+            head = shared->head;
+            frame = head & (shm->tx.size - 1);
+            if (frame + TEST_FRAME > shm->tx.size)
+                frame = 0;
+
+            // written without a wakeup, so that it is not read yet
+            RingWrite(&shm->tx, sent[0], 100);
+            if (X)
+                *(guint32*)(shared->data + frame) = 0x7FFFFFF0U;
+            else
+                __atomic_store_n(&shared->head, shared->head + 5 * shm->tx.size + 8,
+                        __ATOMIC_SEQ_CST);
+
+            CHECK(write(shm->in, &one, sizeof(one)) == sizeof(one), "could not wake the server");
+            usleep(50000);
+        }
+
+        CHECK(Send(transport, seq, 100) == 0, "refused after the scribbling");
+        CHECK(Wait(transport, &peer, seq + 1) && ! peer.bad,
+                "nothing came back after the scribbling");
+    }
+
+    TransportClose(transport);
+    return failures;
+}
+
+static void CheckTransport(const char* path, int port)
+{
+    TRANSPORT* server;
+    struct pollfd fd;
+    pid_t pid;
+    int status = -1, count = 0;
+
+    if (path)
+        server = TransportShmListen(path, Echo, &count);
+    else
+        server = TransportUdpListen(port, Echo, &count);
+    CHECK(server, "%s: could not listen", path ? "shm" : "udp");
+    if (! server)
+        return;
+
+    pid = fork();
+    if (pid == 0)
+        _exit(Client(path, port));
+
+    fd.fd = server->fd;
+    fd.events = POLLIN;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (poll(&fd, 1, 10) > 0)
+            TransportPump(server);
+    }
+
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "%s: the client failed",
+            path ? "shm" : "udp");
+    CHECK(count >= (path ? TEST_DATAGRAMS : TEST_DATAGRAMS / 10), "%s: only %d datagrams echoed",
+            path ? "shm" : "udp", count);
+
+    TransportClose(server);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    char path[64];
+
+    srand(42);
+    CheckRing();
+
+    snprintf(path, sizeof(path), "/tmp/ntetris-transport-%d", (int)getpid());
+    CheckTransport(path, 0);
+    CheckTransport(NULL, TEST_PORT + getpid() % 1000);
+
+    if (! failures)
+        printf("transport_test: ok\n");
+
+    return failures;
+}